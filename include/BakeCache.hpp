@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "EnvironmentContainer.hpp"
+#include "MappedFile.hpp"
+
+namespace Akoylasar
+{
+  // Directory of baked environment containers, one file per key. The key is meant to cover
+  // everything the bake depends on (see hash), so entries never need invalidating; a different
+  // source or different parameters simply produce a different file.
+  class BakeCache
+  {
+  public:
+    explicit BakeCache(const std::filesystem::path& directory);
+
+    // FNV-1a over 64 bit words with an extra xorshift so high bits mix down. Chain calls
+    // through seed to hash several buffers.
+    static std::uint64_t hash(const void* data, std::size_t size, std::uint64_t seed = 0xcbf29ce484222325ull);
+
+    // On a hit maps the entry into file and points output into the mapping, so file must outlive
+    // output. Returns false on a miss and on a stale or corrupt entry, in which case the caller
+    // should rebake and store again.
+    bool load(std::uint64_t key, MappedFile& file, EnvironmentView& output) const;
+    bool store(std::uint64_t key, const EnvironmentView& data) const;
+
+    std::filesystem::path getEntryPath(std::uint64_t key) const;
+
+  private:
+    std::filesystem::path mDirectory;
+  };
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <Neon.hpp>
+#include <GL/gl3w.h>
+
+#include "IBLBaker.hpp"
+#include "Mesh.hpp"
+#include "ShaderProgram.hpp"
+
+namespace Akoylasar
+{
+  // Runs the GLSL prefilter bake a few (face, mip, tile) jobs at a time so that it can be
+  // spread over frames. Each update issues jobs until their estimated GPU time reaches the
+  // budget; the estimate is a cost per texel sample measured with GL_TIME_ELAPSED queries
+  // that are read back frames later, so the CPU never waits on the GPU.
+  class BakeScheduler
+  {
+  public:
+    struct Stats
+    {
+      int jobs = 0;
+      int frames = 0; // Updates that issued anything.
+      double gpuMs = 0.0; // Sum of the measured batches.
+      double worstBatchGpuMs = 0.0;
+    };
+
+    // Needs a current GL context; the cube mesh must outlive the scheduler.
+    explicit BakeScheduler(const GpuMesh& cubeMesh);
+    ~BakeScheduler();
+    BakeScheduler(const BakeScheduler&) = delete;
+    BakeScheduler& operator=(const BakeScheduler&) = delete;
+
+    // Queues a prefilter bake of sourceTexture, a cubemap or an octahedral map with mips, into
+    // the outputTexture cubemap, whose first settings.mipLevels levels must already have
+    // storage; settings.layout is ignored. Replaces any unfinished bake.
+    bool start(GLuint sourceTexture, MapLayout sourceLayout, GLuint outputTexture, const PrefilterSettings& settings);
+    // Issues jobs until their estimated GPU time reaches budgetMs, and at least one.
+    void update(double budgetMs);
+    // Issues every remaining job and waits for the timings.
+    void finish();
+
+    // True until every job has been issued and timed.
+    bool isBusy() const;
+    float getProgress() const;
+    const Stats& getStats() const { return mStats; }
+
+    // View matrices looking down each face, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order.
+    static const std::array<Neon::Mat4f, 6>& getCubeMapFaceViews();
+    static const Neon::Mat4f& getCubeMapFaceProjection();
+
+  private:
+    struct Job
+    {
+      int face;
+      int mip;
+      int x;
+      int y;
+      int width;
+      int height;
+    };
+
+    struct TimerQuery
+    {
+      GLuint query = 0;
+      double samples = 0.0; // Texel samples issued inside the query.
+      bool pending = false;
+    };
+
+    void issue(std::size_t jobCount);
+    void readTimers(bool wait);
+    double getJobSamples(const Job& job) const;
+    void releaseTargets();
+
+  private:
+    const GpuMesh& mCubeMesh;
+    std::unique_ptr<ShaderProgram> mProgram;
+    GLuint mFbo = 0;
+    GLuint mDepthRbo = 0;
+    GLuint mSourceTexture = 0;
+    MapLayout mSourceLayout = MapLayout::CubeMap;
+    GLuint mOutputTexture = 0;
+    PrefilterSettings mSettings;
+    std::vector<int> mMipSamples;
+    std::vector<Job> mJobs;
+    std::size_t mNextJob = 0;
+    std::array<TimerQuery, 4> mTimers;
+    std::size_t mNextTimer = 0;
+    double mMsPerSample = 0.0; // 0 until the first batch has been timed.
+    Stats mStats;
+  };
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Akoylasar
+{
+  enum class Bc6hQuality
+  {
+    Fast,   // Bounding box endpoints, 10 bit mode only.
+    Normal, // Principal axis endpoints refined once, every one region mode.
+    High    // Same with more refinement passes.
+  };
+
+  // CPU BC6H_UF16 (GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT) encoder for RGB half float texels,
+  // rows bottom to top as everywhere else, so the blocks can go straight to
+  // glCompressedTexImage2D. Only the one region modes (11 to 14) are used: they suit the smooth
+  // content of prefiltered and irradiance maps, and sharp edges in the panorama cost a little
+  // precision instead of a partition search. Block rows are encoded on all cores. Negative
+  // values are clamped to zero, the format cannot store them.
+  class Bc6hEncoder
+  {
+  public:
+    static constexpr std::size_t kBlockBytes = 16;
+
+    static std::size_t getBlockCount(int width, int height);
+    static std::size_t getCompressedSize(int width, int height) { return getBlockCount(width, height) * kBlockBytes; }
+
+    // output must hold getCompressedSize(width, height) bytes.
+    static void encode(const std::uint16_t* texels, int width, int height, Bc6hQuality quality, std::uint8_t* output);
+
+    // Every face of every mip of an RGB half cubemap laid out like EnvironmentView::prefilter,
+    // each face compressed on its own so that it can be uploaded with one call. An octahedral
+    // map is the same with a faceCount of 1.
+    static void encodeCubeMap(const std::uint16_t* texels, int size, int mipLevels, Bc6hQuality quality, std::vector<std::uint8_t>& output, int faceCount = 6);
+    // Byte offset of face 0 of mip in the output of encodeCubeMap.
+    static std::size_t getCubeMapOffset(int size, int mip, int faceCount = 6);
+
+    // Decodes the modes encode produces back to RGB halves; anything else decodes to black.
+    static void decode(const std::uint8_t* blocks, int width, int height, std::uint16_t* output);
+
+    // PSNR in dB of the decoded blocks against the halves they were encoded from, both
+    // tonemapped with x / (1 + x) first so that a few very bright texels do not decide the peak.
+    static double computePsnr(const std::uint16_t* reference, const std::uint8_t* blocks, int width, int height);
+    static double computeCubeMapPsnr(const std::uint16_t* reference, const std::uint8_t* blocks, int size, int mipLevels, int faceCount = 6);
+  };
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Akoylasar
+{
+  // Split sum environment BRDF: scale (r) and bias (g) applied to F0, indexed by N.V along s
+  // and roughness along t. The table depends on nothing at runtime so it is integrated at build
+  // time by the BrdfLutGen tool and linked into the executable.
+  class BrdfLut
+  {
+  public:
+    // Must match NumSamples in brdf.fs for validation against the shader to be meaningful.
+    static constexpr int kDefaultNumSamples = 2048;
+    // Largest difference to the embedded table a validation accepts. Half rounding accounts for
+    // up to 2.4e-4, the rest is headroom for the GPU's float math. A table integrated with half
+    // the samples is off by more than 1e-2.
+    static constexpr float kValidationTolerance = 2e-3f;
+
+    struct Error
+    {
+      float max = 0.0f;
+      float rms = 0.0f;
+    };
+
+    // CPU version of IntegrateBRDF in brdf.fs, evaluated at the texel centres of a size x size
+    // table. Output is RG floats, rows bottom to top.
+    static void generate(int size, int numSamples, std::vector<float>& output);
+
+    // Per channel difference between count RG half texels and the same texels as floats.
+    static Error compare(const std::uint16_t* halves, const float* reference, std::size_t count);
+
+    // The table generated for this build, as RG half floats ready for a GL_RG16F upload.
+    // Defined in the BrdfLutData.cpp written by BrdfLutGen.
+    static int getEmbeddedSize();
+    static const std::uint16_t* getEmbeddedTexels();
+  };
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+
+#include "MappedFile.hpp"
+
+namespace Akoylasar
+{
+  // File handling shared by the caches (BakeCache, MeshCache) and the containers they hold
+  // (EnvironmentContainer, MeshContainer): entries named after their key, written atomically,
+  // and made of a fixed header followed by hashed sections.
+  class CacheFile
+  {
+  public:
+    // Where a container's header records each of its sections.
+    struct Section
+    {
+      std::uint64_t offset;
+      std::uint64_t size;
+      std::uint64_t hash; // BakeCache::hash of the section's bytes.
+    };
+
+    // Sections start on a 4k boundary so that uploads read whole pages straight from the mapping.
+    static constexpr std::uint64_t kSectionAlignment = 4096;
+
+    // Fills in sections[0, count), which must lie within header, from data and sizes, then
+    // writes header followed by the sections. name is for the error message.
+    static bool writeSections(const std::filesystem::path& path,
+                              const char* name,
+                              const void* header,
+                              std::size_t headerSize,
+                              Section* sections,
+                              const void* const* data,
+                              const std::uint64_t* sizes,
+                              int count);
+
+    // Points data at section within file, or at nullptr when the section is empty. Returns the
+    // reason when its bounds, alignment or hash do not add up and nullptr when they do.
+    static const char* readSection(const MappedFile& file, const Section& section, const std::uint8_t*& data);
+
+    // directory/<key as 16 hex digits><extension>
+    static std::filesystem::path getEntryPath(const std::filesystem::path& directory, std::uint64_t key, const char* extension);
+
+    // Maps path into file and has read check the container and return the key it was written
+    // with. Logs hits, misses and stale or corrupt entries as name ("Bake cache") and closes
+    // file on anything but a hit.
+    static bool load(const std::filesystem::path& path,
+                     std::uint64_t key,
+                     const char* name,
+                     MappedFile& file,
+                     const std::function<bool(const MappedFile&, std::uint64_t&)>& read);
+
+    // Has write fill a file next to path and renames it into place, so that a crash never
+    // leaves a half written entry behind under the real name. Creates the directory first.
+    static bool store(const std::filesystem::path& path,
+                      const char* name,
+                      const std::function<bool(const std::filesystem::path&)>& write);
+  };
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "IBLBaker.hpp"
+#include "MappedFile.hpp"
+#include "SunLight.hpp"
+
+namespace Akoylasar
+{
+  // A baked environment in GPU ready form: RGB half float texels laid out exactly as the
+  // glTexImage2D calls consume them. The pointers are not owned; they point either into a mapped
+  // container or at the baker's own buffers.
+  struct EnvironmentView
+  {
+    ShCoefficients radianceSh;
+    SunLight sun; // Already taken out of the radiance and the maps when not empty.
+    int sourceSize = 0;
+    int sourceMipLevels = 0;
+    const std::uint16_t* source = nullptr; // Panorama resampled to a cubemap, laid out like prefilter.
+    int irradianceSize = 0;
+    const std::uint16_t* irradiance = nullptr; // 6 faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order.
+    int prefilterSize = 0;
+    int prefilterMipLevels = 0;
+    const std::uint16_t* prefilter = nullptr; // Mips one after another, 6 faces each.
+    // Optional BC6H copies of the maps above in Bc6hEncoder's layout, uploaded instead of the
+    // halves when present. The halves stay around for validation and the CPU side.
+    const std::uint8_t* sourceBc6h = nullptr;
+    const std::uint8_t* irradianceBc6h = nullptr;
+    const std::uint8_t* prefilterBc6h = nullptr;
+  };
+
+  // .pbrenv files: a fixed header with the sizes, SH coefficients, sun and a CacheFile::Section
+  // per map, followed by the maps as laid out by CacheFile::writeSections.
+  class EnvironmentContainer
+  {
+  public:
+    static bool write(const std::filesystem::path& path, std::uint64_t key, const EnvironmentView& view);
+
+    // Points output into the mapped file after checking the header, the section bounds and the
+    // section hashes. The BC6H sections are empty when the container was written without them.
+    // Logs the reason and returns false for anything that does not add up.
+    static bool read(const MappedFile& file, std::uint64_t& key, EnvironmentView& output);
+
+    // Number of halves in mips [0, mip) of an RGB cubemap.
+    static std::size_t getCubeMapOffset(int size, int mip);
+  };
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <GL/gl3w.h>
+
+#include "IBLBaker.hpp"
+#include "SunLight.hpp"
+
+namespace Akoylasar
+{
+  // GPU storage of the irradiance and prefilter cubemaps, bytes per texel in brackets:
+  // GL_RGB16F (6), BC6H (1), GL_RGB9_E5 (4) or RGBM in GL_RGBA8 (4, decoded in ibl.fs).
+  enum class TextureStorage
+  {
+    Rgb16f,
+    Bc6h,
+    Rgb9e5,
+    Rgbm
+  };
+
+  // Everything that differs from one baked environment to the next: its textures and the
+  // CPU side state IBLScene keeps for them. The scene renders from its own copy of these and
+  // swaps it with a resident one to switch environments.
+  struct ResidentEnvironment
+  {
+    std::filesystem::path path;
+    GLuint environmentTexture = 0;
+    bool environmentCompressed = false;
+    MapLayout environmentLayout = MapLayout::CubeMap;
+    std::size_t environmentBytes = 0;
+    GLuint irradianceMap = 0;
+    CubeMapData irradianceData;
+    TextureStorage irradianceStorage = TextureStorage::Bc6h;
+    float irradianceRgbmRange = 0.0f;
+    std::size_t irradianceBytes = 0;
+    MapLayout irradianceLayout = MapLayout::CubeMap;
+    ShCoefficients radianceSh;
+    ShCoefficients irradianceSh;
+    SunLight sun;
+    GLuint prefilterMap = 0;
+    CubeMapData prefilterData;
+    TextureStorage prefilterStorage = TextureStorage::Bc6h;
+    float prefilterRgbmRange = 0.0f;
+    std::size_t prefilterBytes = 0;
+    MapLayout prefilterLayout = MapLayout::CubeMap;
+
+    std::size_t getBytes() const { return environmentBytes + irradianceBytes + prefilterBytes; }
+    // Deletes the textures. Needs a current GL context.
+    void release();
+  };
+
+  // Baked environments kept on the GPU within a byte budget, so that switching to one of them
+  // is a swap of texture handles. The least recently used one is evicted first. Holds the
+  // list of environments to cycle through as well, and picks which one to prefetch next.
+  class EnvironmentLibrary
+  {
+  public:
+    struct Stats
+    {
+      std::size_t hits = 0; // Switches to an environment that was resident.
+      std::size_t misses = 0; // Switches that had to wait for a load.
+      std::size_t evictions = 0;
+      std::size_t residentCount = 0;
+      std::size_t residentBytes = 0; // Excluding the environment in use.
+      std::size_t budgetBytes = 0;
+
+      double getHitRate() const;
+    };
+
+    EnvironmentLibrary(std::vector<std::filesystem::path> paths, std::size_t budgetBytes);
+    ~EnvironmentLibrary();
+    EnvironmentLibrary(const EnvironmentLibrary&) = delete;
+    EnvironmentLibrary& operator=(const EnvironmentLibrary&) = delete;
+
+    const std::vector<std::filesystem::path>& getPaths() const { return mPaths; }
+    // Index of path in getPaths(), or -1.
+    int getIndex(const std::filesystem::path& path) const;
+    // The next path after current in the list, wrapping around, that is neither resident nor
+    // current. Empty when every environment is.
+    std::filesystem::path getPrefetchCandidate(const std::filesystem::path& current) const;
+
+    bool contains(const std::filesystem::path& path) const;
+    // The resident environment for path, counted as a hit and marked as used, or null, counted
+    // as a miss. A hit stays resident; the caller swaps its own environment into it, which makes
+    // the one it leaves the most recently used.
+    ResidentEnvironment* acquire(const std::filesystem::path& path);
+    // Same as acquire without counting, for a switch that was already counted as a miss.
+    ResidentEnvironment* find(const std::filesystem::path& path);
+    // Makes environment resident, then evicts the least recently used others until they fit
+    // in the budget next to inUseBytes, the environment being rendered.
+    void insert(ResidentEnvironment environment, std::size_t inUseBytes);
+    void evict(std::size_t inUseBytes);
+
+    Stats getStats() const;
+
+  private:
+    struct Entry
+    {
+      ResidentEnvironment environment;
+      std::uint64_t lastUse = 0;
+    };
+
+  private:
+    std::vector<std::filesystem::path> mPaths;
+    std::size_t mBudgetBytes;
+    // Few enough that a linear search beats anything smarter.
+    std::vector<Entry> mEntries;
+    std::uint64_t mUseCounter = 0;
+    std::size_t mHits = 0;
+    std::size_t mMisses = 0;
+    std::size_t mEvictions = 0;
+  };
+}
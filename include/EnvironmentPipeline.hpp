@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "BakeCache.hpp"
+#include "Bc6hEncoder.hpp"
+#include "EnvironmentContainer.hpp"
+#include "EnvironmentSampler.hpp"
+#include "IBLBaker.hpp"
+#include "JobSystem.hpp"
+#include "MappedFile.hpp"
+
+namespace Akoylasar
+{
+  // Everything prepared on the CPU for one panorama, handed from stage to stage.
+  struct EnvironmentData
+  {
+    std::filesystem::path path;
+    bool failed = false;
+    // Hash of the source file and every bake parameter.
+    std::uint64_t bakeKey = 0;
+    bool cacheHit = false;
+    // On a cache hit environment points into the mapped container. Otherwise it points at
+    // the buffers below, and gets its prefilter map either from the bake stage or once it has
+    // been baked on the GL thread.
+    MappedFile container;
+    EnvironmentView environment;
+    std::unique_ptr<std::uint16_t[]> sourceTexels;
+    std::vector<std::uint16_t> irradianceTexels;
+    std::vector<std::uint16_t> prefilterTexels;
+    std::vector<std::uint8_t> sourceBc6h;
+    std::vector<std::uint8_t> irradianceBc6h;
+    std::vector<std::uint8_t> prefilterBc6h;
+    CubeMapData irradiance; // Float copy kept for validateIrradianceMap.
+    CubeMapData sourceCube; // Float copy of source, only kept until the CPU prefilter bake.
+    // Only alive between the stages that need them, unless the sampler is built. The radiance
+    // is either the full float decode or, when decoding within a memory budget, a downsampled
+    // mip chain.
+    MappedFile source;
+    std::unique_ptr<float[]> radiance;
+    EquirectMipChain radianceMips;
+    bool hasRadianceSh = false; // Projected while streaming the decode.
+    int width = 0;
+    int height = 0;
+    int downsampleFactor = 1;
+    std::size_t decodePeakBytes = 0;
+    double decodeMs = 0.0;
+    double sunExtractionMs = 0.0;
+    double cubeMapMs = 0.0;
+    double shProjectionMs = 0.0;
+    double irradianceBakeMs = 0.0;
+    double prefilterBakeMs = 0.0;
+    // Built over the radiance by the bake stage when EnvironmentPipelineSettings::buildSampler
+    // is set and the bakes were not cached, for CPU reference renders.
+    EnvironmentSampler sampler;
+    double samplerBuildMs = 0.0;
+    // Filled in by EnvironmentPipeline::compressBc6h, PSNR in dB against the halves.
+    double bc6hEncodeMs = 0.0;
+    std::size_t bc6hBlocks = 0;
+    double sourcePsnr = 0.0;
+    double irradiancePsnr = 0.0;
+    double prefilterPsnr = 0.0;
+
+    EquirectImage getRadiance() const;
+  };
+
+  struct EnvironmentPipelineSettings
+  {
+    PrefilterSettings prefilter; // Its layout must be MapLayout::CubeMap, containers only hold cubemaps.
+    int irradianceSize = 32;
+    // Face size the panorama is resampled to, zero for IBLBaker::getEquirectCubeMapSize.
+    int sourceCubeMapSize = 0;
+    // Bake the prefilter map on the CPU in the bake stage rather than on the GPU after upload.
+    bool cpuPrefilter = false;
+    // Build the importance sampling tables in the bake stage and keep the radiance they were
+    // built over, about 12 bytes a texel each.
+    bool buildSampler = false;
+    // When non-zero, panoramas are decoded with HdrReader::decodeStreaming and downsampled as
+    // far as needed to stay within this many bytes. Zero decodes them whole.
+    std::size_t decodeMemoryBudget = 0;
+    // Take the sun out of each panorama right after decoding, see SunExtractor::extract. Every
+    // map is baked from what is left and the sun travels in EnvironmentView::sun.
+    bool extractSun = false;
+    SunExtractionSettings sun;
+    // BC6H compress the maps in the bake stage so that they are uploaded and cached compressed.
+    bool compressBc6h = false;
+    Bc6hQuality bc6hQuality = Bc6hQuality::Normal;
+    // Items that may wait in front of each stage; stage concurrency is the number of items it
+    // works on at once.
+    std::size_t queueCapacity = 2;
+    unsigned int decodeConcurrency = 2;
+    unsigned int convertConcurrency = 1;
+    unsigned int bakeConcurrency = 1;
+  };
+
+  // Prepares panoramas in overlapping stages: read (map, hash, cache lookup) -> decode (and sun
+  // extraction) -> cubemap and half conversion -> CPU bake -> upload. Every stage but the last
+  // runs on the job system with its own concurrency limit, and pulls work only while the queue
+  // in front of the next stage has room, so a slow stage holds back the ones before it instead
+  // of piling up decoded panoramas. Upload is done by the GL thread through popReady and
+  // finishUpload.
+  class EnvironmentPipeline
+  {
+  public:
+    enum Stage
+    {
+      kRead,
+      kDecode,
+      kConvert,
+      kBake,
+      kUpload,
+      kStageCount
+    };
+
+    struct StageStats
+    {
+      const char* name = "";
+      std::size_t queueDepth = 0;
+      std::size_t peakQueueDepth = 0;
+      std::size_t queueCapacity = 0;
+      std::size_t processed = 0;
+      double busyMs = 0.0;
+      double itemsPerSecond = 0.0; // Over the time the stage was busy.
+    };
+
+    // The job system and the cache must outlive the pipeline, and the job system has to be
+    // drained before it is destroyed.
+    EnvironmentPipeline(JobSystem& jobs, const BakeCache& cache, const EnvironmentPipelineSettings& settings);
+
+    void submit(const std::filesystem::path& path);
+    // Next environment ready for upload, or null. Failed ones are dropped here.
+    std::unique_ptr<EnvironmentData> popReady();
+    void finishUpload(double uploadMs);
+    // Nothing queued, in flight or waiting for upload.
+    bool isIdle() const;
+
+    std::array<StageStats, kStageCount> getStats() const;
+    // Uploaded environments per second since the first submit.
+    double getEnvironmentsPerSecond() const;
+
+    // Runs one stage on item, skipping it once the item has failed. Exposed so that tools can
+    // time the stages back to back as a baseline.
+    static void runStage(Stage stage, EnvironmentData& item, const BakeCache& cache, const EnvironmentPipelineSettings& settings);
+    static std::uint64_t getBakeKey(MappedFile& source, const EnvironmentPipelineSettings& settings);
+    // Compresses the source, irradiance and, once it is set, the prefilter map of item's
+    // environment, skipping the ones already done. Used by the bake stage and after GPU bakes.
+    static void compressBc6h(EnvironmentData& item, Bc6hQuality quality);
+
+  private:
+    using Item = std::unique_ptr<EnvironmentData>;
+
+    struct StageState
+    {
+      const char* name;
+      unsigned int concurrency = 1;
+      std::size_t capacity = 0;
+      std::deque<Item> queue;
+      unsigned int active = 0;
+      std::size_t reserved = 0; // Items in the previous stage that will land in queue.
+      std::size_t peakQueueDepth = 0;
+      std::size_t processed = 0;
+      double busyMs = 0.0;
+    };
+
+    void pump();
+    void finishStage(int stage, Item item, double ms);
+
+  private:
+    JobSystem& mJobs;
+    const BakeCache& mCache;
+    EnvironmentPipelineSettings mSettings;
+    mutable std::mutex mMutex;
+    std::array<StageState, kStageCount> mStages;
+    std::size_t mInFlight = 0; // Submitted and not yet uploaded or dropped.
+    std::chrono::steady_clock::time_point mFirstSubmitTime;
+    std::chrono::steady_clock::time_point mLastUploadTime;
+  };
+}
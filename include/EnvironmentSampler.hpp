@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Neon.hpp>
+
+#include "IBLBaker.hpp"
+
+namespace Akoylasar
+{
+  // Draws directions from a panorama in proportion to the light arriving from them, so that a
+  // sun covering a handful of texels gets its share of the samples instead of showing up as
+  // fireflies. Each texel is weighted by its luminance times sin(theta), i.e. by the solid
+  // angle of its row. The distribution is kept in two forms:
+  // - a marginal CDF over rows and a conditional CDF per row, binary searched in O(log n) and
+  //   monotonic in the random numbers, so that stratified inputs stay stratified;
+  // - Vose alias tables over the same weights, O(1) per draw.
+  class EnvironmentSampler
+  {
+  public:
+    struct Sample
+    {
+      Neon::Vec3f direction;
+      float pdf = 0.0f; // Per steradian.
+    };
+
+    // Builds both forms, the rows spread across all cores. The sampler only keeps the
+    // distribution; radiance is looked up in the image by the caller.
+    void build(const EquirectImage& image);
+    bool isEmpty() const { return mWidth == 0; }
+    int getWidth() const { return mWidth; }
+    int getHeight() const { return mHeight; }
+    // Luminance integrated over the sphere, which is what the weights are normalized by.
+    double getLuminanceIntegral() const { return mIntegral; }
+    std::size_t getMemoryBytes() const;
+
+    // u1 picks the row and u2 the column, both in [0, 1).
+    Sample sampleCdf(float u1, float u2) const;
+    Sample sampleAlias(float u1, float u2) const;
+    // Density of both sampling methods in a normalized direction, for MIS weights.
+    float getPdf(const Neon::Vec3f& direction) const;
+
+  private:
+    struct AliasEntry
+    {
+      float probability; // Of keeping this entry rather than taking its alias.
+      std::uint32_t alias;
+    };
+
+    // Vose's method. scaled, small and large are scratch space, reused across calls.
+    static void buildAliasTable(const float* weights, std::size_t count, double sum, AliasEntry* table,
+                                std::vector<double>& scaled, std::vector<std::uint32_t>& small, std::vector<std::uint32_t>& large);
+    // Index drawn from table and the position within the entry, both from a single number.
+    static std::size_t sampleAliasTable(const AliasEntry* table, std::size_t count, float u, float& offset);
+    Sample makeSample(std::size_t row, std::size_t column, float rowOffset, float columnOffset) const;
+    float getPdf(std::size_t row, std::size_t column, float cosLatitude) const;
+
+  private:
+    int mWidth = 0;
+    int mHeight = 0;
+    double mIntegral = 0.0;
+    std::vector<float> mRowCdf; // height + 1 entries, from 0 to 1.
+    std::vector<float> mColumnCdfs; // width + 1 entries per row.
+    std::vector<AliasEntry> mRowAlias;
+    std::vector<AliasEntry> mColumnAliases; // width entries per row.
+  };
+}
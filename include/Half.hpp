@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Akoylasar
+{
+  // IEEE 754 binary16 conversions, bit compatible with GL_HALF_FLOAT.
+  class Half
+  {
+  public:
+    // Rounds to nearest even. Out of range values become infinity, NaNs stay NaNs.
+    static std::uint16_t fromFloat(float value);
+    static float toFloat(std::uint16_t value);
+
+    // Bulk conversions with F16C when the build enables it (PBR_ENABLE_AVX2), split across all
+    // cores for large buffers. Results match the scalar versions bit for bit, NaN payloads aside.
+    static void fromFloats(const float* input, std::uint16_t* output, std::size_t count);
+    static void toFloats(const std::uint16_t* input, float* output, std::size_t count);
+  };
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Akoylasar
+{
+  // Compact 4 byte encodings of RGB radiance for textures that can live with less precision
+  // than half floats. The bulk packers use AVX2 when the build enables it (PBR_ENABLE_AVX2)
+  // and split large buffers across all cores; they match the scalar versions bit for bit.
+  class HdrPacking
+  {
+  public:
+    // GL_RGB9_E5 texels as GL_UNSIGNED_INT_5_9_9_9_REV: 9 bit mantissas with a shared 5 bit
+    // exponent, following EXT_texture_shared_exponent. Negatives and NaNs become zero and
+    // values above 65408 are clamped. The largest channel keeps about 9 bits, the others
+    // lose whatever lies below its exponent.
+    static std::uint32_t packRgb9e5(const float* rgb);
+    static void packRgb9e5(const float* input, std::uint32_t* output, std::size_t texelCount);
+    static void unpackRgb9e5(std::uint32_t packed, float* rgb);
+
+    // RGBM in GL_RGBA8: RGB / (M * range) in RGB and M in A, decoded in the shader as
+    // rgb * a * range. range is the largest channel value of the whole texture, see
+    // getRgbmRange. Filtering RGBM texels is not exactly filtering radiance, which shows as
+    // slight fringes at the edges of bright sources.
+    static float getRgbmRange(const float* input, std::size_t texelCount);
+    static void packRgbm(const float* rgb, float range, std::uint8_t* rgbm);
+    static void packRgbm(const float* input, std::uint8_t* output, std::size_t texelCount, float range);
+    static void unpackRgbm(const std::uint8_t* rgbm, float range, float* rgb);
+  };
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "IBLBaker.hpp"
+#include "MappedFile.hpp"
+
+namespace Akoylasar
+{
+  struct StreamedHdr
+  {
+    int sourceWidth = 0;
+    int sourceHeight = 0;
+    int downsampleFactor = 1;
+    // Level 0 is the source box filtered by downsampleFactor in both directions.
+    EquirectMipChain mips;
+    // Projected from the full resolution scanlines.
+    ShCoefficients radianceSh;
+    // Heap the decoder held at its peak. Pages of the mapping are not included.
+    std::size_t peakBytes = 0;
+  };
+
+  // Radiance .hdr (RGBE) decoder. Scanline offsets are found in one quick pass over the run
+  // headers, then scanlines are decoded and converted on all cores. Rows are written bottom to
+  // top, the layout stbi_loadf produces with stbi_set_flip_vertically_on_load(true), so no
+  // separate flip pass is needed.
+  class HdrReader
+  {
+  public:
+    // Decodes to RGB floats. Returns false and logs on malformed input.
+    static bool decode(const void* data,
+                       std::size_t size,
+                       int& width,
+                       int& height,
+                       std::unique_ptr<float[]>& output);
+
+    // Decodes to RGB half floats, ready for a GL_HALF_FLOAT upload.
+    static bool decode(const void* data,
+                       std::size_t size,
+                       int& width,
+                       int& height,
+                       std::unique_ptr<std::uint16_t[]>& output);
+
+    // For panoramas too large to hold as floats. Decodes a band of scanlines at a time and box
+    // filters them by the smallest power of two that fits maxBytes, while projecting the full
+    // resolution rows onto SH in the same pass. The mapping's pages are released behind the
+    // decoder, so resident memory stays around maxBytes however large the file is.
+    static bool decodeStreaming(MappedFile& file, std::size_t maxBytes, StreamedHdr& output);
+  };
+}
@@ -2,36 +2,182 @@
  * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
 #pragma once
 
-#include <atomic>
+#include <chrono>
+#include <filesystem>
 
 #include "ShaderProgram.hpp"
 #include "Mesh.hpp"
 #include "Camera.hpp"
+#include "IBLBaker.hpp"
+#include "BakeCache.hpp"
+#include "BakeScheduler.hpp"
+#include "EnvironmentLibrary.hpp"
+#include "EnvironmentPipeline.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "JobSystem.hpp"
+#include "ObjLoader.hpp"
+#include "Profiler.hpp"
+#include "TextureUploader.hpp"
 
 namespace Akoylasar
 {
   class IBLScene
   {
     private:
-      struct ImageData
+      using ImageData = EnvironmentData;
+
+      struct MeshReport
+      {
+        bool cacheHit = false;
+        double loadMs = 0.0; // Cache lookup plus, on a miss, the build or OBJ load and the store.
+        double uploadMs = 0.0;
+        std::size_t triangles = 0;
+        std::size_t vertices = 0;
+        ObjLoadStats objStats; // Only filled in when the OBJ was parsed.
+        MeshOptimizationStats optimization;
+        bool hasPackedVertices = false;
+        std::size_t vertexBufferBytes = 0; // Of whichever format was uploaded.
+        std::vector<LodLevelStats> lodStats; // Only filled in when the levels were built.
+      };
+
+      struct BakeReport
       {
-        int width, height;
-        float* image;
+        double startupMs = 0.0; // From initialise until the environment is uploaded.
+        std::size_t peakResidentBytes = 0;
+        double decodeMs = 0.0;
+        int decodeDownsampleFactor = 1;
+        std::size_t decodePeakBytes = 0;
+        double sunExtractionMs = 0.0;
+        double cubeMapMs = 0.0; // Zero when the cubemap came from the bake cache.
+        int cubeMapSize = 0;
+        int cubeMapMipLevels = 0;
+        double shProjectionMs = 0.0;
+        double irradianceBakeMs = 0.0;
+        bool bakeCacheHit = false;
+        double bakeCacheMs = 0.0; // Prefilter upload on a hit, GLSL bake plus readback and store on a miss.
+        // Filled in by validateIrradianceMap.
+        bool irradianceValidated = false;
+        double glslIrradianceMs = 0.0;
+        float irradianceMaxError = 0.0f;
+        float irradianceRmsError = 0.0f;
+        // Filled in by validatePrefilterMap.
+        bool prefilterValidated = false;
+        double glslPrefilterMs = 0.0;
+        double previewBakeMs = 0.0; // GPU time of the low resolution bake shown until the full one is done.
+        BakeScheduler::Stats prefilterBakeStats;
+        std::vector<PrefilterMipStats> cpuPrefilterStats;
+        float prefilterMaxError = 0.0f;
+        float prefilterRmsError = 0.0f;
+        // Filled in by validateBrdfLut.
+        bool brdfLutValidated = false;
+        bool brdfLutPassed = false;
+        double glslBrdfLutMs = 0.0;
+        float brdfLutMaxError = 0.0f;
+        float brdfLutRmsError = 0.0f;
+        // Every texel upload goes through uploadHalfTexture or uploadBc6hTexture.
+        std::size_t uploadedBytes = 0;
+        std::size_t uploadedBytesAsFloat = 0; // What the same uploads would have sent as GL_FLOAT.
+        double uploadMs = 0.0; // From the first chunk until the last one has landed.
+        std::size_t vramSavedBytes = 0; // By BC6H textures over GL_RGB16F.
+        double bc6hEncodeMs = 0.0;
+        std::size_t bc6hBlocks = 0;
+        double sourcePsnr = 0.0;
+        double irradiancePsnr = 0.0;
+        double prefilterPsnr = 0.0;
+        TextureUploader::Stats uploadStats;
+        // CPU time of the last switch of each map's layout, resampling or rebaking it.
+        double environmentLayoutMs = 0.0;
+        double irradianceLayoutMs = 0.0;
+        double prefilterLayoutMs = 0.0;
       };
     
   public:
-    void initialise();
+    // Loading, CPU bakes and mesh generation run on jobs; shutdown has to cancel and drain
+    // them before the scene goes away.
+    void initialise(JobSystem& jobs);
     void render(double deltaTime, const Camera& camera);
     void shutdown();
     void loadAssets();
+    // The environment is streamed in over several frames: steupResources queues the uploads and
+    // finishResources runs the bakes once the last chunk has landed.
     void steupResources(ImageData* image);
-    void setupBackgroundTexture(ImageData* image);
-    void setupIrradianceMap();
+    void finishResources();
+    bool isLoading() const { return !mInitialised || mPrefilterBakePending; }
+    // For measurements driven from outside, e.g. the zoom sweep in main.
+    bool isLodEnabled() const { return mLodEnabled; }
+    void setLodEnabled(bool enabled) { mLodEnabled = enabled; }
+    std::size_t getDrawnTriangles() const { return mDrawnTriangles; }
+    double getShadingGpuMs() const { return mShadingGpuMs; }
+    void setupBackgroundTexture(const EnvironmentView& environment);
+    void setupIrradianceMap(const ImageData& image);
+    void bakeIrradianceMapGlsl(GLuint outputTexture);
+    void validateIrradianceMap();
     void setupPrefilterEnvMap();
+    void allocatePrefilterMap(GLuint texture, int size, int mipLevels);
+    void bakePrefilterPreview();
+    void startPrefilterBake();
+    void updatePrefilterBake();
+    void validatePrefilterMap();
     void setupBrdLUT();
+    void bakeBrdfLutGlsl(GLuint outputTexture, int size);
+    // Returns whether the embedded table is within BrdfLut::kValidationTolerance of brdf.fs.
+    bool validateBrdfLut();
+    void uploadCachedMaps(const EnvironmentView& data);
+    void readPrefilterMap();
+    void applyIrradianceStorage();
+    void applyPrefilterStorage();
+    // Repacks data into texture in the given storage, uploading directly rather than streaming
+    // since only the small cubemaps are switched at runtime. Zero rgbmRange for non RGBM.
+    // The texture is recreated when data's layout needs another target.
+    void applyTextureStorage(GLuint& texture, const CubeMapData& data, TextureStorage storage, float& rgbmRange, std::size_t& bytes);
+    // Layout switches rebake the map on the CPU: the irradiance map from its SH coefficients,
+    // the others from the environment read back from the GPU, on a job.
+    void setEnvironmentLayout(MapLayout layout);
+    void setIrradianceLayout(MapLayout layout);
+    void setPrefilterLayout(MapLayout layout);
+    void readEnvironmentMap(CubeMapData& output);
+    void storeBakedMaps(std::unique_ptr<ImageData> image);
+    // Writes the image's bakes to the cache on a job, hashing and writing tens of MB being no
+    // work for the GL thread.
+    void storeInCache(std::unique_ptr<ImageData> image);
+    void uploadHalfTexture(GLuint texture,
+                           GLenum bindTarget,
+                           GLenum imageTarget,
+                           GLint level,
+                           GLint internalFormat,
+                           int width,
+                           int height,
+                           GLenum format,
+                           const std::uint16_t* texels);
+    void uploadBc6hTexture(GLuint texture,
+                           GLenum bindTarget,
+                           GLenum imageTarget,
+                           GLint level,
+                           int width,
+                           int height,
+                           const std::uint8_t* blocks);
+    // Environment switches. The scene's own environment members are swapped with a resident
+    // one, so a switch to an environment already in the library lands in the same frame. Others
+    // are loaded through mLibraryPipeline, which bakes everything on the CPU, uploaded over a few
+    // frames into textures of their own and switched to once they are in.
+    void swapEnvironment(ResidentEnvironment& other);
+    void switchEnvironment(const std::filesystem::path& path);
+    void updateLibrary();
+    void prefetchNext();
+    void startPrefetchUpload(std::unique_ptr<ImageData> image);
+    void finishPrefetchUpload();
     void drawUI(double deltaTime);
+    void drawLibraryUI();
+    // Builds or maps the scene mesh on a job and uploads it in the format mQuantizeVertices asks
+    // for, replacing the one there is.
+    void loadSceneMesh();
+    // Builds the scene mesh again without optimising it, for one draw that counts its vertex
+    // shader invocations.
+    void requestSourceMesh();
     static void renderToCubeMap(GLuint inputTexture,
-                                bool isCubeMap,
+                                MapLayout inputLayout,
                                 GLuint outputTexture,
                                 unsigned int width,
                                 unsigned int height,
@@ -40,20 +186,91 @@ namespace Akoylasar
                                 int mip);
 
   private:
-    GLuint mEnvironmentTexture;
+    std::filesystem::path mEnvironmentPath;
+    GLuint mEnvironmentTexture; // The panorama as a cubemap or an octahedral map with its mips.
+    bool mEnvironmentCompressed = false; // BC6H, only once the prefilter map no longer needs baking.
+    MapLayout mEnvironmentLayout = MapLayout::CubeMap;
+    std::size_t mEnvironmentBytes = 0;
+    bool mLayoutBakePending = false; // One layout switch at a time.
     std::unique_ptr<ShaderProgram> mBackgroundProgram;
     std::unique_ptr<ShaderProgram> mPrefilterEnvProgram;
     std::unique_ptr<ShaderProgram> mPbrProgram;
     GpuMesh mCubeMesh;
-    GpuMesh mSphereMesh;
-    std::atomic<ImageData*> mImage = nullptr;
+    GpuMesh mSphereMesh; // Or the model at kModelPath when there is one.
+    MeshReport mMeshReport;
+    JobSystem* mJobs = nullptr;
+    JobSystem::JobHandle mSphereMeshJob;
+    bool mQuantizeVertices = true; // Draw with PackedVertex when the mesh has them.
+    // The scene mesh's level is picked each frame from its projected size, unless disabled.
+    bool mLodEnabled = true;
+    float mLodPixelError = 1.0f;
+    int mSphereLod = 0;
+    std::size_t mDrawnTriangles = 0;
+    // Vertex shader invocations of the scene mesh's draw and of a single draw of the same mesh
+    // in the order it was built in, from GL_ARB_pipeline_statistics_query where there is one.
+    bool mPipelineStatistics = false;
+    GLuint mInvocationQueries[2] = {0, 0};
+    bool mInvocationQueryPending[2] = {false, false};
+    std::uint64_t mVertexInvocations[2] = {0, 0};
+    GpuMesh mSourceMesh;
+    bool mSourceMeshRequested = false;
+    bool mSourceMeshReady = false; // Uploaded and waiting for its draw.
+    std::unique_ptr<ImageData> mPendingImage; // Owns the texels while they are being uploaded.
+    std::unique_ptr<TextureUploader> mUploader;
+    std::chrono::steady_clock::time_point mUploadStartTime;
     GLuint mIrradianceMap;
+    CubeMapData mIrradianceData;
+    TextureStorage mIrradianceStorage = TextureStorage::Bc6h;
+    float mIrradianceRgbmRange = 0.0f;
+    std::size_t mIrradianceBytes = 0;
+    MapLayout mIrradianceLayout = MapLayout::CubeMap;
+    ShCoefficients mRadianceSh; // To rebake the map from when its layout changes.
+    ShCoefficients mIrradianceSh;
+    SunLight mSun; // Drawn by both programs, already missing from every map.
+    bool mDrawSun = true;
+    BakeReport mBakeReport;
+    bool mUseIrradianceSh = false;
     GLuint mPrefilterMap;
+    CubeMapData mPrefilterData; // Float copy to repack from when the storage changes.
+    TextureStorage mPrefilterStorage = TextureStorage::Bc6h;
+    float mPrefilterRgbmRange = 0.0f;
+    std::size_t mPrefilterBytes = 0;
+    MapLayout mPrefilterLayout = MapLayout::CubeMap; // The GLSL bakes and the cache only deal in cubemaps.
+    PrefilterSettings mPrefilterSettings;
+    // Progressive bakes render into mBakeTarget, which is swapped with mPrefilterMap once done.
+    std::unique_ptr<BakeScheduler> mBakeScheduler;
+    GLuint mBakeTarget;
+    bool mPrefilterBakePending = false;
+    float mBakeBudgetMs = 2.0f;
+    std::chrono::steady_clock::time_point mBakeStartTime;
     GLuint mBrdfLUT;
+    BakeCache mBakeCache {"cache"};
+    MeshCache mMeshCache {"cache"};
+    // Declared after the cache it reads from, so that it goes first.
+    std::unique_ptr<EnvironmentPipeline> mPipeline;
+    std::unique_ptr<EnvironmentPipeline> mLibraryPipeline;
+    std::unique_ptr<EnvironmentLibrary> mLibrary;
+    // One prefetch at a time: loading (mPrefetchPath), then uploading into mPrefetched while
+    // mPrefetchImage holds its texels.
+    std::filesystem::path mPrefetchPath;
+    std::unique_ptr<ImageData> mPrefetchImage;
+    ResidentEnvironment mPrefetched;
+    std::filesystem::path mSwitchTarget; // Switched to as soon as it is resident.
+    double mLastSwitchMs = 0.0;
     Neon::Vec3f mAlbedo = Neon::Vec3f(0.98, 0.96, 0.99);
     float mMetallic = 0.5f;
     float mRoughness = 0.3f;
     float mAo = 1.0f;
     bool mInitialised = false;
+    bool mBrdfLutChecked = false; // Debug builds validate the BRDF LUT after the first frame.
+    std::chrono::steady_clock::time_point mInitialiseTime;
+    // GPU time of the background, one environment lookup per pixel, and of the sphere, the pass
+    // that samples both baked maps, averaged over frames.
+    std::unique_ptr<Profiler> mProfiler;
+    TimeStamp* mBackgroundTimeStamp = nullptr;
+    TimeStamp* mShadingTimeStamp = nullptr;
+    bool mPassesTimed = false;
+    double mBackgroundGpuMs = 0.0;
+    double mShadingGpuMs = 0.0;
   };
 }
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+#include <Neon.hpp>
+
+namespace Akoylasar
+{
+  class EnvironmentSampler;
+
+  // Read-only view of an equirectangular RGB float panorama. Rows are stored bottom to top,
+  // i.e. in the order they are uploaded to GL (stbi_set_flip_vertically_on_load(true)).
+  struct EquirectImage
+  {
+    int width = 0;
+    int height = 0;
+    const float* texels = nullptr;
+  };
+
+  // Panorama with its full mip chain, box filtered like glGenerateMipmap. All levels live in a
+  // single buffer so the SIMD lookups can gather across levels.
+  struct EquirectMipChain
+  {
+    std::vector<float> texels;
+    std::vector<int> offsets; // In floats.
+    std::vector<int> widths;
+    std::vector<int> heights;
+
+    int getLevelCount() const;
+    EquirectImage getLevel(int level) const;
+    // Lays out every level of a width x height panorama. Level 0 is left for the caller to fill.
+    void allocate(int width, int height);
+    // Fills levels 1 and up from level 0.
+    void generateMips();
+  };
+
+  enum class MapLayout
+  {
+    // Six faces, GL_TEXTURE_CUBE_MAP.
+    CubeMap,
+    // The sphere folded onto a single square GL_TEXTURE_2D through the octahedron |x|+|y|+|z| = 1,
+    // see IBLBaker::getOctahedralUv. The upper hemisphere fills the inner diamond and the lower
+    // one the four corners, so the sky never crosses the fold.
+    Octahedral
+  };
+
+  // CPU side RGB float environment map. Mips are stored one after another, each mip holding its
+  // faces, rows bottom to top: six in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order for a cubemap,
+  // a single one for an octahedral map.
+  struct CubeMapData
+  {
+    int size = 0;
+    int mipLevels = 0;
+    MapLayout layout = MapLayout::CubeMap;
+    std::vector<float> texels;
+
+    void allocate(int faceSize, int mips, MapLayout mapLayout = MapLayout::CubeMap);
+    int getFaceCount() const;
+    int getMipSize(int mip) const;
+    std::size_t getFaceOffset(int mip, int face) const;
+    float* getFace(int mip, int face);
+    const float* getFace(int mip, int face) const;
+    // Fills mips 1 and up from mip 0, face by face, with a 2x2 box filter like glGenerateMipmap.
+    void generateMips();
+  };
+
+  // L2 spherical harmonics, one RGB triple per basis function. Laid out so that it can be
+  // passed straight to ShaderProgram::setVec3fArrayUniform<9>.
+  using ShCoefficients = std::array<Neon::Vec3f, 9>;
+
+  enum class PrefilterMode
+  {
+    // numSamples GGX samples of the full resolution panorama for every mip.
+    BruteForce,
+    // Each sample reads the panorama mip whose texels match the solid angle the sample stands
+    // for (pdf and source texel solid angle), and each mip gets as many samples as its
+    // roughness needs to meet targetError.
+    FilteredImportanceSampling
+  };
+
+  struct PrefilterSettings
+  {
+    int size = 128;
+    int mipLevels = 5;
+    int numSamples = 2048; // Per texel for BruteForce, upper bound for FilteredImportanceSampling.
+    PrefilterMode mode = PrefilterMode::BruteForce;
+    float targetError = 0.1f; // Relative, FilteredImportanceSampling only.
+    MapLayout layout = MapLayout::CubeMap; // Of the output, size being an octahedral map's width.
+  };
+
+  // projectToSh for a panorama that arrives a band of rows at a time, so that it never has to
+  // be held in full. Bands can be added in any order and from several threads.
+  class ShProjector
+  {
+  public:
+    ShProjector(int width, int height);
+
+    // rowCount rows of RGB floats starting at row firstRow, counted bottom to top.
+    void addRows(const float* texels, int firstRow, int rowCount);
+    ShCoefficients getCoefficients() const;
+
+  private:
+    int mWidth;
+    int mHeight;
+    std::array<std::vector<float>, 5> mAzimuthTables;
+    mutable std::mutex mMutex;
+    std::array<double, 27> mSums {};
+  };
+
+  struct PrefilterMipStats
+  {
+    int size = 0;
+    float roughness = 0.0f;
+    int numSamples = 0;
+    double ms = 0.0;
+    double texelsPerSecond = 0.0;
+  };
+
+  class IBLBaker
+  {
+  public:
+    // Projects the panorama's radiance onto the first 9 SH basis functions, weighting every
+    // texel by its solid angle.
+    static ShCoefficients projectToSh(const EquirectImage& image);
+
+    // Applies the clamped cosine convolution to radiance coefficients. The result evaluates to
+    // irradiance / pi, which is what irradianceComputer.fs writes and ibl.fs expects.
+    static ShCoefficients convolveIrradiance(const ShCoefficients& radiance);
+
+    static Neon::Vec3f evaluateSh(const ShCoefficients& sh, const Neon::Vec3f& direction);
+
+    // Monte Carlo irradiance / pi around normal, the quantity bakeIrradianceMap stores, as a
+    // reference for it. Half of numSamples are drawn from sampler, built over image, and half
+    // cosine weighted, combined with the balance heuristic: the former find a sun the latter
+    // would turn into fireflies, the latter cover a dim, even sky the former spreads thinly.
+    static Neon::Vec3f estimateIrradiance(const EquirectImage& image, const EnvironmentSampler& sampler, const Neon::Vec3f& normal, int numSamples);
+
+    // Reconstructs a single mip irradiance map from radiance coefficients.
+    static void bakeIrradianceMap(const ShCoefficients& radiance, int size, CubeMapData& output, MapLayout layout = MapLayout::CubeMap);
+
+    // CPU version of prefilterEnvMap.fs: for every texel of every mip, importance samples the
+    // GGX lobe of roughness mip / (mipLevels - 1) with Hammersley points and averages the
+    // panorama weighted by N.L. The sample set is built once per mip and evaluated 8 samples at
+    // a time with AVX2; faces are split into tiles spread across all cores, an octahedral
+    // output being tiled as a single face.
+    static void prefilterEnvMap(const EquirectImage& image,
+                                const PrefilterSettings& settings,
+                                CubeMapData& output,
+                                std::vector<PrefilterMipStats>* stats = nullptr);
+    // Same from a mip chain that is already built, level 0 standing in for the panorama.
+    static void prefilterEnvMap(const EquirectMipChain& chain,
+                                const PrefilterSettings& settings,
+                                CubeMapData& output,
+                                std::vector<PrefilterMipStats>* stats = nullptr);
+    // Same from a cubemap or octahedral map with its mips, looked up exactly like the shader's
+    // samplerCube or sampler2D.
+    static void prefilterEnvMap(const CubeMapData& source,
+                                const PrefilterSettings& settings,
+                                CubeMapData& output,
+                                std::vector<PrefilterMipStats>* stats = nullptr);
+
+    // Resamples the panorama into a size x size cubemap with the full mip chain. Every texel of
+    // mip 0 is a trilinear lookup of the panorama mip whose texels cover about as much solid
+    // angle as it does, so that the rows near the poles are minified rather than aliased; the
+    // other mips are box filtered from it. Faces are split into tiles spread across all cores.
+    // With MapLayout::Octahedral the result is a single size x size octahedral map instead.
+    static void equirectToCubeMap(const EquirectImage& image, int size, CubeMapData& output, MapLayout layout = MapLayout::CubeMap);
+    static void equirectToCubeMap(const EquirectMipChain& chain, int size, CubeMapData& output, MapLayout layout = MapLayout::CubeMap);
+    // Resamples a map with its mips into the other layout (or size), the same way
+    // equirectToCubeMap does, for switching layouts of maps that are already baked.
+    static void convertMapLayout(const CubeMapData& source, int size, MapLayout layout, CubeMapData& output);
+    // Octahedral size with about the texel density of a size x size cubemap: twice the face
+    // size, 2/3 of the texels, the largest texel 1.3 times the cubemap's.
+    static int getOctahedralSize(int cubeMapSize);
+    // Power of two face size closest to the panorama's resolution at the equator, capped so
+    // that the cubemap stays within a few times the panorama's size.
+    static int getEquirectCubeMapSize(int width);
+
+    // Samples used for a prefilter mip. Shared with the GLSL path so both bake the same thing.
+    static int getPrefilterSampleCount(float roughness, int faceSize, const PrefilterSettings& settings);
+
+    // Solid angle of an equatorial texel of a width x height panorama.
+    static double getEquirectTexelSolidAngle(int width, int height);
+    // Solid angle of a texel at the centre of a size x size cubemap face. Texels away from the
+    // centre cover that times the cube of the largest component of their normalized direction.
+    static double getCubeMapTexelSolidAngle(int size);
+    // Solid angle of the texels around the six axis directions of a size x size octahedral
+    // map, the smallest. Texels elsewhere cover that times the cube of the sum of the
+    // absolute components of their normalized direction, up to 3 sqrt(3) times as much.
+    static double getOctahedralTexelSolidAngle(int size);
+    // Same for either layout.
+    static double getMapTexelSolidAngle(MapLayout layout, int size);
+
+    static void buildEquirectMipChain(const EquirectImage& image, EquirectMipChain& output);
+
+    // Bilinear, clamp to edge lookup of the panorama in direction (x, y, z), matching the
+    // GL sampler state and the uv mapping used by the shaders.
+    static void sampleEquirect(const EquirectImage& image, float x, float y, float z, float* rgb);
+
+    // Trilinear lookup of the cubemap in direction (x, y, z). Each face is clamped to its own
+    // edges, i.e. the GL sampler without GL_TEXTURE_CUBE_MAP_SEAMLESS. Octahedral maps are
+    // looked up at getOctahedralUv and clamped to their edges as well, so lookups within half a
+    // texel of the border miss the mirrored texels across the fold.
+    static void sampleCubeMap(const CubeMapData& cube, float x, float y, float z, float lod, float* rgb);
+
+    // Direction through texel (s, t) in [0, 1] of a cubemap face, following the GL convention.
+    static Neon::Vec3f getCubeMapDirection(int face, float s, float t);
+    // Normalized direction through (u, v) in [0, 1] of an octahedral map and its inverse, which
+    // takes any non zero direction. Match octahedralUv in the shaders.
+    static Neon::Vec3f getOctahedralDirection(float u, float v);
+    static void getOctahedralUv(float x, float y, float z, float& u, float& v);
+  };
+}
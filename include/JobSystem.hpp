@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Akoylasar
+{
+  // Small work-stealing task scheduler. Every worker owns a deque: it pushes and pops its own
+  // jobs at the back and idle workers steal from the front of the others. Jobs can depend on
+  // other jobs and can be marked to run on the main thread, which picks them up in
+  // runMainThreadJobs, so a chain like decode -> bake -> GL upload is expressed without any
+  // hand-rolled handoff.
+  class JobSystem
+  {
+  public:
+    struct Job;
+    using JobHandle = std::shared_ptr<Job>;
+
+    struct Stats
+    {
+      std::size_t executed = 0;
+      std::size_t skipped = 0; // Dropped because the system was cancelled before they ran.
+      std::size_t stolen = 0;
+    };
+
+    // The constructing thread becomes the main thread.
+    explicit JobSystem(unsigned int workerCount);
+    // Cancels and drains, then joins the workers.
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Runs task on a worker once every dependency has finished. Null dependencies are ignored.
+    JobHandle submit(std::function<void()> task, const std::vector<JobHandle>& dependencies = {});
+    // Same, but the task runs on the main thread during runMainThreadJobs.
+    JobHandle submitMainThread(std::function<void()> task, const std::vector<JobHandle>& dependencies = {});
+
+    // Runs the main thread jobs that are ready. Returns how many ran.
+    std::size_t runMainThreadJobs();
+
+    // Blocks until job has finished, running other jobs meanwhile (main thread jobs included
+    // when called from the main thread).
+    void wait(const JobHandle& job);
+    static bool isFinished(const JobHandle& job);
+
+    // Jobs that have not started yet are skipped from now on, their dependents included, and
+    // running tasks can poll isCancelled to bail out early. Cannot be undone.
+    void cancel();
+    bool isCancelled() const { return mCancelled.load(std::memory_order_relaxed); }
+    // Blocks until every submitted job has either run or been skipped.
+    void drain();
+
+    unsigned int getWorkerCount() const { return unsigned(mWorkers.size()); }
+    Stats getStats() const;
+
+  private:
+    struct Worker
+    {
+      std::mutex mutex;
+      std::deque<JobHandle> jobs;
+      std::thread thread;
+    };
+
+    JobHandle submit(std::function<void()> task, const std::vector<JobHandle>& dependencies, bool mainThread);
+    void schedule(const JobHandle& job);
+    void complete(const JobHandle& job);
+    void execute(const JobHandle& job);
+    JobHandle findJob(int workerIndex);
+    bool runOneJob();
+    void workerLoop(int workerIndex);
+
+  private:
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::thread::id mMainThread;
+    std::atomic<std::size_t> mNextWorker {0};
+    std::atomic<bool> mCancelled {false};
+
+    // Jobs sitting in a worker deque; idle workers sleep on mWake until it is non-zero.
+    std::mutex mSleepMutex;
+    std::condition_variable mWake;
+    std::atomic<std::size_t> mQueuedJobs {0};
+    bool mStopping = false;
+
+    // Submitted jobs that have not run or been skipped yet.
+    std::atomic<std::size_t> mUnfinishedJobs {0};
+    std::mutex mDrainMutex;
+    std::condition_variable mDrained;
+
+    std::mutex mMainThreadMutex;
+    std::vector<JobHandle> mMainThreadJobs;
+
+    std::atomic<std::size_t> mExecuted {0};
+    std::atomic<std::size_t> mSkipped {0};
+    std::atomic<std::size_t> mStolen {0};
+  };
+}
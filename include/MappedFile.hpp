@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace Akoylasar
+{
+  // Read-only memory mapping of a whole file. Pages are only read from disk when touched, and
+  // they belong to the OS page cache rather than the heap.
+  class MappedFile
+  {
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file does not exist, is empty or cannot be mapped.
+    bool open(const std::filesystem::path& path);
+    void close();
+    // Drops the pages of [offset, offset + size) from the process' resident set once they
+    // have been read. They stay valid and are faulted back in from the page cache if touched
+    // again. Only whole pages inside the range are released.
+    void release(std::size_t offset, std::size_t size);
+
+    bool isOpen() const { return mData != nullptr; }
+    const std::uint8_t* getData() const { return mData; }
+    std::size_t getSize() const { return mSize; }
+
+  private:
+    const std::uint8_t* mData = nullptr;
+    std::size_t mSize = 0;
+#ifdef _WIN32
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#endif
+  };
+}
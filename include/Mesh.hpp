@@ -3,12 +3,16 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 
 #include <Neon.hpp>
 
 #include <GL/gl3w.h>
 
+#include "Camera.hpp"
+
 namespace Akoylasar
 {
   struct Vertex
@@ -18,15 +22,51 @@ namespace Akoylasar
     Neon::Vec2f uv;
   };
 
+  // Half the size of Vertex, see VertexPacking. Attribute offsets stay 4 byte aligned, hence the
+  // unused fourth position component.
+  struct PackedVertex
+  {
+    std::uint16_t position[4]; // Normalized within the mesh's bounds.
+    std::int16_t normal[2]; // Octahedral, normalized.
+    std::uint16_t uv[2]; // Half floats.
+  };
+
+  // One level of detail: a range of the index buffer, drawn with the same vertices as every other
+  // level.
+  struct MeshLod
+  {
+    std::uint32_t indexOffset;
+    std::uint32_t indexCount;
+    float error; // Deviation from the full mesh in object space units, see MeshSimplifier.
+  };
+
+  // Vertex and index ranges that are not owned, either a Mesh's own vectors or sections of a
+  // mapped mesh container.
+  struct MeshView
+  {
+    const Vertex* vertices = nullptr;
+    std::size_t vertexCount = 0;
+    const std::uint32_t* indices = nullptr;
+    std::size_t indexCount = 0; // Of every level.
+    const MeshLod* lods = nullptr;
+    std::size_t lodCount = 0;
+
+    // The full mesh's index count, the first level's when there are levels.
+    std::size_t getBaseIndexCount() const { return lodCount ? lods[0].indexCount : indexCount; }
+  };
+
   struct Mesh
   {
     std::vector<Vertex> vertices;
     std::vector<std::uint32_t> indices;
+    // Finest first, see MeshSimplifier::buildLods. Empty when indices is a single level.
+    std::vector<MeshLod> lods;
     static std::unique_ptr<Mesh> buildSphere(double radius = 1.0,
                                              unsigned int hSegments = 32,
                                              unsigned int vSegments = 32);
     static std::unique_ptr<Mesh> buildQuad();
     static std::unique_ptr<Mesh> buildCube();
+    MeshView getView() const { return {vertices.data(), vertices.size(), indices.data(), indices.size(), lods.data(), lods.size()}; }
   };
 
   struct GpuMesh
@@ -35,13 +75,41 @@ namespace Akoylasar
     GLuint ebo;
     GLuint vao;
     GLenum drawMode = 0;
-    GLsizei indexCount = 0;
+    GLsizei indexCount = 0; // Of the full mesh.
+    // Every level of the index buffer, a single one covering it all when the mesh has none.
+    std::vector<MeshLod> lods;
+    // Around the object space bounds, for picking a level by projected size.
+    Neon::Vec3f boundsCenter = Neon::Vec3f(0.0f);
+    float boundsRadius = 0.0f;
+    // Decoding of PackedVertex buffers in the vertex shader: positions are offset + aPos * scale
+    // and normals octahedral. The identity for Vertex buffers.
+    bool quantized = false;
+    Neon::Vec3f positionOffset = Neon::Vec3f(0.0f);
+    Neon::Vec3f positionScale = Neon::Vec3f(1.0f);
+    std::size_t vertexBufferBytes = 0;
     static GpuMesh createGpuMesh(const Mesh& mesh,
                                  GLuint positionAttribuIndex = 0, // layout (location = 0) in shader.
                                  GLuint normalAttribuIndex = 1, // layout (location = 1) in shader.
                                  GLuint uvAttribuIndex = 2); // layout (location = 2) in shader.
+    // Uploads straight from the view's ranges, e.g. a mapped mesh container.
+    static GpuMesh createGpuMesh(const MeshView& mesh,
+                                 GLuint positionAttribuIndex = 0,
+                                 GLuint normalAttribuIndex = 1,
+                                 GLuint uvAttribuIndex = 2);
+    // Vertices from packedVertices instead of the view's, positions quantized within
+    // [boundsMin, boundsMax]. Same attribute locations, with 4 normalized shorts, 2 normalized
+    // shorts and 2 half floats in place of the floats.
+    static GpuMesh createGpuMesh(const MeshView& mesh,
+                                 const PackedVertex* packedVertices,
+                                 const Neon::Vec3f& boundsMin,
+                                 const Neon::Vec3f& boundsMax,
+                                 GLuint positionAttribuIndex = 0,
+                                 GLuint normalAttribuIndex = 1,
+                                 GLuint uvAttribuIndex = 2);
     static void releaseGpuMesh(GpuMesh& gpuMesh);
-    void draw() const;
+    // See MeshSimplifier::selectLod, model being the mesh's column major model matrix.
+    int selectLod(const Camera& camera, const float* model, float viewportHeight, float maxPixelError = 1.0f) const;
+    void draw(int lod = 0) const;
     // @todo(Fouad): Add overload for adding GLB model.
   };
 }
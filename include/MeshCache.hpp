@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include "MappedFile.hpp"
+#include "MeshContainer.hpp"
+
+namespace Akoylasar
+{
+  // Directory of mesh containers, one file per key. Like BakeCache the key covers the source's
+  // contents and every parameter of what was made of it (see getKey), so a stale entry is simply
+  // never asked for again.
+  class MeshCache
+  {
+  public:
+    explicit MeshCache(const std::filesystem::path& directory);
+
+    // Hash of the source bytes (a model file, or nothing for procedural meshes), the parameters
+    // and the version of the code that turns them into a mesh.
+    static std::uint64_t getKey(const void* source, std::size_t sourceSize, const void* parameters, std::size_t parametersSize);
+
+    // On a hit maps the entry into file and points mesh into the mapping, so file must outlive
+    // mesh. Returns false on a miss and on a corrupt entry; the caller falls back to the source.
+    bool load(std::uint64_t key, MappedFile& file, MeshView& mesh, PackedVertices& packed) const;
+    bool store(std::uint64_t key, const MeshView& mesh, const PackedVertices& packed = {}) const;
+
+    std::filesystem::path getEntryPath(std::uint64_t key) const;
+
+  private:
+    std::filesystem::path mDirectory;
+  };
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "MappedFile.hpp"
+#include "Mesh.hpp"
+
+namespace Akoylasar
+{
+  // Compact copy of the vertices in a layout of the writer's choosing, stored next to the float
+  // stream so that a reader can upload whichever it draws with.
+  struct PackedVertices
+  {
+    std::uint32_t format = 0; // 0 when there are none, otherwise up to whoever packed them.
+    std::uint32_t stride = 0;
+    float boundsMin[3] = {0.0f, 0.0f, 0.0f}; // Positions are usually quantized within these.
+    float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+    const std::uint8_t* data = nullptr; // vertexCount * stride bytes.
+  };
+
+  // .pbrmesh files: a fixed header with the counts, the Vertex layout they were written with and
+  // a CacheFile::Section each for the vertices, indices, optional packed vertices and optional
+  // levels of detail, followed by those sections as laid out by CacheFile::writeSections.
+  class MeshContainer
+  {
+  public:
+    static bool write(const std::filesystem::path& path, std::uint64_t key, const MeshView& mesh, const PackedVertices& packed = {});
+
+    // Points mesh and packed into the mapped file after checking the header, the section bounds,
+    // the section hashes, that every index is in range and that the levels of detail are
+    // whole triangles within the index section. Logs the reason and returns false for
+    // anything that does not add up, including a Vertex layout other than this build's.
+    static bool read(const MappedFile& file, std::uint64_t& key, MeshView& mesh, PackedVertices& packed);
+  };
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.hpp"
+
+namespace Akoylasar
+{
+  // Post-transform cache behaviour of an index buffer, simulated as a FIFO.
+  struct VertexCacheStats
+  {
+    std::size_t transformedVertices = 0; // Cache misses, i.e. vertex shader invocations.
+    float acmr = 0.0f; // Transformed vertices per triangle: 3 at worst, about 0.5 for a large regular grid.
+    float atvr = 0.0f; // Transformed vertices per referenced vertex: 1 is ideal.
+  };
+
+  struct MeshOptimizationStats
+  {
+    VertexCacheStats cacheBefore;
+    VertexCacheStats cacheAfter;
+    // Bytes fetched per byte of referenced vertex data: 1 is ideal.
+    float overfetchBefore = 0.0f;
+    float overfetchAfter = 0.0f;
+    std::size_t clusters = 0;
+    double vertexCacheMs = 0.0;
+    double overdrawMs = 0.0;
+    double vertexFetchMs = 0.0;
+  };
+
+  // Reorders a triangle list for the GPU: triangles for the post-transform vertex cache with
+  // Tipsify (Sander, Nehab and Barczak 2007), clusters of them for less overdraw, then vertices
+  // in the order they are first used so that fetches walk the vertex buffer linearly.
+  class MeshOptimizer
+  {
+  public:
+    static constexpr int kDefaultCacheSize = 16;
+
+    static VertexCacheStats analyzeVertexCache(const std::uint32_t* indices,
+                                               std::size_t indexCount,
+                                               std::size_t vertexCount,
+                                               int cacheSize = kDefaultCacheSize);
+    // Behind the post-transform FIFO, fetches go through a small cache of 64 byte lines.
+    static float analyzeVertexFetch(const std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    std::size_t vertexCount,
+                                    std::size_t vertexSize,
+                                    int cacheSize = kDefaultCacheSize);
+
+    // Tipsify in place. When clusters is given it receives the first triangle of every run
+    // that had to restart from an unconnected vertex, where the cache is as good as cold.
+    static void optimizeVertexCache(std::uint32_t* indices,
+                                    std::size_t indexCount,
+                                    std::size_t vertexCount,
+                                    int cacheSize = kDefaultCacheSize,
+                                    std::vector<std::uint32_t>* clusters = nullptr);
+    // Splits the clusters further wherever the cache has warmed up to within threshold of the
+    // cluster's own ACMR, then orders them so that those facing away from the mesh's centre,
+    // which tend to occlude the rest, are drawn first.
+    static void optimizeOverdraw(std::uint32_t* indices,
+                                 std::size_t indexCount,
+                                 const Vertex* vertices,
+                                 std::vector<std::uint32_t>& clusters,
+                                 float threshold = 1.05f,
+                                 int cacheSize = kDefaultCacheSize);
+    // Renumbers vertices in order of first use and drops unreferenced ones.
+    static void optimizeVertexFetch(Mesh& mesh);
+
+    // All three passes, plus the statistics before and after when stats is given.
+    static void optimize(Mesh& mesh, MeshOptimizationStats* stats = nullptr);
+  };
+}
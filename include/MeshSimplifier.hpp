@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Neon.hpp>
+
+#include "Mesh.hpp"
+
+namespace Akoylasar
+{
+  struct LodSettings
+  {
+    int maxLevels = 8; // Including the full mesh.
+    float levelRatio = 0.5f; // Triangles of each level relative to the one before.
+    std::size_t minTriangles = 256; // No level is simplified further than this.
+    float maxError = 0.05f; // Of the coarsest level, relative to the mesh's largest extent.
+  };
+
+  struct LodLevelStats
+  {
+    std::size_t triangles = 0;
+    float error = 0.0f; // As in MeshLod.
+    int passes = 0;
+    double ms = 0.0;
+  };
+
+  // Quadric error metric simplification (Garland and Heckbert 1997) by half edge collapses: a
+  // vertex is only ever moved onto one of its neighbours, so every level indexes the vertices of
+  // the full mesh and all of them share one vertex buffer.
+  //
+  // Vertices sharing a position are treated as one. Where their attributes differ, along a
+  // texcoord or normal seam, the pair on either side moves along the seam together; open borders
+  // only collapse along themselves, and anything with more than two attribute sets, or that is
+  // otherwise not a simple surface, stays where it is.
+  class MeshSimplifier
+  {
+  public:
+    // Down to targetIndexCount indices if that is possible without deviating by more than
+    // maxError, in object space units. error receives the largest deviation of any collapse, as
+    // the square root of its area weighted mean squared distance to the planes it merged.
+    static std::vector<std::uint32_t> simplify(const Vertex* vertices,
+                                               std::size_t vertexCount,
+                                               const std::uint32_t* indices,
+                                               std::size_t indexCount,
+                                               std::size_t targetIndexCount,
+                                               float maxError,
+                                               float* error = nullptr,
+                                               int* passes = nullptr);
+
+    // Appends the coarser levels to mesh.indices, each simplified from the one before and
+    // reordered for the vertex cache, and fills in mesh.lods. Errors add up along the chain.
+    // Expects mesh.indices to be a single level.
+    static void buildLods(Mesh& mesh, const LodSettings& settings = {}, std::vector<LodLevelStats>* stats = nullptr);
+
+    // The coarsest of lods whose error projects to at most maxPixelError pixels at the distance
+    // of the bounding sphere from cameraOrigin. The sphere and the errors go through model, a
+    // column major 4x4 matrix as uploaded to GL, whose largest axis scale stands in for all
+    // three. projectionScale is the projection's y scale, cot(fovy / 2). Level 0 from inside the
+    // sphere.
+    static int selectLod(const MeshLod* lods,
+                         std::size_t lodCount,
+                         const Neon::Vec3f& boundsCenter,
+                         float boundsRadius,
+                         const float* model,
+                         const Neon::Vec3f& cameraOrigin,
+                         float projectionScale,
+                         float viewportHeight,
+                         float maxPixelError);
+  };
+}
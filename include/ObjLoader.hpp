@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+#include "Mesh.hpp"
+
+namespace Akoylasar
+{
+  struct ObjLoadStats
+  {
+    std::size_t fileBytes = 0;
+    int threads = 0;
+    double parseMs = 0.0;
+    double dedupMs = 0.0; // Corner merging and vertex assembly.
+    double normalsMs = 0.0; // Zero when every corner came with a normal.
+    std::size_t corners = 0; // After triangulation, one per index.
+    std::size_t vertices = 0;
+    std::size_t hashCapacity = 0; // Slots the dedup table ended up with.
+  };
+
+  // Wavefront OBJ geometry. Materials, groups and vertex colours are ignored.
+  class ObjLoader
+  {
+  public:
+    // Parses path over a mapping of the file with tinyobj's multithreaded parser, on threads
+    // threads or every core when <= 0. Faces are fan triangulated, and corners that reference
+    // the same position, texcoord and normal become one Vertex. Corners without a normal get
+    // the area weighted average of the faces around their vertex, ones without a texcoord get
+    // zero. Texcoords are flipped to the top down convention of the built in meshes. Returns
+    // null and logs on failure.
+    static std::unique_ptr<Mesh> load(const std::filesystem::path& path, int threads = 0, ObjLoadStats* stats = nullptr);
+  };
+}
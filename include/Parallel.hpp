@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace Akoylasar
+{
+  class JobSystem;
+
+  class Parallel
+  {
+  public:
+    // Number of hardware threads.
+    static unsigned int getThreadCount();
+
+    // The job system forRange spreads its chunks over. Without one forRange runs serially on
+    // the calling thread. Must outlive every forRange call made while it is set.
+    static void setJobSystem(JobSystem* jobs);
+
+    // Splits [0, count) into contiguous chunks of at least grainSize items and calls
+    // body(begin, end) for each of them, on the job system's workers and the calling thread.
+    // Blocks until every chunk is done. Safe to call from inside a job.
+    static void forRange(std::size_t count,
+                         std::size_t grainSize,
+                         const std::function<void(std::size_t, std::size_t)>& body);
+  };
+}
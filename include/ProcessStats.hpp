@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+
+namespace Akoylasar
+{
+  class ProcessStats
+  {
+  public:
+    // High water mark of the process' resident set, in bytes. 0 where unsupported.
+    static std::size_t getPeakResidentBytes();
+  };
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <Neon.hpp>
+
+namespace Akoylasar
+{
+  // A small, very bright disc taken out of a panorama and drawn analytically instead, so that
+  // what is left is smooth enough to bake at a lower resolution and with few samples.
+  struct SunLight
+  {
+    Neon::Vec3f direction = Neon::Vec3f(0.0f, 1.0f, 0.0f); // Normalized, towards the sun.
+    Neon::Vec3f irradiance = Neon::Vec3f(0.0f); // On a surface facing the sun.
+    float solidAngle = 0.0f; // Of the disc, zero when there is no sun.
+
+    bool isEmpty() const { return solidAngle <= 0.0f; }
+    // Cosine of the disc's angular radius.
+    float getCosRadius() const;
+    // Mean over the disc.
+    Neon::Vec3f getRadiance() const;
+  };
+
+  struct SunExtractionSettings
+  {
+    // The brightest texel has to be at least this many times the panorama's mean luminance.
+    float minPeakRatio = 100.0f;
+    // Texels connected to the brightest one belong to the sun while they are at least this
+    // fraction of its luminance, which takes in the core of the glow around the disc.
+    float threshold = 0.01f;
+    // Anything larger is a bright patch of sky rather than a sun, and is left in the panorama.
+    float maxSolidAngle = 0.01f;
+  };
+
+  class SunExtractor
+  {
+  public:
+    // Finds the brightest texel of the panorama, grows the region of texels around it that
+    // pass settings.threshold, and replaces each of them by the mean of the texels bordering
+    // the region, per channel and never brightening one. What was taken out, weighted by solid
+    // angle, becomes sun: its irradiance, its luminance weighted direction and the region's
+    // solid angle. texels are width x height RGB floats, rows bottom to top like EquirectImage,
+    // and are left untouched when no sun is found.
+    static bool extract(float* texels, int width, int height, const SunExtractionSettings& settings, SunLight& sun);
+  };
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <GL/gl3w.h>
+
+namespace Akoylasar
+{
+  // Streams half float or block compressed texel data into existing textures over several
+  // frames. Every update copies whole rows (block rows for compressed formats) into a ring of
+  // pixel buffer objects, up to a byte budget, and issues glTexSubImage2D from them, so the
+  // driver can DMA the data while the frame carries on.
+  // A fence per staging buffer keeps it from being overwritten before the GPU has read it.
+  class TextureUploader
+  {
+  public:
+    struct Stats
+    {
+      std::size_t bytes = 0;
+      std::size_t chunks = 0;
+      int frames = 0; // Updates that copied anything.
+      int stalls = 0; // Updates cut short because every staging buffer was still in flight.
+    };
+
+    // Needs a current GL context.
+    TextureUploader(std::size_t stagingBufferSize, int stagingBufferCount);
+    ~TextureUploader();
+    TextureUploader(const TextureUploader&) = delete;
+    TextureUploader& operator=(const TextureUploader&) = delete;
+
+    // The texture level must already have storage; texels are only read during later updates
+    // and have to stay valid until isIdle returns true. bindTarget is GL_TEXTURE_2D or
+    // GL_TEXTURE_CUBE_MAP, imageTarget the 2D target or the cube face.
+    void enqueue(GLuint texture,
+                 GLenum bindTarget,
+                 GLenum imageTarget,
+                 GLint level,
+                 int width,
+                 int height,
+                 GLenum format,
+                 const std::uint16_t* texels);
+
+    // Same for a level allocated with glCompressedTexImage2D: blocks holds block rows of 4
+    // texel rows each, bottom to top, in internalFormat's layout with blockBytes per 4x4 block.
+    void enqueueCompressed(GLuint texture,
+                           GLenum bindTarget,
+                           GLenum imageTarget,
+                           GLint level,
+                           int width,
+                           int height,
+                           GLenum internalFormat,
+                           std::size_t blockBytes,
+                           const std::uint8_t* blocks);
+
+    // Copies up to byteBudget bytes, though always at least one chunk so that rows larger
+    // than the budget still make progress. Returns the number of bytes copied.
+    std::size_t update(std::size_t byteBudget);
+
+    // True once nothing is queued and the GPU has consumed every staging buffer.
+    bool isIdle();
+
+    const Stats& getStats() const { return mStats; }
+
+  private:
+    struct Request
+    {
+      GLuint texture;
+      GLenum bindTarget;
+      GLenum imageTarget;
+      GLint level;
+      int width;
+      int height;
+      GLenum format; // The internal format for compressed requests.
+      bool compressed;
+      const std::uint8_t* data;
+      std::size_t rowSize;
+      int rowCount; // Texel rows, or block rows when compressed.
+      int nextRow;
+    };
+
+    struct StagingBuffer
+    {
+      GLuint buffer = 0;
+      std::size_t size = 0;
+      GLsync fence = nullptr;
+    };
+
+    bool isAvailable(StagingBuffer& staging);
+
+  private:
+    std::deque<Request> mRequests;
+    std::vector<StagingBuffer> mStagingBuffers;
+    std::size_t mNextStagingBuffer = 0;
+    Stats mStats;
+  };
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <Neon.hpp>
+
+#include "Mesh.hpp"
+
+namespace Akoylasar
+{
+  // Conversions between Vertex and PackedVertex, 32 and 16 bytes. Positions keep 16 bits per
+  // axis within the mesh's bounds, about 0.05mm on a 3m model; normals keep 16 bits per
+  // octahedral coordinate, under a hundredth of a degree; texcoords are half floats.
+  class VertexPacking
+  {
+  public:
+    // PackedVertices::format of PackedVertex streams in mesh containers.
+    static constexpr std::uint32_t kFormat = 1;
+
+    static void getBounds(const Vertex* vertices, std::size_t count, Neon::Vec3f& boundsMin, Neon::Vec3f& boundsMax);
+    // Split across all cores for large meshes.
+    static void pack(const Vertex* input,
+                     std::size_t count,
+                     const Neon::Vec3f& boundsMin,
+                     const Neon::Vec3f& boundsMax,
+                     PackedVertex* output);
+    // What the vertex shader reconstructs, with the normal renormalized.
+    static Vertex unpack(const PackedVertex& packed, const Neon::Vec3f& boundsMin, const Neon::Vec3f& boundsMax);
+
+    // Unit vector onto the octahedron, the lower half folded over the upper, in [-1, 1]^2 as
+    // normalized shorts. Rounds to whichever of the four nearest encodings decodes closest.
+    static void encodeOctahedral(const Neon::Vec3f& normal, std::int16_t* encoded);
+    static Neon::Vec3f decodeOctahedral(const std::int16_t* encoded);
+  };
+}
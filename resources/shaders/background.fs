@@ -1,35 +1,39 @@
 #version 410 core
 
+#define PI 3.1415926535
+
 in vec3 vPos;
 in vec3 vNormal;
 in vec2 vUv;
 
 out vec4 FragColor;
 
-uniform sampler2D sBackground;
-
-vec2 cartesianToSpherical(vec3 p)
-{
-  return vec2(atan(p.z, p.x), asin(p.y));
-}
+uniform samplerCube sBackground;
+uniform sampler2D sBackgroundOctahedral;
+uniform bool uOctahedral;
+// See ibl.fs.
+uniform vec3 uSunDirection;
+uniform vec3 uSunIrradiance;
+uniform float uSunCosRadius;
 
-vec2 shpericalToUvSpace(vec2 p)
+// See IBLBaker::getOctahedralUv.
+vec2 octahedralUv(vec3 d)
 {
-  // spherical to -1, 1 range.
-  const vec2 s = vec2(0.3183, 0.6366); // 1 / (pi), 1 / (pi / 2)
-  vec2 uv = 0.5 * p * s;
-
-  // to UV
-  uv += 0.5;
-  return uv;
+  vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.y < 0.0)
+  {
+    vec2 signs = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    p = (1.0 - abs(p.yx)) * signs;
+  }
+  return p * 0.5 + 0.5;
 }
 
 void main()
 {
-  vec3 diraction = normalize(vPos);
-  vec2 uv = shpericalToUvSpace(cartesianToSpherical(diraction));
-
-  vec3 color = texture(sBackground, uv).rgb;
+  vec3 color = uOctahedral ? textureLod(sBackgroundOctahedral, octahedralUv(vPos), 0.0).rgb : textureLod(sBackground, vPos, 0.0).rgb;
+  // The disc at its mean radiance.
+  if (dot(normalize(vPos), uSunDirection) >= uSunCosRadius)
+    color += uSunIrradiance / max(2.0 * PI * (1.0 - uSunCosRadius), 1e-8);
   
   // Tone-mapping
   color = color / (vec3(1.0) + color);
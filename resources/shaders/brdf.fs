@@ -94,6 +94,7 @@ vec2 IntegrateBRDF(float NoV, float roughness)
 
 void main()
 {
-  vec2 brdf = IntegrateBRDF(vUv.x, vUv.y);
+  // The quad has v = 0 at the top, flip it so that t = roughness as sampled by ibl.fs.
+  vec2 brdf = IntegrateBRDF(vUv.x, 1.0 - vUv.y);
   FragColor = vec4(brdf.x, brdf.y, 0.0, 1.0);
 }
\ No newline at end of file
@@ -16,14 +16,92 @@ uniform float uAo;
 uniform vec3 uCameraPos;
 
 uniform samplerCube sIrradianceMap;
+// Irradiance / pi in L2 spherical harmonics, see IBLBaker::convolveIrradiance.
+uniform vec3 uIrradianceSh[9];
+uniform bool uUseIrradianceSh;
 uniform samplerCube sPrefilterMap;
+// Octahedral alternatives to the cubemaps above, see IBLBaker::getOctahedralUv.
+uniform sampler2D sIrradianceOctahedralMap;
+uniform sampler2D sPrefilterOctahedralMap;
+uniform bool uIrradianceOctahedral;
+uniform bool uPrefilterOctahedral;
 uniform sampler2D sBrdf;
+// Range of maps stored as RGBM (HdrPacking::packRgbm), zero for every other storage.
+uniform float uIrradianceRgbmRange;
+uniform float uPrefilterRgbmRange;
+// Sun taken out of the environment at load time, see SunExtractor::extract. Zero irradiance
+// when there is none.
+uniform vec3 uSunDirection;
+uniform vec3 uSunIrradiance;
+uniform float uSunCosRadius;
 
 vec3 fresnelSchlick(float cosTheta, vec3 F0, float roughness)
 {
   return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(max(1.0 - cosTheta, 0.0), 5.0);
 }
 
+vec3 decodeRgbm(vec4 texel, float range)
+{
+  return range > 0.0 ? texel.rgb * (texel.a * range) : texel.rgb;
+}
+
+vec2 octahedralUv(vec3 d)
+{
+  vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.y < 0.0)
+  {
+    vec2 signs = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    p = (1.0 - abs(p.yx)) * signs;
+  }
+  return p * 0.5 + 0.5;
+}
+
+float distributionGgx(float NdotH, float a)
+{
+  float a2 = a * a;
+  float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+  return a2 / (PI * d * d);
+}
+
+float geometrySmith(float NdotV, float NdotL, float roughness)
+{
+  // Schlick-GGX with the k of analytic lights.
+  float k = (roughness + 1.0) * (roughness + 1.0) / 8.0;
+  return NdotV / (NdotV * (1.0 - k) + k) * NdotL / (NdotL * (1.0 - k) + k);
+}
+
+// Cook-Torrance for the sun as a directional light. Its disc is folded into the GGX lobe by
+// widening alpha by half its angular radius, how far the half vector moves across it, which
+// keeps the highlight's energy and gives a smooth surface a sun sized one rather than a point.
+vec3 shadeSun(vec3 N, vec3 V, vec3 F0)
+{
+  vec3 L = uSunDirection;
+  float NdotL = dot(N, L);
+  if (NdotL <= 0.0)
+    return vec3(0.0);
+  float NdotV = max(dot(N, V), 1e-4);
+  vec3 H = normalize(V + L);
+  float a = uRoughness * uRoughness;
+  float sunA = sqrt(a * a + 0.25 * (1.0 - uSunCosRadius * uSunCosRadius));
+  vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0, 0.0);
+  vec3 specular = distributionGgx(max(dot(N, H), 0.0), sunA) * geometrySmith(NdotV, NdotL, uRoughness) * F / (4.0 * NdotV);
+  vec3 diffuse = (1.0 - F) * (1.0 - uMetallic) * uAlbedo / PI;
+  return (diffuse * NdotL + specular) * uSunIrradiance;
+}
+
+vec3 evaluateSh(vec3 n)
+{
+  return uIrradianceSh[0] * 0.282095
+       + uIrradianceSh[1] * (0.488603 * n.y)
+       + uIrradianceSh[2] * (0.488603 * n.z)
+       + uIrradianceSh[3] * (0.488603 * n.x)
+       + uIrradianceSh[4] * (1.092548 * n.x * n.z)
+       + uIrradianceSh[5] * (1.092548 * n.y * n.z)
+       + uIrradianceSh[6] * (0.315392 * (3.0 * n.y * n.y - 1.0))
+       + uIrradianceSh[7] * (1.092548 * n.x * n.y)
+       + uIrradianceSh[8] * (0.546274 * (n.x * n.x - n.z * n.z));
+}
+
 void main()
 {
   vec3 F0 = vec3(0.04); // Good approx for dielectrics.
@@ -37,15 +115,19 @@ void main()
   kD *= 1.0 - uMetallic;
 
   // Diffuse term.
-  vec3 irradiance = texture(sIrradianceMap, N).rgb;
+  // Explicit lods on the octahedral maps, derivatives are meaningless across the folds.
+  vec4 irradianceTexel = uIrradianceOctahedral ? textureLod(sIrradianceOctahedralMap, octahedralUv(N), 0.0) : texture(sIrradianceMap, N);
+  vec3 irradiance = uUseIrradianceSh ? max(evaluateSh(N), 0.0) : decodeRgbm(irradianceTexel, uIrradianceRgbmRange);
   vec3 diffuse = kD * uAlbedo * irradiance;
 
   // Specular term.
-  vec3 prefilter = textureLod(sPrefilterMap, R, uRoughness * MAX_PREFILTER_MIP).rgb;
+  float prefilterLod = uRoughness * MAX_PREFILTER_MIP;
+  vec4 prefilterTexel = uPrefilterOctahedral ? textureLod(sPrefilterOctahedralMap, octahedralUv(R), prefilterLod) : textureLod(sPrefilterMap, R, prefilterLod);
+  vec3 prefilter = decodeRgbm(prefilterTexel, uPrefilterRgbmRange);
   vec2 brdf = texture(sBrdf, vec2(max(dot(N, V), 0.0), uRoughness)).rg;
   vec3 specular = prefilter * (kS * brdf.x + brdf.y);
 
-  vec3 color = (diffuse + specular) * uAo;
+  vec3 color = (diffuse + specular) * uAo + shadeSun(N, V, F0);
 
   // Tone-mapping
   color = color / (vec3(1.0) + color);
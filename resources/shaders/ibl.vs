@@ -12,9 +12,26 @@ layout (std140) uniform ubMatrices
   mat4 uView;
 };
 
+// PackedVertex meshes, see GpuMesh: positions in [0, 1] within the mesh's bounds and
+// octahedral normals in aNormal.xy. Offset 0, scale 1 and false for float vertices.
+uniform vec3 uPositionOffset;
+uniform vec3 uPositionScale;
+uniform bool uOctahedralNormals;
+
+// Same as VertexPacking::decodeOctahedral.
+vec3 decodeOctahedralNormal(vec2 encoded)
+{
+  vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  float fold = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -fold : fold;
+  n.y += n.y >= 0.0 ? -fold : fold;
+  return normalize(n);
+}
+
 void main()
 {
-  vPos = aPos.xyz;
-  vNormal = aNormal;
-  gl_Position =  uProjection * uView * vec4(aPos, 1.0f);
-}
\ No newline at end of file
+  vec3 position = uPositionOffset + aPos * uPositionScale;
+  vPos = position;
+  vNormal = uOctahedralNormals ? decodeOctahedralNormal(aNormal.xy) : aNormal;
+  gl_Position =  uProjection * uView * vec4(position, 1.0f);
+}
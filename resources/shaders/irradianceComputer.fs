@@ -9,22 +9,20 @@ out vec4 FragColor;
 #define PI 3.141592653589793
 #define HALF_PI PI * 0.5
 
-uniform sampler2D sBackground;
+uniform samplerCube sBackground;
+uniform sampler2D sBackgroundOctahedral;
+uniform bool uOctahedralSource;
 
-vec2 cartesianToSpherical(vec3 p)
+// See IBLBaker::getOctahedralUv.
+vec2 octahedralUv(vec3 d)
 {
-  return vec2(atan(p.z, p.x), asin(p.y));
-}
-
-vec2 shpericalToUvSpace(vec2 p)
-{
-  // spherical to -1, 1 range.
-  const vec2 s = vec2(0.3183, 0.6366); // 1 / (pi), 1 / (pi / 2)
-  vec2 uv = 0.5 * p * s;
-
-  // to UV
-  uv += 0.5;
-  return uv;
+  vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.y < 0.0)
+  {
+    vec2 signs = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    p = (1.0 - abs(p.yx)) * signs;
+  }
+  return p * 0.5 + 0.5;
 }
 
 void main()
@@ -44,8 +42,8 @@ void main()
       {
         vec3 sampl = vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
         vec3 wi = sampl.x * right + sampl.y * up + sampl.z * N; 
-        vec2 wiPolar = shpericalToUvSpace(cartesianToSpherical(normalize(wi)));
-        Lo += texture(sBackground, wiPolar).rgb * cos(theta) * sin(theta);
+        vec3 color = uOctahedralSource ? textureLod(sBackgroundOctahedral, octahedralUv(wi), 0.0).rgb : textureLod(sBackground, wi, 0.0).rgb;
+        Lo += color * cos(theta) * sin(theta);
         numSamples++;
       }
   }
@@ -9,13 +9,15 @@ out vec4 FragColor;
 #define PI 3.141592653589793
 #define HALF_PI PI * 0.5
 
-uniform sampler2D sBackground;
+uniform samplerCube sBackground;
+// The source is read from sBackgroundOctahedral instead when it is an octahedral map.
+uniform sampler2D sBackgroundOctahedral;
+uniform bool uOctahedralSource;
 uniform float uRoughness;
-
-vec2 cartesianToSpherical(vec3 p)
-{
-  return vec2(atan(p.z, p.x), asin(p.y));
-}
+uniform int uNumSamples;
+// Filtered importance sampling: read the source mip matching each sample's solid angle.
+uniform bool uFilteredSampling;
+uniform float uSourceTexelSolidAngle; // Solid angle of a mip 0 texel where L lies on an axis.
 
 // http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
 // efficient VanDerCorpus calculation.
@@ -56,15 +58,23 @@ vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness)
   return normalize(sampleVec);
 }
 
-vec2 shpericalToUvSpace(vec2 p)
+// See IBLBaker::getOctahedralUv.
+vec2 octahedralUv(vec3 d)
 {
-  // spherical to -1, 1 range.
-  const vec2 s = vec2(0.3183, 0.6366); // 1 / (pi), 1 / (pi / 2)
-  vec2 uv = 0.5 * p * s;
+  vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.y < 0.0)
+  {
+    vec2 signs = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+    p = (1.0 - abs(p.yx)) * signs;
+  }
+  return p * 0.5 + 0.5;
+}
 
-  // to UV
-  uv += 0.5;
-  return uv;
+float D_GGX(float NoH, float a)
+{
+  float a2 = a * a;
+  float d = NoH * NoH * (a2 - 1.0) + 1.0;
+  return a2 / (PI * d * d);
 }
 
 void main()
@@ -74,21 +84,35 @@ void main()
   vec3 R = N;
   vec3 V = R;
 
-  const uint NumSamples = 2048;
   vec3 prefilteredColor = vec3(0.0);
   float totalWeight = 0.0;
+  float a = uRoughness * uRoughness;
   
-  for(uint i = 0; i < NumSamples; ++i)
+  uint numSamples = uint(uNumSamples);
+  for(uint i = 0; i < numSamples; ++i)
   {
-    vec2 Xi = Hammersley(i, NumSamples);
+    vec2 Xi = Hammersley(i, numSamples);
     vec3 H = ImportanceSampleGGX(Xi, N, uRoughness);
     vec3 L = normalize(2.0 * dot(V, H) * H - V);
 
     float NdotL = max(dot(N, L), 0.0);
     if(NdotL > 0.0)
     {
-      vec2 LPolar = shpericalToUvSpace(cartesianToSpherical(L));
-      prefilteredColor += texture(sBackground, LPolar).rgb * NdotL;
+      float lod = 0.0;
+      if (uFilteredSampling && a > 0.0)
+      {
+        // pdf(L) = D * NoH / (4 * VoH) = D / 4 as N = V. Cube texels shrink with the cube of
+        // the largest component of L towards the face edges, octahedral texels grow with the
+        // cube of the sum of its components away from the axes.
+        float pdf = D_GGX(dot(N, H), a) * 0.25;
+        float sampleSolidAngle = 1.0 / (float(numSamples) * pdf);
+        vec3 absL = abs(L);
+        float scale = uOctahedralSource ? absL.x + absL.y + absL.z : max(absL.x, max(absL.y, absL.z));
+        float texelSolidAngle = uSourceTexelSolidAngle * scale * scale * scale;
+        lod = max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+      }
+      vec3 color = uOctahedralSource ? textureLod(sBackgroundOctahedral, octahedralUv(L), lod).rgb : textureLod(sBackground, L, lod).rgb;
+      prefilteredColor += color * NdotL;
       totalWeight += NdotL;
     }
   }
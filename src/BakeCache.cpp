@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "BakeCache.hpp"
+
+#include <cstring>
+
+#include "CacheFile.hpp"
+
+namespace Akoylasar
+{
+  BakeCache::BakeCache(const std::filesystem::path& directory)
+  : mDirectory(directory)
+  {}
+
+  std::uint64_t BakeCache::hash(const void* data, std::size_t size, std::uint64_t seed)
+  {
+    constexpr std::uint64_t kPrime = 0x100000001b3ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t result = seed;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+      std::uint64_t word;
+      std::memcpy(&word, bytes + i, sizeof(word));
+      result = (result ^ word) * kPrime;
+      result ^= result >> 29;
+    }
+    for (; i < size; ++i)
+    {
+      result ^= bytes[i];
+      result *= kPrime;
+    }
+    return result;
+  }
+
+  std::filesystem::path BakeCache::getEntryPath(std::uint64_t key) const
+  {
+    return CacheFile::getEntryPath(mDirectory, key, ".pbrenv");
+  }
+
+  bool BakeCache::load(std::uint64_t key, MappedFile& file, EnvironmentView& output) const
+  {
+    return CacheFile::load(getEntryPath(key), key, "Bake cache", file, [&output](const MappedFile& mapped, std::uint64_t& storedKey)
+    {
+      return EnvironmentContainer::read(mapped, storedKey, output);
+    });
+  }
+
+  bool BakeCache::store(std::uint64_t key, const EnvironmentView& data) const
+  {
+    return CacheFile::store(getEntryPath(key), "Bake cache", [key, &data](const std::filesystem::path& path)
+    {
+      return EnvironmentContainer::write(path, key, data);
+    });
+  }
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "BakeScheduler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "Common.hpp"
+#include "Debug.hpp"
+
+namespace
+{
+  // Small enough that a tile of the most expensive mip stays well under a millisecond on
+  // integrated GPUs, large enough to keep the draw call count reasonable.
+  constexpr int kTileSize = 32;
+  constexpr int kNumCubeMapFaces = 6;
+}
+
+namespace Akoylasar
+{
+  BakeScheduler::BakeScheduler(const GpuMesh& cubeMesh)
+  : mCubeMesh(cubeMesh)
+  {
+    for (auto& timer : mTimers)
+      CHECK_GL_ERROR(glGenQueries(1, &timer.query));
+  }
+
+  BakeScheduler::~BakeScheduler()
+  {
+    releaseTargets();
+    for (auto& timer : mTimers)
+      CHECK_GL_ERROR(glDeleteQueries(1, &timer.query));
+  }
+
+  bool BakeScheduler::start(GLuint sourceTexture, MapLayout sourceLayout, GLuint outputTexture, const PrefilterSettings& settings)
+  {
+    if (!mProgram)
+    {
+      ProgramInfo prefilterProgramInfo {std::make_pair("shaders/passThrough.vs", ""), std::make_pair("shaders/prefilterEnvMap.fs", "")};
+      for (auto& pair : prefilterProgramInfo)
+      {
+        auto& path = pair.first;
+        auto& str = pair.second;
+        if (Common::readToString(path, str))
+        {
+          std::cerr << "Failed to load shader with path " << path << std::endl;
+          return false;
+        }
+      }
+      mProgram = std::make_unique<ShaderProgram>(prefilterProgramInfo.at(0).second, prefilterProgramInfo.at(1).second);
+    }
+
+    // Drop whatever was left of the previous bake, its timings included.
+    readTimers(true);
+    releaseTargets();
+    mSourceTexture = sourceTexture;
+    mSourceLayout = sourceLayout;
+    mOutputTexture = outputTexture;
+    mSettings = settings;
+    mSettings.layout = MapLayout::CubeMap;
+    mJobs.clear();
+    mNextJob = 0;
+    mStats = Stats();
+
+    // Every mip is split into tiles, one job per tile of every face.
+    mMipSamples.resize(settings.mipLevels);
+    for (int mip = 0; mip < settings.mipLevels; ++mip)
+    {
+      const int size = settings.size >> mip;
+      const float roughness = mip / float(settings.mipLevels - 1);
+      mMipSamples[mip] = IBLBaker::getPrefilterSampleCount(roughness, size, mSettings);
+      for (int face = 0; face < kNumCubeMapFaces; ++face)
+        for (int y = 0; y < size; y += kTileSize)
+          for (int x = 0; x < size; x += kTileSize)
+            mJobs.push_back({face, mip, x, y, std::min(kTileSize, size - x), std::min(kTileSize, size - y)});
+    }
+
+    CHECK_GL_ERROR(glGenFramebuffers(1, &mFbo));
+    CHECK_GL_ERROR(glGenRenderbuffers(1, &mDepthRbo));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+    CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, mDepthRbo));
+    CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, settings.size, settings.size));
+    CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mDepthRbo));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+    // Uniforms shared by every job.
+    GLint sourceSize;
+    const bool octahedralSource = sourceLayout == MapLayout::Octahedral;
+    CHECK_GL_ERROR(glBindTexture(octahedralSource ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP, sourceTexture));
+    CHECK_GL_ERROR(glGetTexLevelParameteriv(octahedralSource ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &sourceSize));
+    mProgram->use();
+    // Both samplers need a unit of their own even though only one of them is read.
+    mProgram->setIntUniform(mProgram->getUniformLocation("sBackground"), 0);
+    mProgram->setIntUniform(mProgram->getUniformLocation("sBackgroundOctahedral"), 1);
+    mProgram->setIntUniform(mProgram->getUniformLocation("uOctahedralSource"), octahedralSource);
+    mProgram->setIntUniform(mProgram->getUniformLocation("uFilteredSampling"), settings.mode == PrefilterMode::FilteredImportanceSampling);
+    mProgram->setFloatUniform(mProgram->getUniformLocation("uSourceTexelSolidAngle"), float(IBLBaker::getMapTexelSolidAngle(sourceLayout, sourceSize)));
+    mProgram->setMat4fUniform(mProgram->getUniformLocation("uProjection"), getCubeMapFaceProjection());
+    return true;
+  }
+
+  void BakeScheduler::update(double budgetMs)
+  {
+    readTimers(false);
+    if (mNextJob == mJobs.size())
+      return;
+
+    // Without a measurement yet, issue a single job to get one.
+    std::size_t count = 1;
+    if (mMsPerSample > 0.0)
+    {
+      double estimatedMs = getJobSamples(mJobs[mNextJob]) * mMsPerSample;
+      while (mNextJob + count < mJobs.size())
+      {
+        const double jobMs = getJobSamples(mJobs[mNextJob + count]) * mMsPerSample;
+        if (estimatedMs + jobMs > budgetMs)
+          break;
+        estimatedMs += jobMs;
+        ++count;
+      }
+    }
+    issue(count);
+  }
+
+  void BakeScheduler::finish()
+  {
+    if (mNextJob < mJobs.size())
+      issue(mJobs.size() - mNextJob);
+    readTimers(true);
+  }
+
+  bool BakeScheduler::isBusy() const
+  {
+    if (mNextJob < mJobs.size())
+      return true;
+    for (const auto& timer : mTimers)
+      if (timer.pending)
+        return true;
+    return false;
+  }
+
+  float BakeScheduler::getProgress() const
+  {
+    return mJobs.empty() ? 1.0f : float(mNextJob) / mJobs.size();
+  }
+
+  const std::array<Neon::Mat4f, 6>& BakeScheduler::getCubeMapFaceViews()
+  {
+    static const std::array<Neon::Mat4f, kNumCubeMapFaces> views
+    {
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(1.0f,  0.0f,  0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f)), // origin, look at, up
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(-1.0f, 0.0f,  0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f)),
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  1.0f,  0.0f), Neon::Vec3f(0.0f,  0.0f,  1.0f)),
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f), Neon::Vec3f(0.0f,  0.0f, -1.0f)),
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  0.0f,  1.0f), Neon::Vec3f(0.0f, -1.0f,  0.0)),
+      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  0.0f, -1.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f))
+    };
+    return views;
+  }
+
+  const Neon::Mat4f& BakeScheduler::getCubeMapFaceProjection()
+  {
+    static const Neon::Mat4f projection = Neon::makePerspective((float)Neon::kPi / 2.0f, 1.0f, 0.1f, 2.0f);
+    return projection;
+  }
+
+  void BakeScheduler::issue(std::size_t jobCount)
+  {
+    GLint viewPort[4];
+    CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewPort));
+
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+    CHECK_GL_ERROR(glEnable(GL_SCISSOR_TEST));
+    const bool octahedralSource = mSourceLayout == MapLayout::Octahedral;
+    CHECK_GL_ERROR(glActiveTexture(octahedralSource ? GL_TEXTURE1 : GL_TEXTURE0));
+    CHECK_GL_ERROR(glBindTexture(octahedralSource ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP, mSourceTexture));
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+    mProgram->use();
+    const GLint viewLoc = mProgram->getUniformLocation("uView");
+    const GLint roughnessLoc = mProgram->getUniformLocation("uRoughness");
+    const GLint numSamplesLoc = mProgram->getUniformLocation("uNumSamples");
+
+    // Time the batch unless every query is still waiting for its result.
+    TimerQuery& timer = mTimers[mNextTimer];
+    const bool timed = !timer.pending;
+    if (timed)
+      CHECK_GL_ERROR(glBeginQuery(GL_TIME_ELAPSED, timer.query));
+
+    double samples = 0.0;
+    int currentMip = -1;
+    for (const std::size_t end = mNextJob + jobCount; mNextJob < end; ++mNextJob)
+    {
+      const Job& job = mJobs[mNextJob];
+      const int size = mSettings.size >> job.mip;
+      if (job.mip != currentMip)
+      {
+        currentMip = job.mip;
+        mProgram->setFloatUniform(roughnessLoc, job.mip / float(mSettings.mipLevels - 1));
+        mProgram->setIntUniform(numSamplesLoc, mMipSamples[job.mip]);
+        CHECK_GL_ERROR(glViewport(0, 0, size, size));
+      }
+      mProgram->setMat4fUniform(viewLoc, getCubeMapFaceViews()[job.face]);
+      CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + job.face, mOutputTexture, job.mip));
+      // The scissor restricts the clear as well as the draw to this tile.
+      CHECK_GL_ERROR(glScissor(job.x, job.y, job.width, job.height));
+      CHECK_GL_ERROR(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+      mCubeMesh.draw();
+      samples += getJobSamples(job);
+    }
+
+    if (timed)
+    {
+      CHECK_GL_ERROR(glEndQuery(GL_TIME_ELAPSED));
+      timer.samples = samples;
+      timer.pending = true;
+      mNextTimer = (mNextTimer + 1) % mTimers.size();
+    }
+
+    CHECK_GL_ERROR(glDisable(GL_SCISSOR_TEST));
+    CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    CHECK_GL_ERROR(glViewport(viewPort[0], viewPort[1], viewPort[2], viewPort[3]));
+
+    mStats.jobs += int(jobCount);
+    ++mStats.frames;
+    if (mNextJob == mJobs.size())
+      releaseTargets();
+  }
+
+  void BakeScheduler::readTimers(bool wait)
+  {
+    for (auto& timer : mTimers)
+    {
+      if (!timer.pending)
+        continue;
+      if (!wait)
+      {
+        GLint available = 0;
+        CHECK_GL_ERROR(glGetQueryObjectiv(timer.query, GL_QUERY_RESULT_AVAILABLE, &available));
+        if (!available)
+          continue;
+      }
+      GLuint64 elapsedNs = 0;
+      CHECK_GL_ERROR(glGetQueryObjectui64v(timer.query, GL_QUERY_RESULT, &elapsedNs));
+      timer.pending = false;
+
+      const double ms = elapsedNs * 1e-6;
+      mStats.gpuMs += ms;
+      mStats.worstBatchGpuMs = std::max(mStats.worstBatchGpuMs, ms);
+      // Smooth the estimate a little, batches of different mips do not cost exactly the same per sample.
+      const double msPerSample = ms / std::max(timer.samples, 1.0);
+      mMsPerSample = mMsPerSample > 0.0 ? 0.5 * (mMsPerSample + msPerSample) : msPerSample;
+    }
+  }
+
+  double BakeScheduler::getJobSamples(const Job& job) const
+  {
+    return double(job.width) * job.height * mMipSamples[job.mip];
+  }
+
+  void BakeScheduler::releaseTargets()
+  {
+    if (mFbo)
+      CHECK_GL_ERROR(glDeleteFramebuffers(1, &mFbo));
+    if (mDepthRbo)
+      CHECK_GL_ERROR(glDeleteRenderbuffers(1, &mDepthRbo));
+    mFbo = 0;
+    mDepthRbo = 0;
+  }
+}
@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "Bc6hEncoder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include "Half.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  constexpr int kBlockSize = 4;
+  constexpr int kBlockTexels = 16;
+  // Interpolation weights of the 4 bit index modes, out of 64.
+  constexpr int kWeights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+  // Largest finite half. Unsigned BC6H decodes to at most (0xffff * 31) >> 6 = 0x7bff.
+  constexpr int kMaxHalf = 0x7bff;
+
+  // The one region modes. Transformed modes store the second endpoint as a signed delta from
+  // the first, which buys precision for endpoints that are close together.
+  struct Mode
+  {
+    std::uint32_t bits;
+    int precision;
+    int deltaBits; // 0 for the untransformed 10 bit mode.
+  };
+  constexpr Mode kModes[] =
+  {
+    {0x03, 10, 0},
+    {0x07, 11, 9},
+    {0x0b, 12, 8},
+    {0x0f, 16, 4}
+  };
+  constexpr int kModeCount = sizeof(kModes) / sizeof(kModes[0]);
+
+  // Texels in the 16 bit domain the hardware interpolates in. Decoding finishes with
+  // (value * 31) >> 6, which maps it back onto half float bits.
+  struct Block
+  {
+    float texels[kBlockTexels][3];
+  };
+
+  struct Encoding
+  {
+    int mode = 0;
+    int endpoints[2][3] = {};
+    std::uint8_t indices[kBlockTexels] = {};
+    float error = std::numeric_limits<float>::max();
+  };
+
+  float toInterpolated(std::uint16_t half)
+  {
+    // Negative values and NaNs have no unsigned encoding.
+    const int bits = half & 0x8000 ? 0 : std::min<int>(half, kMaxHalf);
+    return bits * (64.0f / 31.0f);
+  }
+
+  std::uint16_t finishUnquantize(int value)
+  {
+    return std::uint16_t((value * 31) >> 6);
+  }
+
+  int unquantize(int value, int precision)
+  {
+    if (precision >= 15)
+      return value;
+    if (value == 0)
+      return 0;
+    if (value == (1 << precision) - 1)
+      return 0xffff;
+    return ((value << 16) + 0x8000) >> precision;
+  }
+
+  int quantize(float value, int precision)
+  {
+    // unquantize rounds, so the nearest of the two candidates around the truncated value wins.
+    const int maxValue = (1 << precision) - 1;
+    const int q = std::min(std::max(int(value * (1 << precision) / 65536.0f), 0), maxValue);
+    if (q < maxValue && std::abs(unquantize(q + 1, precision) - value) < std::abs(unquantize(q, precision) - value))
+      return q + 1;
+    return q;
+  }
+
+  int interpolate(int a, int b, int index)
+  {
+    return ((64 - kWeights[index]) * a + kWeights[index] * b + 32) >> 6;
+  }
+
+  void loadBlock(const std::uint16_t* texels, int width, int height, int blockX, int blockY, Block& block)
+  {
+    // Partial blocks on the right and top edges repeat the last column and row.
+    for (int y = 0; y < kBlockSize; ++y)
+    {
+      const int row = std::min(blockY * kBlockSize + y, height - 1);
+      for (int x = 0; x < kBlockSize; ++x)
+      {
+        const int column = std::min(blockX * kBlockSize + x, width - 1);
+        const std::uint16_t* texel = texels + (std::size_t(row) * width + column) * 3;
+        for (int ch = 0; ch < 3; ++ch)
+          block.texels[y * kBlockSize + x][ch] = toInterpolated(texel[ch]);
+      }
+    }
+  }
+
+  // Line through the block the endpoints are picked on.
+  void fitEndpoints(const Block& block, Bc6hQuality quality, float endpoints[2][3])
+  {
+    float mean[3] = {};
+    float minimum[3], maximum[3];
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      minimum[ch] = maximum[ch] = block.texels[0][ch];
+      for (const auto& texel : block.texels)
+      {
+        mean[ch] += texel[ch] / kBlockTexels;
+        minimum[ch] = std::min(minimum[ch], texel[ch]);
+        maximum[ch] = std::max(maximum[ch], texel[ch]);
+      }
+    }
+
+    float axis[3] = {maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2]};
+    if (quality != Bc6hQuality::Fast)
+    {
+      // Principal axis of the block by power iteration on its covariance, started from the
+      // bounding box diagonal.
+      float covariance[6] = {};
+      for (const auto& texel : block.texels)
+      {
+        const float d[3] = {texel[0] - mean[0], texel[1] - mean[1], texel[2] - mean[2]};
+        covariance[0] += d[0] * d[0];
+        covariance[1] += d[0] * d[1];
+        covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1];
+        covariance[4] += d[1] * d[2];
+        covariance[5] += d[2] * d[2];
+      }
+      for (int iteration = 0; iteration < 8; ++iteration)
+      {
+        const float next[3] =
+        {
+          covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+          covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+          covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+        };
+        const float length = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+        if (length <= 0.0f)
+          break;
+        for (int ch = 0; ch < 3; ++ch)
+          axis[ch] = next[ch] / length;
+      }
+    }
+
+    const float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    if (lengthSquared <= 0.0f)
+    {
+      // Flat block.
+      for (int ch = 0; ch < 3; ++ch)
+        endpoints[0][ch] = endpoints[1][ch] = mean[ch];
+      return;
+    }
+    float lowest = std::numeric_limits<float>::max(), highest = -lowest;
+    for (const auto& texel : block.texels)
+    {
+      const float t = ((texel[0] - mean[0]) * axis[0] + (texel[1] - mean[1]) * axis[1] + (texel[2] - mean[2]) * axis[2]) / lengthSquared;
+      lowest = std::min(lowest, t);
+      highest = std::max(highest, t);
+    }
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      endpoints[0][ch] = std::min(std::max(mean[ch] + lowest * axis[ch], 0.0f), 65535.0f);
+      endpoints[1][ch] = std::min(std::max(mean[ch] + highest * axis[ch], 0.0f), 65535.0f);
+    }
+  }
+
+  // Endpoints that minimise the squared error for fixed indices.
+  void refineEndpoints(const Block& block, const std::uint8_t* indices, float endpoints[2][3])
+  {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < kBlockTexels; ++i)
+    {
+      const float b = kWeights[indices[i]] / 64.0f;
+      const float a = 1.0f - b;
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int ch = 0; ch < 3; ++ch)
+      {
+        ax[ch] += a * block.texels[i][ch];
+        bx[ch] += b * block.texels[i][ch];
+      }
+    }
+    const float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+      return;
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      endpoints[0][ch] = std::min(std::max((ax[ch] * bb - bx[ch] * ab) / determinant, 0.0f), 65535.0f);
+      endpoints[1][ch] = std::min(std::max((bx[ch] * aa - ax[ch] * ab) / determinant, 0.0f), 65535.0f);
+    }
+  }
+
+  // Quantizes endpoints for mode, picks the best index per texel and applies the rule that the
+  // first index has an implicit zero top bit. Returns false if the mode cannot store them.
+  bool evaluate(const Block& block, int mode, const float endpoints[2][3], Encoding& encoding)
+  {
+    const Mode& info = kModes[mode];
+    int quantized[2][3];
+    int palette[16][3];
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      quantized[0][ch] = quantize(endpoints[0][ch], info.precision);
+      quantized[1][ch] = quantize(endpoints[1][ch], info.precision);
+      const int a = unquantize(quantized[0][ch], info.precision);
+      const int b = unquantize(quantized[1][ch], info.precision);
+      for (int index = 0; index < 16; ++index)
+        palette[index][ch] = interpolate(a, b, index);
+    }
+
+    float error = 0.0f;
+    for (int i = 0; i < kBlockTexels; ++i)
+    {
+      float bestError = std::numeric_limits<float>::max();
+      for (int index = 0; index < 16; ++index)
+      {
+        float texelError = 0.0f;
+        for (int ch = 0; ch < 3; ++ch)
+        {
+          const float d = palette[index][ch] - block.texels[i][ch];
+          texelError += d * d;
+        }
+        if (texelError < bestError)
+        {
+          bestError = texelError;
+          encoding.indices[i] = std::uint8_t(index);
+        }
+      }
+      error += bestError;
+    }
+
+    if (encoding.indices[0] & 8)
+    {
+      for (int ch = 0; ch < 3; ++ch)
+        std::swap(quantized[0][ch], quantized[1][ch]);
+      for (auto& index : encoding.indices)
+        index = std::uint8_t(15 - index);
+    }
+
+    if (info.deltaBits)
+    {
+      const int limit = 1 << (info.deltaBits - 1);
+      for (int ch = 0; ch < 3; ++ch)
+      {
+        const int delta = quantized[1][ch] - quantized[0][ch];
+        if (delta < -limit || delta >= limit)
+          return false;
+      }
+    }
+
+    encoding.mode = mode;
+    std::memcpy(encoding.endpoints, quantized, sizeof(quantized));
+    encoding.error = error;
+    return true;
+  }
+
+  class BitWriter
+  {
+  public:
+    explicit BitWriter(std::uint8_t* output)
+    : mOutput(output)
+    {
+      std::memset(mOutput, 0, Bc6hEncoder::kBlockBytes);
+    }
+
+    void write(std::uint32_t value, int bits)
+    {
+      for (int i = 0; i < bits; ++i, ++mPosition)
+        if ((value >> i) & 1)
+          mOutput[mPosition >> 3] |= std::uint8_t(1 << (mPosition & 7));
+    }
+
+  private:
+    std::uint8_t* mOutput;
+    int mPosition = 0;
+  };
+
+  class BitReader
+  {
+  public:
+    explicit BitReader(const std::uint8_t* input)
+    : mInput(input)
+    {}
+
+    std::uint32_t read(int bits)
+    {
+      std::uint32_t value = 0;
+      for (int i = 0; i < bits; ++i, ++mPosition)
+        value |= std::uint32_t((mInput[mPosition >> 3] >> (mPosition & 7)) & 1) << i;
+      return value;
+    }
+
+  private:
+    const std::uint8_t* mInput;
+    int mPosition = 0;
+  };
+
+  // Mode bits, the low 10 bits of the first endpoint, then either the second endpoint or the
+  // deltas, each delta followed by the remaining bits of the first endpoint from the top bit
+  // down. Then the indices, the first one a bit short.
+  void writeBlock(const Encoding& encoding, std::uint8_t* output)
+  {
+    const Mode& info = kModes[encoding.mode];
+    BitWriter writer(output);
+    writer.write(info.bits, 5);
+    for (int ch = 0; ch < 3; ++ch)
+      writer.write(encoding.endpoints[0][ch] & 0x3ff, 10);
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      if (!info.deltaBits)
+      {
+        writer.write(encoding.endpoints[1][ch], 10);
+        continue;
+      }
+      writer.write(std::uint32_t(encoding.endpoints[1][ch] - encoding.endpoints[0][ch]) & ((1u << info.deltaBits) - 1), info.deltaBits);
+      for (int bit = info.precision - 1; bit >= 10; --bit)
+        writer.write((encoding.endpoints[0][ch] >> bit) & 1, 1);
+    }
+    writer.write(encoding.indices[0], 3);
+    for (int i = 1; i < kBlockTexels; ++i)
+      writer.write(encoding.indices[i], 4);
+  }
+
+  void encodeBlock(const Block& block, Bc6hQuality quality, std::uint8_t* output)
+  {
+    const int modeCount = quality == Bc6hQuality::Fast ? 1 : kModeCount;
+    const int refinements = quality == Bc6hQuality::Fast ? 0 : quality == Bc6hQuality::Normal ? 1 : 3;
+    float fitted[2][3];
+    fitEndpoints(block, quality, fitted);
+
+    Encoding best;
+    for (int mode = 0; mode < modeCount; ++mode)
+    {
+      float endpoints[2][3];
+      std::memcpy(endpoints, fitted, sizeof(endpoints));
+      for (int pass = 0; pass <= refinements; ++pass)
+      {
+        Encoding candidate;
+        if (!evaluate(block, mode, endpoints, candidate))
+          break;
+        if (candidate.error < best.error)
+          best = candidate;
+        if (pass < refinements)
+        {
+          // Refine against the indices before the anchor swap, which match endpoints' order.
+          std::uint8_t indices[kBlockTexels];
+          const bool swapped = candidate.endpoints[0][0] != quantize(endpoints[0][0], kModes[mode].precision) ||
+                               candidate.endpoints[0][1] != quantize(endpoints[0][1], kModes[mode].precision) ||
+                               candidate.endpoints[0][2] != quantize(endpoints[0][2], kModes[mode].precision);
+          for (int i = 0; i < kBlockTexels; ++i)
+            indices[i] = swapped ? std::uint8_t(15 - candidate.indices[i]) : candidate.indices[i];
+          refineEndpoints(block, indices, endpoints);
+        }
+      }
+    }
+    writeBlock(best, output);
+  }
+
+  void decodeBlock(const std::uint8_t* input, std::uint16_t texels[kBlockTexels][3])
+  {
+    BitReader reader(input);
+    std::uint32_t bits = reader.read(2);
+    if (bits == 0x03)
+      bits |= reader.read(3) << 2;
+    const Mode* info = nullptr;
+    for (const auto& mode : kModes)
+      if (mode.bits == bits)
+        info = &mode;
+    if (!info)
+    {
+      std::memset(texels, 0, sizeof(std::uint16_t) * kBlockTexels * 3);
+      return;
+    }
+
+    int endpoints[2][3];
+    for (int ch = 0; ch < 3; ++ch)
+      endpoints[0][ch] = int(reader.read(10));
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      if (!info->deltaBits)
+      {
+        endpoints[1][ch] = int(reader.read(10));
+        continue;
+      }
+      // Sign extend the delta.
+      int delta = int(reader.read(info->deltaBits));
+      if (delta & (1 << (info->deltaBits - 1)))
+        delta -= 1 << info->deltaBits;
+      for (int bit = info->precision - 1; bit >= 10; --bit)
+        endpoints[0][ch] |= int(reader.read(1)) << bit;
+      endpoints[1][ch] = delta;
+    }
+    if (info->deltaBits)
+      for (int ch = 0; ch < 3; ++ch)
+        endpoints[1][ch] = (endpoints[0][ch] + endpoints[1][ch]) & ((1 << info->precision) - 1);
+
+    int a[3], b[3];
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      a[ch] = unquantize(endpoints[0][ch], info->precision);
+      b[ch] = unquantize(endpoints[1][ch], info->precision);
+    }
+    for (int i = 0; i < kBlockTexels; ++i)
+    {
+      const int index = int(reader.read(i == 0 ? 3 : 4));
+      for (int ch = 0; ch < 3; ++ch)
+        texels[i][ch] = finishUnquantize(interpolate(a[ch], b[ch], index));
+    }
+  }
+
+  double tonemap(std::uint16_t half)
+  {
+    const double value = std::max(double(Half::toFloat(half)), 0.0);
+    return value / (1.0 + value);
+  }
+
+  double getSquaredError(const std::uint16_t* reference, const std::uint8_t* blocks, int width, int height)
+  {
+    const std::size_t count = std::size_t(width) * height * 3;
+    std::unique_ptr<std::uint16_t[]> decoded(new std::uint16_t[count]);
+    Bc6hEncoder::decode(blocks, width, height, decoded.get());
+
+    double sumSquaredError = 0.0;
+    std::mutex mutex;
+    Parallel::forRange(count, 4096, [&](std::size_t begin, std::size_t end)
+    {
+      double partial = 0.0;
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        const double d = tonemap(reference[i]) - tonemap(decoded[i]);
+        partial += d * d;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      sumSquaredError += partial;
+    });
+    return sumSquaredError;
+  }
+
+  double getPsnr(double sumSquaredError, std::size_t count)
+  {
+    const double meanSquaredError = sumSquaredError / count;
+    return meanSquaredError > 0.0 ? 10.0 * std::log10(1.0 / meanSquaredError) : std::numeric_limits<double>::infinity();
+  }
+}
+
+namespace Akoylasar
+{
+  std::size_t Bc6hEncoder::getBlockCount(int width, int height)
+  {
+    return std::size_t((width + kBlockSize - 1) / kBlockSize) * ((height + kBlockSize - 1) / kBlockSize);
+  }
+
+  void Bc6hEncoder::encode(const std::uint16_t* texels, int width, int height, Bc6hQuality quality, std::uint8_t* output)
+  {
+    const int blocksX = (width + kBlockSize - 1) / kBlockSize;
+    const int blocksY = (height + kBlockSize - 1) / kBlockSize;
+    Parallel::forRange(std::size_t(blocksY), 1, [&](std::size_t begin, std::size_t end)
+    {
+      Block block;
+      for (std::size_t blockY = begin; blockY < end; ++blockY)
+      {
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+          loadBlock(texels, width, height, blockX, int(blockY), block);
+          encodeBlock(block, quality, output + (blockY * blocksX + blockX) * kBlockBytes);
+        }
+      }
+    });
+  }
+
+  void Bc6hEncoder::decode(const std::uint8_t* blocks, int width, int height, std::uint16_t* output)
+  {
+    const int blocksX = (width + kBlockSize - 1) / kBlockSize;
+    const int blocksY = (height + kBlockSize - 1) / kBlockSize;
+    Parallel::forRange(std::size_t(blocksY), 1, [&](std::size_t begin, std::size_t end)
+    {
+      std::uint16_t texels[kBlockTexels][3];
+      for (std::size_t blockY = begin; blockY < end; ++blockY)
+      {
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+          decodeBlock(blocks + (blockY * blocksX + blockX) * kBlockBytes, texels);
+          for (int y = 0; y < kBlockSize; ++y)
+          {
+            const std::size_t row = blockY * kBlockSize + y;
+            for (int x = 0; x < kBlockSize; ++x)
+            {
+              const int column = blockX * kBlockSize + x;
+              if (row < std::size_t(height) && column < width)
+                std::memcpy(output + (row * width + column) * 3, texels[y * kBlockSize + x], sizeof(texels[0]));
+            }
+          }
+        }
+      }
+    });
+  }
+
+  double Bc6hEncoder::computePsnr(const std::uint16_t* reference, const std::uint8_t* blocks, int width, int height)
+  {
+    return getPsnr(getSquaredError(reference, blocks, width, height), std::size_t(width) * height * 3);
+  }
+
+  void Bc6hEncoder::encodeCubeMap(const std::uint16_t* texels, int size, int mipLevels, Bc6hQuality quality, std::vector<std::uint8_t>& output, int faceCount)
+  {
+    output.resize(getCubeMapOffset(size, mipLevels, faceCount));
+    for (int mip = 0; mip < mipLevels; ++mip)
+    {
+      const int mipSize = std::max(size >> mip, 1);
+      const std::size_t faceTexels = std::size_t(mipSize) * mipSize * 3;
+      for (int face = 0; face < faceCount; ++face)
+        encode(texels + face * faceTexels, mipSize, mipSize, quality, output.data() + getCubeMapOffset(size, mip, faceCount) + face * getCompressedSize(mipSize, mipSize));
+      texels += faceCount * faceTexels;
+    }
+  }
+
+  std::size_t Bc6hEncoder::getCubeMapOffset(int size, int mip, int faceCount)
+  {
+    std::size_t offset = 0;
+    for (int i = 0; i < mip; ++i)
+    {
+      const int mipSize = std::max(size >> i, 1);
+      offset += getCompressedSize(mipSize, mipSize) * faceCount;
+    }
+    return offset;
+  }
+
+  double Bc6hEncoder::computeCubeMapPsnr(const std::uint16_t* reference, const std::uint8_t* blocks, int size, int mipLevels, int faceCount)
+  {
+    double sumSquaredError = 0.0;
+    std::size_t count = 0;
+    for (int mip = 0; mip < mipLevels; ++mip)
+    {
+      const int mipSize = std::max(size >> mip, 1);
+      const std::size_t faceTexels = std::size_t(mipSize) * mipSize * 3;
+      for (int face = 0; face < faceCount; ++face)
+        sumSquaredError += getSquaredError(reference + face * faceTexels, blocks + getCubeMapOffset(size, mip, faceCount) + face * getCompressedSize(mipSize, mipSize), mipSize, mipSize);
+      reference += faceCount * faceTexels;
+      count += faceCount * faceTexels;
+    }
+    return getPsnr(sumSquaredError, count);
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "BrdfLut.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Half.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  constexpr float kPi = 3.1415926535f;
+
+  float radicalInverse(std::uint32_t bits)
+  {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+  }
+
+  // GGX half vectors for one roughness, in the frame brdf.fs builds around N = +Z
+  // (tangent -Y, bitangent +X).
+  struct HalfVectors
+  {
+    std::vector<float> x, y, z;
+  };
+
+  void buildHalfVectors(float roughness, int numSamples, HalfVectors& output)
+  {
+    const float a = roughness * roughness;
+    output.x.resize(numSamples);
+    output.y.resize(numSamples);
+    output.z.resize(numSamples);
+    for (int i = 0; i < numSamples; ++i)
+    {
+      const float u = float(i) / float(numSamples);
+      const float v = radicalInverse(std::uint32_t(i));
+      const float phi = 2.0f * kPi * u;
+      const float cosTheta = std::sqrt((1.0f - v) / (1.0f + (a * a - 1.0f) * v));
+      const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+      const float hx = std::cos(phi) * sinTheta;
+      const float hy = std::sin(phi) * sinTheta;
+      const float invLength = 1.0f / std::sqrt(hx * hx + hy * hy + cosTheta * cosTheta);
+      output.x[i] = hy * invLength;
+      output.y[i] = -hx * invLength;
+      output.z[i] = cosTheta * invLength;
+    }
+  }
+
+  void integrate(float nDotV, float roughness, const HalfVectors& h, float* rg)
+  {
+    // V lies in the xz plane, so V.H and the reflected L.z only need x and z.
+    const float vx = std::sqrt(1.0f - nDotV * nDotV);
+    const float vz = nDotV;
+    const float k = roughness * roughness / 2.0f;
+    const float gv = nDotV / (nDotV * (1.0f - k) + k);
+    float a = 0.0f, b = 0.0f;
+    const int numSamples = int(h.x.size());
+    for (int i = 0; i < numSamples; ++i)
+    {
+      const float vDotH = vx * h.x[i] + vz * h.z[i];
+      // L = normalize(2 V.H H - V) is already unit length, so L.z is all we need.
+      const float nDotL = std::max(2.0f * vDotH * h.z[i] - vz, 0.0f);
+      if (nDotL > 0.0f)
+      {
+        const float nDotH = std::max(h.z[i], 0.0f);
+        const float vDotHClamped = std::max(vDotH, 0.0f);
+        const float g = gv * (nDotL / (nDotL * (1.0f - k) + k));
+        const float gVis = (g * vDotHClamped) / (nDotH * nDotV);
+        const float oneMinus = 1.0f - vDotHClamped;
+        const float oneMinus2 = oneMinus * oneMinus;
+        const float fc = oneMinus2 * oneMinus2 * oneMinus;
+        a += (1.0f - fc) * gVis;
+        b += fc * gVis;
+      }
+    }
+    rg[0] = a / float(numSamples);
+    rg[1] = b / float(numSamples);
+  }
+}
+
+namespace Akoylasar
+{
+  void BrdfLut::generate(int size, int numSamples, std::vector<float>& output)
+  {
+    output.resize(std::size_t(size) * size * 2);
+    // Every row shares one roughness, so the sample set is built once per row.
+    Parallel::forRange(std::size_t(size), 1, [&](std::size_t begin, std::size_t end)
+    {
+      HalfVectors h;
+      for (std::size_t row = begin; row < end; ++row)
+      {
+        const float roughness = (float(row) + 0.5f) / float(size);
+        buildHalfVectors(roughness, numSamples, h);
+        float* texels = output.data() + row * size * 2;
+        for (int column = 0; column < size; ++column)
+          integrate((float(column) + 0.5f) / float(size), roughness, h, texels + column * 2);
+      }
+    });
+  }
+
+  BrdfLut::Error BrdfLut::compare(const std::uint16_t* halves, const float* reference, std::size_t count)
+  {
+    double maxError = 0.0, sumSquaredError = 0.0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const double error = std::abs(double(Half::toFloat(halves[i])) - reference[i]);
+      maxError = std::max(maxError, error);
+      sumSquaredError += error * error;
+    }
+    Error result;
+    result.max = float(maxError);
+    result.rms = count ? float(std::sqrt(sumSquaredError / count)) : 0.0f;
+    return result;
+  }
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "CacheFile.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "BakeCache.hpp"
+
+namespace Akoylasar
+{
+  bool CacheFile::writeSections(const std::filesystem::path& path,
+                                const char* name,
+                                const void* header,
+                                std::size_t headerSize,
+                                Section* sections,
+                                const void* const* data,
+                                const std::uint64_t* sizes,
+                                int count)
+  {
+    std::uint64_t offset = headerSize;
+    for (int i = 0; i < count; ++i)
+    {
+      offset = (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+      sections[i] = {offset, sizes[i], BakeCache::hash(data[i], sizes[i])};
+      offset += sizes[i];
+    }
+
+    std::ofstream file {path, std::ios::binary | std::ios::trunc};
+    file.write(static_cast<const char*>(header), headerSize);
+    const char padding[kSectionAlignment] = {};
+    std::uint64_t position = headerSize;
+    for (int i = 0; i < count; ++i)
+    {
+      file.write(padding, sections[i].offset - position);
+      file.write(static_cast<const char*>(data[i]), sizes[i]);
+      position = sections[i].offset + sizes[i];
+    }
+    if (!file)
+    {
+      std::cerr << "Failed to write " << name << " " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  const char* CacheFile::readSection(const MappedFile& file, const Section& section, const std::uint8_t*& data)
+  {
+    if (section.offset % kSectionAlignment || section.offset > file.getSize() || section.size > file.getSize() - section.offset)
+      return "truncated";
+    data = section.size ? file.getData() + section.offset : nullptr;
+    if (BakeCache::hash(data, section.size) != section.hash)
+      return "checksum mismatch";
+    return nullptr;
+  }
+
+  std::filesystem::path CacheFile::getEntryPath(const std::filesystem::path& directory, std::uint64_t key, const char* extension)
+  {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << extension;
+    return directory / name.str();
+  }
+
+  bool CacheFile::load(const std::filesystem::path& path,
+                       std::uint64_t key,
+                       const char* name,
+                       MappedFile& file,
+                       const std::function<bool(const MappedFile&, std::uint64_t&)>& read)
+  {
+    if (!file.open(path))
+    {
+      std::cout << name << " miss: " << path << std::endl;
+      return false;
+    }
+
+    std::uint64_t storedKey = key;
+    if (!read(file, storedKey) || storedKey != key)
+    {
+      std::cerr << name << " entry " << path << " is " << (storedKey != key ? "stale" : "corrupt") << ", replacing it" << std::endl;
+      file.close();
+      return false;
+    }
+    std::cout << name << " hit: " << path << " (" << file.getSize() << " bytes mapped)" << std::endl;
+    return true;
+  }
+
+  bool CacheFile::store(const std::filesystem::path& path,
+                        const char* name,
+                        const std::function<bool(const std::filesystem::path&)>& write)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error)
+    {
+      std::cerr << name << ": failed to create directory " << path.parent_path() << ": " << error.message() << std::endl;
+      return false;
+    }
+
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    if (!write(tempPath))
+      return false;
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+      std::cerr << name << ": failed to write entry " << path << ": " << error.message() << std::endl;
+      std::filesystem::remove(tempPath, error);
+      return false;
+    }
+    std::cout << name << " stored: " << path << " (" << std::filesystem::file_size(path, error) << " bytes written)" << std::endl;
+    return true;
+  }
+}
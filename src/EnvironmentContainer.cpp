@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "EnvironmentContainer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "Bc6hEncoder.hpp"
+#include "CacheFile.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  constexpr char kMagic[4] = {'P', 'E', 'N', 'V'};
+  constexpr std::uint32_t kVersion = 4;
+
+  enum Section
+  {
+    kSource,
+    kIrradiance,
+    kPrefilter,
+    kSourceBc6h,
+    kIrradianceBc6h,
+    kPrefilterBc6h,
+    kSectionCount
+  };
+
+  // Written as is, so containers are only portable between machines of the same endianness.
+  struct Header
+  {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t key;
+    std::int32_t sourceSize;
+    std::int32_t sourceMipLevels;
+    std::int32_t irradianceSize;
+    std::int32_t prefilterSize;
+    std::int32_t prefilterMipLevels;
+    float radianceSh[27];
+    float sunDirection[3];
+    float sunIrradiance[3];
+    float sunSolidAngle;
+    CacheFile::Section sections[kSectionCount];
+  };
+
+  void getSectionSizes(const EnvironmentView& view, std::uint64_t* sizes)
+  {
+    sizes[kSource] = EnvironmentContainer::getCubeMapOffset(view.sourceSize, view.sourceMipLevels) * sizeof(std::uint16_t);
+    sizes[kIrradiance] = EnvironmentContainer::getCubeMapOffset(view.irradianceSize, 1) * sizeof(std::uint16_t);
+    sizes[kPrefilter] = EnvironmentContainer::getCubeMapOffset(view.prefilterSize, view.prefilterMipLevels) * sizeof(std::uint16_t);
+    sizes[kSourceBc6h] = Bc6hEncoder::getCubeMapOffset(view.sourceSize, view.sourceMipLevels);
+    sizes[kIrradianceBc6h] = Bc6hEncoder::getCubeMapOffset(view.irradianceSize, 1);
+    sizes[kPrefilterBc6h] = Bc6hEncoder::getCubeMapOffset(view.prefilterSize, view.prefilterMipLevels);
+  }
+
+  bool isValidSize(std::int32_t size)
+  {
+    return size > 0 && size <= 65536;
+  }
+
+  bool isValidMipChain(std::int32_t size, std::int32_t mipLevels)
+  {
+    return mipLevels >= 1 && mipLevels <= 17 && (size >> (mipLevels - 1)) >= 1;
+  }
+}
+
+namespace Akoylasar
+{
+  std::size_t EnvironmentContainer::getCubeMapOffset(int size, int mip)
+  {
+    std::size_t offset = 0;
+    for (int i = 0; i < mip; ++i)
+    {
+      const std::size_t mipSize = std::size_t(std::max(size >> i, 1));
+      offset += mipSize * mipSize * 3 * 6;
+    }
+    return offset;
+  }
+
+  bool EnvironmentContainer::write(const std::filesystem::path& path, std::uint64_t key, const EnvironmentView& view)
+  {
+    Header header {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.key = key;
+    header.sourceSize = view.sourceSize;
+    header.sourceMipLevels = view.sourceMipLevels;
+    header.irradianceSize = view.irradianceSize;
+    header.prefilterSize = view.prefilterSize;
+    header.prefilterMipLevels = view.prefilterMipLevels;
+    for (int i = 0; i < 9; ++i)
+    {
+      header.radianceSh[i * 3] = view.radianceSh[i].x;
+      header.radianceSh[i * 3 + 1] = view.radianceSh[i].y;
+      header.radianceSh[i * 3 + 2] = view.radianceSh[i].z;
+    }
+    const SunLight& sun = view.sun;
+    header.sunDirection[0] = sun.direction.x;
+    header.sunDirection[1] = sun.direction.y;
+    header.sunDirection[2] = sun.direction.z;
+    header.sunIrradiance[0] = sun.irradiance.x;
+    header.sunIrradiance[1] = sun.irradiance.y;
+    header.sunIrradiance[2] = sun.irradiance.z;
+    header.sunSolidAngle = sun.solidAngle;
+
+    const void* data[kSectionCount] = {view.source, view.irradiance, view.prefilter, view.sourceBc6h, view.irradianceBc6h, view.prefilterBc6h};
+    std::uint64_t sizes[kSectionCount];
+    getSectionSizes(view, sizes);
+    for (int i = 0; i < kSectionCount; ++i)
+      sizes[i] = data[i] ? sizes[i] : 0;
+    return CacheFile::writeSections(path, "environment container", &header, sizeof(header), header.sections, data, sizes, kSectionCount);
+  }
+
+  bool EnvironmentContainer::read(const MappedFile& file, std::uint64_t& key, EnvironmentView& output)
+  {
+    auto reject = [](const char* reason)
+    {
+      std::cerr << "Invalid environment container: " << reason << std::endl;
+      return false;
+    };
+
+    if (file.getSize() < sizeof(Header))
+      return reject("truncated");
+    Header header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) || header.version != kVersion)
+      return reject("unknown version");
+    if (!isValidSize(header.sourceSize) || !isValidMipChain(header.sourceSize, header.sourceMipLevels) || !isValidSize(header.irradianceSize) ||
+        !isValidSize(header.prefilterSize) || !isValidMipChain(header.prefilterSize, header.prefilterMipLevels))
+      return reject("bad dimensions");
+
+    EnvironmentView view;
+    view.sourceSize = header.sourceSize;
+    view.sourceMipLevels = header.sourceMipLevels;
+    view.irradianceSize = header.irradianceSize;
+    view.prefilterSize = header.prefilterSize;
+    view.prefilterMipLevels = header.prefilterMipLevels;
+    std::uint64_t sizes[kSectionCount];
+    getSectionSizes(view, sizes);
+
+    const std::uint8_t* data[kSectionCount];
+    for (int i = 0; i < kSectionCount; ++i)
+    {
+      const CacheFile::Section& section = header.sections[i];
+      const bool optional = i >= kSourceBc6h && section.size == 0;
+      if (section.size != sizes[i] && !optional)
+        return reject("truncated");
+      if (const char* reason = CacheFile::readSection(file, section, data[i]))
+        return reject(reason);
+    }
+
+    for (int i = 0; i < 9; ++i)
+      view.radianceSh[i] = Neon::Vec3f(header.radianceSh[i * 3], header.radianceSh[i * 3 + 1], header.radianceSh[i * 3 + 2]);
+    view.sun.direction = Neon::Vec3f(header.sunDirection[0], header.sunDirection[1], header.sunDirection[2]);
+    view.sun.irradiance = Neon::Vec3f(header.sunIrradiance[0], header.sunIrradiance[1], header.sunIrradiance[2]);
+    view.sun.solidAngle = header.sunSolidAngle;
+    view.source = reinterpret_cast<const std::uint16_t*>(data[kSource]);
+    view.irradiance = reinterpret_cast<const std::uint16_t*>(data[kIrradiance]);
+    view.prefilter = reinterpret_cast<const std::uint16_t*>(data[kPrefilter]);
+    view.sourceBc6h = data[kSourceBc6h];
+    view.irradianceBc6h = data[kIrradianceBc6h];
+    view.prefilterBc6h = data[kPrefilterBc6h];
+    output = view;
+    key = header.key;
+    return true;
+  }
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "EnvironmentLibrary.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "Debug.hpp"
+
+namespace Akoylasar
+{
+  void ResidentEnvironment::release()
+  {
+    const GLuint textures[] = {environmentTexture, irradianceMap, prefilterMap};
+    CHECK_GL_ERROR(glDeleteTextures(3, textures));
+    environmentTexture = irradianceMap = prefilterMap = 0;
+    environmentBytes = irradianceBytes = prefilterBytes = 0;
+  }
+
+  double EnvironmentLibrary::Stats::getHitRate() const
+  {
+    const std::size_t switches = hits + misses;
+    return switches ? double(hits) / switches : 0.0;
+  }
+
+  EnvironmentLibrary::EnvironmentLibrary(std::vector<std::filesystem::path> paths, std::size_t budgetBytes)
+  : mPaths(std::move(paths)),
+    mBudgetBytes(budgetBytes)
+  {}
+
+  EnvironmentLibrary::~EnvironmentLibrary()
+  {
+    for (Entry& entry : mEntries)
+      entry.environment.release();
+  }
+
+  int EnvironmentLibrary::getIndex(const std::filesystem::path& path) const
+  {
+    const auto it = std::find(mPaths.begin(), mPaths.end(), path);
+    return it == mPaths.end() ? -1 : int(it - mPaths.begin());
+  }
+
+  std::filesystem::path EnvironmentLibrary::getPrefetchCandidate(const std::filesystem::path& current) const
+  {
+    const int start = getIndex(current);
+    const int count = int(mPaths.size());
+    for (int i = 1; i < count + 1; ++i)
+    {
+      const std::filesystem::path& candidate = mPaths[(start + i + count) % count];
+      if (candidate != current && !contains(candidate))
+        return candidate;
+    }
+    return {};
+  }
+
+  bool EnvironmentLibrary::contains(const std::filesystem::path& path) const
+  {
+    return std::any_of(mEntries.begin(), mEntries.end(), [&](const Entry& entry) { return entry.environment.path == path; });
+  }
+
+  ResidentEnvironment* EnvironmentLibrary::acquire(const std::filesystem::path& path)
+  {
+    ResidentEnvironment* environment = find(path);
+    ++(environment ? mHits : mMisses);
+    return environment;
+  }
+
+  ResidentEnvironment* EnvironmentLibrary::find(const std::filesystem::path& path)
+  {
+    for (Entry& entry : mEntries)
+    {
+      if (entry.environment.path == path)
+      {
+        entry.lastUse = ++mUseCounter;
+        return &entry.environment;
+      }
+    }
+    return nullptr;
+  }
+
+  void EnvironmentLibrary::insert(ResidentEnvironment environment, std::size_t inUseBytes)
+  {
+    DEBUG_ASSERT(!contains(environment.path));
+    mEntries.push_back({std::move(environment), ++mUseCounter});
+    evict(inUseBytes);
+  }
+
+  void EnvironmentLibrary::evict(std::size_t inUseBytes)
+  {
+    // The most recent entry stays even over budget, it is about to be switched to.
+    std::size_t bytes = inUseBytes;
+    for (const Entry& entry : mEntries)
+      bytes += entry.environment.getBytes();
+    while (bytes > mBudgetBytes && mEntries.size() > 1)
+    {
+      const auto oldest = std::min_element(mEntries.begin(), mEntries.end(),
+                                           [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+      std::cout << "Evicted " << oldest->environment.path << " (" << oldest->environment.getBytes() / (1024.0 * 1024.0)
+                << "MB) from the environment library" << std::endl;
+      bytes -= oldest->environment.getBytes();
+      oldest->environment.release();
+      mEntries.erase(oldest);
+      ++mEvictions;
+    }
+  }
+
+  EnvironmentLibrary::Stats EnvironmentLibrary::getStats() const
+  {
+    Stats stats;
+    stats.hits = mHits;
+    stats.misses = mMisses;
+    stats.evictions = mEvictions;
+    stats.residentCount = mEntries.size();
+    for (const Entry& entry : mEntries)
+      stats.residentBytes += entry.environment.getBytes();
+    stats.budgetBytes = mBudgetBytes;
+    return stats;
+  }
+}
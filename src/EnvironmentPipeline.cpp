@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "EnvironmentPipeline.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+#include "Half.hpp"
+#include "HdrReader.hpp"
+
+namespace
+{
+  // Bump whenever a bake shader or baker changes its output, so old cache entries are not reused.
+  constexpr std::uint32_t kBakeVersion = 4;
+  // Hashed a piece at a time so that a huge source is never resident all at once.
+  constexpr std::size_t kHashChunkSize = 64 << 20;
+
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+}
+
+namespace Akoylasar
+{
+  EquirectImage EnvironmentData::getRadiance() const
+  {
+    if (radiance)
+      return {width, height, radiance.get()};
+    return radianceMips.getLevelCount() ? radianceMips.getLevel(0) : EquirectImage();
+  }
+
+  EnvironmentPipeline::EnvironmentPipeline(JobSystem& jobs, const BakeCache& cache, const EnvironmentPipelineSettings& settings)
+  : mJobs(jobs),
+    mCache(cache),
+    mSettings(settings)
+  {
+    const char* const names[kStageCount] = {"Read", "Decode", "Convert", "Bake", "Upload"};
+    const unsigned int concurrency[kStageCount] = {1, settings.decodeConcurrency, settings.convertConcurrency, settings.bakeConcurrency, 1};
+    for (int stage = 0; stage < kStageCount; ++stage)
+    {
+      mStages[stage].name = names[stage];
+      mStages[stage].concurrency = std::max(1u, concurrency[stage]);
+      mStages[stage].capacity = std::max<std::size_t>(1, settings.queueCapacity);
+    }
+    // Requests are only paths, there is no reason to hold them back.
+    mStages[kRead].capacity = std::numeric_limits<std::size_t>::max();
+  }
+
+  void EnvironmentPipeline::submit(const std::filesystem::path& path)
+  {
+    auto item = std::make_unique<EnvironmentData>();
+    item->path = path;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mInFlight++ == 0 && mStages[kUpload].processed == 0)
+      mFirstSubmitTime = Clock::now();
+    StageState& read = mStages[kRead];
+    read.queue.push_back(std::move(item));
+    read.peakQueueDepth = std::max(read.peakQueueDepth, read.queue.size());
+    pump();
+  }
+
+  std::unique_ptr<EnvironmentData> EnvironmentPipeline::popReady()
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    StageState& upload = mStages[kUpload];
+    while (!upload.queue.empty())
+    {
+      Item item = std::move(upload.queue.front());
+      upload.queue.pop_front();
+      // Room has been made in front of the upload stage.
+      pump();
+      if (item->failed)
+      {
+        --mInFlight;
+        continue;
+      }
+      ++upload.active;
+      return item;
+    }
+    return nullptr;
+  }
+
+  void EnvironmentPipeline::finishUpload(double uploadMs)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    StageState& upload = mStages[kUpload];
+    --upload.active;
+    ++upload.processed;
+    upload.busyMs += uploadMs;
+    --mInFlight;
+    mLastUploadTime = Clock::now();
+  }
+
+  bool EnvironmentPipeline::isIdle() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mInFlight == 0;
+  }
+
+  std::array<EnvironmentPipeline::StageStats, EnvironmentPipeline::kStageCount> EnvironmentPipeline::getStats() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::array<StageStats, kStageCount> stats;
+    for (int stage = 0; stage < kStageCount; ++stage)
+    {
+      const StageState& state = mStages[stage];
+      stats[stage].name = state.name;
+      stats[stage].queueDepth = state.queue.size();
+      stats[stage].peakQueueDepth = state.peakQueueDepth;
+      stats[stage].queueCapacity = state.capacity;
+      stats[stage].processed = state.processed;
+      stats[stage].busyMs = state.busyMs;
+      // Concurrent items overlap, so busy time is spread over the stage's slots.
+      const double busySeconds = state.busyMs * 1e-3 / state.concurrency;
+      stats[stage].itemsPerSecond = busySeconds > 0.0 ? state.processed / busySeconds : 0.0;
+    }
+    return stats;
+  }
+
+  double EnvironmentPipeline::getEnvironmentsPerSecond() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const std::size_t uploaded = mStages[kUpload].processed;
+    if (uploaded == 0)
+      return 0.0;
+    const double seconds = std::chrono::duration<double>(mLastUploadTime - mFirstSubmitTime).count();
+    return seconds > 0.0 ? uploaded / seconds : 0.0;
+  }
+
+  void EnvironmentPipeline::pump()
+  {
+    // Called with mMutex held. Later stages first, so that freed room is used downstream
+    // before more work is pulled in at the front.
+    for (int stage = kBake; stage >= kRead; --stage)
+    {
+      StageState& current = mStages[stage];
+      StageState& next = mStages[stage + 1];
+      while (current.active < current.concurrency && !current.queue.empty() &&
+             next.queue.size() + next.reserved < next.capacity)
+      {
+        // std::function needs a copyable capture; the holder also frees the item if the job
+        // gets skipped on shutdown.
+        auto item = std::make_shared<Item>(std::move(current.queue.front()));
+        current.queue.pop_front();
+        ++current.active;
+        ++next.reserved;
+        mJobs.submit([this, stage, item]()
+        {
+          const auto start = Clock::now();
+          runStage(Stage(stage), **item, mCache, mSettings);
+          finishStage(stage, std::move(*item), getElapsedMs(start));
+        });
+      }
+    }
+  }
+
+  void EnvironmentPipeline::finishStage(int stage, Item item, double ms)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    StageState& current = mStages[stage];
+    StageState& next = mStages[stage + 1];
+    --current.active;
+    ++current.processed;
+    current.busyMs += ms;
+    --next.reserved;
+    next.queue.push_back(std::move(item));
+    next.peakQueueDepth = std::max(next.peakQueueDepth, next.queue.size());
+    pump();
+  }
+
+  void EnvironmentPipeline::runStage(Stage stage, EnvironmentData& item, const BakeCache& cache, const EnvironmentPipelineSettings& settings)
+  {
+    if (item.failed)
+      return;
+
+    EnvironmentView& environment = item.environment;
+    switch (stage)
+    {
+      case kRead:
+      {
+        // Map the source rather than reading it into the heap; it is only needed for the key
+        // on a cache hit and is released as soon as it has been decoded on a miss.
+        if (!item.source.open(item.path))
+        {
+          std::cerr << "Failed to load texture with path " << item.path << std::endl;
+          item.failed = true;
+          return;
+        }
+        item.bakeKey = getBakeKey(item.source, settings);
+        item.cacheHit = cache.load(item.bakeKey, item.container, environment);
+        if (item.cacheHit)
+          item.source.close();
+        break;
+      }
+
+      case kDecode:
+      {
+        if (item.cacheHit)
+          return;
+        const auto start = Clock::now();
+        bool decoded;
+        if (settings.decodeMemoryBudget)
+        {
+          StreamedHdr streamed;
+          decoded = HdrReader::decodeStreaming(item.source, settings.decodeMemoryBudget, streamed);
+          item.radianceMips = std::move(streamed.mips);
+          environment.radianceSh = streamed.radianceSh;
+          item.hasRadianceSh = decoded;
+          item.downsampleFactor = streamed.downsampleFactor;
+          item.decodePeakBytes = streamed.peakBytes;
+          item.width = decoded ? item.radianceMips.widths[0] : 0;
+          item.height = decoded ? item.radianceMips.heights[0] : 0;
+        }
+        else
+        {
+          decoded = HdrReader::decode(item.source.getData(), item.source.getSize(), item.width, item.height, item.radiance);
+          item.decodePeakBytes = std::size_t(item.width) * item.height * 3 * sizeof(float);
+        }
+        item.source.close();
+        if (!decoded)
+        {
+          std::cerr << "Failed to load texture with path " << item.path << std::endl;
+          item.failed = true;
+          return;
+        }
+        item.decodeMs = getElapsedMs(start);
+        std::cout << "Decoded " << item.path << " (" << item.width * item.downsampleFactor << "x" << item.height * item.downsampleFactor
+                  << ", kept at " << item.width << "x" << item.height << ") in " << item.decodeMs << "ms" << std::endl;
+
+        if (settings.extractSun)
+        {
+          const auto sunStart = Clock::now();
+          float* texels = item.radiance ? item.radiance.get() : item.radianceMips.texels.data();
+          if (SunExtractor::extract(texels, item.width, item.height, settings.sun, environment.sun))
+          {
+            // Whatever was derived from the radiance while streaming still holds the sun.
+            if (item.radianceMips.getLevelCount())
+              item.radianceMips.generateMips();
+            item.hasRadianceSh = false;
+          }
+          item.sunExtractionMs = getElapsedMs(sunStart);
+          std::cout << "Sun extraction for " << item.path << ": " << (environment.sun.isEmpty() ? "none found" : "found") << " in "
+                    << item.sunExtractionMs << "ms" << std::endl;
+        }
+        break;
+      }
+
+      case kConvert:
+      {
+        if (item.cacheHit)
+        {
+          // Everything else is uploaded straight from the mapping on the GL thread.
+          item.irradiance.allocate(environment.irradianceSize, 1);
+          Half::toFloats(environment.irradiance, item.irradiance.texels.data(), item.irradiance.texels.size());
+          return;
+        }
+        // The GPU only ever samples the panorama as a cubemap, mips included, so that none of
+        // the shaders has to map directions to latitude and longitude.
+        const auto start = Clock::now();
+        const int cubeSize = settings.sourceCubeMapSize ? settings.sourceCubeMapSize : IBLBaker::getEquirectCubeMapSize(item.width);
+        if (item.radianceMips.getLevelCount())
+          IBLBaker::equirectToCubeMap(item.radianceMips, cubeSize, item.sourceCube);
+        else
+          IBLBaker::equirectToCubeMap(item.getRadiance(), cubeSize, item.sourceCube);
+        item.cubeMapMs = getElapsedMs(start);
+        const std::size_t sourceCount = item.sourceCube.texels.size();
+        item.sourceTexels.reset(new std::uint16_t[sourceCount]);
+        Half::fromFloats(item.sourceCube.texels.data(), item.sourceTexels.get(), sourceCount);
+        environment.sourceSize = cubeSize;
+        environment.sourceMipLevels = item.sourceCube.mipLevels;
+        environment.source = item.sourceTexels.get();
+        if (!settings.cpuPrefilter)
+          item.sourceCube = CubeMapData();
+        std::cout << "Resampled " << item.path << " to a " << cubeSize << "x" << cubeSize << " cubemap with "
+                  << environment.sourceMipLevels << " mips in " << item.cubeMapMs << "ms" << std::endl;
+        break;
+      }
+
+      case kBake:
+      {
+        if (item.cacheHit)
+          return;
+        // The diffuse term only needs the first 3 SH bands, so bake it here instead of on the GL thread.
+        const EquirectImage equirect = item.getRadiance();
+        auto start = Clock::now();
+        if (!item.hasRadianceSh)
+        {
+          environment.radianceSh = IBLBaker::projectToSh(equirect);
+          item.shProjectionMs = getElapsedMs(start);
+          start = Clock::now();
+        }
+        IBLBaker::bakeIrradianceMap(environment.radianceSh, settings.irradianceSize, item.irradiance);
+        item.irradianceBakeMs = getElapsedMs(start);
+        item.irradianceTexels.resize(item.irradiance.texels.size());
+        Half::fromFloats(item.irradiance.texels.data(), item.irradianceTexels.data(), item.irradianceTexels.size());
+        environment.irradianceSize = settings.irradianceSize;
+        environment.irradiance = item.irradianceTexels.data();
+
+        if (settings.cpuPrefilter)
+        {
+          start = Clock::now();
+          // From the cubemap, like the GLSL bake would.
+          CubeMapData prefilter;
+          IBLBaker::prefilterEnvMap(item.sourceCube, settings.prefilter, prefilter);
+          item.prefilterTexels.resize(prefilter.texels.size());
+          Half::fromFloats(prefilter.texels.data(), item.prefilterTexels.data(), item.prefilterTexels.size());
+          environment.prefilterSize = settings.prefilter.size;
+          environment.prefilterMipLevels = settings.prefilter.mipLevels;
+          environment.prefilter = item.prefilterTexels.data();
+          item.prefilterBakeMs = getElapsedMs(start);
+        }
+
+        if (settings.compressBc6h)
+          compressBc6h(item, settings.bc6hQuality);
+
+        if (settings.buildSampler)
+        {
+          start = Clock::now();
+          item.sampler.build(equirect);
+          item.samplerBuildMs = getElapsedMs(start);
+          std::cout << "Importance sampling tables for " << item.path << " built in " << item.samplerBuildMs << "ms" << std::endl;
+        }
+
+        // Keep only the half float copies that get uploaded and stored, and what the sampler reads.
+        if (!settings.buildSampler)
+        {
+          item.radiance.reset();
+          item.radianceMips = EquirectMipChain();
+        }
+        item.sourceCube = CubeMapData();
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  std::uint64_t EnvironmentPipeline::getBakeKey(MappedFile& source, const EnvironmentPipelineSettings& settings)
+  {
+    // Key the cache on the file contents rather than its path or time stamp, plus everything
+    // that changes the baked texels.
+    const std::uint32_t parameters[] =
+    {
+      kBakeVersion,
+      std::uint32_t(settings.irradianceSize),
+      std::uint32_t(settings.sourceCubeMapSize),
+      std::uint32_t(settings.prefilter.size),
+      std::uint32_t(settings.prefilter.mipLevels),
+      std::uint32_t(settings.prefilter.numSamples),
+      std::uint32_t(settings.prefilter.mode),
+      std::uint32_t(settings.prefilter.targetError * 1e6f),
+      std::uint32_t(settings.decodeMemoryBudget >> 20),
+      std::uint32_t(settings.compressBc6h),
+      std::uint32_t(settings.bc6hQuality),
+      std::uint32_t(settings.extractSun),
+      std::uint32_t(settings.sun.minPeakRatio * 1e3f),
+      std::uint32_t(settings.sun.threshold * 1e6f),
+      std::uint32_t(settings.sun.maxSolidAngle * 1e6f)
+    };
+    std::uint64_t key = BakeCache::hash(parameters, sizeof(parameters));
+    for (std::size_t offset = 0; offset < source.getSize(); offset += kHashChunkSize)
+    {
+      const std::size_t size = std::min(kHashChunkSize, source.getSize() - offset);
+      key = BakeCache::hash(source.getData() + offset, size, key);
+      source.release(offset, size);
+    }
+    return key;
+  }
+
+  void EnvironmentPipeline::compressBc6h(EnvironmentData& item, Bc6hQuality quality)
+  {
+    // Only the encodes are timed, the PSNR is measured afterwards.
+    EnvironmentView& environment = item.environment;
+    if (environment.source && item.sourceBc6h.empty())
+    {
+      const auto start = Clock::now();
+      Bc6hEncoder::encodeCubeMap(environment.source, environment.sourceSize, environment.sourceMipLevels, quality, item.sourceBc6h);
+      item.bc6hEncodeMs += getElapsedMs(start);
+      item.bc6hBlocks += item.sourceBc6h.size() / Bc6hEncoder::kBlockBytes;
+      environment.sourceBc6h = item.sourceBc6h.data();
+      item.sourcePsnr = Bc6hEncoder::computeCubeMapPsnr(environment.source, environment.sourceBc6h, environment.sourceSize, environment.sourceMipLevels);
+    }
+    if (environment.irradiance && item.irradianceBc6h.empty())
+    {
+      const auto start = Clock::now();
+      Bc6hEncoder::encodeCubeMap(environment.irradiance, environment.irradianceSize, 1, quality, item.irradianceBc6h);
+      item.bc6hEncodeMs += getElapsedMs(start);
+      item.bc6hBlocks += item.irradianceBc6h.size() / Bc6hEncoder::kBlockBytes;
+      environment.irradianceBc6h = item.irradianceBc6h.data();
+      item.irradiancePsnr = Bc6hEncoder::computeCubeMapPsnr(environment.irradiance, environment.irradianceBc6h, environment.irradianceSize, 1);
+    }
+    if (environment.prefilter && item.prefilterBc6h.empty())
+    {
+      const auto start = Clock::now();
+      Bc6hEncoder::encodeCubeMap(environment.prefilter, environment.prefilterSize, environment.prefilterMipLevels, quality, item.prefilterBc6h);
+      item.bc6hEncodeMs += getElapsedMs(start);
+      item.bc6hBlocks += item.prefilterBc6h.size() / Bc6hEncoder::kBlockBytes;
+      environment.prefilterBc6h = item.prefilterBc6h.data();
+      item.prefilterPsnr = Bc6hEncoder::computeCubeMapPsnr(environment.prefilter, environment.prefilterBc6h,
+                                                           environment.prefilterSize, environment.prefilterMipLevels);
+    }
+    std::cout << "BC6H compressed " << item.bc6hBlocks << " blocks in " << item.bc6hEncodeMs << "ms ("
+              << item.bc6hBlocks * 1000.0 / std::max(item.bc6hEncodeMs, 1e-3) << " blocks/s), PSNR source " << item.sourcePsnr
+              << "dB, irradiance " << item.irradiancePsnr << "dB, prefilter " << item.prefilterPsnr << "dB" << std::endl;
+  }
+}
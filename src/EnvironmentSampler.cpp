@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "EnvironmentSampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Debug.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  constexpr double kPi = 3.14159265358979323846;
+
+  float getLuminance(const float* rgb)
+  {
+    const float luminance = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+    // Also drops NaNs.
+    return luminance > 0.0f ? luminance : 0.0f;
+  }
+
+  // Normalized running sum of count weights into count + 1 entries. Uniform when every weight
+  // is zero, so that a black row still maps every number somewhere.
+  void buildCdf(const float* weights, std::size_t count, double sum, float* cdf)
+  {
+    double running = 0.0;
+    cdf[0] = 0.0f;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      running += sum > 0.0 ? weights[i] : 1.0;
+      cdf[i + 1] = float(running / (sum > 0.0 ? sum : double(count)));
+    }
+    cdf[count] = 1.0f;
+  }
+
+  // Interval of cdf holding u and where u lies within it.
+  std::size_t findInterval(const float* cdf, std::size_t count, float u, float& offset)
+  {
+    const std::size_t index = std::min(std::size_t(std::upper_bound(cdf, cdf + count + 1, u) - cdf), count) - 1;
+    const float width = cdf[index + 1] - cdf[index];
+    offset = width > 0.0f ? std::min((u - cdf[index]) / width, 1.0f) : 0.5f;
+    return index;
+  }
+}
+
+namespace Akoylasar
+{
+  void EnvironmentSampler::build(const EquirectImage& image)
+  {
+    DEBUG_ASSERT(image.texels && image.width > 0 && image.height > 0);
+    mWidth = image.width;
+    mHeight = image.height;
+    const std::size_t width = mWidth, height = mHeight;
+    mColumnCdfs.resize(height * (width + 1));
+    mColumnAliases.resize(height * width);
+
+    // Rows are independent, only their sums are needed for the marginal distribution.
+    std::vector<double> rowSums(height);
+    Parallel::forRange(height, 16, [&](std::size_t begin, std::size_t end)
+    {
+      std::vector<float> weights(width);
+      std::vector<double> scaled;
+      std::vector<std::uint32_t> small, large;
+      for (std::size_t row = begin; row < end; ++row)
+      {
+        const float sinTheta = float(std::sin(kPi * (row + 0.5) / height));
+        const float* texel = image.texels + row * width * 3;
+        double sum = 0.0;
+        for (std::size_t x = 0; x < width; ++x, texel += 3)
+        {
+          weights[x] = getLuminance(texel) * sinTheta;
+          sum += weights[x];
+        }
+        rowSums[row] = sum;
+        buildCdf(weights.data(), width, sum, mColumnCdfs.data() + row * (width + 1));
+        buildAliasTable(weights.data(), width, sum, mColumnAliases.data() + row * width, scaled, small, large);
+      }
+    });
+
+    std::vector<float> rowWeights(height);
+    double total = 0.0;
+    for (std::size_t row = 0; row < height; ++row)
+    {
+      rowWeights[row] = float(rowSums[row]);
+      total += rowSums[row];
+    }
+    mRowCdf.resize(height + 1);
+    buildCdf(rowWeights.data(), height, total, mRowCdf.data());
+    mRowAlias.resize(height);
+    std::vector<double> scaled;
+    std::vector<std::uint32_t> small, large;
+    buildAliasTable(rowWeights.data(), height, total, mRowAlias.data(), scaled, small, large);
+    // A texel spans 2 pi / width by pi / height radians, times sin(theta) already in the weights.
+    mIntegral = total * 2.0 * kPi * kPi / (double(width) * height);
+  }
+
+  std::size_t EnvironmentSampler::getMemoryBytes() const
+  {
+    return (mRowCdf.size() + mColumnCdfs.size()) * sizeof(float) +
+           (mRowAlias.size() + mColumnAliases.size()) * sizeof(AliasEntry);
+  }
+
+  EnvironmentSampler::Sample EnvironmentSampler::sampleCdf(float u1, float u2) const
+  {
+    DEBUG_ASSERT(!isEmpty());
+    float rowOffset, columnOffset;
+    const std::size_t row = findInterval(mRowCdf.data(), mHeight, u1, rowOffset);
+    const std::size_t column = findInterval(mColumnCdfs.data() + row * (mWidth + 1), mWidth, u2, columnOffset);
+    return makeSample(row, column, rowOffset, columnOffset);
+  }
+
+  EnvironmentSampler::Sample EnvironmentSampler::sampleAlias(float u1, float u2) const
+  {
+    DEBUG_ASSERT(!isEmpty());
+    float rowOffset, columnOffset;
+    const std::size_t row = sampleAliasTable(mRowAlias.data(), mHeight, u1, rowOffset);
+    const std::size_t column = sampleAliasTable(mColumnAliases.data() + row * mWidth, mWidth, u2, columnOffset);
+    return makeSample(row, column, rowOffset, columnOffset);
+  }
+
+  float EnvironmentSampler::getPdf(const Neon::Vec3f& direction) const
+  {
+    DEBUG_ASSERT(!isEmpty());
+    const float cosLatitude = std::sqrt(direction.x * direction.x + direction.z * direction.z);
+    if (cosLatitude <= 0.0f)
+      return 0.0f;
+    // Inverse of makeSample, i.e. IBLBaker::sampleEquirect's mapping.
+    const float u = float(std::atan2(direction.z, direction.x) / (2.0 * kPi) + 0.5);
+    const float v = float(std::asin(std::min(1.0f, std::max(-1.0f, direction.y))) / kPi + 0.5);
+    const std::size_t column = std::min(std::size_t(std::max(u, 0.0f) * mWidth), std::size_t(mWidth - 1));
+    const std::size_t row = std::min(std::size_t(std::max(v, 0.0f) * mHeight), std::size_t(mHeight - 1));
+    return getPdf(row, column, cosLatitude);
+  }
+
+  void EnvironmentSampler::buildAliasTable(const float* weights, std::size_t count, double sum, AliasEntry* table,
+                                           std::vector<double>& scaled, std::vector<std::uint32_t>& small, std::vector<std::uint32_t>& large)
+  {
+    // Scale to a mean of 1, then pair every entry below 1 with one above it that tops it up.
+    scaled.resize(count);
+    small.clear();
+    large.clear();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      scaled[i] = sum > 0.0 ? weights[i] * (count / sum) : 1.0;
+      (scaled[i] < 1.0 ? small : large).push_back(std::uint32_t(i));
+    }
+    while (!small.empty() && !large.empty())
+    {
+      const std::uint32_t less = small.back();
+      const std::uint32_t more = large.back();
+      small.pop_back();
+      table[less] = {float(scaled[less]), more};
+      scaled[more] -= 1.0 - scaled[less];
+      if (scaled[more] < 1.0)
+      {
+        large.pop_back();
+        small.push_back(more);
+      }
+    }
+    // Whatever is left is 1 up to rounding.
+    for (const std::uint32_t i : large)
+      table[i] = {1.0f, i};
+    for (const std::uint32_t i : small)
+      table[i] = {1.0f, i};
+  }
+
+  std::size_t EnvironmentSampler::sampleAliasTable(const AliasEntry* table, std::size_t count, float u, float& offset)
+  {
+    // The integer part of u * count picks the entry, the fraction is the coin, and whichever
+    // side of the coin was taken is stretched back to [0, 1) as the position in the texel.
+    const float scaled = u * count;
+    const std::size_t index = std::min(std::size_t(scaled), count - 1);
+    const float coin = std::min(scaled - float(index), 1.0f);
+    const AliasEntry& entry = table[index];
+    if (coin < entry.probability)
+    {
+      offset = coin / entry.probability;
+      return index;
+    }
+    offset = (coin - entry.probability) / (1.0f - entry.probability);
+    return entry.alias;
+  }
+
+  EnvironmentSampler::Sample EnvironmentSampler::makeSample(std::size_t row, std::size_t column, float rowOffset, float columnOffset) const
+  {
+    const double phi = ((column + columnOffset) / mWidth - 0.5) * 2.0 * kPi;
+    const double latitude = ((row + rowOffset) / mHeight - 0.5) * kPi;
+    const float cosLatitude = float(std::cos(latitude));
+    Sample sample;
+    sample.direction = Neon::Vec3f(cosLatitude * float(std::cos(phi)), float(std::sin(latitude)), cosLatitude * float(std::sin(phi)));
+    sample.pdf = cosLatitude > 0.0f ? getPdf(row, column, cosLatitude) : 0.0f;
+    return sample;
+  }
+
+  float EnvironmentSampler::getPdf(std::size_t row, std::size_t column, float cosLatitude) const
+  {
+    // Constant per texel in (u, v), then divided by the Jacobian of the equirect mapping,
+    // 2 pi^2 cos(latitude).
+    const float* columnCdf = mColumnCdfs.data() + row * (mWidth + 1);
+    const float texelPdf = (mRowCdf[row + 1] - mRowCdf[row]) * mHeight * (columnCdf[column + 1] - columnCdf[column]) * mWidth;
+    return float(texelPdf / (2.0 * kPi * kPi * cosLatitude));
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "Half.hpp"
+
+#include <cstring>
+
+#if defined(__AVX__) && defined(__F16C__)
+#include <immintrin.h>
+#define PBR_HALF_F16C 1
+#endif
+
+#include "Parallel.hpp"
+
+namespace
+{
+  // Below this many values the threads cost more than they save.
+  constexpr std::size_t kParallelGrain = 1 << 18;
+
+  std::uint32_t asBits(float value)
+  {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  float asFloat(std::uint32_t bits)
+  {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+}
+
+namespace Akoylasar
+{
+  std::uint16_t Half::fromFloat(float value)
+  {
+    constexpr std::uint32_t kFloatInfinity = 255u << 23;
+    constexpr std::uint32_t kHalfOverflow = (127u + 16u) << 23; // Smallest float that rounds to half infinity.
+    constexpr std::uint32_t kHalfNormal = 113u << 23; // Smallest normal half, 2^-14.
+    constexpr std::uint32_t kDenormalMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    std::uint32_t bits = asBits(value);
+    const std::uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    std::uint16_t result;
+    if (bits >= kHalfOverflow)
+      result = bits > kFloatInfinity ? 0x7e00 : 0x7c00;
+    else if (bits < kHalfNormal)
+    {
+      // Let the FPU do the rounding by shifting the mantissa into place with a magic add.
+      result = std::uint16_t(asBits(asFloat(bits) + asFloat(kDenormalMagic)) - kDenormalMagic);
+    }
+    else
+    {
+      const std::uint32_t mantissaOdd = (bits >> 13) & 1u;
+      bits += ((15u - 127u) << 23) + 0xfffu + mantissaOdd;
+      result = std::uint16_t(bits >> 13);
+    }
+    return std::uint16_t(result | (sign >> 16));
+  }
+
+  float Half::toFloat(std::uint16_t value)
+  {
+    constexpr std::uint32_t kShiftedExponent = 0x7c00u << 13;
+    constexpr std::uint32_t kDenormalMagic = 113u << 23;
+
+    std::uint32_t bits = (value & 0x7fffu) << 13;
+    const std::uint32_t exponent = bits & kShiftedExponent;
+    bits += (127u - 15u) << 23;
+    if (exponent == kShiftedExponent)
+      bits += (128u - 16u) << 23; // Infinity or NaN.
+    else if (exponent == 0)
+    {
+      bits += 1u << 23;
+      bits = asBits(asFloat(bits) - asFloat(kDenormalMagic));
+    }
+    return asFloat(bits | (std::uint32_t(value & 0x8000u) << 16));
+  }
+
+  void Half::fromFloats(const float* input, std::uint16_t* output, std::size_t count)
+  {
+    Parallel::forRange(count, kParallelGrain, [input, output](std::size_t begin, std::size_t end)
+    {
+      std::size_t i = begin;
+#ifdef PBR_HALF_F16C
+      for (; i + 16 <= end; i += 16)
+      {
+        const __m128i low = _mm256_cvtps_ph(_mm256_loadu_ps(input + i), _MM_FROUND_TO_NEAREST_INT);
+        const __m128i high = _mm256_cvtps_ph(_mm256_loadu_ps(input + i + 8), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 8), high);
+      }
+#endif
+      for (; i < end; ++i)
+        output[i] = fromFloat(input[i]);
+    });
+  }
+
+  void Half::toFloats(const std::uint16_t* input, float* output, std::size_t count)
+  {
+    Parallel::forRange(count, kParallelGrain, [input, output](std::size_t begin, std::size_t end)
+    {
+      std::size_t i = begin;
+#ifdef PBR_HALF_F16C
+      for (; i + 8 <= end; i += 8)
+        _mm256_storeu_ps(output + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i))));
+#endif
+      for (; i < end; ++i)
+        output[i] = toFloat(input[i]);
+    });
+  }
+}
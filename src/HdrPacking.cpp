@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "HdrPacking.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PBR_PACKING_AVX2 1
+#endif
+
+#include "Parallel.hpp"
+
+namespace
+{
+  // Below this many texels the threads cost more than they save.
+  constexpr std::size_t kParallelGrain = 1 << 16;
+  // (2^9 - 1) / 2^9 * 2^(31 - 15), the largest value RGB9E5 can hold.
+  constexpr float kMaxRgb9e5 = 65408.0f;
+  constexpr int kExponentBias = 15;
+  constexpr int kMantissaBits = 9;
+
+  std::uint32_t asBits(float value)
+  {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  float asFloat(std::uint32_t bits)
+  {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // Also turns NaNs into zero, unlike std::max.
+  float clampChannel(float value, float maximum)
+  {
+    return value > 0.0f ? std::min(value, maximum) : 0.0f;
+  }
+
+  // 2^(kExponentBias + kMantissaBits - exponent), the step between mantissa values inverted.
+  float getInverseStep(int exponent)
+  {
+    return asFloat(std::uint32_t(127 + kExponentBias + kMantissaBits - exponent) << 23);
+  }
+}
+
+namespace Akoylasar
+{
+  std::uint32_t HdrPacking::packRgb9e5(const float* rgb)
+  {
+    const float r = clampChannel(rgb[0], kMaxRgb9e5);
+    const float g = clampChannel(rgb[1], kMaxRgb9e5);
+    const float b = clampChannel(rgb[2], kMaxRgb9e5);
+    const float maxChannel = std::max(r, std::max(g, b));
+
+    // floor(log2(maxChannel)) straight from the float's exponent; zero and denormals end up
+    // at the lower bound.
+    int exponent = std::max(int(asBits(maxChannel) >> 23) - 127, -kExponentBias - 1) + 1 + kExponentBias;
+    float inverseStep = getInverseStep(exponent);
+    if (std::floor(maxChannel * inverseStep + 0.5f) == float(1 << kMantissaBits))
+      inverseStep = getInverseStep(++exponent);
+
+    const std::uint32_t red = std::uint32_t(std::floor(r * inverseStep + 0.5f));
+    const std::uint32_t green = std::uint32_t(std::floor(g * inverseStep + 0.5f));
+    const std::uint32_t blue = std::uint32_t(std::floor(b * inverseStep + 0.5f));
+    return red | (green << 9) | (blue << 18) | (std::uint32_t(exponent) << 27);
+  }
+
+  void HdrPacking::packRgb9e5(const float* input, std::uint32_t* output, std::size_t texelCount)
+  {
+    Parallel::forRange(texelCount, kParallelGrain, [input, output](std::size_t begin, std::size_t end)
+    {
+      std::size_t i = begin;
+#ifdef PBR_PACKING_AVX2
+      const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 maximum = _mm256_set1_ps(kMaxRgb9e5);
+      const __m256 half = _mm256_set1_ps(0.5f);
+      const __m256i inverseStepBase = _mm256_set1_epi32(127 + kExponentBias + kMantissaBits);
+      for (; i + 8 <= end; i += 8)
+      {
+        // max_ps returns its second operand for NaNs, which clamps them to zero as well.
+        const float* texels = input + i * 3;
+        const __m256 r = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels, offsets, 4), zero), maximum);
+        const __m256 g = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels + 1, offsets, 4), zero), maximum);
+        const __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels + 2, offsets, 4), zero), maximum);
+        const __m256 maxChannel = _mm256_max_ps(r, _mm256_max_ps(g, b));
+
+        __m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(maxChannel), 23), _mm256_set1_epi32(127));
+        exponent = _mm256_add_epi32(_mm256_max_epi32(exponent, _mm256_set1_epi32(-kExponentBias - 1)), _mm256_set1_epi32(1 + kExponentBias));
+        __m256 inverseStep = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(inverseStepBase, exponent), 23));
+        const __m256 maxMantissa = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(maxChannel, inverseStep), half));
+        // All ones where the largest channel rounded up to the next exponent.
+        const __m256i overflow = _mm256_castps_si256(_mm256_cmp_ps(maxMantissa, _mm256_set1_ps(float(1 << kMantissaBits)), _CMP_EQ_OQ));
+        exponent = _mm256_sub_epi32(exponent, overflow);
+        inverseStep = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(inverseStepBase, exponent), 23));
+
+        const __m256i red = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(r, inverseStep), half)));
+        const __m256i green = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(g, inverseStep), half)));
+        const __m256i blue = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(b, inverseStep), half)));
+        const __m256i packed = _mm256_or_si256(_mm256_or_si256(red, _mm256_slli_epi32(green, 9)),
+                                               _mm256_or_si256(_mm256_slli_epi32(blue, 18), _mm256_slli_epi32(exponent, 27)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), packed);
+      }
+#endif
+      for (; i < end; ++i)
+        output[i] = packRgb9e5(input + i * 3);
+    });
+  }
+
+  void HdrPacking::unpackRgb9e5(std::uint32_t packed, float* rgb)
+  {
+    const float step = 1.0f / getInverseStep(int(packed >> 27));
+    rgb[0] = float(packed & 0x1ff) * step;
+    rgb[1] = float((packed >> 9) & 0x1ff) * step;
+    rgb[2] = float((packed >> 18) & 0x1ff) * step;
+  }
+
+  float HdrPacking::getRgbmRange(const float* input, std::size_t texelCount)
+  {
+    float range = 0.0f;
+    std::mutex mutex;
+    Parallel::forRange(texelCount * 3, kParallelGrain * 3, [input, &range, &mutex](std::size_t begin, std::size_t end)
+    {
+      float partial = 0.0f;
+      for (std::size_t i = begin; i < end; ++i)
+        partial = std::max(partial, clampChannel(input[i], std::numeric_limits<float>::max()));
+      std::lock_guard<std::mutex> lock(mutex);
+      range = std::max(range, partial);
+    });
+    // An all black texture still needs a range to divide by.
+    return range > 0.0f ? range : 1.0f;
+  }
+
+  void HdrPacking::packRgbm(const float* rgb, float range, std::uint8_t* rgbm)
+  {
+    // M is rounded up to the next 1/255 so that RGB never exceeds 1; RGB is then
+    // c / (M * range) * 255 = c * (255 * 255 / range) / (M * 255).
+    const float inverseRange = 1.0f / range;
+    const float channelScale = 65025.0f * inverseRange;
+    const float clamped[3] = {clampChannel(rgb[0], range), clampChannel(rgb[1], range), clampChannel(rgb[2], range)};
+    const float maxChannel = std::max(clamped[0], std::max(clamped[1], clamped[2]));
+    const float m = std::max(std::min(std::ceil(maxChannel * inverseRange * 255.0f), 255.0f), 1.0f);
+    for (int ch = 0; ch < 3; ++ch)
+      rgbm[ch] = std::uint8_t(std::min(std::nearbyint(clamped[ch] * channelScale / m), 255.0f));
+    rgbm[3] = std::uint8_t(m);
+  }
+
+  void HdrPacking::packRgbm(const float* input, std::uint8_t* output, std::size_t texelCount, float range)
+  {
+    // Same steps as the single texel version.
+    const float inverseRange = 1.0f / range;
+    const float channelScale = 65025.0f * inverseRange;
+    Parallel::forRange(texelCount, kParallelGrain, [=](std::size_t begin, std::size_t end)
+    {
+      std::size_t i = begin;
+#ifdef PBR_PACKING_AVX2
+      const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 one = _mm256_set1_ps(1.0f);
+      const __m256 maximum = _mm256_set1_ps(range);
+      const __m256 limit = _mm256_set1_ps(255.0f);
+      const __m256 inverseRange8 = _mm256_set1_ps(inverseRange);
+      const __m256 channelScale8 = _mm256_set1_ps(channelScale);
+      for (; i + 8 <= end; i += 8)
+      {
+        const float* texels = input + i * 3;
+        const __m256 r = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels, offsets, 4), zero), maximum);
+        const __m256 g = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels + 1, offsets, 4), zero), maximum);
+        const __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_i32gather_ps(texels + 2, offsets, 4), zero), maximum);
+        const __m256 maxChannel = _mm256_max_ps(r, _mm256_max_ps(g, b));
+        __m256 m = _mm256_ceil_ps(_mm256_mul_ps(_mm256_mul_ps(maxChannel, inverseRange8), limit));
+        m = _mm256_max_ps(_mm256_min_ps(m, limit), one);
+
+        const auto quantize = [&](__m256 channel)
+        {
+          const __m256 value = _mm256_min_ps(_mm256_round_ps(_mm256_div_ps(_mm256_mul_ps(channel, channelScale8), m),
+                                                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), limit);
+          return _mm256_cvttps_epi32(value);
+        };
+        const __m256i packed = _mm256_or_si256(_mm256_or_si256(quantize(r), _mm256_slli_epi32(quantize(g), 8)),
+                                               _mm256_or_si256(_mm256_slli_epi32(quantize(b), 16), _mm256_slli_epi32(_mm256_cvttps_epi32(m), 24)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i * 4), packed);
+      }
+#endif
+      for (; i < end; ++i)
+        packRgbm(input + i * 3, range, output + i * 4);
+    });
+  }
+
+  void HdrPacking::unpackRgbm(const std::uint8_t* rgbm, float range, float* rgb)
+  {
+    const float scale = rgbm[3] / 255.0f * range / 255.0f;
+    for (int ch = 0; ch < 3; ++ch)
+      rgb[ch] = rgbm[ch] * scale;
+  }
+}
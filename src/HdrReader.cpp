@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "HdrReader.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__F16C__)
+#include <immintrin.h>
+#define PBR_HDR_AVX2 1
+#endif
+
+#include "Half.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  struct Header
+  {
+    int width = 0;
+    int height = 0;
+    std::size_t dataOffset = 0;
+  };
+
+  bool readLine(const std::uint8_t* data, std::size_t size, std::size_t& offset, std::string& line)
+  {
+    line.clear();
+    while (offset < size && data[offset] != '\n')
+      line.push_back(char(data[offset++]));
+    if (offset == size)
+      return false;
+    ++offset; // Skip '\n'.
+    return true;
+  }
+
+  bool parseHeader(const std::uint8_t* data, std::size_t size, Header& header)
+  {
+    std::size_t offset = 0;
+    std::string line;
+    if (!readLine(data, size, offset, line) || (line.compare(0, 10, "#?RADIANCE") && line.compare(0, 6, "#?RGBE")))
+    {
+      std::cerr << "Not a Radiance .hdr file" << std::endl;
+      return false;
+    }
+    // Header variables end at the first empty line.
+    while (true)
+    {
+      if (!readLine(data, size, offset, line))
+      {
+        std::cerr << "Truncated .hdr header" << std::endl;
+        return false;
+      }
+      if (line.empty())
+        break;
+      if (!line.compare(0, 7, "FORMAT=") && line != "FORMAT=32-bit_rle_rgbe")
+      {
+        std::cerr << "Unsupported .hdr format " << line << std::endl;
+        return false;
+      }
+    }
+    // Only the standard orientation, like stb_image.
+    char yAxis[3] = {}, xAxis[3] = {};
+    if (!readLine(data, size, offset, line) ||
+        std::sscanf(line.c_str(), "%2s %d %2s %d", yAxis, &header.height, xAxis, &header.width) != 4 ||
+        std::strcmp(yAxis, "-Y") || std::strcmp(xAxis, "+X"))
+    {
+      std::cerr << "Unsupported .hdr resolution line " << line << std::endl;
+      return false;
+    }
+    if (header.width <= 0 || header.height <= 0 || header.width > (1 << 24) / 4 || header.height > (1 << 24) / 4)
+    {
+      std::cerr << "Invalid .hdr size " << header.width << "x" << header.height << std::endl;
+      return false;
+    }
+    header.dataOffset = offset;
+    return true;
+  }
+
+  bool isRleScanline(const std::uint8_t* p, std::size_t remaining, int width)
+  {
+    return width >= 8 && width < 32768 && remaining >= 4 &&
+           p[0] == 2 && p[1] == 2 && !(p[2] & 0x80) && ((p[2] << 8) | p[3]) == width;
+  }
+
+  // Walks the run headers of scanline y starting at offset without decoding it, and moves
+  // offset past its end.
+  bool indexScanline(const std::uint8_t* data, std::size_t size, int width, int y, std::size_t& offset)
+  {
+    if (!isRleScanline(data + offset, size - offset, width))
+    {
+      std::cerr << "Invalid .hdr scanline " << y << std::endl;
+      return false;
+    }
+    offset += 4;
+    for (int channel = 0; channel < 4; ++channel)
+    {
+      int count = 0;
+      while (count < width)
+      {
+        if (offset >= size)
+        {
+          std::cerr << "Truncated .hdr data" << std::endl;
+          return false;
+        }
+        int run = data[offset++];
+        if (run > 128)
+        {
+          run -= 128;
+          offset += 1;
+        }
+        else
+          offset += run;
+        if (run == 0 || count + run > width)
+        {
+          std::cerr << "Corrupt .hdr scanline " << y << std::endl;
+          return false;
+        }
+        count += run;
+      }
+    }
+    if (offset > size)
+    {
+      std::cerr << "Truncated .hdr data" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool isFlat(const std::uint8_t* data, std::size_t size, const Header& header)
+  {
+    return !isRleScanline(data + header.dataOffset, size - header.dataOffset, header.width);
+  }
+
+  bool checkFlatSize(std::size_t size, const Header& header)
+  {
+    if ((size - header.dataOffset) / 4 / std::size_t(header.width) < std::size_t(header.height))
+    {
+      std::cerr << "Truncated .hdr data" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Walks the run headers of every scanline without decoding them. An empty result with a true
+  // return means the image is stored flat (uncompressed), which is only allowed from the first
+  // scanline on.
+  bool indexScanlines(const std::uint8_t* data, std::size_t size, const Header& header, std::vector<std::size_t>& offsets)
+  {
+    if (isFlat(data, size, header))
+    {
+      offsets.clear();
+      return checkFlatSize(size, header);
+    }
+
+    offsets.resize(header.height);
+    std::size_t offset = header.dataOffset;
+    for (int y = 0; y < header.height; ++y)
+    {
+      offsets[y] = offset;
+      if (!indexScanline(data, size, header.width, y, offset))
+        return false;
+    }
+    return true;
+  }
+
+  // Decodes one RLE scanline into four planes of width bytes (R, G, B, E). The index pass has
+  // already validated the runs.
+  void decodeRleScanline(const std::uint8_t* p, int width, std::uint8_t* planes)
+  {
+    p += 4;
+    for (int channel = 0; channel < 4; ++channel)
+    {
+      std::uint8_t* out = planes + channel * width;
+      const std::uint8_t* end = out + width;
+      while (out < end)
+      {
+        int run = *p++;
+        if (run > 128)
+        {
+          std::memset(out, *p++, run - 128);
+          out += run - 128;
+        }
+        else
+        {
+          std::memcpy(out, p, run);
+          out += run;
+          p += run;
+        }
+      }
+    }
+  }
+
+  void deinterleaveFlatScanline(const std::uint8_t* p, int width, std::uint8_t* planes)
+  {
+    for (int x = 0; x < width; ++x)
+      for (int channel = 0; channel < 4; ++channel)
+        planes[channel * width + x] = p[x * 4 + channel];
+  }
+
+  void decodeScanline(const std::uint8_t* data, const Header& header, bool flat, std::size_t offset, std::uint8_t* planes)
+  {
+    if (flat)
+      deinterleaveFlatScanline(data + offset, header.width, planes);
+    else
+      decodeRleScanline(data + offset, header.width, planes);
+  }
+
+  float getScale(std::uint8_t exponent)
+  {
+    // Same as stb_image: mantissa * 2^(e - 136), zero for e == 0.
+    return exponent ? std::ldexp(1.0f, int(exponent) - 136) : 0.0f;
+  }
+
+  void storePixel(float r, float g, float b, float* out)
+  {
+    out[0] = r;
+    out[1] = g;
+    out[2] = b;
+  }
+
+  void storePixel(float r, float g, float b, std::uint16_t* out)
+  {
+    out[0] = Half::fromFloat(r);
+    out[1] = Half::fromFloat(g);
+    out[2] = Half::fromFloat(b);
+  }
+
+#ifdef PBR_HDR_AVX2
+  __m256 loadChannel(const std::uint8_t* p)
+  {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+  }
+
+  // 2^(e - 136) as 2^(e - 128) / 256. 2^(e - 128) goes straight into the exponent bits, except
+  // for e == 1 which is the denormal 2^-127. Every step is exact, including the denormal results
+  // for e < 10, so it matches ldexp bit for bit.
+  __m256 loadScale(const std::uint8_t* p)
+  {
+    const __m256i e = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    __m256i bits = _mm256_slli_epi32(_mm256_sub_epi32(e, _mm256_set1_epi32(1)), 23);
+    bits = _mm256_blendv_epi8(bits, _mm256_set1_epi32(0x00400000), _mm256_cmpeq_epi32(e, _mm256_set1_epi32(1)));
+    bits = _mm256_andnot_si256(_mm256_cmpeq_epi32(e, _mm256_setzero_si256()), bits);
+    return _mm256_mul_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f / 256.0f));
+  }
+
+  // Turns 8 pixels of planar r, g, b into 24 interleaved values: each output register gathers
+  // its pixels from all three planes and blends the right channel into each lane.
+  void interleave(__m256 r, __m256 g, __m256 b, __m256& out0, __m256& out1, __m256& out2)
+  {
+    const __m256i index0 = _mm256_setr_epi32(0, 0, 0, 1, 1, 1, 2, 2);
+    const __m256i index1 = _mm256_setr_epi32(2, 3, 3, 3, 4, 4, 4, 5);
+    const __m256i index2 = _mm256_setr_epi32(5, 5, 6, 6, 6, 7, 7, 7);
+    out0 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permutevar8x32_ps(r, index0), _mm256_permutevar8x32_ps(g, index0), 0x92),
+                           _mm256_permutevar8x32_ps(b, index0), 0x24);
+    out1 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permutevar8x32_ps(r, index1), _mm256_permutevar8x32_ps(g, index1), 0x24),
+                           _mm256_permutevar8x32_ps(b, index1), 0x49);
+    out2 = _mm256_blend_ps(_mm256_blend_ps(_mm256_permutevar8x32_ps(r, index2), _mm256_permutevar8x32_ps(g, index2), 0x49),
+                           _mm256_permutevar8x32_ps(b, index2), 0x92);
+  }
+
+  void store8(__m256 out0, __m256 out1, __m256 out2, float* out)
+  {
+    _mm256_storeu_ps(out, out0);
+    _mm256_storeu_ps(out + 8, out1);
+    _mm256_storeu_ps(out + 16, out2);
+  }
+
+  void store8(__m256 out0, __m256 out1, __m256 out2, std::uint16_t* out)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvtps_ph(out0, _MM_FROUND_TO_NEAREST_INT));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm256_cvtps_ph(out1, _MM_FROUND_TO_NEAREST_INT));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm256_cvtps_ph(out2, _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+
+  template <typename T>
+  void convertScanline(const std::uint8_t* planes, int width, T* out)
+  {
+    const std::uint8_t* r = planes;
+    const std::uint8_t* g = planes + width;
+    const std::uint8_t* b = planes + width * 2;
+    const std::uint8_t* e = planes + width * 3;
+    int x = 0;
+#ifdef PBR_HDR_AVX2
+    for (; x + 8 <= width; x += 8)
+    {
+      const __m256 scale = loadScale(e + x);
+      __m256 out0, out1, out2;
+      interleave(_mm256_mul_ps(loadChannel(r + x), scale),
+                 _mm256_mul_ps(loadChannel(g + x), scale),
+                 _mm256_mul_ps(loadChannel(b + x), scale),
+                 out0, out1, out2);
+      store8(out0, out1, out2, out + x * 3);
+    }
+#endif
+    for (; x < width; ++x)
+    {
+      const float scale = getScale(e[x]);
+      storePixel(r[x] * scale, g[x] * scale, b[x] * scale, out + x * 3);
+    }
+  }
+
+  template <typename T>
+  bool decodeImage(const void* data, std::size_t size, int& width, int& height, std::unique_ptr<T[]>& output)
+  {
+    const auto* bytes = static_cast<const std::uint8_t*>(data);
+    Header header;
+    std::vector<std::size_t> offsets;
+    if (!parseHeader(bytes, size, header) || !indexScanlines(bytes, size, header, offsets))
+      return false;
+
+    width = header.width;
+    height = header.height;
+    // Left uninitialised on purpose, every texel gets written exactly once below.
+    output.reset(new T[std::size_t(width) * height * 3]);
+    T* texels = output.get();
+    const bool flat = offsets.empty();
+    Parallel::forRange(std::size_t(height), 16, [&](std::size_t begin, std::size_t end)
+    {
+      std::vector<std::uint8_t> planes(std::size_t(width) * 4);
+      for (std::size_t y = begin; y < end; ++y)
+      {
+        decodeScanline(bytes, header, flat, flat ? header.dataOffset + y * width * 4 : offsets[y], planes.data());
+        // The file stores the top row first.
+        convertScanline(planes.data(), width, texels + (height - 1 - y) * std::size_t(width) * 3);
+      }
+    });
+    return true;
+  }
+
+}
+
+namespace Akoylasar
+{
+  bool HdrReader::decode(const void* data,
+                         std::size_t size,
+                         int& width,
+                         int& height,
+                         std::unique_ptr<float[]>& output)
+  {
+    return decodeImage(data, size, width, height, output);
+  }
+
+  bool HdrReader::decode(const void* data,
+                         std::size_t size,
+                         int& width,
+                         int& height,
+                         std::unique_ptr<std::uint16_t[]>& output)
+  {
+    return decodeImage(data, size, width, height, output);
+  }
+
+  bool HdrReader::decodeStreaming(MappedFile& file, std::size_t maxBytes, StreamedHdr& output)
+  {
+    const std::uint8_t* bytes = file.getData();
+    const std::size_t size = file.getSize();
+    Header header;
+    if (!parseHeader(bytes, size, header))
+      return false;
+    const bool flat = isFlat(bytes, size, header);
+    if (flat && !checkFlatSize(size, header))
+      return false;
+
+    // Every thread holds one decoded scanline, as planes and as floats, plus the output row
+    // it accumulates into.
+    const int width = header.width;
+    const int height = header.height;
+    const std::size_t threadCount = Parallel::getThreadCount();
+    auto getScratchBytes = [&](int outputWidth) { return threadCount * (std::size_t(width) * 16 + std::size_t(outputWidth) * 12); };
+    // The mip chain adds a third on top of level 0.
+    auto getChainBytes = [](int outputWidth, int outputHeight) { return std::size_t(outputWidth) * outputHeight * 12 * 4 / 3; };
+
+    // Smallest power of two box that fits the budget.
+    int factor = 1;
+    int outputWidth = width, outputHeight = height;
+    while (getChainBytes(outputWidth, outputHeight) + getScratchBytes(outputWidth) > maxBytes)
+    {
+      if (outputWidth == 1 && outputHeight == 1)
+      {
+        std::cerr << width << "x" << height << " .hdr cannot be decoded within " << maxBytes << " bytes" << std::endl;
+        return false;
+      }
+      factor *= 2;
+      outputWidth = (width + factor - 1) / factor;
+      outputHeight = (height + factor - 1) / factor;
+    }
+
+    output.sourceWidth = width;
+    output.sourceHeight = height;
+    output.downsampleFactor = factor;
+    output.mips.allocate(outputWidth, outputHeight);
+    output.peakBytes = output.mips.texels.size() * sizeof(float) + getScratchBytes(outputWidth);
+    ShProjector projector(width, height);
+
+    // Output rows are handled a band at a time, in file order (top first). The band's
+    // scanlines are indexed serially, decoded and filtered in parallel, and their pages of
+    // the mapping are dropped before the next band.
+    const int bandRows = std::max<int>(16, int(threadCount));
+    std::vector<std::size_t> offsets;
+    std::size_t offset = header.dataOffset;
+    for (int bandStart = 0; bandStart < outputHeight; bandStart += bandRows)
+    {
+      const int bandEnd = std::min(bandStart + bandRows, outputHeight);
+      // Output row i from the top covers file rows [i * factor, (i + 1) * factor).
+      const int firstFileRow = bandStart * factor;
+      const int endFileRow = std::min(bandEnd * factor, height);
+      offsets.resize(endFileRow - firstFileRow);
+      for (int y = firstFileRow; y < endFileRow; ++y)
+      {
+        offsets[y - firstFileRow] = offset;
+        if (flat)
+          offset += std::size_t(width) * 4;
+        else if (!indexScanline(bytes, size, width, y, offset))
+          return false;
+      }
+
+      Parallel::forRange(std::size_t(bandEnd - bandStart), 1, [&](std::size_t begin, std::size_t end)
+      {
+        std::vector<std::uint8_t> planes(std::size_t(width) * 4);
+        std::vector<float> scanline(std::size_t(width) * 3);
+        std::vector<float> sum(std::size_t(outputWidth) * 3);
+        for (std::size_t i = bandStart + begin; i < bandStart + end; ++i)
+        {
+          std::fill(sum.begin(), sum.end(), 0.0f);
+          const int rowBegin = int(i) * factor;
+          const int rowEnd = std::min(rowBegin + factor, height);
+          for (int y = rowBegin; y < rowEnd; ++y)
+          {
+            decodeScanline(bytes, header, flat, offsets[y - firstFileRow], planes.data());
+            convertScanline(planes.data(), width, scanline.data());
+            // SH is projected from the full resolution rows, the file stores the top row first.
+            projector.addRows(scanline.data(), height - 1 - y, 1);
+            const float* texel = scanline.data();
+            for (int x = 0; x < outputWidth; ++x)
+            {
+              float* cell = sum.data() + std::size_t(x) * 3;
+              for (int column = std::min(factor, width - x * factor); column > 0; --column, texel += 3)
+              {
+                cell[0] += texel[0];
+                cell[1] += texel[1];
+                cell[2] += texel[2];
+              }
+            }
+          }
+
+          // Cells on the right and top edges may cover fewer texels.
+          float* row = output.mips.texels.data() + (outputHeight - 1 - i) * std::size_t(outputWidth) * 3;
+          for (int x = 0; x < outputWidth; ++x)
+          {
+            const int columns = std::min(factor, width - x * factor);
+            const float scale = 1.0f / float(columns * (rowEnd - rowBegin));
+            for (int ch = 0; ch < 3; ++ch)
+              row[x * 3 + ch] = sum[std::size_t(x) * 3 + ch] * scale;
+          }
+        }
+      });
+      file.release(0, offset);
+    }
+
+    output.mips.generateMips();
+    output.radianceSh = projector.getCoefficients();
+    return true;
+  }
+}
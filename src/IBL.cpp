@@ -2,27 +2,257 @@
  * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
 #include "IBL.hpp"
 
-#include <thread>
+#include <algorithm>
 #include <array>
-
-#include <stb_image.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <vector>
 
 #include <imgui.h>
 
 #include <Neon.hpp>
 
 #include "Common.hpp"
+#include "Half.hpp"
+#include "Bc6hEncoder.hpp"
+#include "BrdfLut.hpp"
+#include "HdrPacking.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "ObjLoader.hpp"
+#include "ProcessStats.hpp"
+#include "VertexPacking.hpp"
 
 namespace
 {
   const GLuint kMatricesUniformBlockBinding = 0;
   const char* const kMatricesUbName = "ubMatrices";
+  constexpr int kIrradianceMapSize = 32;
+  // Panoramas are decoded a band of scanlines at a time and downsampled until they fit; the
+  // bakes never need more than a few thousand texels across.
+  constexpr std::size_t kDecodeMemoryBudget = std::size_t(256) << 20;
+  // Everything but the GPU's own prefilter bake target is stored as BC6H, 1 byte per texel
+  // instead of 6.
+  constexpr bool kCompressBc6h = true;
+  constexpr Akoylasar::Bc6hQuality kBc6hQuality = Akoylasar::Bc6hQuality::Normal;
+  // The sun is taken out of the panorama and drawn analytically. What is left has no texels
+  // thousands of times brighter than the rest, so the prefilter bake needs far fewer samples.
+  constexpr bool kExtractSun = true;
+  constexpr int kSunlessPrefilterSamples = 256;
+  // Texel streaming. 8MB a frame gets the 3k panorama in within 4 frames.
+  constexpr std::size_t kUploadBytesPerFrame = 8 << 20;
+  constexpr std::size_t kStagingBufferSize = 4 << 20;
+  constexpr int kStagingBufferCount = 3;
+  // Low resolution prefilter bake shown while the full one is spread over frames.
+  constexpr int kPreviewPrefilterSize = 32;
+  constexpr int kPreviewPrefilterSamples = 64;
+  // Every .hdr in there can be switched to. The library keeps baked ones other than the one in
+  // use within this budget, about seven 3k panoramas with everything in BC6H.
+  const char* const kDefaultEnvironment = "images/Barce_Rooftop_C_3k.hdr";
+  const char* const kEnvironmentDirectory = "images";
+  constexpr std::size_t kLibraryBudgetBytes = std::size_t(64) << 20;
+  // Shown instead of the sphere when it exists, scaled to the sphere's size.
+  const char* const kModelPath = "models/model.obj";
+  constexpr float kModelRadius = 1.5f;
+  constexpr int kSphereSegments = 256;
+  // ibl.vs draws it in object space, column major like the matrices it does take.
+  constexpr float kSphereModel[16] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  // In TextureStorage order.
+  const char* const kTextureStorageNames[] = {"RGB16F", "BC6H", "RGB9E5", "RGBM"};
+  // In MapLayout order.
+  const char* const kMapLayoutNames[] = {"Cubemap", "Octahedral"};
+
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Exponential moving average of a pass's GPU time, zero meaning no sample yet.
+  void addGpuSample(double& averageMs, Akoylasar::TimeStamp& timeStamp)
+  {
+    const double ms = timeStamp.getElapsedTime() * Akoylasar::fromNsToMs;
+    averageMs = averageMs > 0.0 ? 0.95 * averageMs + 0.05 * ms : ms;
+  }
+
+  GLenum getTextureTarget(Akoylasar::MapLayout layout)
+  {
+    return layout == Akoylasar::MapLayout::Octahedral ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+  }
+
+  // Clamped to the edges, trilinear when there are mips. Octahedral maps clamp as well rather
+  // than mirror across the fold; the half texel it costs at the border is not worth a lookup.
+  void setMapSampler(GLenum target, int mipLevels)
+  {
+    CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, mipLevels - 1));
+    CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    if (target == GL_TEXTURE_CUBE_MAP)
+      CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
+
+  // Zero irradiance when there is no sun or it is switched off.
+  void setSunUniforms(Akoylasar::ShaderProgram& program, const Akoylasar::SunLight& sun, bool draw)
+  {
+    program.setVec3fUniform(program.getUniformLocation("uSunDirection"), sun.direction);
+    program.setVec3fUniform(program.getUniformLocation("uSunIrradiance"), draw ? sun.irradiance : Neon::Vec3f(0.0f));
+    program.setFloatUniform(program.getUniformLocation("uSunCosRadius"), sun.isEmpty() ? 1.0f : sun.getCosRadius());
+  }
+
+  // Centres the mesh's bounding box on the origin and scales it to fit in a sphere of radius.
+  void fitToSphere(Akoylasar::Mesh& mesh, float radius)
+  {
+    if (mesh.vertices.empty())
+      return;
+    Neon::Vec3f lower = mesh.vertices[0].position;
+    Neon::Vec3f upper = lower;
+    for (const auto& vertex : mesh.vertices)
+    {
+      lower = Neon::Vec3f(std::min(lower.x, vertex.position.x), std::min(lower.y, vertex.position.y), std::min(lower.z, vertex.position.z));
+      upper = Neon::Vec3f(std::max(upper.x, vertex.position.x), std::max(upper.y, vertex.position.y), std::max(upper.z, vertex.position.z));
+    }
+    const Neon::Vec3f centre = (lower + upper) * 0.5f;
+    float extent = 0.0f;
+    for (const auto& vertex : mesh.vertices)
+      extent = std::max(extent, Neon::mag(vertex.position - centre));
+    const float scale = extent > 0.0f ? radius / extent : 1.0f;
+    for (auto& vertex : mesh.vertices)
+      vertex.position = (vertex.position - centre) * scale;
+  }
+
+  // The mesh drawn in place of the sphere. view points either into mesh or into the mapped
+  // cache entry.
+  struct SceneMesh
+  {
+    std::unique_ptr<Akoylasar::Mesh> mesh;
+    Akoylasar::MappedFile cacheEntry;
+    Akoylasar::MeshView view;
+    Akoylasar::PackedVertices packed; // Points into packedVertices or the mapping.
+    std::vector<Akoylasar::PackedVertex> packedVertices;
+    Akoylasar::ObjLoadStats stats;
+    // Only the after statistics on a hit, which are measured on the mapping.
+    Akoylasar::MeshOptimizationStats optimization;
+    std::vector<Akoylasar::LodLevelStats> lodStats; // Empty on a hit.
+    bool cacheHit = false;
+    double ms = 0.0;
+  };
+
+  // The model fitted to the sphere's size, or the sphere when there is no model or it fails to
+  // load, in the order it was built in.
+  std::unique_ptr<Akoylasar::Mesh> buildSourceMesh(bool hasModel, bool& loaded, Akoylasar::ObjLoadStats* stats)
+  {
+    using namespace Akoylasar;
+    std::unique_ptr<Mesh> mesh;
+    loaded = hasModel && (mesh = ObjLoader::load(kModelPath, 0, stats));
+    if (loaded)
+      fitToSphere(*mesh, kModelRadius);
+    else
+      mesh = Mesh::buildSphere(kModelRadius, kSphereSegments, kSphereSegments);
+    return mesh;
+  }
+
+  // Cached under the model's contents when there is one and under the sphere's parameters
+  // otherwise, after fitting, optimising and simplifying into levels of detail, so that a hit
+  // needs nothing but the mapping.
+  void buildSceneMesh(const Akoylasar::MeshCache& cache, SceneMesh& output)
+  {
+    using namespace Akoylasar;
+    const auto start = Clock::now();
+    MappedFile model;
+    std::error_code error;
+    const bool hasModel = std::filesystem::exists(kModelPath, error) && model.open(kModelPath);
+    const float parameters[] = {kModelRadius, float(kSphereSegments)};
+    const std::uint64_t key = MeshCache::getKey(model.getData(), model.getSize(), parameters, sizeof(parameters));
+    model.close();
+    output.cacheHit = cache.load(key, output.cacheEntry, output.view, output.packed);
+    if (output.cacheHit)
+    {
+      const MeshView& view = output.view;
+      // Of the full mesh, which comes first in the index section.
+      const std::size_t indexCount = view.getBaseIndexCount();
+      output.optimization.cacheAfter = MeshOptimizer::analyzeVertexCache(view.indices, indexCount, view.vertexCount);
+      output.optimization.overfetchAfter = MeshOptimizer::analyzeVertexFetch(view.indices, indexCount, view.vertexCount, sizeof(Vertex));
+    }
+    else
+    {
+      bool loaded = false;
+      output.mesh = buildSourceMesh(hasModel, loaded, &output.stats);
+      MeshOptimizer::optimize(*output.mesh, &output.optimization);
+      // After the vertex fetch order is settled, the levels index the same vertices.
+      MeshSimplifier::buildLods(*output.mesh, {}, &output.lodStats);
+      output.view = output.mesh->getView();
+      Neon::Vec3f boundsMin, boundsMax;
+      VertexPacking::getBounds(output.view.vertices, output.view.vertexCount, boundsMin, boundsMax);
+      output.packedVertices.resize(output.view.vertexCount);
+      VertexPacking::pack(output.view.vertices, output.view.vertexCount, boundsMin, boundsMax, output.packedVertices.data());
+      output.packed.format = VertexPacking::kFormat;
+      output.packed.stride = sizeof(PackedVertex);
+      const float bounds[6] = {boundsMin.x, boundsMin.y, boundsMin.z, boundsMax.x, boundsMax.y, boundsMax.z};
+      std::copy(bounds, bounds + 3, output.packed.boundsMin);
+      std::copy(bounds + 3, bounds + 6, output.packed.boundsMax);
+      output.packed.data = reinterpret_cast<const std::uint8_t*>(output.packedVertices.data());
+      // A model that failed to load is not cached as the sphere standing in for it.
+      if (loaded || !hasModel)
+        cache.store(key, output.view, output.packed);
+    }
+    output.ms = getElapsedMs(start);
+  }
+
+  // Identity for float vertices, see GpuMesh.
+  void setMeshUniforms(Akoylasar::ShaderProgram& program, const Akoylasar::GpuMesh& mesh)
+  {
+    program.setVec3fUniform(program.getUniformLocation("uPositionOffset"), mesh.positionOffset);
+    program.setVec3fUniform(program.getUniformLocation("uPositionScale"), mesh.positionScale);
+    program.setIntUniform(program.getUniformLocation("uOctahedralNormals"), mesh.quantized);
+  }
+
+  bool hasExtension(const char* name)
+  {
+    GLint count = 0;
+    CHECK_GL_ERROR(glGetIntegerv(GL_NUM_EXTENSIONS, &count));
+    for (GLint i = 0; i < count; ++i)
+    {
+      if (!std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name))
+        return true;
+    }
+    return false;
+  }
+
+  // Takes a pending query's result once the GPU has it, without waiting for it.
+  void pollQuery(GLuint query, bool& pending, std::uint64_t& result)
+  {
+    if (!pending)
+      return;
+    GLint available = 0;
+    CHECK_GL_ERROR(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+    if (!available)
+      return;
+    CHECK_GL_ERROR(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result));
+    pending = false;
+  }
+
+  // A map read back from the GPU and what a layout switch made of it on a job.
+  struct LayoutBake
+  {
+    Akoylasar::CubeMapData source;
+    Akoylasar::CubeMapData output;
+    double ms = 0.0;
+  };
 }
 
 namespace Akoylasar
 {
-  void IBLScene::initialise()
+  void IBLScene::initialise(JobSystem& jobs)
   {
+    mJobs = &jobs;
+
     // Load shader sources from disk.
     ProgramInfo backgroundProgramInfo {std::make_pair("shaders/background.vs", ""), std::make_pair("shaders/background.fs", "")};
     ProgramInfo pbrProgramInfo {std::make_pair("shaders/ibl.vs", ""), std::make_pair("shaders/ibl.fs", "")};
@@ -56,36 +286,99 @@ namespace Akoylasar
     
     CHECK_GL_ERROR(glGenTextures(1, &mEnvironmentTexture));
     CHECK_GL_ERROR(glGenTextures(1, &mPrefilterMap));
+    CHECK_GL_ERROR(glGenTextures(1, &mBakeTarget));
     CHECK_GL_ERROR(glGenTextures(1, &mIrradianceMap));
+    CHECK_GL_ERROR(glGenTextures(1, &mBrdfLUT));
     CHECK_GL_ERROR(glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS));
 
     const auto cubeMesh = Mesh::buildCube();
     mCubeMesh = GpuMesh::createGpuMesh(*cubeMesh);
-    const auto sphereMesh = Mesh::buildSphere(1.5, 256, 256);
-    mSphereMesh = GpuMesh::createGpuMesh(*sphereMesh);
+    loadSceneMesh();
+    mPipelineStatistics = hasExtension("GL_ARB_pipeline_statistics_query");
+    if (mPipelineStatistics)
+      CHECK_GL_ERROR(glGenQueries(2, mInvocationQueries));
+
+    mUploader = std::make_unique<TextureUploader>(kStagingBufferSize, kStagingBufferCount);
+    mBakeScheduler = std::make_unique<BakeScheduler>(mCubeMesh);
+    mProfiler = std::make_unique<Profiler>();
+    mBackgroundTimeStamp = &mProfiler->createTimeStamp();
+    mShadingTimeStamp = &mProfiler->createTimeStamp();
+
+    if (kExtractSun)
+      mPrefilterSettings.numSamples = kSunlessPrefilterSamples;
+    EnvironmentPipelineSettings pipelineSettings;
+    pipelineSettings.prefilter = mPrefilterSettings;
+    pipelineSettings.irradianceSize = kIrradianceMapSize;
+    pipelineSettings.decodeMemoryBudget = kDecodeMemoryBudget;
+    pipelineSettings.compressBc6h = kCompressBc6h;
+    pipelineSettings.bc6hQuality = kBc6hQuality;
+    pipelineSettings.extractSun = kExtractSun;
+    mPipeline = std::make_unique<EnvironmentPipeline>(*mJobs, mBakeCache, pipelineSettings);
+    // Environments loaded after startup are baked entirely on the CPU, so that nothing is left
+    // for the GL thread but the upload.
+    EnvironmentPipelineSettings librarySettings = pipelineSettings;
+    librarySettings.cpuPrefilter = true;
+    mLibraryPipeline = std::make_unique<EnvironmentPipeline>(*mJobs, mBakeCache, librarySettings);
+
+    std::vector<std::filesystem::path> environments {kDefaultEnvironment};
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(kEnvironmentDirectory, error))
+    {
+      if (entry.path().extension() == ".hdr" && entry.path() != environments.front())
+        environments.push_back(entry.path());
+    }
+    std::sort(environments.begin(), environments.end());
+    mLibrary = std::make_unique<EnvironmentLibrary>(std::move(environments), kLibraryBudgetBytes);
     
-    // Launch a separate thread to load image from disk without blocking main app.
-    std::thread t(&IBLScene::loadAssets, this);
-    t.detach();
+    mInitialiseTime = std::chrono::steady_clock::now();
+
+    // Load the image from disk without blocking the main app.
+    loadAssets();
   }
   
   void IBLScene::render(double deltaTime, const Camera& camera)
   {
     if (mInitialised)
     {
+      if (mPrefilterBakePending)
+        updatePrefilterBake();
+      updateLibrary();
+
+      // The queries of the previous frame have long finished by now.
+      if (mPassesTimed)
+      {
+        addGpuSample(mBackgroundGpuMs, *mBackgroundTimeStamp);
+        addGpuSample(mShadingGpuMs, *mShadingTimeStamp);
+      }
+      if (mPipelineStatistics)
+      {
+        pollQuery(mInvocationQueries[0], mInvocationQueryPending[0], mVertexInvocations[0]);
+        pollQuery(mInvocationQueries[1], mInvocationQueryPending[1], mVertexInvocations[1]);
+      }
+
       // Draw background
+      mBackgroundTimeStamp->begin();
       mBackgroundProgram->use();
-      CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
-      CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, mEnvironmentTexture));
+      // Each sampler type gets a unit of its own, whichever of them is read.
+      const bool octahedralEnvironment = mEnvironmentLayout == MapLayout::Octahedral;
+      CHECK_GL_ERROR(glActiveTexture(octahedralEnvironment ? GL_TEXTURE1 : GL_TEXTURE0));
+      CHECK_GL_ERROR(glBindTexture(getTextureTarget(mEnvironmentLayout), mEnvironmentTexture));
       mBackgroundProgram->setIntUniform(mBackgroundProgram->getUniformLocation("sBackground"), 0); // GL_TEXTURE0
+      mBackgroundProgram->setIntUniform(mBackgroundProgram->getUniformLocation("sBackgroundOctahedral"), 1); // GL_TEXTURE1
+      mBackgroundProgram->setIntUniform(mBackgroundProgram->getUniformLocation("uOctahedral"), octahedralEnvironment);
+      setSunUniforms(*mBackgroundProgram, mSun, mDrawSun);
       mCubeMesh.draw();
+      mBackgroundTimeStamp->end();
       
-      // Draw sphere
+      // Draw sphere.
+      mShadingTimeStamp->begin();
       mPbrProgram->use();
-      CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
-      CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mIrradianceMap));
-      CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE1));
-      CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mPrefilterMap));
+      const bool octahedralIrradiance = mIrradianceLayout == MapLayout::Octahedral;
+      const bool octahedralPrefilter = mPrefilterLayout == MapLayout::Octahedral;
+      CHECK_GL_ERROR(glActiveTexture(octahedralIrradiance ? GL_TEXTURE3 : GL_TEXTURE0));
+      CHECK_GL_ERROR(glBindTexture(getTextureTarget(mIrradianceLayout), mIrradianceMap));
+      CHECK_GL_ERROR(glActiveTexture(octahedralPrefilter ? GL_TEXTURE4 : GL_TEXTURE1));
+      CHECK_GL_ERROR(glBindTexture(getTextureTarget(mPrefilterLayout), mPrefilterMap));
       CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE2));
       CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, mBrdfLUT));
       mPbrProgram->setVec3fUniform(mPbrProgram->getUniformLocation("uAlbedo"), mAlbedo);
@@ -96,15 +389,80 @@ namespace Akoylasar
       mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("sIrradianceMap"), 0); // GL_TEXTURE1
       mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("sPrefilterMap"), 1); // GL_TEXTURE2
       mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("sBrdf"), 2); // GL_TEXTURE2
-      mSphereMesh.draw();
+      mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("sIrradianceOctahedralMap"), 3); // GL_TEXTURE3
+      mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("sPrefilterOctahedralMap"), 4); // GL_TEXTURE4
+      mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("uIrradianceOctahedral"), octahedralIrradiance);
+      mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("uPrefilterOctahedral"), octahedralPrefilter);
+      mPbrProgram->setIntUniform(mPbrProgram->getUniformLocation("uUseIrradianceSh"), mUseIrradianceSh);
+      mPbrProgram->setVec3fArrayUniform<9>(mPbrProgram->getUniformLocation("uIrradianceSh"), mIrradianceSh);
+      mPbrProgram->setFloatUniform(mPbrProgram->getUniformLocation("uIrradianceRgbmRange"), mIrradianceRgbmRange);
+      mPbrProgram->setFloatUniform(mPbrProgram->getUniformLocation("uPrefilterRgbmRange"), mPrefilterRgbmRange);
+      setSunUniforms(*mPbrProgram, mSun, mDrawSun);
+      setMeshUniforms(*mPbrProgram, mSphereMesh);
+      mSphereLod = 0;
+      if (mLodEnabled)
+      {
+        GLint viewport[4];
+        CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewport));
+        mSphereLod = mSphereMesh.selectLod(camera, kSphereModel, float(viewport[3]), mLodPixelError);
+      }
+      mDrawnTriangles = mSphereMesh.lods[mSphereLod].indexCount / 3;
+      // Only the full mesh compares with the draw in build order.
+      const bool countInvocations = mPipelineStatistics && !mInvocationQueryPending[0] && mSphereLod == 0;
+      if (countInvocations)
+        CHECK_GL_ERROR(glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, mInvocationQueries[0]));
+      mSphereMesh.draw(mSphereLod);
+      if (countInvocations)
+      {
+        CHECK_GL_ERROR(glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB));
+        mInvocationQueryPending[0] = true;
+      }
+      mShadingTimeStamp->end();
+      // The mesh in the order it was built in, drawn once with the same program and nothing
+      // written, for its invocation count.
+      if (mSourceMeshReady)
+      {
+        CHECK_GL_ERROR(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+        CHECK_GL_ERROR(glDepthMask(GL_FALSE));
+        setMeshUniforms(*mPbrProgram, mSourceMesh);
+        CHECK_GL_ERROR(glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, mInvocationQueries[1]));
+        mSourceMesh.draw();
+        CHECK_GL_ERROR(glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB));
+        CHECK_GL_ERROR(glDepthMask(GL_TRUE));
+        CHECK_GL_ERROR(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+        GpuMesh::releaseGpuMesh(mSourceMesh);
+        mSourceMeshReady = false;
+        mInvocationQueryPending[1] = true;
+      }
+      mProfiler->swapBuffers();
+      mPassesTimed = true;
+
+#ifndef NDEBUG
+      // Debug builds check the embedded table against brdf.fs once the first frame is drawn.
+      if (!mBrdfLutChecked)
+      {
+        mBrdfLutChecked = true;
+        validateBrdfLut();
+      }
+#endif
     }
     else
     {
-      ImageData* image = mImage.exchange(nullptr, std::memory_order_acq_rel);
-      if (image)
+      // Take the environment off the pipeline once the sphere mesh is there as well.
+      if (!mPendingImage && mPipeline && JobSystem::isFinished(mSphereMeshJob))
+      {
+        if (auto image = mPipeline->popReady())
+          steupResources(image.release());
+      }
+      if (mPendingImage)
       {
-        steupResources(image);
-        mInitialised = true;
+        mUploader->update(kUploadBytesPerFrame);
+        if (mUploader->isIdle())
+        {
+          finishResources();
+          mInitialised = true;
+          prefetchNext();
+        }
       }
     }
   }
@@ -118,81 +476,582 @@ namespace Akoylasar
       ImGui::SliderFloat("Roughness", &mRoughness, 0, 1);
       ImGui::Separator();
       ImGui::SliderFloat("AO", &mAo, 0, 1.0);
+      ImGui::Text("Mesh: %zu triangles, %zu vertices, %s in %.2f(ms), buffers filled in %.2f(ms)", mMeshReport.triangles,
+                  mMeshReport.vertices, mMeshReport.cacheHit ? "mapped from the mesh cache" : "built", mMeshReport.loadMs,
+                  mMeshReport.uploadMs);
+      const ObjLoadStats& objStats = mMeshReport.objStats;
+      if (objStats.vertices)
+        ImGui::Text("OBJ parsed in %.2f(ms) on %d threads, merged in %.2f(ms)", objStats.parseMs, objStats.threads, objStats.dedupMs);
+      // The simulated FIFO of MeshOptimizer::kDefaultCacheSize entries; before is only known when
+      // the mesh was built rather than mapped.
+      const MeshOptimizationStats& optimization = mMeshReport.optimization;
+      if (optimization.cacheBefore.transformedVertices)
+      {
+        ImGui::Text("Vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overfetch %.2f -> %.2f", optimization.cacheBefore.acmr,
+                    optimization.cacheAfter.acmr, optimization.cacheBefore.atvr, optimization.cacheAfter.atvr,
+                    optimization.overfetchBefore, optimization.overfetchAfter);
+        ImGui::Text("Optimised in %.2f(ms) cache, %.2f(ms) overdraw (%zu clusters), %.2f(ms) fetch", optimization.vertexCacheMs,
+                    optimization.overdrawMs, optimization.clusters, optimization.vertexFetchMs);
+      }
+      else
+        ImGui::Text("Vertex cache: ACMR %.3f, ATVR %.3f, overfetch %.2f", optimization.cacheAfter.acmr, optimization.cacheAfter.atvr,
+                    optimization.overfetchAfter);
+      if (mMeshReport.hasPackedVertices)
+      {
+        ImGui::Text("Vertex buffer: %.1f(MB), %.1f(MB) as PackedVertex, %.1f(MB) as Vertex", mMeshReport.vertexBufferBytes / (1024.0 * 1024.0),
+                    mMeshReport.vertices * sizeof(PackedVertex) / (1024.0 * 1024.0), mMeshReport.vertices * sizeof(Vertex) / (1024.0 * 1024.0));
+        // Compare the shading pass's GPU time below between the two.
+        if (JobSystem::isFinished(mSphereMeshJob) && ImGui::Checkbox("Quantized vertices", &mQuantizeVertices))
+          loadSceneMesh();
+      }
+      // Errors are the deviation from the full mesh in object space, the model spans
+      // 2 * kModelRadius.
+      ImGui::Checkbox("Levels of detail", &mLodEnabled);
+      if (mLodEnabled)
+      {
+        ImGui::SameLine();
+        ImGui::SliderFloat("Max error (px)", &mLodPixelError, 0.25f, 8.0f);
+      }
+      ImGui::Text("Drawing level %d of %zu, %zu triangles", mSphereLod, mSphereMesh.lods.size(), mDrawnTriangles);
+      for (std::size_t i = 1; i < mSphereMesh.lods.size(); ++i)
+      {
+        const MeshLod& lod = mSphereMesh.lods[i];
+        const bool built = i < mMeshReport.lodStats.size();
+        ImGui::Text("  Level %zu: %u triangles, error %.5f%s", i, lod.indexCount / 3, lod.error, built ? "," : "");
+        if (built)
+        {
+          ImGui::SameLine();
+          ImGui::Text("simplified in %.2f(ms), %d passes", mMeshReport.lodStats[i].ms, mMeshReport.lodStats[i].passes);
+        }
+      }
+      if (mPipelineStatistics)
+      {
+        ImGui::Text("Vertex shader invocations: %llu", static_cast<unsigned long long>(mVertexInvocations[0]));
+        if (mVertexInvocations[1])
+        {
+          ImGui::SameLine();
+          ImGui::Text(", %llu in build order", static_cast<unsigned long long>(mVertexInvocations[1]));
+        }
+        else if (!mSourceMeshRequested && ImGui::Button("Count invocations in build order"))
+          requestSourceMesh();
+      }
+      ImGui::Separator();
+      drawLibraryUI();
+      ImGui::Separator();
+      ImGui::Text("Environment ready after %.2f(ms), peak RSS %.1f(MB)", mBakeReport.startupMs, mBakeReport.peakResidentBytes / (1024.0 * 1024.0));
+      ImGui::Text("HDR decode: %.2f(ms) at 1/%d resolution, %.1f(MB) peak", mBakeReport.decodeMs,
+                  mBakeReport.decodeDownsampleFactor, mBakeReport.decodePeakBytes / (1024.0 * 1024.0));
+      if (!mSun.isEmpty())
+      {
+        ImGui::Text("Sun (extracted in %.2f(ms)): direction (%.3f, %.3f, %.3f), irradiance (%.1f, %.1f, %.1f), %.2e(sr)",
+                    mBakeReport.sunExtractionMs, mSun.direction.x, mSun.direction.y, mSun.direction.z,
+                    mSun.irradiance.x, mSun.irradiance.y, mSun.irradiance.z, mSun.solidAngle);
+        ImGui::Checkbox("Draw analytic sun", &mDrawSun);
+      }
+      else
+        ImGui::Text("No sun extracted");
+      if (mBakeReport.cubeMapMs > 0.0)
+        ImGui::Text("Equirect to cubemap (CPU): %dx%d, %d mips in %.2f(ms)", mBakeReport.cubeMapSize, mBakeReport.cubeMapSize,
+                    mBakeReport.cubeMapMipLevels, mBakeReport.cubeMapMs);
+      else
+        ImGui::Text("Environment cubemap: %dx%d, %d mips from the bake cache", mBakeReport.cubeMapSize, mBakeReport.cubeMapSize,
+                    mBakeReport.cubeMapMipLevels);
+      for (const auto& stage : mPipeline->getStats())
+        ImGui::Text("%s: %zu done, %zu queued (peak %zu), %.2f(ms) busy, %.1f/s", stage.name, stage.processed,
+                    stage.queueDepth, stage.peakQueueDepth, stage.busyMs, stage.itemsPerSecond);
+      ImGui::Text("Texture uploads: %.1f(MB), %.1f(MB) saved over GL_FLOAT", mBakeReport.uploadedBytes / (1024.0 * 1024.0),
+                  (mBakeReport.uploadedBytesAsFloat - mBakeReport.uploadedBytes) / (1024.0 * 1024.0));
+      if (mBakeReport.vramSavedBytes)
+        ImGui::Text("BC6H: %.1f(MB) VRAM saved over GL_RGB16F", mBakeReport.vramSavedBytes / (1024.0 * 1024.0));
+      if (mBakeReport.bc6hBlocks)
+        ImGui::Text("BC6H encode: %zu blocks in %.2f(ms), %.0f blocks/s, PSNR %.1f/%.1f/%.1f(dB) source/irradiance/prefilter",
+                    mBakeReport.bc6hBlocks, mBakeReport.bc6hEncodeMs, mBakeReport.bc6hBlocks * 1000.0 / mBakeReport.bc6hEncodeMs,
+                    mBakeReport.sourcePsnr, mBakeReport.irradiancePsnr, mBakeReport.prefilterPsnr);
+      int irradianceStorage = int(mIrradianceStorage);
+      if (ImGui::Combo("Irradiance storage", &irradianceStorage, kTextureStorageNames, IM_ARRAYSIZE(kTextureStorageNames)))
+      {
+        mIrradianceStorage = TextureStorage(irradianceStorage);
+        applyIrradianceStorage();
+      }
+      // The float copy only exists once the full bake is done.
+      int prefilterStorage = int(mPrefilterStorage);
+      if (!mPrefilterBakePending &&
+          ImGui::Combo("Prefilter storage", &prefilterStorage, kTextureStorageNames, IM_ARRAYSIZE(kTextureStorageNames)))
+      {
+        mPrefilterStorage = TextureStorage(prefilterStorage);
+        applyPrefilterStorage();
+      }
+      ImGui::Text("Irradiance %.1f(KB), prefilter %.1f(KB), %.1f(KB) as RGB16F", mIrradianceBytes / 1024.0, mPrefilterBytes / 1024.0,
+                  (mIrradianceData.texels.size() + mPrefilterData.texels.size()) * sizeof(std::uint16_t) / 1024.0);
+      // A switch rebakes the map on the CPU; the GLSL bakes only write cubemaps, so their
+      // buttons go away while the map they would replace is octahedral.
+      const bool canSwitchLayout = !mLayoutBakePending && !mPrefilterBakePending;
+      int environmentLayout = int(mEnvironmentLayout);
+      if (canSwitchLayout && ImGui::Combo("Environment layout", &environmentLayout, kMapLayoutNames, IM_ARRAYSIZE(kMapLayoutNames)) &&
+          MapLayout(environmentLayout) != mEnvironmentLayout)
+        setEnvironmentLayout(MapLayout(environmentLayout));
+      int irradianceLayout = int(mIrradianceLayout);
+      if (canSwitchLayout && ImGui::Combo("Irradiance layout", &irradianceLayout, kMapLayoutNames, IM_ARRAYSIZE(kMapLayoutNames)) &&
+          MapLayout(irradianceLayout) != mIrradianceLayout)
+        setIrradianceLayout(MapLayout(irradianceLayout));
+      int prefilterLayout = int(mPrefilterLayout);
+      if (canSwitchLayout && ImGui::Combo("Prefilter layout", &prefilterLayout, kMapLayoutNames, IM_ARRAYSIZE(kMapLayoutNames)) &&
+          MapLayout(prefilterLayout) != mPrefilterLayout)
+        setPrefilterLayout(MapLayout(prefilterLayout));
+      if (mLayoutBakePending)
+        ImGui::Text("Switching layout...");
+      ImGui::Text("Environment %s %.1f(MB), irradiance %s, prefilter %s", kMapLayoutNames[int(mEnvironmentLayout)],
+                  mEnvironmentBytes / (1024.0 * 1024.0), kMapLayoutNames[int(mIrradianceLayout)], kMapLayoutNames[int(mPrefilterLayout)]);
+      ImGui::Text("Layout switch (CPU): environment %.2f(ms), irradiance %.2f(ms), prefilter %.2f(ms)", mBakeReport.environmentLayoutMs,
+                  mBakeReport.irradianceLayoutMs, mBakeReport.prefilterLayoutMs);
+      ImGui::Text("Background pass (GPU): %.3f(ms), shading pass (GPU): %.3f(ms)", mBackgroundGpuMs, mShadingGpuMs);
+      ImGui::Text("Streamed in %zu chunks over %d frames (%d stalls): %.2f(ms)", mBakeReport.uploadStats.chunks,
+                  mBakeReport.uploadStats.frames, mBakeReport.uploadStats.stalls, mBakeReport.uploadMs);
+      ImGui::Text("Bake cache %s: %.2f(ms)", mBakeReport.bakeCacheHit ? "hit" : "miss", mBakeReport.bakeCacheMs);
+      ImGui::Checkbox("Evaluate irradiance SH per pixel", &mUseIrradianceSh);
+      ImGui::Text("SH projection (CPU): %.2f(ms)", mBakeReport.shProjectionMs);
+      ImGui::Text("Irradiance reconstruction (CPU): %.2f(ms)", mBakeReport.irradianceBakeMs);
+      if (mIrradianceLayout == MapLayout::CubeMap && ImGui::Button("Validate irradiance against GLSL"))
+        validateIrradianceMap();
+      if (mBakeReport.irradianceValidated)
+      {
+        ImGui::Text("Irradiance (GLSL): %.2f(ms)", mBakeReport.glslIrradianceMs);
+        ImGui::Text("Irradiance error max: %.4f rms: %.4f", mBakeReport.irradianceMaxError, mBakeReport.irradianceRmsError);
+      }
+      ImGui::Text("BRDF LUT (embedded): %dx%d", BrdfLut::getEmbeddedSize(), BrdfLut::getEmbeddedSize());
+      if (ImGui::Button("Validate BRDF LUT against GLSL"))
+        validateBrdfLut();
+      if (mBakeReport.brdfLutValidated)
+      {
+        ImGui::Text("BRDF LUT (GLSL): %.2f(ms)", mBakeReport.glslBrdfLutMs);
+        ImGui::Text("BRDF LUT error max: %.4f rms: %.4f (%s)", mBakeReport.brdfLutMaxError, mBakeReport.brdfLutRmsError,
+                    mBakeReport.brdfLutPassed ? "passed" : "FAILED");
+      }
+      bool filtered = mPrefilterSettings.mode == PrefilterMode::FilteredImportanceSampling;
+      if (ImGui::Checkbox("Filtered importance sampling", &filtered))
+        mPrefilterSettings.mode = filtered ? PrefilterMode::FilteredImportanceSampling : PrefilterMode::BruteForce;
+      if (filtered)
+        ImGui::SliderFloat("Target error", &mPrefilterSettings.targetError, 0.01f, 0.5f);
+      ImGui::SliderFloat("Bake budget per frame (GPU ms)", &mBakeBudgetMs, 0.5f, 16.0f);
+      const bool canBakeGlsl = mPrefilterLayout == MapLayout::CubeMap && !mLayoutBakePending;
+      if (mPrefilterBakePending)
+        ImGui::ProgressBar(mBakeScheduler->getProgress(), ImVec2(0.0f, 0.0f), "Baking prefilter");
+      else if (canBakeGlsl && ImGui::Button("Rebake prefilter"))
+        startPrefilterBake();
+      const BakeScheduler::Stats& bakeStats = mBakeReport.prefilterBakeStats;
+      ImGui::Text("Prefilter (GLSL): %.2f(ms) in %d jobs over %d frames, worst frame %.2f(ms)",
+                  mBakeReport.glslPrefilterMs, bakeStats.jobs, bakeStats.frames, bakeStats.worstBatchGpuMs);
+      if (mBakeReport.previewBakeMs > 0.0)
+        ImGui::Text("Prefilter preview %dx%d (GLSL): %.2f(ms)", kPreviewPrefilterSize, kPreviewPrefilterSize, mBakeReport.previewBakeMs);
+      if (!mPrefilterBakePending && canBakeGlsl && ImGui::Button("Validate CPU prefilter against GLSL"))
+        validatePrefilterMap();
+      if (mBakeReport.prefilterValidated)
+      {
+        for (const auto& mip : mBakeReport.cpuPrefilterStats)
+          ImGui::Text("Prefilter (CPU) %dx%d %d spp: %.2f(ms) %.2f(Mtexels/s)", mip.size, mip.size, mip.numSamples, mip.ms, mip.texelsPerSecond * 1e-6);
+        ImGui::Text("Prefilter error max: %.4f rms: %.4f", mBakeReport.prefilterMaxError, mBakeReport.prefilterRmsError);
+      }
     }
   }
   
+  void IBLScene::drawLibraryUI()
+  {
+    // Switching needs the environment's textures to themselves.
+    const bool canSwitch = !mPrefilterBakePending && !mLayoutBakePending;
+    const std::vector<std::filesystem::path>& paths = mLibrary->getPaths();
+    if (canSwitch && ImGui::BeginCombo("Environment", mEnvironmentPath.filename().string().c_str()))
+    {
+      for (const auto& path : paths)
+      {
+        if (ImGui::Selectable(path.filename().string().c_str(), path == mEnvironmentPath))
+          switchEnvironment(path);
+      }
+      ImGui::EndCombo();
+    }
+    if (canSwitch && paths.size() > 1 && ImGui::Button("Next environment"))
+      switchEnvironment(paths[(mLibrary->getIndex(mEnvironmentPath) + 1) % paths.size()]);
+    const EnvironmentLibrary::Stats stats = mLibrary->getStats();
+    ImGui::Text("Library: %zu resident, %.1f of %.1f(MB), hit rate %.0f%% (%zu hits, %zu misses), %zu evictions",
+                stats.residentCount, stats.residentBytes / (1024.0 * 1024.0), stats.budgetBytes / (1024.0 * 1024.0),
+                stats.getHitRate() * 100.0, stats.hits, stats.misses, stats.evictions);
+    ImGui::Text("Last switch: %.3f(ms)", mLastSwitchMs);
+    if (!mSwitchTarget.empty())
+      ImGui::Text("Switching to %s once loaded...", mSwitchTarget.filename().string().c_str());
+    else if (!mPrefetchPath.empty())
+      ImGui::Text("Prefetching %s...", mPrefetchPath.filename().string().c_str());
+  }
+
+  void IBLScene::loadSceneMesh()
+  {
+    // The sphere is dense enough to be worth building off the main thread, and a model to load
+    // takes its place. The buffers are filled straight from the mesh cache's mapping on a hit,
+    // so switching the vertex format later reloads it from there.
+    auto sceneMesh = std::make_shared<SceneMesh>();
+    const JobSystem::JobHandle buildSphere = mJobs->submit([this, sceneMesh]() { buildSceneMesh(mMeshCache, *sceneMesh); });
+    mSphereMeshJob = mJobs->submitMainThread([this, sceneMesh]()
+    {
+      if (mSphereMesh.indexCount)
+        GpuMesh::releaseGpuMesh(mSphereMesh);
+      const PackedVertices& packed = sceneMesh->packed;
+      const bool hasPacked = packed.format == VertexPacking::kFormat && packed.stride == sizeof(PackedVertex);
+      const auto start = Clock::now();
+      if (mQuantizeVertices && hasPacked)
+      {
+        mSphereMesh = GpuMesh::createGpuMesh(sceneMesh->view, reinterpret_cast<const PackedVertex*>(packed.data),
+                                             Neon::Vec3f(packed.boundsMin[0], packed.boundsMin[1], packed.boundsMin[2]),
+                                             Neon::Vec3f(packed.boundsMax[0], packed.boundsMax[1], packed.boundsMax[2]));
+      }
+      else
+        mSphereMesh = GpuMesh::createGpuMesh(sceneMesh->view);
+      mMeshReport.uploadMs = getElapsedMs(start);
+      mMeshReport.loadMs = sceneMesh->ms;
+      mMeshReport.cacheHit = sceneMesh->cacheHit;
+      mMeshReport.triangles = sceneMesh->view.getBaseIndexCount() / 3;
+      mMeshReport.vertices = sceneMesh->view.vertexCount;
+      mMeshReport.objStats = sceneMesh->stats;
+      mMeshReport.optimization = sceneMesh->optimization;
+      mMeshReport.hasPackedVertices = hasPacked;
+      mMeshReport.vertexBufferBytes = mSphereMesh.vertexBufferBytes;
+      mMeshReport.lodStats = sceneMesh->lodStats;
+      // The shading pass average restarts with the new format.
+      mShadingGpuMs = 0.0;
+    }, {buildSphere});
+  }
+
+  void IBLScene::requestSourceMesh()
+  {
+    mSourceMeshRequested = true;
+    auto source = std::make_shared<Mesh>();
+    const JobSystem::JobHandle build = mJobs->submit([source]()
+    {
+      std::error_code error;
+      bool loaded = false;
+      *source = std::move(*buildSourceMesh(std::filesystem::exists(kModelPath, error), loaded, nullptr));
+    });
+    mJobs->submitMainThread([this, source]()
+    {
+      mSourceMesh = GpuMesh::createGpuMesh(*source);
+      mSourceMeshReady = true;
+    }, {build});
+  }
+
   void IBLScene::shutdown()
   {
     if (mInitialised)
     {
       GpuMesh::releaseGpuMesh(mCubeMesh);
+      if (mSourceMeshReady)
+        GpuMesh::releaseGpuMesh(mSourceMesh);
+      mSourceMeshReady = false;
+      if (mPipelineStatistics)
+        CHECK_GL_ERROR(glDeleteQueries(2, mInvocationQueries));
       
       mBackgroundProgram.release();
       
       CHECK_GL_ERROR(glDeleteTextures(1, &mEnvironmentTexture));
       CHECK_GL_ERROR(glDeleteTextures(1, &mPrefilterMap));
+      CHECK_GL_ERROR(glDeleteTextures(1, &mBakeTarget));
       CHECK_GL_ERROR(glDeleteTextures(1, &mBrdfLUT));
+      mPrefetched.release();
+      mLibrary.reset();
       mInitialised = false;
     }
+    mPendingImage.reset();
+    mPipeline.reset();
+    mPrefetchImage.reset();
+    mLibraryPipeline.reset();
+    mPrefetchPath.clear();
+    mSwitchTarget.clear();
+    mUploader.reset();
+    mBakeScheduler.reset();
+    mProfiler.reset();
+    mBackgroundTimeStamp = nullptr;
+    mShadingTimeStamp = nullptr;
+    mPassesTimed = false;
+    mPrefilterBakePending = false;
   }
   
   void IBLScene::loadAssets()
   {
-    // Load image from disk and create a GPU texture from it.
-    std::filesystem::path imagePath {"images/Barce_Rooftop_C_3k.hdr"};
-    int w, h, numComps;
-    stbi_set_flip_vertically_on_load(true);
-    float* data = stbi_loadf(imagePath.c_str(), &w, &h, &numComps, 0);
-    if (!data)
-    {
-      std::cerr << "Failed to load texture with path " << imagePath << std::endl;
-      return;
-    }
-    ImageData* image = new ImageData;
-    image->width = w;
-    image->height = h;
-    image->image = data;
-    mImage.store(image, std::memory_order_release);
+    // Read, decode, half conversion and the CPU bakes overlap on the job system; render picks
+    // the result up for upload.
+    mEnvironmentPath = kDefaultEnvironment;
+    mPipeline->submit(mEnvironmentPath);
   }
   
   void IBLScene::steupResources(ImageData* image)
   {
-    setupBackgroundTexture(image);
+    // Allocate every texture and queue its texels; the uploader spreads them over the next
+    // frames, reading straight from the container mapping or the loader's buffers.
+    mPendingImage.reset(image);
+    mUploadStartTime = Clock::now();
+    setupBackgroundTexture(image->environment);
+    setupIrradianceMap(*image);
+    setupBrdLUT();
+    // Set on a cache hit, or when the pipeline baked the prefilter map on the CPU.
+    if (image->environment.prefilter)
+      uploadCachedMaps(image->environment);
+  }
+
+  void IBLScene::finishResources()
+  {
+    mBakeReport.uploadMs = getElapsedMs(mUploadStartTime);
+    mBakeReport.uploadStats = mUploader->getStats();
+    std::cout << "Streamed " << mBakeReport.uploadStats.bytes / (1024.0 * 1024.0) << "MB in " << mBakeReport.uploadStats.chunks
+              << " chunks over " << mBakeReport.uploadStats.frames << " frames, " << mBakeReport.uploadMs << "ms" << std::endl;
+    mPipeline->finishUpload(mBakeReport.uploadMs);
+
+    mBakeReport.bc6hEncodeMs = mPendingImage->bc6hEncodeMs;
+    mBakeReport.bc6hBlocks = mPendingImage->bc6hBlocks;
+    mBakeReport.sourcePsnr = mPendingImage->sourcePsnr;
+    mBakeReport.irradiancePsnr = mPendingImage->irradiancePsnr;
+    mBakeReport.prefilterPsnr = mPendingImage->prefilterPsnr;
 
     // Save viewport size.
     GLint viewPort[4];
     CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewPort));
 
-    setupIrradianceMap();
-    setupPrefilterEnvMap();
-    setupBrdLUT();
-    
-    stbi_image_free(image->image);
-    delete image;
+    mBakeReport.bakeCacheHit = mPendingImage->cacheHit;
+    if (mPendingImage->cacheHit)
+    {
+      mBakeReport.bakeCacheMs = mBakeReport.uploadMs;
+      std::cout << "Prefilter map streamed from the bake cache in " << mBakeReport.bakeCacheMs << "ms" << std::endl;
+      // Unmaps the container.
+      mPendingImage.reset();
+    }
+    else if (mPendingImage->environment.prefilter)
+    {
+      mBakeReport.bakeCacheMs = mPendingImage->prefilterBakeMs;
+      std::cout << "Prefilter map baked on the CPU in " << mBakeReport.bakeCacheMs << "ms" << std::endl;
+      storeInCache(std::move(mPendingImage));
+    }
+    else
+    {
+      // Show a cheap bake right away and spread the full one over the next frames. The image
+      // is kept until then so that the result can be stored in the cache.
+      bakePrefilterPreview();
+      startPrefilterBake();
+    }
 
     // Restore viewport size.
     CHECK_GL_ERROR(glViewport(viewPort[0], viewPort[1], viewPort[2], viewPort[3]));
+
+    mBakeReport.startupMs = getElapsedMs(mInitialiseTime);
+    mBakeReport.peakResidentBytes = ProcessStats::getPeakResidentBytes();
+    std::cout << "Environment ready " << mBakeReport.startupMs << "ms after initialise, peak RSS "
+              << mBakeReport.peakResidentBytes / (1024.0 * 1024.0) << "MB" << std::endl;
+    std::cout << "Uploaded " << mBakeReport.uploadedBytes / (1024.0 * 1024.0) << "MB of half float texels, "
+              << (mBakeReport.uploadedBytesAsFloat - mBakeReport.uploadedBytes) / (1024.0 * 1024.0) << "MB less than GL_FLOAT" << std::endl;
   }
   
-  void IBLScene::setupBackgroundTexture(ImageData* image)
-  {
-    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, mEnvironmentTexture));
-    CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D,
-                                0, // level
-                                GL_RGB16F, // internal format
-                                image->width,
-                                image->height,
-                                0, // border
-                                GL_RGB,
-                                GL_FLOAT, // data format
-                                image->image));
-    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  void IBLScene::swapEnvironment(ResidentEnvironment& other)
+  {
+    std::swap(mEnvironmentPath, other.path);
+    std::swap(mEnvironmentTexture, other.environmentTexture);
+    std::swap(mEnvironmentCompressed, other.environmentCompressed);
+    std::swap(mEnvironmentLayout, other.environmentLayout);
+    std::swap(mEnvironmentBytes, other.environmentBytes);
+    std::swap(mIrradianceMap, other.irradianceMap);
+    std::swap(mIrradianceData, other.irradianceData);
+    std::swap(mIrradianceStorage, other.irradianceStorage);
+    std::swap(mIrradianceRgbmRange, other.irradianceRgbmRange);
+    std::swap(mIrradianceBytes, other.irradianceBytes);
+    std::swap(mIrradianceLayout, other.irradianceLayout);
+    std::swap(mRadianceSh, other.radianceSh);
+    std::swap(mIrradianceSh, other.irradianceSh);
+    std::swap(mSun, other.sun);
+    std::swap(mPrefilterMap, other.prefilterMap);
+    std::swap(mPrefilterData, other.prefilterData);
+    std::swap(mPrefilterStorage, other.prefilterStorage);
+    std::swap(mPrefilterRgbmRange, other.prefilterRgbmRange);
+    std::swap(mPrefilterBytes, other.prefilterBytes);
+    std::swap(mPrefilterLayout, other.prefilterLayout);
+  }
+
+  void IBLScene::switchEnvironment(const std::filesystem::path& path)
+  {
+    // Bakes and layout switches write into the current environment's textures.
+    if (path == mEnvironmentPath || mPrefilterBakePending || mLayoutBakePending)
+      return;
+    const auto start = Clock::now();
+    ResidentEnvironment* resident = path == mSwitchTarget ? mLibrary->find(path) : mLibrary->acquire(path);
+    if (!resident)
+    {
+      // Switched to as soon as it has been loaded, right after the prefetch in flight if any.
+      mSwitchTarget = path;
+      prefetchNext();
+      return;
+    }
+    // The environment left behind takes the resident one's place, as the most recently used.
+    swapEnvironment(*resident);
+    mSwitchTarget.clear();
+    mShadingGpuMs = 0.0;
+    mBackgroundGpuMs = 0.0;
+    mLastSwitchMs = getElapsedMs(start);
+    std::cout << "Switched to " << mEnvironmentPath << " in " << mLastSwitchMs << "ms" << std::endl;
+    prefetchNext();
+  }
+
+  void IBLScene::updateLibrary()
+  {
+    // A switch that landed while a bake held it back.
+    if (!mSwitchTarget.empty() && mLibrary->contains(mSwitchTarget))
+      switchEnvironment(mSwitchTarget);
+    if (mPrefetchImage)
+    {
+      mUploader->update(kUploadBytesPerFrame);
+      if (mUploader->isIdle())
+        finishPrefetchUpload();
+    }
+    else if (auto image = mLibraryPipeline->popReady())
+      startPrefetchUpload(std::move(image));
+    else if (!mPrefetchPath.empty() && mLibraryPipeline->isIdle())
+    {
+      // popReady dropped it, the load failed.
+      std::cerr << "Failed to load environment " << mPrefetchPath << std::endl;
+      if (mSwitchTarget == mPrefetchPath)
+        mSwitchTarget.clear();
+      mPrefetchPath.clear();
+    }
+  }
+
+  void IBLScene::prefetchNext()
+  {
+    if (!mPrefetchPath.empty())
+      return;
+    // A pending switch goes first, otherwise the environment after the current one.
+    const bool loadTarget = !mSwitchTarget.empty() && !mLibrary->contains(mSwitchTarget);
+    mPrefetchPath = loadTarget ? mSwitchTarget : mLibrary->getPrefetchCandidate(mEnvironmentPath);
+    if (!mPrefetchPath.empty())
+      mLibraryPipeline->submit(mPrefetchPath);
   }
 
-  void IBLScene::setupIrradianceMap()
+  void IBLScene::startPrefetchUpload(std::unique_ptr<ImageData> image)
+  {
+    ResidentEnvironment incoming;
+    incoming.path = image->path;
+    incoming.irradianceStorage = mIrradianceStorage;
+    incoming.prefilterStorage = mPrefilterStorage;
+    CHECK_GL_ERROR(glGenTextures(1, &incoming.environmentTexture));
+    CHECK_GL_ERROR(glGenTextures(1, &incoming.irradianceMap));
+    CHECK_GL_ERROR(glGenTextures(1, &incoming.prefilterMap));
+
+    // The setup functions fill in the scene's own environment, so point it at the incoming one
+    // while they queue the uploads. The report keeps describing the startup environment.
+    const BakeReport report = mBakeReport;
+    swapEnvironment(incoming);
+    setupBackgroundTexture(image->environment);
+    setupIrradianceMap(*image);
+    uploadCachedMaps(image->environment);
+    swapEnvironment(incoming);
+    mBakeReport = report;
+
+    mPrefetched = std::move(incoming);
+    mPrefetchImage = std::move(image);
+    mUploadStartTime = Clock::now();
+  }
+
+  void IBLScene::finishPrefetchUpload()
+  {
+    const double uploadMs = getElapsedMs(mUploadStartTime);
+    mLibraryPipeline->finishUpload(uploadMs);
+    if (mPrefetchImage->cacheHit)
+      mPrefetchImage.reset();
+    else
+      storeInCache(std::move(mPrefetchImage));
+    std::cout << "Prefetched " << mPrefetched.path << " (" << mPrefetched.getBytes() / (1024.0 * 1024.0) << "MB) in "
+              << uploadMs << "ms" << std::endl;
+
+    const std::filesystem::path path = mPrefetched.path;
+    mLibrary->insert(std::move(mPrefetched), mEnvironmentBytes + mIrradianceBytes + mPrefilterBytes);
+    mPrefetched = ResidentEnvironment();
+    mPrefetchPath.clear();
+    if (path == mSwitchTarget)
+      switchEnvironment(path);
+    else
+      prefetchNext();
+  }
+
+  void IBLScene::setupBackgroundTexture(const EnvironmentView& environment)
+  {
+    // The pipeline resampled the panorama to a cubemap and built its mips, so every shader does
+    // plain cube lookups. Half floats or BC6H blocks stream straight from the container mapping
+    // (or the loader's buffer on a miss). The GLSL prefilter bake reads the halves, so the
+    // cubemap is only compressed once that bake is done.
+    mEnvironmentCompressed = environment.sourceBc6h && environment.prefilter;
+    mEnvironmentBytes = mEnvironmentCompressed ? Bc6hEncoder::getCubeMapOffset(environment.sourceSize, environment.sourceMipLevels)
+                                               : EnvironmentContainer::getCubeMapOffset(environment.sourceSize, environment.sourceMipLevels) * sizeof(std::uint16_t);
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mEnvironmentTexture));
+    for (int mip = 0; mip < environment.sourceMipLevels; ++mip)
+    {
+      const int size = std::max(environment.sourceSize >> mip, 1);
+      const std::uint16_t* texels = environment.source + EnvironmentContainer::getCubeMapOffset(environment.sourceSize, mip);
+      for (unsigned int i = 0; i < 6; ++i)
+      {
+        if (mEnvironmentCompressed)
+          uploadBc6hTexture(mEnvironmentTexture, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, size, size,
+                            environment.sourceBc6h + Bc6hEncoder::getCubeMapOffset(environment.sourceSize, mip) + Bc6hEncoder::getCompressedSize(size, size) * i);
+        else
+          uploadHalfTexture(mEnvironmentTexture, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB16F,
+                            size, size, GL_RGB, texels + std::size_t(size) * size * 3 * i);
+      }
+    }
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, environment.sourceMipLevels - 1));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
+
+  void IBLScene::setupIrradianceMap(const ImageData& image)
+  {
+    mIrradianceData = image.irradiance;
+    mRadianceSh = image.environment.radianceSh;
+    mIrradianceSh = IBLBaker::convolveIrradiance(mRadianceSh);
+    mBakeReport.decodeMs = image.decodeMs;
+    mBakeReport.decodeDownsampleFactor = image.downsampleFactor;
+    mBakeReport.decodePeakBytes = image.decodePeakBytes;
+    mBakeReport.sunExtractionMs = image.sunExtractionMs;
+    mSun = image.environment.sun;
+    mBakeReport.cubeMapMs = image.cubeMapMs;
+    mBakeReport.cubeMapSize = image.environment.sourceSize;
+    mBakeReport.cubeMapMipLevels = image.environment.sourceMipLevels;
+    mBakeReport.shProjectionMs = image.shProjectionMs;
+    mBakeReport.irradianceBakeMs = image.irradianceBakeMs;
+    std::cout << "Irradiance SH projection: " << image.shProjectionMs << "ms, "
+              << "cubemap reconstruction: " << image.irradianceBakeMs << "ms" << std::endl;
+
+    // Stream the CPU baked faces as halves or BC6H when they come in the chosen storage,
+    // otherwise pack them here, and configure the sampler.
+    const int size = image.environment.irradianceSize;
+    const std::size_t faceTexels = std::size_t(size) * size * 3;
+    const bool streamBc6h = mIrradianceStorage == TextureStorage::Bc6h && image.environment.irradianceBc6h;
+    if (streamBc6h || mIrradianceStorage == TextureStorage::Rgb16f)
+    {
+      CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mIrradianceMap));
+      for (unsigned int i = 0; i < 6; ++i)
+      {
+        if (streamBc6h)
+          uploadBc6hTexture(mIrradianceMap, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, size, size,
+                            image.environment.irradianceBc6h + Bc6hEncoder::getCompressedSize(size, size) * i);
+        else
+          uploadHalfTexture(mIrradianceMap, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                            size, size, GL_RGB, image.environment.irradiance + faceTexels * i);
+      }
+      mIrradianceRgbmRange = 0.0f;
+      mIrradianceBytes = streamBc6h ? Bc6hEncoder::getCubeMapOffset(size, 1) : EnvironmentContainer::getCubeMapOffset(size, 1) * sizeof(std::uint16_t);
+    }
+    else
+      applyIrradianceStorage();
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
+
+  void IBLScene::bakeIrradianceMapGlsl(GLuint outputTexture)
   {
     ProgramInfo irradianceProgramInfo {std::make_pair("shaders/passThrough.vs", ""), std::make_pair("shaders/irradianceComputer.fs", "")};
     for (auto& pair : irradianceProgramInfo)
@@ -209,68 +1068,191 @@ namespace Akoylasar
     auto program = std::make_unique<ShaderProgram>(irradianceProgramInfo.at(0).second, irradianceProgramInfo.at(1).second);
     program->use();
 
-    // Generate the texture for prefilter map.
     // Allocate size for the cubemap sides and configure its sampler.
-    constexpr int kMapSize = 32;
-    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mIrradianceMap));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, outputTexture));
     for (unsigned int i = 0; i < 6; ++i)
-      CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, kMapSize, kMapSize, 0, GL_RGB, GL_FLOAT, nullptr));
+      CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, kIrradianceMapSize, kIrradianceMapSize, 0, GL_RGB, GL_HALF_FLOAT, nullptr));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
 
-    renderToCubeMap(mEnvironmentTexture, false, mIrradianceMap, kMapSize, kMapSize, *program, mCubeMesh, 0);
+    renderToCubeMap(mEnvironmentTexture, mEnvironmentLayout, outputTexture, kIrradianceMapSize, kIrradianceMapSize, *program, mCubeMesh, 0);
 
-    program.reset();  
+    program.reset();
   }
-  
-  void IBLScene::setupPrefilterEnvMap()
+
+  void IBLScene::validateIrradianceMap()
   {
-    ProgramInfo prefilterProgramInfo {std::make_pair("shaders/passThrough.vs", ""), std::make_pair("shaders/prefilterEnvMap.fs", "")};
-    for (auto& pair : prefilterProgramInfo)
+    // Bake the reference with the brute-force shader into a scratch cubemap and compare it
+    // with the SH reconstruction we uploaded.
+    GLint viewPort[4];
+    CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewPort));
+
+    GLuint reference;
+    CHECK_GL_ERROR(glGenTextures(1, &reference));
+    CHECK_GL_ERROR(glFinish());
+    const auto start = Clock::now();
+    bakeIrradianceMapGlsl(reference);
+    CHECK_GL_ERROR(glFinish());
+    mBakeReport.glslIrradianceMs = getElapsedMs(start);
+
+    const std::size_t faceFloats = kIrradianceMapSize * kIrradianceMapSize * 3;
+    std::vector<float> face(faceFloats);
+    double maxError = 0.0, sumSquaredError = 0.0;
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, reference));
+    for (int i = 0; i < 6; ++i)
     {
-      auto& path = pair.first;
-      auto& str = pair.second;
-      if (Common::readToString(path, str))
+      CHECK_GL_ERROR(glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, GL_FLOAT, face.data()));
+      const float* baked = mIrradianceData.getFace(0, i);
+      for (std::size_t j = 0; j < faceFloats; ++j)
       {
-        std::cerr << "Failed to load shader with path " << path << std::endl;
-        return;
+        const double error = std::abs(double(baked[j]) - face[j]);
+        maxError = std::max(maxError, error);
+        sumSquaredError += error * error;
       }
     }
+    CHECK_GL_ERROR(glDeleteTextures(1, &reference));
+    CHECK_GL_ERROR(glViewport(viewPort[0], viewPort[1], viewPort[2], viewPort[3]));
 
-    auto program = std::make_unique<ShaderProgram>(prefilterProgramInfo.at(0).second, prefilterProgramInfo.at(1).second);
-    program->use();
+    mBakeReport.irradianceMaxError = float(maxError);
+    mBakeReport.irradianceRmsError = float(std::sqrt(sumSquaredError / (6 * faceFloats)));
+    mBakeReport.irradianceValidated = true;
+    std::cout << "Irradiance GLSL bake: " << mBakeReport.glslIrradianceMs << "ms vs SH "
+              << mBakeReport.shProjectionMs + mBakeReport.irradianceBakeMs << "ms. "
+              << "Max error: " << maxError << " RMS error: " << mBakeReport.irradianceRmsError << std::endl;
+  }
+  
+  void IBLScene::setupPrefilterEnvMap()
+  {
+    // Bake the whole map in one go. Each mip level corresponding to a certain roughness value.
+    allocatePrefilterMap(mPrefilterMap, mPrefilterSettings.size, mPrefilterSettings.mipLevels);
+    if (mBakeScheduler->start(mEnvironmentTexture, mEnvironmentLayout, mPrefilterMap, mPrefilterSettings))
+      mBakeScheduler->finish();
+  }
 
-    // Generate the texture for prefilter map.
+  void IBLScene::allocatePrefilterMap(GLuint texture, int size, int mipLevels)
+  {
     // Allocate size for the cubemap sides and configure its sampler.
-    constexpr int kMapSize = 128;
-    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mPrefilterMap));
-    for (unsigned int i = 0; i < 6; ++i)
-      CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, kMapSize, kMapSize, 0, GL_RGB, GL_FLOAT, nullptr));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, texture));
+    for (int mip = 0; mip < mipLevels; ++mip)
+      for (unsigned int i = 0; i < 6; ++i)
+        CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB16F, size >> mip, size >> mip, 0, GL_RGB, GL_HALF_FLOAT, nullptr));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, mipLevels - 1));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
-    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR)); // needs to be GL_LINEAR_MIPMAP_LINEAR otherwise no mips are generated.
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
     CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    CHECK_GL_ERROR(glGenerateMipmap(GL_TEXTURE_CUBE_MAP));
+  }
+
+  void IBLScene::bakePrefilterPreview()
+  {
+    // Same mip count as the full map so that ibl.fs picks the same roughness per mip.
+    PrefilterSettings preview = mPrefilterSettings;
+    preview.size = kPreviewPrefilterSize;
+    preview.numSamples = kPreviewPrefilterSamples;
+    preview.mode = PrefilterMode::FilteredImportanceSampling;
+    allocatePrefilterMap(mPrefilterMap, preview.size, preview.mipLevels);
+    if (!mBakeScheduler->start(mEnvironmentTexture, mEnvironmentLayout, mPrefilterMap, preview))
+      return;
+    mBakeScheduler->finish();
+    mBakeReport.previewBakeMs = mBakeScheduler->getStats().gpuMs;
+    std::cout << "Prefilter preview " << preview.size << "x" << preview.size << " baked in " << mBakeReport.previewBakeMs << "ms (GPU)" << std::endl;
+  }
+
+  void IBLScene::startPrefilterBake()
+  {
+    allocatePrefilterMap(mBakeTarget, mPrefilterSettings.size, mPrefilterSettings.mipLevels);
+    mPrefilterBakePending = mBakeScheduler->start(mEnvironmentTexture, mEnvironmentLayout, mBakeTarget, mPrefilterSettings);
+    mBakeStartTime = Clock::now();
+  }
 
-    // Compute the prefilter map. Each mip level corresponding to a certain roughness value.
-    constexpr int kMipLevels = 5;
-    for (int mip = 0; mip < kMipLevels; ++mip)
+  void IBLScene::updatePrefilterBake()
+  {
+    mBakeScheduler->update(mBakeBudgetMs);
+    if (mBakeScheduler->isBusy())
+      return;
+
+    // Every job has run and been timed; the finished map replaces the current one.
+    mPrefilterBakePending = false;
+    std::swap(mPrefilterMap, mBakeTarget);
+    mBakeReport.prefilterBakeStats = mBakeScheduler->getStats();
+    mBakeReport.glslPrefilterMs = mBakeReport.prefilterBakeStats.gpuMs;
+    std::cout << "Prefilter map baked in " << mBakeReport.prefilterBakeStats.jobs << " jobs over "
+              << mBakeReport.prefilterBakeStats.frames << " frames: " << mBakeReport.glslPrefilterMs << "ms (GPU), worst frame "
+              << mBakeReport.prefilterBakeStats.worstBatchGpuMs << "ms, " << getElapsedMs(mBakeStartTime) << "ms wall" << std::endl;
+
+    readPrefilterMap();
+    if (mPendingImage)
     {
-      const int size = kMapSize >> mip;
-      const float roughness = mip / float(kMipLevels - 1);
-      program->setFloatUniform(program->getUniformLocation("uRoughness"), roughness);
-      renderToCubeMap(mEnvironmentTexture, false, mPrefilterMap, size, size, *program, mCubeMesh, mip);
+      storeBakedMaps(std::move(mPendingImage));
+      mBakeReport.bakeCacheMs = getElapsedMs(mBakeStartTime);
+      std::cout << "Prefilter map baked and cached in " << mBakeReport.bakeCacheMs << "ms" << std::endl;
     }
-
-    program.reset();
+    applyPrefilterStorage();
   }
   
+  void IBLScene::validatePrefilterMap()
+  {
+    // Time the GLSL bake by simply redoing it; it overwrites mPrefilterMap with identical data.
+    GLint viewPort[4];
+    CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewPort));
+    CHECK_GL_ERROR(glFinish());
+    const auto start = Clock::now();
+    setupPrefilterEnvMap();
+    CHECK_GL_ERROR(glFinish());
+    mBakeReport.glslPrefilterMs = getElapsedMs(start);
+    CHECK_GL_ERROR(glViewport(viewPort[0], viewPort[1], viewPort[2], viewPort[3]));
+
+    // Bake on the CPU from the very texels the shader samples, every mip of every face.
+    CubeMapData environment;
+    readEnvironmentMap(environment);
+    CubeMapData cpuPrefilter;
+    IBLBaker::prefilterEnvMap(environment,
+                              mPrefilterSettings,
+                              cpuPrefilter,
+                              &mBakeReport.cpuPrefilterStats);
+
+    double maxError = 0.0, sumSquaredError = 0.0;
+    std::size_t count = 0;
+    std::vector<float> face;
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mPrefilterMap));
+    for (int mip = 0; mip < mPrefilterSettings.mipLevels; ++mip)
+    {
+      const int size = cpuPrefilter.getMipSize(mip);
+      face.resize(std::size_t(size) * size * 3);
+      for (int i = 0; i < 6; ++i)
+      {
+        CHECK_GL_ERROR(glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB, GL_FLOAT, face.data()));
+        const float* baked = cpuPrefilter.getFace(mip, i);
+        for (std::size_t j = 0; j < face.size(); ++j)
+        {
+          const double error = std::abs(double(baked[j]) - face[j]);
+          maxError = std::max(maxError, error);
+          sumSquaredError += error * error;
+        }
+        count += face.size();
+      }
+    }
+
+    mBakeReport.prefilterMaxError = float(maxError);
+    mBakeReport.prefilterRmsError = float(std::sqrt(sumSquaredError / count));
+    mBakeReport.prefilterValidated = true;
+    std::cout << "Prefilter GLSL bake: " << mBakeReport.glslPrefilterMs << "ms" << std::endl;
+    for (const auto& mip : mBakeReport.cpuPrefilterStats)
+      std::cout << "Prefilter CPU bake " << mip.size << "x" << mip.size << " (roughness " << mip.roughness << ", " << mip.numSamples << " samples): "
+                << mip.ms << "ms, " << mip.texelsPerSecond << " texels/s" << std::endl;
+    std::cout << "Prefilter max error: " << maxError << " RMS error: " << mBakeReport.prefilterRmsError << std::endl;
+
+    // The GLSL bake replaced the map with an RGB16F one.
+    readPrefilterMap();
+    applyPrefilterStorage();
+  }
+
   void IBLScene::renderToCubeMap(GLuint inputTexture,
-                                 bool isCubeMap,
+                                 MapLayout inputLayout,
                                  GLuint outputTexture,
                                  unsigned int width,
                                  unsigned int height,
@@ -297,24 +1279,20 @@ namespace Akoylasar
     CHECK_GL_ERROR(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
     DEBUG_ASSERT_MSG(status == GL_FRAMEBUFFER_COMPLETE, "Invalid framebuffer");
     
+    const bool octahedralInput = inputLayout == MapLayout::Octahedral;
+    CHECK_GL_ERROR(glActiveTexture(octahedralInput ? GL_TEXTURE1 : GL_TEXTURE0));
+    CHECK_GL_ERROR(glBindTexture(getTextureTarget(inputLayout), inputTexture));
     CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
-    CHECK_GL_ERROR(glBindTexture(isCubeMap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, inputTexture));
     program.setIntUniform(program.getUniformLocation("sBackground"), 0);
+    program.setIntUniform(program.getUniformLocation("sBackgroundOctahedral"), 1);
+    program.setIntUniform(program.getUniformLocation("uOctahedralSource"), octahedralInput);
     
     // Resize viewport.
     CHECK_GL_ERROR(glViewport(0, 0, width, height));
 
     // Setup projection and view matrices.
-    Neon::Mat4f proj = Neon::makePerspective((float)Neon::kPi / 2.0f, 1.0f, 0.1f, 2.0f);
-    std::array<Neon::Mat4f, kNumCubmapFaces> views
-    {
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(1.0f,  0.0f,  0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f)), // origin, look at, up
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(-1.0f, 0.0f,  0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f)),
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  1.0f,  0.0f), Neon::Vec3f(0.0f,  0.0f,  1.0f)),
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f), Neon::Vec3f(0.0f,  0.0f, -1.0f)),
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  0.0f,  1.0f), Neon::Vec3f(0.0f, -1.0f,  0.0)),
-      Neon::makeLookAt(Neon::Vec3f(0.0f), Neon::Vec3f(0.0f,  0.0f, -1.0f), Neon::Vec3f(0.0f, -1.0f,  0.0f))
-    };
+    const Neon::Mat4f& proj = BakeScheduler::getCubeMapFaceProjection();
+    const std::array<Neon::Mat4f, kNumCubmapFaces>& views = BakeScheduler::getCubeMapFaceViews();
     
     // Render.
     GLuint projLoc = program.getUniformLocation("uProjection");
@@ -334,6 +1312,18 @@ namespace Akoylasar
   }
   
   void IBLScene::setupBrdLUT()
+  {
+    // The table was integrated at build time by BrdfLutGen, so this is just an upload.
+    const int size = BrdfLut::getEmbeddedSize();
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, mBrdfLUT));
+    uploadHalfTexture(mBrdfLUT, GL_TEXTURE_2D, GL_TEXTURE_2D, 0, GL_RG16F, size, size, GL_RG, BrdfLut::getEmbeddedTexels());
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
+
+  void IBLScene::bakeBrdfLutGlsl(GLuint outputTexture, int size)
   {
     // Solve the brdf integral and wirte the results in a 2d texture.
     
@@ -356,7 +1346,6 @@ namespace Akoylasar
     GpuMesh quad = GpuMesh::createGpuMesh(*quadGeom);
     
     // Prepare FBO and RBO.
-    const int size = 512;
     GLuint fbo, rbo;
     CHECK_GL_ERROR(glGenFramebuffers(1, &fbo));
     CHECK_GL_ERROR(glGenRenderbuffers(1, &rbo));
@@ -372,9 +1361,8 @@ namespace Akoylasar
     DEBUG_ASSERT_MSG(status == GL_FRAMEBUFFER_COMPLETE, "Invalid framebuffer");
     
     // Prepare the texture.
-    CHECK_GL_ERROR(glGenTextures(1, &mBrdfLUT));
-    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, mBrdfLUT));
-    CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, size, size, 0, GL_RG, GL_FLOAT, nullptr));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, outputTexture));
+    CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, size, size, 0, GL_RG, GL_HALF_FLOAT, nullptr));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -384,7 +1372,7 @@ namespace Akoylasar
     CHECK_GL_ERROR(glViewport(0, 0, size, size));
     
     // Render
-    CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mBrdfLUT, 0));
+    CHECK_GL_ERROR(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0));
     CHECK_GL_ERROR(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
     quad.draw();
     
@@ -395,4 +1383,343 @@ namespace Akoylasar
     GpuMesh::releaseGpuMesh(quad);
     // program.reset();
   }
+
+  bool IBLScene::validateBrdfLut()
+  {
+    // Integrate the LUT with brdf.fs the way it used to be done at startup and compare it with
+    // the embedded table.
+    GLint viewPort[4];
+    CHECK_GL_ERROR(glGetIntegerv(GL_VIEWPORT, viewPort));
+
+    const int size = BrdfLut::getEmbeddedSize();
+    GLuint reference;
+    CHECK_GL_ERROR(glGenTextures(1, &reference));
+    CHECK_GL_ERROR(glFinish());
+    const auto start = Clock::now();
+    bakeBrdfLutGlsl(reference, size);
+    CHECK_GL_ERROR(glFinish());
+    mBakeReport.glslBrdfLutMs = getElapsedMs(start);
+
+    const std::size_t count = std::size_t(size) * size * 2;
+    std::vector<float> glsl(count);
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, reference));
+    CHECK_GL_ERROR(glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, glsl.data()));
+    CHECK_GL_ERROR(glDeleteTextures(1, &reference));
+    CHECK_GL_ERROR(glViewport(viewPort[0], viewPort[1], viewPort[2], viewPort[3]));
+
+    const BrdfLut::Error error = BrdfLut::compare(BrdfLut::getEmbeddedTexels(), glsl.data(), count);
+    mBakeReport.brdfLutMaxError = error.max;
+    mBakeReport.brdfLutRmsError = error.rms;
+    mBakeReport.brdfLutPassed = error.max <= BrdfLut::kValidationTolerance;
+    mBakeReport.brdfLutValidated = true;
+    std::cout << "BRDF LUT GLSL bake: " << mBakeReport.glslBrdfLutMs << "ms. "
+              << "Max error: " << error.max << " RMS error: " << error.rms << std::endl;
+    if (!mBakeReport.brdfLutPassed)
+      std::cerr << "Embedded BRDF LUT differs from brdf.fs by " << error.max << ", more than the tolerated "
+                << BrdfLut::kValidationTolerance << ". Is BrdfLutData.cpp stale?" << std::endl;
+    return mBakeReport.brdfLutPassed;
+  }
+
+  void IBLScene::uploadCachedMaps(const EnvironmentView& data)
+  {
+    // Same texture state as setupPrefilterEnvMap, only filled from the cache. Halves and BC6H
+    // blocks stream straight from the mapping; other storages are packed from a float copy.
+    mPrefilterData.allocate(data.prefilterSize, data.prefilterMipLevels);
+    Half::toFloats(data.prefilter, mPrefilterData.texels.data(), mPrefilterData.texels.size());
+    const bool streamBc6h = mPrefilterStorage == TextureStorage::Bc6h && data.prefilterBc6h;
+    if (streamBc6h || mPrefilterStorage == TextureStorage::Rgb16f)
+    {
+      CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mPrefilterMap));
+      for (int mip = 0; mip < data.prefilterMipLevels; ++mip)
+      {
+        const int size = data.prefilterSize >> mip;
+        const std::uint16_t* texels = data.prefilter + EnvironmentContainer::getCubeMapOffset(data.prefilterSize, mip);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+          if (streamBc6h)
+            uploadBc6hTexture(mPrefilterMap, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, size, size,
+                              data.prefilterBc6h + Bc6hEncoder::getCubeMapOffset(data.prefilterSize, mip) + Bc6hEncoder::getCompressedSize(size, size) * i);
+          else
+            uploadHalfTexture(mPrefilterMap, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB16F,
+                              size, size, GL_RGB, texels + std::size_t(size) * size * 3 * i);
+        }
+      }
+      mPrefilterRgbmRange = 0.0f;
+      mPrefilterBytes = streamBc6h ? Bc6hEncoder::getCubeMapOffset(data.prefilterSize, data.prefilterMipLevels)
+                                   : EnvironmentContainer::getCubeMapOffset(data.prefilterSize, data.prefilterMipLevels) * sizeof(std::uint16_t);
+    }
+    else
+      applyPrefilterStorage();
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, data.prefilterMipLevels - 1));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+    CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  }
+
+  void IBLScene::readPrefilterMap()
+  {
+    // Only called right after a GLSL bake, while the map is still RGB16F, so nothing is lost.
+    mPrefilterData.allocate(mPrefilterSettings.size, mPrefilterSettings.mipLevels);
+    CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_CUBE_MAP, mPrefilterMap));
+    for (int mip = 0; mip < mPrefilterData.mipLevels; ++mip)
+      for (int i = 0; i < 6; ++i)
+        CHECK_GL_ERROR(glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB, GL_FLOAT, mPrefilterData.getFace(mip, i)));
+    CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+  }
+
+  void IBLScene::applyIrradianceStorage()
+  {
+    applyTextureStorage(mIrradianceMap, mIrradianceData, mIrradianceStorage, mIrradianceRgbmRange, mIrradianceBytes);
+    mShadingGpuMs = 0.0;
+  }
+
+  void IBLScene::applyPrefilterStorage()
+  {
+    applyTextureStorage(mPrefilterMap, mPrefilterData, mPrefilterStorage, mPrefilterRgbmRange, mPrefilterBytes);
+    mShadingGpuMs = 0.0;
+  }
+
+  void IBLScene::applyTextureStorage(GLuint& texture, const CubeMapData& data, TextureStorage storage, float& rgbmRange, std::size_t& bytes)
+  {
+    const int faceCount = data.getFaceCount();
+    const auto start = Clock::now();
+    const std::size_t texelCount = data.texels.size() / 3;
+    std::vector<std::uint16_t> halves;
+    std::vector<std::uint8_t> packed;
+    rgbmRange = 0.0f;
+    switch (storage)
+    {
+      case TextureStorage::Rgb16f:
+      case TextureStorage::Bc6h:
+        halves.resize(data.texels.size());
+        Half::fromFloats(data.texels.data(), halves.data(), halves.size());
+        if (storage == TextureStorage::Bc6h)
+          Bc6hEncoder::encodeCubeMap(halves.data(), data.size, data.mipLevels, kBc6hQuality, packed, faceCount);
+        break;
+      case TextureStorage::Rgb9e5:
+        packed.resize(texelCount * sizeof(std::uint32_t));
+        HdrPacking::packRgb9e5(data.texels.data(), reinterpret_cast<std::uint32_t*>(packed.data()), texelCount);
+        break;
+      case TextureStorage::Rgbm:
+        rgbmRange = HdrPacking::getRgbmRange(data.texels.data(), texelCount);
+        packed.resize(texelCount * 4);
+        HdrPacking::packRgbm(data.texels.data(), packed.data(), texelCount, rgbmRange);
+        break;
+    }
+    const double packMs = getElapsedMs(start);
+
+    // A texture keeps the target it was first bound to, so a layout switch needs a new name.
+    CHECK_GL_ERROR(glDeleteTextures(1, &texture));
+    CHECK_GL_ERROR(glGenTextures(1, &texture));
+    const GLenum bindTarget = getTextureTarget(data.layout);
+    CHECK_GL_ERROR(glBindTexture(bindTarget, texture));
+
+    // Small mips have rows that are not a multiple of 4 bytes.
+    bytes = 0;
+    CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    for (int mip = 0; mip < data.mipLevels; ++mip)
+    {
+      const int size = data.getMipSize(mip);
+      for (int i = 0; i < faceCount; ++i)
+      {
+        const GLenum target = bindTarget == GL_TEXTURE_2D ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+        const std::size_t texelOffset = data.getFaceOffset(mip, i) / 3;
+        const std::size_t faceTexels = std::size_t(size) * size;
+        switch (storage)
+        {
+          case TextureStorage::Rgb16f:
+            CHECK_GL_ERROR(glTexImage2D(target, mip, GL_RGB16F, size, size, 0, GL_RGB, GL_HALF_FLOAT, halves.data() + texelOffset * 3));
+            bytes += faceTexels * 3 * sizeof(std::uint16_t);
+            break;
+          case TextureStorage::Bc6h:
+          {
+            const std::size_t faceBytes = Bc6hEncoder::getCompressedSize(size, size);
+            CHECK_GL_ERROR(glCompressedTexImage2D(target, mip, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, size, size, 0, GLsizei(faceBytes),
+                                                  packed.data() + Bc6hEncoder::getCubeMapOffset(data.size, mip, faceCount) + faceBytes * i));
+            bytes += faceBytes;
+            break;
+          }
+          case TextureStorage::Rgb9e5:
+            CHECK_GL_ERROR(glTexImage2D(target, mip, GL_RGB9_E5, size, size, 0, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, packed.data() + texelOffset * 4));
+            bytes += faceTexels * 4;
+            break;
+          case TextureStorage::Rgbm:
+            CHECK_GL_ERROR(glTexImage2D(target, mip, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, packed.data() + texelOffset * 4));
+            bytes += faceTexels * 4;
+            break;
+        }
+      }
+    }
+    CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    setMapSampler(bindTarget, data.mipLevels);
+    std::cout << "Stored " << data.size << "x" << data.size << " " << kMapLayoutNames[int(data.layout)] << " map as "
+              << kTextureStorageNames[int(storage)] << ": " << bytes / 1024.0 << "KB, packed in " << packMs << "ms" << std::endl;
+  }
+
+  void IBLScene::setEnvironmentLayout(MapLayout layout)
+  {
+    // Resample the texels every shader reads rather than the panorama, which is long gone.
+    // An octahedral map gets about the cubemap's texel density and back.
+    auto bake = std::make_shared<LayoutBake>();
+    readEnvironmentMap(bake->source);
+    const int size = layout == MapLayout::Octahedral ? IBLBaker::getOctahedralSize(bake->source.size) : bake->source.size / 2;
+    mLayoutBakePending = true;
+    const JobSystem::JobHandle convert = mJobs->submit([bake, size, layout]()
+    {
+      const auto start = Clock::now();
+      IBLBaker::convertMapLayout(bake->source, size, layout, bake->output);
+      bake->ms = getElapsedMs(start);
+    });
+    mJobs->submitMainThread([this, bake, layout]()
+    {
+      // The GLSL prefilter bake reads halves, so the environment stays RGB16F from here on.
+      float rgbmRange;
+      applyTextureStorage(mEnvironmentTexture, bake->output, TextureStorage::Rgb16f, rgbmRange, mEnvironmentBytes);
+      mEnvironmentLayout = layout;
+      mEnvironmentCompressed = false;
+      mBakeReport.environmentLayoutMs = bake->ms;
+      mBackgroundGpuMs = 0.0;
+      mLayoutBakePending = false;
+      std::cout << "Environment resampled to a " << kMapLayoutNames[int(layout)] << " map in " << bake->ms << "ms" << std::endl;
+    }, {convert});
+  }
+
+  void IBLScene::setIrradianceLayout(MapLayout layout)
+  {
+    // The SH reconstruction is cheap enough to redo right here.
+    const auto start = Clock::now();
+    const int size = layout == MapLayout::Octahedral ? IBLBaker::getOctahedralSize(kIrradianceMapSize) : kIrradianceMapSize;
+    IBLBaker::bakeIrradianceMap(mRadianceSh, size, mIrradianceData, layout);
+    mBakeReport.irradianceLayoutMs = getElapsedMs(start);
+    mIrradianceLayout = layout;
+    mBakeReport.irradianceValidated = false;
+    applyIrradianceStorage();
+    std::cout << "Irradiance rebaked as a " << kMapLayoutNames[int(layout)] << " map in " << mBakeReport.irradianceLayoutMs << "ms" << std::endl;
+  }
+
+  void IBLScene::setPrefilterLayout(MapLayout layout)
+  {
+    // Same settings and texel density as the cubemap, baked from whatever layout the
+    // environment is in.
+    auto bake = std::make_shared<LayoutBake>();
+    readEnvironmentMap(bake->source);
+    PrefilterSettings settings = mPrefilterSettings;
+    settings.layout = layout;
+    if (layout == MapLayout::Octahedral)
+      settings.size = IBLBaker::getOctahedralSize(settings.size);
+    mLayoutBakePending = true;
+    const JobSystem::JobHandle prefilter = mJobs->submit([bake, settings]()
+    {
+      const auto start = Clock::now();
+      IBLBaker::prefilterEnvMap(bake->source, settings, bake->output);
+      bake->ms = getElapsedMs(start);
+    });
+    mJobs->submitMainThread([this, bake, layout]()
+    {
+      mPrefilterData = std::move(bake->output);
+      mPrefilterLayout = layout;
+      mBakeReport.prefilterLayoutMs = bake->ms;
+      mBakeReport.prefilterValidated = false;
+      applyPrefilterStorage();
+      mLayoutBakePending = false;
+      std::cout << "Prefilter rebaked as a " << kMapLayoutNames[int(layout)] << " map in " << bake->ms << "ms" << std::endl;
+    }, {prefilter});
+  }
+
+  void IBLScene::readEnvironmentMap(CubeMapData& output)
+  {
+    // As float whatever the storage, BC6H blocks are decoded by the driver.
+    const GLenum target = getTextureTarget(mEnvironmentLayout);
+    const bool octahedral = mEnvironmentLayout == MapLayout::Octahedral;
+    GLint size, maxLevel;
+    CHECK_GL_ERROR(glBindTexture(target, mEnvironmentTexture));
+    CHECK_GL_ERROR(glGetTexLevelParameteriv(octahedral ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &size));
+    CHECK_GL_ERROR(glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel));
+    output.allocate(size, maxLevel + 1, mEnvironmentLayout);
+    CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    for (int mip = 0; mip < output.mipLevels; ++mip)
+      for (int i = 0; i < output.getFaceCount(); ++i)
+        CHECK_GL_ERROR(glGetTexImage(octahedral ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB, GL_FLOAT, output.getFace(mip, i)));
+    CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+  }
+
+  void IBLScene::storeBakedMaps(std::unique_ptr<ImageData> image)
+  {
+    // readPrefilterMap got the GLSL results from an RGB16F texture, so converting them back to
+    // halves is exact.
+    EnvironmentView& data = image->environment;
+    data.prefilterSize = mPrefilterData.size;
+    data.prefilterMipLevels = mPrefilterData.mipLevels;
+    image->prefilterTexels.resize(mPrefilterData.texels.size());
+    Half::fromFloats(mPrefilterData.texels.data(), image->prefilterTexels.data(), image->prefilterTexels.size());
+    data.prefilter = image->prefilterTexels.data();
+
+    if (!kCompressBc6h)
+    {
+      storeInCache(std::move(image));
+      return;
+    }
+    // The compressed copy is only for the cache, so encode it off the GL thread. The shared
+    // holder frees the image if the job gets skipped on shutdown.
+    auto holder = std::make_shared<std::unique_ptr<ImageData>>(std::move(image));
+    mJobs->submit([this, holder]()
+    {
+      ImageData& pending = **holder;
+      EnvironmentPipeline::compressBc6h(pending, kBc6hQuality);
+      mBakeCache.store(pending.bakeKey, pending.environment);
+    });
+  }
+
+  void IBLScene::storeInCache(std::unique_ptr<ImageData> image)
+  {
+    // The shared holder frees the image if the job gets skipped on shutdown.
+    auto holder = std::make_shared<std::unique_ptr<ImageData>>(std::move(image));
+    mJobs->submit([this, holder]()
+    {
+      const ImageData& pending = **holder;
+      mBakeCache.store(pending.bakeKey, pending.environment);
+    });
+  }
+
+  void IBLScene::uploadHalfTexture(GLuint texture,
+                                   GLenum bindTarget,
+                                   GLenum imageTarget,
+                                   GLint level,
+                                   GLint internalFormat,
+                                   int width,
+                                   int height,
+                                   GLenum format,
+                                   const std::uint16_t* texels)
+  {
+    // Only allocate the storage here, the texels arrive through the uploader's staging buffers.
+    CHECK_GL_ERROR(glTexImage2D(imageTarget, level, internalFormat, width, height, 0, format, GL_HALF_FLOAT, nullptr));
+    mUploader->enqueue(texture, bindTarget, imageTarget, level, width, height, format, texels);
+
+    const std::size_t components = format == GL_RG ? 2 : format == GL_RGBA ? 4 : 3;
+    const std::size_t values = std::size_t(width) * height * components;
+    mBakeReport.uploadedBytes += values * sizeof(std::uint16_t);
+    mBakeReport.uploadedBytesAsFloat += values * sizeof(float);
+  }
+
+  void IBLScene::uploadBc6hTexture(GLuint texture,
+                                   GLenum bindTarget,
+                                   GLenum imageTarget,
+                                   GLint level,
+                                   int width,
+                                   int height,
+                                   const std::uint8_t* blocks)
+  {
+    const std::size_t size = Bc6hEncoder::getCompressedSize(width, height);
+    CHECK_GL_ERROR(glCompressedTexImage2D(imageTarget, level, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, width, height, 0, GLsizei(size), nullptr));
+    mUploader->enqueueCompressed(texture, bindTarget, imageTarget, level, width, height,
+                                 GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, Bc6hEncoder::kBlockBytes, blocks);
+
+    const std::size_t values = std::size_t(width) * height * 3;
+    mBakeReport.uploadedBytes += size;
+    mBakeReport.uploadedBytesAsFloat += values * sizeof(float);
+    mBakeReport.vramSavedBytes += values * sizeof(std::uint16_t) - size;
+  }
 }
@@ -0,0 +1,1314 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "IBLBaker.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Parallel.hpp"
+#include "Debug.hpp"
+#include "EnvironmentSampler.hpp"
+
+namespace
+{
+  constexpr int kNumCubeMapFaces = 6;
+  constexpr double kPi = 3.14159265358979323846;
+
+  // Real SH basis constants, with +Y as the pole so that every term factors into a function of
+  // the row latitude times a function of the column azimuth.
+  constexpr double kSh0 = 0.282095; // Y00
+  constexpr double kSh1 = 0.488603; // Y1x
+  constexpr double kSh2 = 1.092548; // Y2-2, Y2-1, Y21
+  constexpr double kSh3 = 0.315392; // Y20
+  constexpr double kSh4 = 0.546274; // Y22
+
+  // Clamped cosine lobe in SH divided by pi, see Ramamoorthi & Hanrahan 2001.
+  constexpr float kBandFactors[3] = {1.0f, 2.0f / 3.0f, 0.25f};
+
+  // The five azimuthal sums per channel needed to project a single row:
+  // sum(L), sum(L cos(phi)), sum(L sin(phi)), sum(L cos(2 phi)), sum(L sin(2 phi)).
+  constexpr int kNumRowSums = 5;
+  using RowSums = std::array<std::array<double, 3>, kNumRowSums>;
+
+  // Azimuthal tables repeated once per channel so a row of interleaved RGB can be multiplied
+  // against them directly, without de-interleaving.
+  using AzimuthTables = std::array<std::vector<float>, kNumRowSums>;
+
+  AzimuthTables buildAzimuthTables(int width)
+  {
+    AzimuthTables tables;
+    for (auto& table : tables)
+      table.resize(3 * width);
+    for (int c = 0; c < width; ++c)
+    {
+      const double phi = ((c + 0.5) / width - 0.5) * 2.0 * kPi;
+      const float values[kNumRowSums] =
+      {
+        1.0f,
+        static_cast<float>(std::cos(phi)),
+        static_cast<float>(std::sin(phi)),
+        static_cast<float>(std::cos(2.0 * phi)),
+        static_cast<float>(std::sin(2.0 * phi))
+      };
+      for (int s = 0; s < kNumRowSums; ++s)
+        for (int ch = 0; ch < 3; ++ch)
+          tables[s][3 * c + ch] = values[s];
+    }
+    return tables;
+  }
+
+  RowSums computeRowSums(const float* row, int width, const AzimuthTables& tables)
+  {
+    RowSums sums {};
+    const int count = 3 * width;
+    int k = 0;
+#if defined(__AVX2__)
+    // Process 8 pixels (24 floats) per iteration. Within the block, lane l of vector j always
+    // holds channel (8 * j + l) % 3, so each accumulator lane has a fixed channel.
+    __m256 acc[kNumRowSums][3];
+    for (auto& sum : acc)
+      for (auto& vec : sum)
+        vec = _mm256_setzero_ps();
+    for (; k + 24 <= count; k += 24)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        const __m256 radiance = _mm256_loadu_ps(row + k + 8 * j);
+        for (int s = 0; s < kNumRowSums; ++s)
+          acc[s][j] = _mm256_fmadd_ps(radiance, _mm256_loadu_ps(tables[s].data() + k + 8 * j), acc[s][j]);
+      }
+    }
+    for (int s = 0; s < kNumRowSums; ++s)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, acc[s][j]);
+        for (int l = 0; l < 8; ++l)
+          sums[s][(8 * j + l) % 3] += lanes[l];
+      }
+    }
+#endif
+    for (; k < count; ++k)
+      for (int s = 0; s < kNumRowSums; ++s)
+        sums[s][k % 3] += row[k] * tables[s][k];
+    return sums;
+  }
+
+  // The shaders map spherical coordinates to uv with these rounded constants; use the same ones
+  // so that CPU and GPU bakes land on the same texels.
+  constexpr float kUScale = 0.5f * 0.3183f;
+  constexpr float kVScale = 0.5f * 0.6366f;
+  constexpr int kPrefilterTileSize = 16;
+  constexpr int kCubeMapTileSize = 32;
+  // 1024 faces keep the 3k panorama's equatorial detail; past that the cubemap of an 8k or
+  // 16k panorama would be several times the budgeted decode.
+  constexpr int kMaxEnvironmentCubeMapSize = 1024;
+
+  // The unnormalized direction through face coordinates (sc, tc) in [-1, 1] is
+  // axes[0] + sc * axes[1] + tc * axes[2], in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order.
+  constexpr float kFaceAxes[kNumCubeMapFaces][3][3] =
+  {
+    {{1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, -1.0f, 0.0f}},  // +X
+    {{-1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, -1.0f, 0.0f}},  // -X
+    {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},    // +Y
+    {{0.0f, -1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}},  // -Y
+    {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}},   // +Z
+    {{0.0f, 0.0f, -1.0f}, {-1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}}  // -Z
+  };
+
+  // http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
+  float radicalInverse(std::uint32_t bits)
+  {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+  }
+
+  // Reflected GGX sample directions in tangent space (N = V = +Z). Only samples above the
+  // horizon are kept and the arrays are padded to a multiple of 8 with zero weight entries.
+  // For filtered importance sampling, lod holds the source mip of each sample at the equator;
+  // the latitude dependent part of the texel solid angle is added per lookup.
+  struct GgxSamples
+  {
+    std::vector<float> x, y, z, weight, lod;
+    float totalWeight = 0.0f;
+    bool filtered = false;
+  };
+
+  GgxSamples buildGgxSamples(float roughness, int numSamples, bool filtered, double sourceTexelSolidAngle)
+  {
+    GgxSamples samples;
+    const float a = roughness * roughness;
+    // A perfect mirror reads a single texel, no filtering needed.
+    samples.filtered = filtered && a > 0.0f;
+    for (int i = 0; i < numSamples; ++i)
+    {
+      const float xi0 = float(i) / float(numSamples);
+      const float xi1 = radicalInverse(std::uint32_t(i));
+      const float phi = 2.0f * float(kPi) * xi0;
+      const float cosTheta = std::sqrt((1.0f - xi1) / (1.0f + (a * a - 1.0f) * xi1));
+      const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+      const float hx = std::cos(phi) * sinTheta, hy = std::sin(phi) * sinTheta, hz = cosTheta;
+      // L = 2 (V.H) H - V with V = (0, 0, 1).
+      const float lx = 2.0f * hz * hx, ly = 2.0f * hz * hy, lz = 2.0f * hz * hz - 1.0f;
+      if (lz <= 0.0f)
+        continue;
+      const float invLength = 1.0f / std::sqrt(lx * lx + ly * ly + lz * lz);
+      samples.x.push_back(lx * invLength);
+      samples.y.push_back(ly * invLength);
+      samples.z.push_back(lz * invLength);
+      samples.weight.push_back(lz * invLength);
+      samples.totalWeight += lz * invLength;
+
+      // pdf(L) = D(H) (N.H) / (4 V.H) = D(H) / 4 since N = V. The sample represents a solid
+      // angle of 1 / (N pdf); pick the mip whose texels cover about as much (+1 bias, Colbert & Krivanek).
+      float lod = 0.0f;
+      if (samples.filtered)
+      {
+        const double a2 = double(a) * a;
+        const double d = hz * hz * (a2 - 1.0) + 1.0;
+        const double pdf = a2 / (kPi * d * d) * 0.25;
+        const double sampleSolidAngle = 1.0 / (numSamples * pdf);
+        lod = float(std::max(0.5 * std::log2(sampleSolidAngle / sourceTexelSolidAngle) + 1.0, 0.0));
+      }
+      samples.lod.push_back(lod);
+    }
+    while (samples.x.size() % 8 != 0)
+    {
+      samples.x.push_back(0.0f);
+      samples.y.push_back(0.0f);
+      samples.z.push_back(1.0f);
+      samples.weight.push_back(0.0f);
+      samples.lod.push_back(0.0f);
+    }
+    return samples;
+  }
+
+  // Tangent frame built exactly like ImportanceSampleGGX in prefilterEnvMap.fs.
+  void buildTangentFrame(const Neon::Vec3f& n, Neon::Vec3f& tangent, Neon::Vec3f& bitangent)
+  {
+    const Neon::Vec3f up = std::abs(n.z) < 0.999f ? Neon::Vec3f(0.0f, 0.0f, 1.0f) : Neon::Vec3f(1.0f, 0.0f, 0.0f);
+    tangent = Neon::normalize(Neon::cross(up, n));
+    bitangent = Neon::cross(n, tangent);
+  }
+
+  // Texels of an equirect row cover cos(latitude) times the equatorial solid angle, so the
+  // filtered lookups move down by 0.5 * log2(cos(latitude)) mips.
+  float getLatitudeLodOffset(float y)
+  {
+    return -0.25f * std::log2(std::max(1.0f - y * y, 1e-4f));
+  }
+
+  void sampleEquirectLod(const Akoylasar::EquirectMipChain& chain, float x, float y, float z, float lod, float* rgb)
+  {
+    const int maxLevel = chain.getLevelCount() - 1;
+    lod = std::min(std::max(lod, 0.0f), float(maxLevel));
+    const int level0 = int(lod);
+    const int level1 = std::min(level0 + 1, maxLevel);
+    const float blend = lod - level0;
+    Akoylasar::IBLBaker::sampleEquirect(chain.getLevel(level0), x, y, z, rgb);
+    if (blend > 0.0f)
+    {
+      float upper[3];
+      Akoylasar::IBLBaker::sampleEquirect(chain.getLevel(level1), x, y, z, upper);
+      for (int ch = 0; ch < 3; ++ch)
+        rgb[ch] += (upper[ch] - rgb[ch]) * blend;
+    }
+  }
+
+  // Bilinear, clamp to edge lookup at (u, v) in [0, 1] of a width x height RGB image.
+  void bilinear(const float* texels, int width, int height, float u, float v, float* rgb)
+  {
+    const float fx = u * width - 0.5f;
+    const float fy = v * height - 0.5f;
+    const float x0f = std::floor(fx), y0f = std::floor(fy);
+    const float ax = fx - x0f, ay = fy - y0f;
+    const int x0 = std::min(std::max(int(x0f), 0), width - 1);
+    const int x1 = std::min(std::max(int(x0f) + 1, 0), width - 1);
+    const int y0 = std::min(std::max(int(y0f), 0), height - 1);
+    const int y1 = std::min(std::max(int(y0f) + 1, 0), height - 1);
+    const float* t00 = texels + (std::size_t(y0) * width + x0) * 3;
+    const float* t10 = texels + (std::size_t(y0) * width + x1) * 3;
+    const float* t01 = texels + (std::size_t(y1) * width + x0) * 3;
+    const float* t11 = texels + (std::size_t(y1) * width + x1) * 3;
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      const float bottom = t00[ch] + (t10[ch] - t00[ch]) * ax;
+      const float top = t01[ch] + (t11[ch] - t01[ch]) * ax;
+      rgb[ch] = bottom + (top - bottom) * ay;
+    }
+  }
+
+  // 2x2 box filter of rows [beginRow, endRow) of a mip from the level above it, clamping at
+  // the edges for odd sizes like glGenerateMipmap.
+  void downsampleRows(const float* source, int sourceWidth, int sourceHeight,
+                      float* destination, int width, std::size_t beginRow, std::size_t endRow)
+  {
+    for (std::size_t r = beginRow; r < endRow; ++r)
+    {
+      const float* row0 = source + std::min<std::size_t>(2 * r, sourceHeight - 1) * sourceWidth * 3;
+      const float* row1 = source + std::min<std::size_t>(2 * r + 1, sourceHeight - 1) * sourceWidth * 3;
+      float* texel = destination + r * width * 3;
+      for (int c = 0; c < width; ++c, texel += 3)
+      {
+        const int c0 = std::min(2 * c, sourceWidth - 1) * 3;
+        const int c1 = std::min(2 * c + 1, sourceWidth - 1) * 3;
+        for (int ch = 0; ch < 3; ++ch)
+          texel[ch] = 0.25f * (row0[c0 + ch] + row0[c1 + ch] + row1[c0 + ch] + row1[c1 + ch]);
+      }
+    }
+  }
+
+  // Face and (s, t) in [0, 1] hit by direction (x, y, z), the inverse of getCubeMapDirection.
+  // Returns the largest absolute component.
+  float getCubeMapFaceUv(float x, float y, float z, int& face, float& s, float& t)
+  {
+    const float ax = std::abs(x), ay = std::abs(y), az = std::abs(z);
+    float major, sc, tc;
+    if (ax >= ay && ax >= az)
+    {
+      face = x > 0.0f ? 0 : 1;
+      major = ax;
+      sc = x > 0.0f ? -z : z;
+      tc = -y;
+    }
+    else if (ay >= az)
+    {
+      face = y > 0.0f ? 2 : 3;
+      major = ay;
+      sc = x;
+      tc = y > 0.0f ? z : -z;
+    }
+    else
+    {
+      face = z > 0.0f ? 4 : 5;
+      major = az;
+      sc = z > 0.0f ? x : -x;
+      tc = -y;
+    }
+    const float scale = 0.5f / std::max(major, 1e-30f);
+    s = sc * scale + 0.5f;
+    t = tc * scale + 0.5f;
+    return major;
+  }
+
+  // Texels cover the solid angle at the centre of the map times scale^3, scale being the largest
+  // absolute component of the normalized direction for cubemaps and their sum for octahedral
+  // maps, so the filtered lookups move by -1.5 * log2(scale) mips.
+  constexpr float kTexelLodScale = -1.5f;
+
+  float getTexelLodOffset(float scale)
+  {
+    return kTexelLodScale * std::log2(std::max(scale, 1e-4f));
+  }
+
+  // The output side of a resample: scale is 1 / |d| for the unnormalized point d a texel of the
+  // map being written sits at, so what it gathers moves by 1.5 * log2(scale) = -0.75 * log2(|d|^2)
+  // mips, taken from |d|^2 to spare the square root.
+  float getOutputTexelLodOffset(float lengthSquared)
+  {
+    return 0.5f * kTexelLodScale * std::log2(lengthSquared);
+  }
+
+  // Point on the octahedron |x|+|y|+|z| = 1 through (px, pz) in [-1, 1]^2, the corners folded
+  // over to the lower hemisphere.
+  void getOctahedralPoint(float px, float pz, float& x, float& y, float& z)
+  {
+    y = 1.0f - std::abs(px) - std::abs(pz);
+    x = y < 0.0f ? std::copysign(1.0f - std::abs(pz), px) : px;
+    z = y < 0.0f ? std::copysign(1.0f - std::abs(px), pz) : pz;
+  }
+
+  // (u, v) in [0, 1] of direction (x, y, z) in an octahedral map. Returns the sum of the
+  // absolute components.
+  float getOctahedralUvScale(float x, float y, float z, float& u, float& v)
+  {
+    const float sum = std::abs(x) + std::abs(y) + std::abs(z);
+    const float scale = 1.0f / std::max(sum, 1e-30f);
+    float px = x * scale, pz = z * scale;
+    if (y < 0.0f)
+    {
+      const float foldedX = std::copysign(1.0f - std::abs(pz), px);
+      pz = std::copysign(1.0f - std::abs(px), pz);
+      px = foldedX;
+    }
+    u = px * 0.5f + 0.5f;
+    v = pz * 0.5f + 0.5f;
+    return sum;
+  }
+
+  // Unnormalized direction through (sc, tc) in [-1, 1]^2 of a face: |d| = 1 at the centre of a
+  // cube face and at the axes of an octahedral map, whose single face ignores face.
+  void getTexelPoint(Akoylasar::MapLayout layout, int face, float sc, float tc, float* d)
+  {
+    if (layout == Akoylasar::MapLayout::Octahedral)
+    {
+      getOctahedralPoint(sc, tc, d[0], d[1], d[2]);
+      return;
+    }
+    const float (&axes)[3][3] = kFaceAxes[face];
+    for (int i = 0; i < 3; ++i)
+      d[i] = axes[0][i] + sc * axes[1][i] + tc * axes[2][i];
+  }
+
+  Neon::Vec3f getTexelDirection(Akoylasar::MapLayout layout, int face, float s, float t)
+  {
+    float d[3];
+    getTexelPoint(layout, face, 2.0f * s - 1.0f, 2.0f * t - 1.0f, d);
+    return Neon::normalize(Neon::Vec3f(d[0], d[1], d[2]));
+  }
+
+#if defined(__AVX2__)
+  inline __m256 abs8(__m256 v)
+  {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+  }
+
+  // Minimax atan on [0, 1] extended to all quadrants, ~1e-6 rad max error.
+  inline __m256 atan2x8(__m256 y, __m256 x)
+  {
+    const __m256 ax = abs8(x), ay = abs8(y);
+    const __m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+    const __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), mx);
+    const __m256 s = _mm256_mul_ps(a, a);
+    __m256 p = _mm256_set1_ps(-0.01172120f);
+    p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.05265332f));
+    p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.11643287f));
+    p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.19354346f));
+    p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.33262347f));
+    p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.99997726f));
+    __m256 r = _mm256_mul_ps(p, a);
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(float(kPi * 0.5)), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(float(kPi)), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    return _mm256_or_ps(r, _mm256_and_ps(y, _mm256_set1_ps(-0.0f)));
+  }
+
+  // Abramowitz & Stegun 4.4.46, ~2e-8 rad max error.
+  inline __m256 asinx8(__m256 y)
+  {
+    const __m256 a = _mm256_min_ps(abs8(y), _mm256_set1_ps(1.0f));
+    __m256 p = _mm256_set1_ps(-0.0012624911f);
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(0.0066700901f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(-0.0170881256f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(0.0308918810f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(-0.0501743046f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(0.0889789874f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(-0.2145988016f));
+    p = _mm256_fmadd_ps(p, a, _mm256_set1_ps(1.5707963050f));
+    const __m256 r = _mm256_fnmadd_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), a)), p, _mm256_set1_ps(float(kPi * 0.5)));
+    return _mm256_or_ps(r, _mm256_and_ps(y, _mm256_set1_ps(-0.0f)));
+  }
+
+  // Exponent plus a quadratic fit of the mantissa, ~5e-3 max error which is plenty for a lod.
+  inline __m256 log2x8(__m256 x)
+  {
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+    const __m256 p = _mm256_fmadd_ps(_mm256_fmadd_ps(m, _mm256_set1_ps(-0.34484843f), _mm256_set1_ps(2.02466578f)), m, _mm256_set1_ps(-1.67487759f));
+    return _mm256_add_ps(exponent, p);
+  }
+
+  inline __m256 getOutputTexelLodOffset8(__m256 lengthSquared)
+  {
+    return _mm256_mul_ps(log2x8(lengthSquared), _mm256_set1_ps(0.5f * kTexelLodScale));
+  }
+
+  inline void directionToUv8(__m256 x, __m256 y, __m256 z, __m256& u, __m256& v)
+  {
+    u = _mm256_fmadd_ps(atan2x8(z, x), _mm256_set1_ps(kUScale), _mm256_set1_ps(0.5f));
+    v = _mm256_fmadd_ps(asinx8(y), _mm256_set1_ps(kVScale), _mm256_set1_ps(0.5f));
+  }
+
+  // Bilinear, clamp to edge lookup of 8 texels, each lane may come from a different mip level
+  // described by its offset (in floats) and size.
+  inline void bilinear8(const float* texels, __m256i offset, __m256i width, __m256i height,
+                        __m256 u, __m256 v, __m256* rgb)
+  {
+    const __m256 fx = _mm256_fmsub_ps(u, _mm256_cvtepi32_ps(width), _mm256_set1_ps(0.5f));
+    const __m256 fy = _mm256_fmsub_ps(v, _mm256_cvtepi32_ps(height), _mm256_set1_ps(0.5f));
+    const __m256 x0f = _mm256_floor_ps(fx), y0f = _mm256_floor_ps(fy);
+    const __m256 ax = _mm256_sub_ps(fx, x0f), ay = _mm256_sub_ps(fy, y0f);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i maxX = _mm256_sub_epi32(width, one), maxY = _mm256_sub_epi32(height, one);
+    const __m256i x0 = _mm256_cvtps_epi32(x0f), y0 = _mm256_cvtps_epi32(y0f);
+    const __m256i cx0 = _mm256_min_epi32(_mm256_max_epi32(x0, zero), maxX);
+    const __m256i cx1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(x0, one), zero), maxX);
+    const __m256i cy0 = _mm256_min_epi32(_mm256_max_epi32(y0, zero), maxY);
+    const __m256i cy1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(y0, one), zero), maxY);
+
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i row0 = _mm256_mullo_epi32(cy0, width), row1 = _mm256_mullo_epi32(cy1, width);
+    const __m256i i00 = _mm256_add_epi32(offset, _mm256_mullo_epi32(_mm256_add_epi32(row0, cx0), three));
+    const __m256i i10 = _mm256_add_epi32(offset, _mm256_mullo_epi32(_mm256_add_epi32(row0, cx1), three));
+    const __m256i i01 = _mm256_add_epi32(offset, _mm256_mullo_epi32(_mm256_add_epi32(row1, cx0), three));
+    const __m256i i11 = _mm256_add_epi32(offset, _mm256_mullo_epi32(_mm256_add_epi32(row1, cx1), three));
+
+    const __m256 w11 = _mm256_mul_ps(ax, ay);
+    const __m256 w01 = _mm256_sub_ps(ay, w11);
+    const __m256 w10 = _mm256_sub_ps(ax, w11);
+    const __m256 w00 = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), ax), w01);
+
+    for (int ch = 0; ch < 3; ++ch)
+    {
+      const float* base = texels + ch;
+      __m256 c = _mm256_mul_ps(_mm256_i32gather_ps(base, i00, 4), w00);
+      c = _mm256_fmadd_ps(_mm256_i32gather_ps(base, i10, 4), w10, c);
+      c = _mm256_fmadd_ps(_mm256_i32gather_ps(base, i01, 4), w01, c);
+      rgb[ch] = _mm256_fmadd_ps(_mm256_i32gather_ps(base, i11, 4), w11, c);
+    }
+  }
+
+  // Trilinear lookup with a per lane lod into the concatenated mip chain.
+  inline void trilinear8(const Akoylasar::EquirectMipChain& chain, __m256 lod, __m256 u, __m256 v, __m256* rgb)
+  {
+    const int maxLevel = chain.getLevelCount() - 1;
+    lod = _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), _mm256_set1_ps(float(maxLevel)));
+    const __m256 level0f = _mm256_floor_ps(lod);
+    const __m256 blend = _mm256_sub_ps(lod, level0f);
+    const __m256i level0 = _mm256_cvtps_epi32(level0f);
+    const __m256i level1 = _mm256_min_epi32(_mm256_add_epi32(level0, _mm256_set1_epi32(1)), _mm256_set1_epi32(maxLevel));
+
+    __m256 lower[3], upper[3];
+    bilinear8(chain.texels.data(),
+              _mm256_i32gather_epi32(chain.offsets.data(), level0, 4),
+              _mm256_i32gather_epi32(chain.widths.data(), level0, 4),
+              _mm256_i32gather_epi32(chain.heights.data(), level0, 4),
+              u, v, lower);
+    bilinear8(chain.texels.data(),
+              _mm256_i32gather_epi32(chain.offsets.data(), level1, 4),
+              _mm256_i32gather_epi32(chain.widths.data(), level1, 4),
+              _mm256_i32gather_epi32(chain.heights.data(), level1, 4),
+              u, v, upper);
+    for (int ch = 0; ch < 3; ++ch)
+      rgb[ch] = _mm256_fmadd_ps(_mm256_sub_ps(upper[ch], lower[ch]), blend, lower[ch]);
+  }
+
+  inline float horizontalSum(__m256 v)
+  {
+    const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    return _mm_cvtss_f32(_mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1)));
+  }
+
+  // getCubeMapFaceUv for 8 directions.
+  inline __m256 cubeMapFaceUv8(__m256 x, __m256 y, __m256 z, __m256i& face, __m256& s, __m256& t)
+  {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 ax = abs8(x), ay = abs8(y), az = abs8(z);
+    const __m256 xMajor = _mm256_and_ps(_mm256_cmp_ps(ax, ay, _CMP_GE_OQ), _mm256_cmp_ps(ax, az, _CMP_GE_OQ));
+    const __m256 yMajor = _mm256_andnot_ps(xMajor, _mm256_cmp_ps(ay, az, _CMP_GE_OQ));
+    const __m256 xPositive = _mm256_cmp_ps(x, zero, _CMP_GT_OQ);
+    const __m256 yPositive = _mm256_cmp_ps(y, zero, _CMP_GT_OQ);
+    const __m256 zPositive = _mm256_cmp_ps(z, zero, _CMP_GT_OQ);
+    const __m256 negativeX = _mm256_sub_ps(zero, x), negativeY = _mm256_sub_ps(zero, y), negativeZ = _mm256_sub_ps(zero, z);
+
+    // Z major unless one of the others wins.
+    __m256 major = az;
+    __m256 sc = _mm256_blendv_ps(negativeX, x, zPositive);
+    __m256 tc = negativeY;
+    __m256 faceIndex = _mm256_blendv_ps(_mm256_set1_ps(5.0f), _mm256_set1_ps(4.0f), zPositive);
+    major = _mm256_blendv_ps(major, ay, yMajor);
+    sc = _mm256_blendv_ps(sc, x, yMajor);
+    tc = _mm256_blendv_ps(tc, _mm256_blendv_ps(negativeZ, z, yPositive), yMajor);
+    faceIndex = _mm256_blendv_ps(faceIndex, _mm256_blendv_ps(_mm256_set1_ps(3.0f), _mm256_set1_ps(2.0f), yPositive), yMajor);
+    major = _mm256_blendv_ps(major, ax, xMajor);
+    sc = _mm256_blendv_ps(sc, _mm256_blendv_ps(z, negativeZ, xPositive), xMajor);
+    tc = _mm256_blendv_ps(tc, negativeY, xMajor);
+    faceIndex = _mm256_blendv_ps(faceIndex, _mm256_blendv_ps(_mm256_set1_ps(1.0f), zero, xPositive), xMajor);
+
+    const __m256 scale = _mm256_div_ps(_mm256_set1_ps(0.5f), _mm256_max_ps(major, _mm256_set1_ps(1e-30f)));
+    s = _mm256_fmadd_ps(sc, scale, _mm256_set1_ps(0.5f));
+    t = _mm256_fmadd_ps(tc, scale, _mm256_set1_ps(0.5f));
+    face = _mm256_cvttps_epi32(faceIndex);
+    return major;
+  }
+
+  // getOctahedralPoint for 8 points of a row.
+  inline void octahedralPoint8(__m256 px, __m256 pz, __m256& x, __m256& y, __m256& z)
+  {
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    y = _mm256_sub_ps(_mm256_sub_ps(one, abs8(px)), abs8(pz));
+    const __m256 lower = _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ);
+    x = _mm256_blendv_ps(px, _mm256_or_ps(_mm256_sub_ps(one, abs8(pz)), _mm256_and_ps(px, signBit)), lower);
+    z = _mm256_blendv_ps(pz, _mm256_or_ps(_mm256_sub_ps(one, abs8(px)), _mm256_and_ps(pz, signBit)), lower);
+  }
+
+  // getOctahedralUvScale for 8 directions.
+  inline __m256 octahedralUv8(__m256 x, __m256 y, __m256 z, __m256& u, __m256& v)
+  {
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sum = _mm256_add_ps(_mm256_add_ps(abs8(x), abs8(y)), abs8(z));
+    const __m256 scale = _mm256_div_ps(one, _mm256_max_ps(sum, _mm256_set1_ps(1e-30f)));
+    const __m256 px = _mm256_mul_ps(x, scale), pz = _mm256_mul_ps(z, scale);
+    const __m256 lower = _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ);
+    const __m256 foldedX = _mm256_blendv_ps(px, _mm256_or_ps(_mm256_sub_ps(one, abs8(pz)), _mm256_and_ps(px, signBit)), lower);
+    const __m256 foldedZ = _mm256_blendv_ps(pz, _mm256_or_ps(_mm256_sub_ps(one, abs8(px)), _mm256_and_ps(pz, signBit)), lower);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    u = _mm256_fmadd_ps(foldedX, half, half);
+    v = _mm256_fmadd_ps(foldedZ, half, half);
+    return sum;
+  }
+#endif
+
+  // Source lookups for prefilterTexel. lod is the sample's mip before the part that depends on
+  // where the direction lands in the source, and is ignored for unfiltered sample sets.
+  struct EquirectSource
+  {
+    const Akoylasar::EquirectImage& base;
+    const Akoylasar::EquirectMipChain& chain; // Only read for filtered sample sets.
+
+    void sample(float x, float y, float z, bool filtered, float lod, float* rgb) const
+    {
+      if (filtered)
+        sampleEquirectLod(chain, x, y, z, lod + getLatitudeLodOffset(y), rgb);
+      else
+        Akoylasar::IBLBaker::sampleEquirect(base, x, y, z, rgb);
+    }
+
+#if defined(__AVX2__)
+    void sample8(__m256 x, __m256 y, __m256 z, bool filtered, __m256 lod, __m256* rgb) const
+    {
+      __m256 u, v;
+      directionToUv8(x, y, z, u, v);
+      if (filtered)
+      {
+        const __m256 cos2Lat = _mm256_max_ps(_mm256_fnmadd_ps(y, y, _mm256_set1_ps(1.0f)), _mm256_set1_ps(1e-4f));
+        trilinear8(chain, _mm256_fmadd_ps(log2x8(cos2Lat), _mm256_set1_ps(-0.25f), lod), u, v, rgb);
+      }
+      else
+        bilinear8(base.texels, _mm256_setzero_si256(), _mm256_set1_epi32(base.width), _mm256_set1_epi32(base.height), u, v, rgb);
+    }
+#endif
+  };
+
+  struct CubeMapSource
+  {
+    const Akoylasar::CubeMapData& cube;
+    // Offset of face 0 (in floats) and face size of every mip, for the gathers.
+    std::vector<int> offsets;
+    std::vector<int> sizes;
+
+    explicit CubeMapSource(const Akoylasar::CubeMapData& source)
+    : cube(source)
+    {
+      for (int mip = 0; mip < cube.mipLevels; ++mip)
+      {
+        offsets.push_back(int(cube.getFaceOffset(mip, 0)));
+        sizes.push_back(cube.getMipSize(mip));
+      }
+    }
+
+    void sample(float x, float y, float z, bool filtered, float lod, float* rgb) const
+    {
+      if (filtered)
+      {
+        const float scale = cube.layout == Akoylasar::MapLayout::Octahedral
+                          ? std::abs(x) + std::abs(y) + std::abs(z)
+                          : std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+        lod += getTexelLodOffset(scale);
+      }
+      Akoylasar::IBLBaker::sampleCubeMap(cube, x, y, z, filtered ? lod : 0.0f, rgb);
+    }
+
+#if defined(__AVX2__)
+    void sample8(__m256 x, __m256 y, __m256 z, bool filtered, __m256 lod, __m256* rgb) const
+    {
+      __m256i face = _mm256_setzero_si256();
+      __m256 s, t;
+      const __m256 scale = cube.layout == Akoylasar::MapLayout::Octahedral ? octahedralUv8(x, y, z, s, t)
+                                                                           : cubeMapFaceUv8(x, y, z, face, s, t);
+      if (!filtered)
+      {
+        const __m256i offset = _mm256_mullo_epi32(face, _mm256_set1_epi32(sizes[0] * sizes[0] * 3));
+        bilinear8(cube.texels.data(), offset, _mm256_set1_epi32(sizes[0]), _mm256_set1_epi32(sizes[0]), s, t, rgb);
+        return;
+      }
+
+      const int maxLevel = cube.mipLevels - 1;
+      lod = _mm256_fmadd_ps(log2x8(_mm256_max_ps(scale, _mm256_set1_ps(1e-4f))), _mm256_set1_ps(kTexelLodScale), lod);
+      lod = _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), _mm256_set1_ps(float(maxLevel)));
+      const __m256 level0f = _mm256_floor_ps(lod);
+      const __m256 blend = _mm256_sub_ps(lod, level0f);
+      const __m256i level0 = _mm256_cvtps_epi32(level0f);
+      const __m256i level1 = _mm256_min_epi32(_mm256_add_epi32(level0, _mm256_set1_epi32(1)), _mm256_set1_epi32(maxLevel));
+      __m256 lower[3], upper[3];
+      lookup8(level0, face, s, t, lower);
+      lookup8(level1, face, s, t, upper);
+      for (int ch = 0; ch < 3; ++ch)
+        rgb[ch] = _mm256_fmadd_ps(_mm256_sub_ps(upper[ch], lower[ch]), blend, lower[ch]);
+    }
+
+    void lookup8(__m256i level, __m256i face, __m256 s, __m256 t, __m256* rgb) const
+    {
+      const __m256i size = _mm256_i32gather_epi32(sizes.data(), level, 4);
+      const __m256i faceFloats = _mm256_mullo_epi32(_mm256_mullo_epi32(size, size), _mm256_set1_epi32(3));
+      const __m256i offset = _mm256_add_epi32(_mm256_i32gather_epi32(offsets.data(), level, 4), _mm256_mullo_epi32(face, faceFloats));
+      bilinear8(cube.texels.data(), offset, size, size, s, t, rgb);
+    }
+#endif
+  };
+
+  template <typename Source>
+  void prefilterTexel(const Source& source,
+                      const GgxSamples& samples,
+                      const Neon::Vec3f& n,
+                      float* rgb)
+  {
+    Neon::Vec3f t(0.0f), b(0.0f);
+    buildTangentFrame(n, t, b);
+    const std::size_t count = samples.x.size();
+#if defined(__AVX2__)
+    __m256 acc[3] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    for (std::size_t i = 0; i < count; i += 8)
+    {
+      const __m256 lx = _mm256_loadu_ps(samples.x.data() + i);
+      const __m256 ly = _mm256_loadu_ps(samples.y.data() + i);
+      const __m256 lz = _mm256_loadu_ps(samples.z.data() + i);
+      const __m256 wx = _mm256_fmadd_ps(lz, _mm256_set1_ps(n.x), _mm256_fmadd_ps(ly, _mm256_set1_ps(b.x), _mm256_mul_ps(lx, _mm256_set1_ps(t.x))));
+      const __m256 wy = _mm256_fmadd_ps(lz, _mm256_set1_ps(n.y), _mm256_fmadd_ps(ly, _mm256_set1_ps(b.y), _mm256_mul_ps(lx, _mm256_set1_ps(t.y))));
+      const __m256 wz = _mm256_fmadd_ps(lz, _mm256_set1_ps(n.z), _mm256_fmadd_ps(ly, _mm256_set1_ps(b.z), _mm256_mul_ps(lx, _mm256_set1_ps(t.z))));
+      __m256 color[3];
+      source.sample8(wx, wy, wz, samples.filtered, _mm256_loadu_ps(samples.lod.data() + i), color);
+      const __m256 weight = _mm256_loadu_ps(samples.weight.data() + i);
+      for (int ch = 0; ch < 3; ++ch)
+        acc[ch] = _mm256_fmadd_ps(color[ch], weight, acc[ch]);
+    }
+    for (int ch = 0; ch < 3; ++ch)
+      rgb[ch] = horizontalSum(acc[ch]);
+#else
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const float weight = samples.weight[i];
+      if (weight <= 0.0f)
+        continue;
+      const float wx = t.x * samples.x[i] + b.x * samples.y[i] + n.x * samples.z[i];
+      const float wy = t.y * samples.x[i] + b.y * samples.y[i] + n.y * samples.z[i];
+      const float wz = t.z * samples.x[i] + b.z * samples.y[i] + n.z * samples.z[i];
+      float color[3];
+      source.sample(wx, wy, wz, samples.filtered, samples.lod[i], color);
+      rgb[0] += color[0] * weight;
+      rgb[1] += color[1] * weight;
+      rgb[2] += color[2] * weight;
+    }
+#endif
+    const float invWeight = 1.0f / samples.totalWeight;
+    rgb[0] *= invWeight;
+    rgb[1] *= invWeight;
+    rgb[2] *= invWeight;
+  }
+
+  // The body of every IBLBaker::prefilterEnvMap overload. sourceTexelSolidAngle is the solid
+  // angle the source's lod offsets are relative to.
+  template <typename Source>
+  void prefilterTiles(const Source& source,
+                      double sourceTexelSolidAngle,
+                      const Akoylasar::PrefilterSettings& settings,
+                      Akoylasar::CubeMapData& output,
+                      std::vector<Akoylasar::PrefilterMipStats>* stats)
+  {
+    using Akoylasar::IBLBaker;
+    DEBUG_ASSERT(settings.mipLevels > 1);
+    const bool filtered = settings.mode == Akoylasar::PrefilterMode::FilteredImportanceSampling;
+
+    output.allocate(settings.size, settings.mipLevels, settings.layout);
+    const int faceCount = output.getFaceCount();
+    if (stats)
+      stats->clear();
+
+    for (int mip = 0; mip < settings.mipLevels; ++mip)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      const int mipSize = output.getMipSize(mip);
+      const float roughness = mip / float(settings.mipLevels - 1);
+      const int numSamples = IBLBaker::getPrefilterSampleCount(roughness, mipSize, settings);
+      const GgxSamples samples = buildGgxSamples(roughness, numSamples, filtered, sourceTexelSolidAngle);
+
+      const int tileSize = std::min(kPrefilterTileSize, mipSize);
+      const int tilesPerRow = (mipSize + tileSize - 1) / tileSize;
+      const int tilesPerFace = tilesPerRow * tilesPerRow;
+      Akoylasar::Parallel::forRange(faceCount * tilesPerFace, 1, [&](std::size_t begin, std::size_t end)
+      {
+        for (std::size_t tile = begin; tile < end; ++tile)
+        {
+          const int face = int(tile / tilesPerFace);
+          const int tileX = int(tile % tilesPerFace) % tilesPerRow * tileSize;
+          const int tileY = int(tile % tilesPerFace) / tilesPerRow * tileSize;
+          float* faceTexels = output.getFace(mip, face);
+          for (int t = tileY; t < std::min(tileY + tileSize, mipSize); ++t)
+          {
+            for (int s = tileX; s < std::min(tileX + tileSize, mipSize); ++s)
+            {
+              const Neon::Vec3f n = getTexelDirection(settings.layout, face, (s + 0.5f) / mipSize, (t + 0.5f) / mipSize);
+              prefilterTexel(source, samples, n, faceTexels + (std::size_t(t) * mipSize + s) * 3);
+            }
+          }
+        }
+      });
+
+      if (stats)
+      {
+        Akoylasar::PrefilterMipStats mipStats;
+        mipStats.size = mipSize;
+        mipStats.roughness = roughness;
+        mipStats.numSamples = numSamples;
+        mipStats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        mipStats.texelsPerSecond = faceCount * double(mipSize) * mipSize / (mipStats.ms * 0.001);
+        stats->push_back(mipStats);
+      }
+    }
+  }
+}
+
+namespace Akoylasar
+{
+  void CubeMapData::allocate(int faceSize, int mips, MapLayout mapLayout)
+  {
+    size = faceSize;
+    mipLevels = mips;
+    layout = mapLayout;
+    texels.assign(getFaceOffset(mips, 0), 0.0f);
+  }
+
+  int CubeMapData::getFaceCount() const
+  {
+    return layout == MapLayout::Octahedral ? 1 : kNumCubeMapFaces;
+  }
+
+  int CubeMapData::getMipSize(int mip) const
+  {
+    return std::max(1, size >> mip);
+  }
+
+  std::size_t CubeMapData::getFaceOffset(int mip, int face) const
+  {
+    std::size_t offset = 0;
+    for (int m = 0; m < mip; ++m)
+    {
+      const std::size_t mipSize = getMipSize(m);
+      offset += getFaceCount() * mipSize * mipSize * 3;
+    }
+    const std::size_t mipSize = getMipSize(mip);
+    return offset + face * mipSize * mipSize * 3;
+  }
+
+  float* CubeMapData::getFace(int mip, int face)
+  {
+    return texels.data() + getFaceOffset(mip, face);
+  }
+
+  const float* CubeMapData::getFace(int mip, int face) const
+  {
+    return texels.data() + getFaceOffset(mip, face);
+  }
+
+  void CubeMapData::generateMips()
+  {
+    for (int mip = 1; mip < mipLevels; ++mip)
+    {
+      const int sourceSize = getMipSize(mip - 1);
+      const int mipSize = getMipSize(mip);
+      Parallel::forRange(getFaceCount() * mipSize, 16, [&](std::size_t begin, std::size_t end)
+      {
+        // Ranges may span faces; split them at face boundaries.
+        while (begin < end)
+        {
+          const int face = int(begin / mipSize);
+          const std::size_t faceEnd = std::min(end, std::size_t(face + 1) * mipSize);
+          downsampleRows(getFace(mip - 1, face), sourceSize, sourceSize, getFace(mip, face), mipSize,
+                         begin - std::size_t(face) * mipSize, faceEnd - std::size_t(face) * mipSize);
+          begin = faceEnd;
+        }
+      });
+    }
+  }
+
+  int EquirectMipChain::getLevelCount() const
+  {
+    return int(offsets.size());
+  }
+
+  EquirectImage EquirectMipChain::getLevel(int level) const
+  {
+    return {widths[level], heights[level], texels.data() + offsets[level]};
+  }
+
+  void EquirectMipChain::allocate(int width, int height)
+  {
+    // Same level sizes as glGenerateMipmap.
+    offsets.clear();
+    widths.clear();
+    heights.clear();
+    std::size_t totalFloats = 0;
+    for (int w = width, h = height;; w = std::max(1, w / 2), h = std::max(1, h / 2))
+    {
+      offsets.push_back(int(totalFloats));
+      widths.push_back(w);
+      heights.push_back(h);
+      totalFloats += std::size_t(w) * h * 3;
+      if (w == 1 && h == 1)
+        break;
+    }
+    texels.resize(totalFloats);
+  }
+
+  void EquirectMipChain::generateMips()
+  {
+    for (int level = 1; level < getLevelCount(); ++level)
+    {
+      const EquirectImage source = getLevel(level - 1);
+      float* destination = texels.data() + offsets[level];
+      Parallel::forRange(heights[level], 16, [&](std::size_t begin, std::size_t end)
+      {
+        downsampleRows(source.texels, source.width, source.height, destination, widths[level], begin, end);
+      });
+    }
+  }
+
+  ShProjector::ShProjector(int width, int height)
+  : mWidth(width),
+    mHeight(height),
+    mAzimuthTables(buildAzimuthTables(width))
+  {
+    DEBUG_ASSERT(width > 0 && height > 0);
+  }
+
+  void ShProjector::addRows(const float* texels, int firstRow, int rowCount)
+  {
+    const double texelAzimuth = 2.0 * kPi / mWidth;
+    std::array<double, 27> partial {};
+    for (int i = 0; i < rowCount; ++i)
+    {
+      const std::size_t r = std::size_t(firstRow) + i;
+      const float* row = texels + std::size_t(i) * mWidth * 3;
+      const RowSums sums = computeRowSums(row, mWidth, mAzimuthTables);
+
+      // Exact solid angle of a texel in this row and the latitude of its centre.
+      const double lat0 = (double(r) / mHeight - 0.5) * kPi;
+      const double lat1 = (double(r + 1) / mHeight - 0.5) * kPi;
+      const double lat = (double(r + 0.5) / mHeight - 0.5) * kPi;
+      const double w = texelAzimuth * (std::sin(lat1) - std::sin(lat0));
+      const double sinLat = std::sin(lat);
+      const double cosLat = std::cos(lat);
+
+      for (int ch = 0; ch < 3; ++ch)
+      {
+        const double s1 = sums[0][ch], sc = sums[1][ch], ss = sums[2][ch];
+        const double sc2 = sums[3][ch], ss2 = sums[4][ch];
+        double* coef = partial.data() + ch;
+        coef[0 * 3] += w * kSh0 * s1;
+        coef[1 * 3] += w * kSh1 * sinLat * s1;                              // y
+        coef[2 * 3] += w * kSh1 * cosLat * ss;                              // z
+        coef[3 * 3] += w * kSh1 * cosLat * sc;                              // x
+        coef[4 * 3] += w * kSh2 * cosLat * cosLat * 0.5 * ss2;              // xz
+        coef[5 * 3] += w * kSh2 * sinLat * cosLat * ss;                     // yz
+        coef[6 * 3] += w * kSh3 * (3.0 * sinLat * sinLat - 1.0) * s1;       // 3y^2 - 1
+        coef[7 * 3] += w * kSh2 * sinLat * cosLat * sc;                     // xy
+        coef[8 * 3] += w * kSh4 * cosLat * cosLat * sc2;                    // x^2 - z^2
+      }
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (std::size_t i = 0; i < mSums.size(); ++i)
+      mSums[i] += partial[i];
+  }
+
+  ShCoefficients ShProjector::getCoefficients() const
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ShCoefficients sh;
+    for (int i = 0; i < 9; ++i)
+      sh[i] = Neon::Vec3f(float(mSums[3 * i]), float(mSums[3 * i + 1]), float(mSums[3 * i + 2]));
+    return sh;
+  }
+
+  ShCoefficients IBLBaker::projectToSh(const EquirectImage& image)
+  {
+    DEBUG_ASSERT(image.texels && image.width > 0 && image.height > 0);
+    ShProjector projector(image.width, image.height);
+    Parallel::forRange(image.height, 16, [&](std::size_t begin, std::size_t end)
+    {
+      projector.addRows(image.texels + begin * image.width * 3, int(begin), int(end - begin));
+    });
+    return projector.getCoefficients();
+  }
+
+  ShCoefficients IBLBaker::convolveIrradiance(const ShCoefficients& radiance)
+  {
+    ShCoefficients irradiance = radiance;
+    for (int i = 0; i < 9; ++i)
+    {
+      const float factor = kBandFactors[i == 0 ? 0 : (i < 4 ? 1 : 2)];
+      irradiance[i] = radiance[i] * factor;
+    }
+    return irradiance;
+  }
+
+  Neon::Vec3f IBLBaker::evaluateSh(const ShCoefficients& sh, const Neon::Vec3f& direction)
+  {
+    const float x = direction.x, y = direction.y, z = direction.z;
+    const float basis[9] =
+    {
+      float(kSh0),
+      float(kSh1) * y,
+      float(kSh1) * z,
+      float(kSh1) * x,
+      float(kSh2) * x * z,
+      float(kSh2) * y * z,
+      float(kSh3) * (3.0f * y * y - 1.0f),
+      float(kSh2) * x * y,
+      float(kSh4) * (x * x - z * z)
+    };
+    Neon::Vec3f result(0.0f);
+    for (int i = 0; i < 9; ++i)
+      result += sh[i] * basis[i];
+    return result;
+  }
+
+  Neon::Vec3f IBLBaker::estimateIrradiance(const EquirectImage& image, const EnvironmentSampler& sampler, const Neon::Vec3f& normal, int numSamples)
+  {
+    DEBUG_ASSERT(image.texels && !sampler.isEmpty() && numSamples > 0);
+    const int environmentSamples = (numSamples + 1) / 2;
+    const int cosineSamples = numSamples - environmentSamples;
+    Neon::Vec3f tangent, bitangent;
+    buildTangentFrame(normal, tangent, bitangent);
+
+    // Every sample, whichever strategy drew it, is weighted by the density of both combined.
+    Neon::Vec3f sum(0.0f);
+    const auto addSample = [&](const Neon::Vec3f& direction, float environmentPdf)
+    {
+      const float cosTheta = direction.x * normal.x + direction.y * normal.y + direction.z * normal.z;
+      const float pdf = environmentSamples * environmentPdf + cosineSamples * cosTheta * float(1.0 / kPi);
+      if (cosTheta <= 0.0f || pdf <= 0.0f)
+        return;
+      float rgb[3];
+      sampleEquirect(image, direction.x, direction.y, direction.z, rgb);
+      sum += Neon::Vec3f(rgb[0], rgb[1], rgb[2]) * (cosTheta / pdf);
+    };
+    for (int i = 0; i < environmentSamples; ++i)
+    {
+      const EnvironmentSampler::Sample sample = sampler.sampleCdf(radicalInverse(std::uint32_t(i)), (i + 0.5f) / environmentSamples);
+      addSample(sample.direction, sample.pdf);
+    }
+    for (int i = 0; i < cosineSamples; ++i)
+    {
+      // Malley's method: uniform points on the disk projected up onto the hemisphere.
+      const float xi0 = (i + 0.5f) / cosineSamples, xi1 = radicalInverse(std::uint32_t(i));
+      const float r = std::sqrt(xi0), phi = 2.0f * float(kPi) * xi1;
+      const float x = r * std::cos(phi), y = r * std::sin(phi), z = std::sqrt(std::max(1.0f - xi0, 0.0f));
+      const Neon::Vec3f direction = tangent * x + bitangent * y + normal * z;
+      addSample(direction, sampler.getPdf(direction));
+    }
+    return sum * float(1.0 / kPi);
+  }
+
+  void IBLBaker::bakeIrradianceMap(const ShCoefficients& radiance, int size, CubeMapData& output, MapLayout layout)
+  {
+    const ShCoefficients irradiance = convolveIrradiance(radiance);
+    output.allocate(size, 1, layout);
+    Parallel::forRange(output.getFaceCount() * size, 4, [&](std::size_t begin, std::size_t end)
+    {
+      for (std::size_t row = begin; row < end; ++row)
+      {
+        const int face = int(row / size);
+        const int t = int(row % size);
+        float* texel = output.getFace(0, face) + t * size * 3;
+        for (int s = 0; s < size; ++s, texel += 3)
+        {
+          const Neon::Vec3f dir = getTexelDirection(layout, face, (s + 0.5f) / size, (t + 0.5f) / size);
+          const Neon::Vec3f value = evaluateSh(irradiance, dir);
+          texel[0] = std::max(0.0f, value.x);
+          texel[1] = std::max(0.0f, value.y);
+          texel[2] = std::max(0.0f, value.z);
+        }
+      }
+    });
+  }
+
+  Neon::Vec3f IBLBaker::getCubeMapDirection(int face, float s, float t)
+  {
+    const float sc = 2.0f * s - 1.0f;
+    const float tc = 2.0f * t - 1.0f;
+    const float (&axes)[3][3] = kFaceAxes[face];
+    return Neon::normalize(Neon::Vec3f(axes[0][0] + sc * axes[1][0] + tc * axes[2][0],
+                                       axes[0][1] + sc * axes[1][1] + tc * axes[2][1],
+                                       axes[0][2] + sc * axes[1][2] + tc * axes[2][2]));
+  }
+
+  Neon::Vec3f IBLBaker::getOctahedralDirection(float u, float v)
+  {
+    return getTexelDirection(MapLayout::Octahedral, 0, u, v);
+  }
+
+  void IBLBaker::getOctahedralUv(float x, float y, float z, float& u, float& v)
+  {
+    getOctahedralUvScale(x, y, z, u, v);
+  }
+
+  void IBLBaker::sampleEquirect(const EquirectImage& image, float x, float y, float z, float* rgb)
+  {
+    const float u = std::atan2(z, x) * kUScale + 0.5f;
+    const float v = std::asin(std::min(1.0f, std::max(-1.0f, y))) * kVScale + 0.5f;
+    bilinear(image.texels, image.width, image.height, u, v, rgb);
+  }
+
+  void IBLBaker::sampleCubeMap(const CubeMapData& cube, float x, float y, float z, float lod, float* rgb)
+  {
+    int face = 0;
+    float s, t;
+    if (cube.layout == MapLayout::Octahedral)
+      getOctahedralUvScale(x, y, z, s, t);
+    else
+      getCubeMapFaceUv(x, y, z, face, s, t);
+    const int maxLevel = cube.mipLevels - 1;
+    lod = std::min(std::max(lod, 0.0f), float(maxLevel));
+    const int level0 = int(lod);
+    const int level1 = std::min(level0 + 1, maxLevel);
+    const float blend = lod - level0;
+    bilinear(cube.getFace(level0, face), cube.getMipSize(level0), cube.getMipSize(level0), s, t, rgb);
+    if (blend > 0.0f)
+    {
+      float upper[3];
+      bilinear(cube.getFace(level1, face), cube.getMipSize(level1), cube.getMipSize(level1), s, t, upper);
+      for (int ch = 0; ch < 3; ++ch)
+        rgb[ch] += (upper[ch] - rgb[ch]) * blend;
+    }
+  }
+
+  void IBLBaker::equirectToCubeMap(const EquirectImage& image, int size, CubeMapData& output, MapLayout layout)
+  {
+    EquirectMipChain chain;
+    buildEquirectMipChain(image, chain);
+    equirectToCubeMap(chain, size, output, layout);
+  }
+
+  void IBLBaker::equirectToCubeMap(const EquirectMipChain& chain, int size, CubeMapData& output, MapLayout layout)
+  {
+    DEBUG_ASSERT(chain.getLevelCount() && size > 0);
+    int mipLevels = 1;
+    while ((size >> mipLevels) > 0)
+      ++mipLevels;
+    output.allocate(size, mipLevels, layout);
+    const bool octahedral = layout == MapLayout::Octahedral;
+
+    // lod = 0.5 * log2(map texel solid angle / panorama texel solid angle). The map's texels
+    // shrink with 1 / |d|^3 of their unnormalized direction d in either layout, the panorama's
+    // with cos(latitude).
+    const EquirectImage base = chain.getLevel(0);
+    const float baseLod = float(0.5 * std::log2(getMapTexelSolidAngle(layout, size) / getEquirectTexelSolidAngle(base.width, base.height)));
+    const float texelScale = 2.0f / size;
+    const int tileSize = std::min(kCubeMapTileSize, size);
+    const int tilesPerRow = (size + tileSize - 1) / tileSize;
+    const int tilesPerFace = tilesPerRow * tilesPerRow;
+    Parallel::forRange(output.getFaceCount() * tilesPerFace, 1, [&](std::size_t begin, std::size_t end)
+    {
+      for (std::size_t tile = begin; tile < end; ++tile)
+      {
+        const int face = int(tile / tilesPerFace);
+        const int tileX = int(tile % tilesPerFace) % tilesPerRow * tileSize;
+        const int tileY = int(tile % tilesPerFace) / tilesPerRow * tileSize;
+        const int tileEnd = std::min(tileX + tileSize, size);
+        const float (&axes)[3][3] = kFaceAxes[face];
+        for (int t = tileY; t < std::min(tileY + tileSize, size); ++t)
+        {
+          const float tc = (t + 0.5f) * texelScale - 1.0f;
+          const float rowX = axes[0][0] + tc * axes[2][0];
+          const float rowY = axes[0][1] + tc * axes[2][1];
+          const float rowZ = axes[0][2] + tc * axes[2][2];
+          float* texel = output.getFace(0, face) + (std::size_t(t) * size + tileX) * 3;
+          int s = tileX;
+#if defined(__AVX2__)
+          for (; s + 8 <= tileEnd; s += 8, texel += 24)
+          {
+            const __m256 columns = _mm256_add_ps(_mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f), _mm256_set1_ps(float(s)));
+            const __m256 sc = _mm256_fmsub_ps(columns, _mm256_set1_ps(texelScale), _mm256_set1_ps(1.0f));
+            __m256 dx, dy, dz;
+            if (octahedral)
+              octahedralPoint8(sc, _mm256_set1_ps(tc), dx, dy, dz);
+            else
+            {
+              dx = _mm256_fmadd_ps(sc, _mm256_set1_ps(axes[1][0]), _mm256_set1_ps(rowX));
+              dy = _mm256_fmadd_ps(sc, _mm256_set1_ps(axes[1][1]), _mm256_set1_ps(rowY));
+              dz = _mm256_fmadd_ps(sc, _mm256_set1_ps(axes[1][2]), _mm256_set1_ps(rowZ));
+            }
+            const __m256 lengthSquared = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+            const __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+            const __m256 x = _mm256_mul_ps(dx, invLength), y = _mm256_mul_ps(dy, invLength), z = _mm256_mul_ps(dz, invLength);
+            const __m256 cos2Lat = _mm256_max_ps(_mm256_fnmadd_ps(y, y, _mm256_set1_ps(1.0f)), _mm256_set1_ps(1e-4f));
+            __m256 lod = _mm256_add_ps(getOutputTexelLodOffset8(lengthSquared), _mm256_set1_ps(baseLod));
+            lod = _mm256_fmadd_ps(log2x8(cos2Lat), _mm256_set1_ps(-0.25f), lod);
+            __m256 u, v, color[3];
+            directionToUv8(x, y, z, u, v);
+            trilinear8(chain, lod, u, v, color);
+            alignas(32) float lanes[3][8];
+            for (int ch = 0; ch < 3; ++ch)
+              _mm256_store_ps(lanes[ch], color[ch]);
+            for (int l = 0; l < 8; ++l)
+              for (int ch = 0; ch < 3; ++ch)
+                texel[l * 3 + ch] = lanes[ch][l];
+          }
+#endif
+          for (; s < tileEnd; ++s, texel += 3)
+          {
+            const float sc = (s + 0.5f) * texelScale - 1.0f;
+            float dx = rowX + sc * axes[1][0], dy = rowY + sc * axes[1][1], dz = rowZ + sc * axes[1][2];
+            if (octahedral)
+              getOctahedralPoint(sc, tc, dx, dy, dz);
+            const float lengthSquared = dx * dx + dy * dy + dz * dz;
+            const float invLength = 1.0f / std::sqrt(lengthSquared);
+            const float y = dy * invLength;
+            const float lod = baseLod + getOutputTexelLodOffset(lengthSquared) + getLatitudeLodOffset(y);
+            sampleEquirectLod(chain, dx * invLength, y, dz * invLength, lod, texel);
+          }
+        }
+      }
+    });
+    output.generateMips();
+  }
+
+  void IBLBaker::convertMapLayout(const CubeMapData& source, int size, MapLayout layout, CubeMapData& output)
+  {
+    DEBUG_ASSERT(source.mipLevels > 0 && size > 0 && &source != &output);
+    int mipLevels = 1;
+    while ((size >> mipLevels) > 0)
+      ++mipLevels;
+    output.allocate(size, mipLevels, layout);
+
+    // As in equirectToCubeMap, with CubeMapSource adding the lod offset of the source's texels.
+    const CubeMapSource lookup(source);
+    const float baseLod = float(0.5 * std::log2(getMapTexelSolidAngle(layout, size) / getMapTexelSolidAngle(source.layout, source.size)));
+    const float texelScale = 2.0f / size;
+    const int tileSize = std::min(kCubeMapTileSize, size);
+    const int tilesPerRow = (size + tileSize - 1) / tileSize;
+    const int tilesPerFace = tilesPerRow * tilesPerRow;
+    Parallel::forRange(output.getFaceCount() * tilesPerFace, 1, [&](std::size_t begin, std::size_t end)
+    {
+      for (std::size_t tile = begin; tile < end; ++tile)
+      {
+        const int face = int(tile / tilesPerFace);
+        const int tileX = int(tile % tilesPerFace) % tilesPerRow * tileSize;
+        const int tileY = int(tile % tilesPerFace) / tilesPerRow * tileSize;
+        for (int t = tileY; t < std::min(tileY + tileSize, size); ++t)
+        {
+          float* texel = output.getFace(0, face) + (std::size_t(t) * size + tileX) * 3;
+          for (int s = tileX; s < std::min(tileX + tileSize, size); ++s, texel += 3)
+          {
+            float d[3];
+            getTexelPoint(layout, face, (s + 0.5f) * texelScale - 1.0f, (t + 0.5f) * texelScale - 1.0f, d);
+            const float lengthSquared = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            const float invLength = 1.0f / std::sqrt(lengthSquared);
+            lookup.sample(d[0] * invLength, d[1] * invLength, d[2] * invLength, true, baseLod + getOutputTexelLodOffset(lengthSquared), texel);
+          }
+        }
+      }
+    });
+    output.generateMips();
+  }
+
+  int IBLBaker::getOctahedralSize(int cubeMapSize)
+  {
+    return 2 * cubeMapSize;
+  }
+
+  int IBLBaker::getEquirectCubeMapSize(int width)
+  {
+    // A face spans 90 degrees with 2 / size radians per texel at its centre, the panorama's
+    // equator 2 pi / width, so they match at width / pi.
+    const int exponent = int(std::lround(std::log2(std::max(width / kPi, 1.0))));
+    return std::min(1 << std::min(exponent, 30), kMaxEnvironmentCubeMapSize);
+  }
+
+  void IBLBaker::buildEquirectMipChain(const EquirectImage& image, EquirectMipChain& output)
+  {
+    output.allocate(image.width, image.height);
+    std::copy(image.texels, image.texels + std::size_t(image.width) * image.height * 3, output.texels.begin());
+    output.generateMips();
+  }
+
+  int IBLBaker::getPrefilterSampleCount(float roughness, int faceSize, const PrefilterSettings& settings)
+  {
+    if (settings.mode == PrefilterMode::BruteForce)
+      return settings.numSamples;
+
+    // The relative variance of the filtered estimator is close to 1 once the reflected GGX lobe
+    // (~4 pi alpha^2 sr) spans many output texels and vanishes when it fits inside a single one,
+    // so N ~= min(1, lobe / texel) / error^2.
+    const double alpha = double(roughness) * roughness;
+    const double lobeSolidAngle = 4.0 * kPi * alpha * alpha;
+    const int faceCount = settings.layout == MapLayout::Octahedral ? 1 : kNumCubeMapFaces;
+    const double texelSolidAngle = 4.0 * kPi / (faceCount * double(faceSize) * faceSize);
+    const double variance = std::min(1.0, lobeSolidAngle / texelSolidAngle);
+    const double error = std::max(double(settings.targetError), 1e-3);
+    const int count = int(std::ceil(variance / (error * error)));
+    return std::min(std::max(count, 1), settings.numSamples);
+  }
+
+  double IBLBaker::getEquirectTexelSolidAngle(int width, int height)
+  {
+    return (2.0 * kPi / width) * (kPi / height);
+  }
+
+  double IBLBaker::getCubeMapTexelSolidAngle(int size)
+  {
+    // Faces span [-1, 1]^2 at distance 1.
+    return 4.0 / (double(size) * size);
+  }
+
+  double IBLBaker::getOctahedralTexelSolidAngle(int size)
+  {
+    // Around the axes, where the octahedron touches the unit sphere, a texel covers as much
+    // solid angle as its area in [-1, 1]^2.
+    return 4.0 / (double(size) * size);
+  }
+
+  double IBLBaker::getMapTexelSolidAngle(MapLayout layout, int size)
+  {
+    return layout == MapLayout::Octahedral ? getOctahedralTexelSolidAngle(size) : getCubeMapTexelSolidAngle(size);
+  }
+
+  void IBLBaker::prefilterEnvMap(const EquirectImage& image,
+                                 const PrefilterSettings& settings,
+                                 CubeMapData& output,
+                                 std::vector<PrefilterMipStats>* stats)
+  {
+    DEBUG_ASSERT(image.texels);
+    // Brute force only ever reads the full resolution image.
+    EquirectMipChain chain;
+    if (settings.mode == PrefilterMode::FilteredImportanceSampling)
+      buildEquirectMipChain(image, chain);
+    prefilterTiles(EquirectSource {image, chain}, getEquirectTexelSolidAngle(image.width, image.height), settings, output, stats);
+  }
+
+  void IBLBaker::prefilterEnvMap(const EquirectMipChain& chain,
+                                 const PrefilterSettings& settings,
+                                 CubeMapData& output,
+                                 std::vector<PrefilterMipStats>* stats)
+  {
+    const EquirectImage image = chain.getLevel(0);
+    prefilterTiles(EquirectSource {image, chain}, getEquirectTexelSolidAngle(image.width, image.height), settings, output, stats);
+  }
+
+  void IBLBaker::prefilterEnvMap(const CubeMapData& source,
+                                 const PrefilterSettings& settings,
+                                 CubeMapData& output,
+                                 std::vector<PrefilterMipStats>* stats)
+  {
+    DEBUG_ASSERT(source.mipLevels > 0 && !source.texels.empty());
+    prefilterTiles(CubeMapSource(source), getMapTexelSolidAngle(source.layout, source.size), settings, output, stats);
+  }
+}
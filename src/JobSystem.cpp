@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+  // Lets a task running on a worker push follow-up jobs onto its own deque.
+  thread_local const void* tWorkerSystem = nullptr;
+  thread_local int tWorkerIndex = -1;
+}
+
+namespace Akoylasar
+{
+  struct JobSystem::Job
+  {
+    std::function<void()> task;
+    bool mainThread = false;
+    // Starts at 1 so that the job cannot be scheduled while its dependencies are being added.
+    std::atomic<int> pendingDependencies {1};
+    std::mutex mutex;
+    bool finished = false;
+    std::vector<JobHandle> continuations;
+  };
+
+  JobSystem::JobSystem(unsigned int workerCount)
+  : mMainThread(std::this_thread::get_id())
+  {
+    workerCount = std::max(1u, workerCount);
+    for (unsigned int i = 0; i < workerCount; ++i)
+      mWorkers.push_back(std::make_unique<Worker>());
+    for (unsigned int i = 0; i < workerCount; ++i)
+      mWorkers[i]->thread = std::thread(&JobSystem::workerLoop, this, int(i));
+  }
+
+  JobSystem::~JobSystem()
+  {
+    cancel();
+    drain();
+    {
+      std::lock_guard<std::mutex> lock(mSleepMutex);
+      mStopping = true;
+    }
+    mWake.notify_all();
+    for (auto& worker : mWorkers)
+      worker->thread.join();
+  }
+
+  JobSystem::JobHandle JobSystem::submit(std::function<void()> task, const std::vector<JobHandle>& dependencies)
+  {
+    return submit(std::move(task), dependencies, false);
+  }
+
+  JobSystem::JobHandle JobSystem::submitMainThread(std::function<void()> task, const std::vector<JobHandle>& dependencies)
+  {
+    return submit(std::move(task), dependencies, true);
+  }
+
+  JobSystem::JobHandle JobSystem::submit(std::function<void()> task, const std::vector<JobHandle>& dependencies, bool mainThread)
+  {
+    auto job = std::make_shared<Job>();
+    job->task = std::move(task);
+    job->mainThread = mainThread;
+    ++mUnfinishedJobs;
+
+    for (const auto& dependency : dependencies)
+    {
+      if (!dependency)
+        continue;
+      std::lock_guard<std::mutex> lock(dependency->mutex);
+      if (!dependency->finished)
+      {
+        ++job->pendingDependencies;
+        dependency->continuations.push_back(job);
+      }
+    }
+
+    if (--job->pendingDependencies == 0)
+      schedule(job);
+    return job;
+  }
+
+  std::size_t JobSystem::runMainThreadJobs()
+  {
+    std::vector<JobHandle> jobs;
+    {
+      std::lock_guard<std::mutex> lock(mMainThreadMutex);
+      jobs.swap(mMainThreadJobs);
+    }
+    for (const auto& job : jobs)
+      execute(job);
+    return jobs.size();
+  }
+
+  void JobSystem::wait(const JobHandle& job)
+  {
+    const bool onMainThread = std::this_thread::get_id() == mMainThread;
+    while (!isFinished(job))
+    {
+      if (onMainThread && runMainThreadJobs())
+        continue;
+      if (!runOneJob())
+        std::this_thread::yield();
+    }
+  }
+
+  bool JobSystem::isFinished(const JobHandle& job)
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return job->finished;
+  }
+
+  void JobSystem::cancel()
+  {
+    mCancelled = true;
+    // Main thread jobs may never be run again, so skip them here; worker jobs are skipped as
+    // they are popped.
+    std::vector<JobHandle> jobs;
+    {
+      std::lock_guard<std::mutex> lock(mMainThreadMutex);
+      jobs.swap(mMainThreadJobs);
+    }
+    for (const auto& job : jobs)
+      execute(job);
+  }
+
+  void JobSystem::drain()
+  {
+    const bool onMainThread = std::this_thread::get_id() == mMainThread;
+    while (mUnfinishedJobs > 0)
+    {
+      if (onMainThread && runMainThreadJobs())
+        continue;
+      if (runOneJob())
+        continue;
+      std::unique_lock<std::mutex> lock(mDrainMutex);
+      mDrained.wait_for(lock, std::chrono::milliseconds(1), [this]() { return mUnfinishedJobs == 0; });
+    }
+  }
+
+  JobSystem::Stats JobSystem::getStats() const
+  {
+    Stats stats;
+    stats.executed = mExecuted;
+    stats.skipped = mSkipped;
+    stats.stolen = mStolen;
+    return stats;
+  }
+
+  void JobSystem::schedule(const JobHandle& job)
+  {
+    if (mCancelled)
+    {
+      execute(job);
+      return;
+    }
+
+    if (job->mainThread)
+    {
+      std::lock_guard<std::mutex> lock(mMainThreadMutex);
+      mMainThreadJobs.push_back(job);
+      return;
+    }
+
+    // Workers keep their own follow-up jobs local, everyone else spreads them round robin.
+    const bool onWorker = tWorkerSystem == this;
+    Worker& worker = *mWorkers[onWorker ? tWorkerIndex : mNextWorker++ % mWorkers.size()];
+    {
+      // Counted before it becomes visible so that a thief can never take the count below zero.
+      std::lock_guard<std::mutex> lock(mSleepMutex);
+      ++mQueuedJobs;
+    }
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.jobs.push_back(job);
+    }
+    mWake.notify_one();
+  }
+
+  void JobSystem::execute(const JobHandle& job)
+  {
+    if (mCancelled)
+      ++mSkipped;
+    else
+    {
+      job->task();
+      ++mExecuted;
+    }
+    // Release whatever the task captured before its dependents run.
+    job->task = nullptr;
+    complete(job);
+  }
+
+  void JobSystem::complete(const JobHandle& job)
+  {
+    // Once cancelled, dependents are skipped right here. Done with a work list rather than
+    // recursion since dependency chains can be arbitrarily long.
+    std::vector<JobHandle> finished {job};
+    while (!finished.empty())
+    {
+      const JobHandle current = std::move(finished.back());
+      finished.pop_back();
+
+      std::vector<JobHandle> continuations;
+      {
+        std::lock_guard<std::mutex> lock(current->mutex);
+        current->finished = true;
+        continuations.swap(current->continuations);
+      }
+      for (auto& continuation : continuations)
+      {
+        if (--continuation->pendingDependencies != 0)
+          continue;
+        if (mCancelled)
+        {
+          ++mSkipped;
+          continuation->task = nullptr;
+          finished.push_back(std::move(continuation));
+        }
+        else
+          schedule(continuation);
+      }
+
+      if (--mUnfinishedJobs == 0)
+      {
+        std::lock_guard<std::mutex> lock(mDrainMutex);
+        mDrained.notify_all();
+      }
+    }
+  }
+
+  JobSystem::JobHandle JobSystem::findJob(int workerIndex)
+  {
+    // Newest first from our own deque, it is the most likely to still be in cache.
+    if (workerIndex >= 0)
+    {
+      Worker& worker = *mWorkers[workerIndex];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!worker.jobs.empty())
+      {
+        JobHandle job = std::move(worker.jobs.back());
+        worker.jobs.pop_back();
+        --mQueuedJobs;
+        return job;
+      }
+    }
+
+    // Oldest first from everyone else.
+    const std::size_t count = mWorkers.size();
+    const std::size_t start = workerIndex >= 0 ? std::size_t(workerIndex) + 1 : 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      Worker& victim = *mWorkers[(start + i) % count];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+        JobHandle job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        --mQueuedJobs;
+        ++mStolen;
+        return job;
+      }
+    }
+    return nullptr;
+  }
+
+  bool JobSystem::runOneJob()
+  {
+    JobHandle job = findJob(tWorkerSystem == this ? tWorkerIndex : -1);
+    if (!job)
+      return false;
+    execute(job);
+    return true;
+  }
+
+  void JobSystem::workerLoop(int workerIndex)
+  {
+    tWorkerSystem = this;
+    tWorkerIndex = workerIndex;
+    while (true)
+    {
+      if (JobHandle job = findJob(workerIndex))
+      {
+        execute(job);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mSleepMutex);
+      mWake.wait(lock, [this]() { return mStopping || mQueuedJobs > 0; });
+      if (mStopping && mQueuedJobs == 0)
+        return;
+    }
+  }
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Akoylasar
+{
+  MappedFile::~MappedFile()
+  {
+    close();
+  }
+
+  MappedFile::MappedFile(MappedFile&& other) noexcept
+  {
+    *this = std::move(other);
+  }
+
+  MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+  {
+    if (this != &other)
+    {
+      close();
+      std::swap(mData, other.mData);
+      std::swap(mSize, other.mSize);
+#ifdef _WIN32
+      std::swap(mFile, other.mFile);
+      std::swap(mMapping, other.mMapping);
+#endif
+    }
+    return *this;
+  }
+
+#ifdef _WIN32
+  bool MappedFile::open(const std::filesystem::path& path)
+  {
+    close();
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+      CloseHandle(file);
+      return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+      if (mapping)
+        CloseHandle(mapping);
+      CloseHandle(file);
+      return false;
+    }
+    mFile = file;
+    mMapping = mapping;
+    mData = static_cast<const std::uint8_t*>(data);
+    mSize = std::size_t(size.QuadPart);
+    return true;
+  }
+
+  void MappedFile::close()
+  {
+    if (mData)
+      UnmapViewOfFile(mData);
+    if (mMapping)
+      CloseHandle(mMapping);
+    if (mFile)
+      CloseHandle(mFile);
+    mData = nullptr;
+    mSize = 0;
+    mFile = nullptr;
+    mMapping = nullptr;
+  }
+
+  void MappedFile::release(std::size_t offset, std::size_t size)
+  {
+    if (!mData || offset >= mSize || size == 0)
+      return;
+    // Unlocking pages that were never locked removes them from the working set.
+    VirtualUnlock(const_cast<std::uint8_t*>(mData) + offset, std::min(size, mSize - offset));
+  }
+#else
+  bool MappedFile::open(const std::filesystem::path& path)
+  {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) || info.st_size == 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    void* data = mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    // Everything we map is read front to back exactly once.
+    madvise(data, std::size_t(info.st_size), MADV_SEQUENTIAL);
+    mData = static_cast<const std::uint8_t*>(data);
+    mSize = std::size_t(info.st_size);
+    return true;
+  }
+
+  void MappedFile::close()
+  {
+    if (mData)
+      munmap(const_cast<std::uint8_t*>(mData), mSize);
+    mData = nullptr;
+    mSize = 0;
+  }
+
+  void MappedFile::release(std::size_t offset, std::size_t size)
+  {
+    if (!mData || offset >= mSize)
+      return;
+    // madvise wants page aligned ranges; round inwards so neighbouring data is kept.
+    const std::size_t pageSize = std::size_t(sysconf(_SC_PAGESIZE));
+    const std::size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+    const std::size_t end = std::min(offset + size, mSize) / pageSize * pageSize;
+    if (begin < end)
+      madvise(const_cast<std::uint8_t*>(mData) + begin, end - begin, MADV_DONTNEED);
+  }
+#endif
+}
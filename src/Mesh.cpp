@@ -2,9 +2,63 @@
  * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
 #include "Mesh.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 #include "Debug.hpp"
+#include "MeshSimplifier.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  // Vao, vertex and index buffers, with the vao and the vertex buffer left bound for the
+  // attribute setup.
+  GpuMesh createBuffers(const MeshView& mesh, const void* vertices, std::size_t vertexSize)
+  {
+    DEBUG_ASSERT(mesh.vertexCount && mesh.indexCount);
+    GpuMesh gpuMesh;
+    
+    // Vao setup.
+    CHECK_GL_ERROR(glGenVertexArrays(1, &gpuMesh.vao));
+    CHECK_GL_ERROR(glBindVertexArray(gpuMesh.vao));
+    
+    // Setup vertex buffer.
+    CHECK_GL_ERROR(glGenBuffers(1, &gpuMesh.vbo));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.vbo));
+    gpuMesh.vertexBufferBytes = mesh.vertexCount * vertexSize;
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, gpuMesh.vertexBufferBytes, vertices, GL_STATIC_DRAW));
+    
+    // Setup index buffer.
+    CHECK_GL_ERROR(glGenBuffers(1, &gpuMesh.ebo));
+    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.ebo));
+    const auto indexBufferSize = mesh.indexCount * sizeof(std::uint32_t);
+    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, mesh.indices, GL_STATIC_DRAW));
+    
+    gpuMesh.indexCount = GLsizei(mesh.getBaseIndexCount());
+    gpuMesh.drawMode = GL_TRIANGLES;
+    if (mesh.lodCount)
+      gpuMesh.lods.assign(mesh.lods, mesh.lods + mesh.lodCount);
+    else
+      gpuMesh.lods.push_back({0, std::uint32_t(mesh.indexCount), 0.0f});
+    
+    return gpuMesh;
+  }
+
+  void setBounds(GpuMesh& gpuMesh, const Vertex* vertices, std::size_t count)
+  {
+    Neon::Vec3f boundsMin = vertices[0].position;
+    Neon::Vec3f boundsMax = boundsMin;
+    for (std::size_t i = 1; i < count; ++i)
+    {
+      const Neon::Vec3f& position = vertices[i].position;
+      boundsMin = Neon::Vec3f(std::min(boundsMin.x, position.x), std::min(boundsMin.y, position.y), std::min(boundsMin.z, position.z));
+      boundsMax = Neon::Vec3f(std::max(boundsMax.x, position.x), std::max(boundsMax.y, position.y), std::max(boundsMax.z, position.z));
+    }
+    gpuMesh.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+    gpuMesh.boundsRadius = Neon::mag(boundsMax - boundsMin) * 0.5f;
+  }
+}
 
 namespace Akoylasar
 {
@@ -160,38 +214,48 @@ namespace Akoylasar
                                  GLuint normalAttribuIndex,
                                  GLuint uvAttribuIndex)
   {
-    GpuMesh gpuMesh;
-    
-    // Vao setup.
-    CHECK_GL_ERROR(glGenVertexArrays(1, &gpuMesh.vao));
-    CHECK_GL_ERROR(glBindVertexArray(gpuMesh.vao));
-    
-    // Setup vertex buffer.
-    CHECK_GL_ERROR(glGenBuffers(1, &gpuMesh.vbo));
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.vbo));
-    const auto vertexBufferSize = mesh.vertices.size() * sizeof(Vertex);
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, &mesh.vertices.at(0), GL_STATIC_DRAW));
-    
-    // Setup index buffer.
-    CHECK_GL_ERROR(glGenBuffers(1, &gpuMesh.ebo));
-    CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.ebo));
-    const auto indexBufferSize = mesh.indices.size() * sizeof(std::uint32_t);
-    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, &mesh.indices.at(0), GL_STATIC_DRAW));
-    
-    // Specify vertex format.
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.vbo));
+    return createGpuMesh(mesh.getView(), positionAttribuIndex, normalAttribuIndex, uvAttribuIndex);
+  }
+
+  GpuMesh GpuMesh::createGpuMesh(const MeshView& mesh,
+                                 GLuint positionAttribuIndex,
+                                 GLuint normalAttribuIndex,
+                                 GLuint uvAttribuIndex)
+  {
+    GpuMesh gpuMesh = createBuffers(mesh, mesh.vertices, sizeof(Vertex));
+    setBounds(gpuMesh, mesh.vertices, mesh.vertexCount);
     CHECK_GL_ERROR(glVertexAttribPointer(positionAttribuIndex, 3, GL_FLOAT, false, sizeof(Vertex), (void*)(offsetof(Vertex, position))));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(positionAttribuIndex));
     CHECK_GL_ERROR(glVertexAttribPointer(normalAttribuIndex, 3, GL_FLOAT, false, sizeof(Vertex), (void*)(offsetof(Vertex, normal))));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(normalAttribuIndex));
     CHECK_GL_ERROR(glVertexAttribPointer(uvAttribuIndex, 2, GL_FLOAT, false, sizeof(Vertex), (void*)(offsetof(Vertex, uv))));
-    CHECK_GL_ERROR(glEnableVertexAttribArray(2));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(uvAttribuIndex));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+    return gpuMesh;
+  }
 
+  GpuMesh GpuMesh::createGpuMesh(const MeshView& mesh,
+                                 const PackedVertex* packedVertices,
+                                 const Neon::Vec3f& boundsMin,
+                                 const Neon::Vec3f& boundsMax,
+                                 GLuint positionAttribuIndex,
+                                 GLuint normalAttribuIndex,
+                                 GLuint uvAttribuIndex)
+  {
+    GpuMesh gpuMesh = createBuffers(mesh, packedVertices, sizeof(PackedVertex));
+    CHECK_GL_ERROR(glVertexAttribPointer(positionAttribuIndex, 3, GL_UNSIGNED_SHORT, true, sizeof(PackedVertex),
+                                         (void*)(offsetof(PackedVertex, position))));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(positionAttribuIndex));
+    CHECK_GL_ERROR(glVertexAttribPointer(normalAttribuIndex, 2, GL_SHORT, true, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, normal))));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(normalAttribuIndex));
+    CHECK_GL_ERROR(glVertexAttribPointer(uvAttribuIndex, 2, GL_HALF_FLOAT, false, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, uv))));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(uvAttribuIndex));
     CHECK_GL_ERROR(glBindVertexArray(0));
-    
-    gpuMesh.indexCount = mesh.indices.size();
-    gpuMesh.drawMode = GL_TRIANGLES;
-    
+    gpuMesh.quantized = true;
+    gpuMesh.positionOffset = boundsMin;
+    gpuMesh.positionScale = boundsMax - boundsMin;
+    gpuMesh.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+    gpuMesh.boundsRadius = Neon::mag(boundsMax - boundsMin) * 0.5f;
     return gpuMesh;
   }
 
@@ -203,14 +267,23 @@ namespace Akoylasar
     gpuMesh.vbo = 0;
     gpuMesh.ebo = 0;
     gpuMesh.vao = 0;
+    gpuMesh.indexCount = 0;
+    gpuMesh.lods.clear();
+  }
+
+  int GpuMesh::selectLod(const Camera& camera, const float* model, float viewportHeight, float maxPixelError) const
+  {
+    return MeshSimplifier::selectLod(lods.data(), lods.size(), boundsCenter, boundsRadius, model, camera.getOrigin(),
+                                     camera.getProjection().data()[5], viewportHeight, maxPixelError);
   }
   
-  void GpuMesh::draw() const
+  void GpuMesh::draw(int lod) const
   {
+    const MeshLod& level = lods[lod];
     CHECK_GL_ERROR(glBindVertexArray(vao));
     CHECK_GL_ERROR(glDrawElements(drawMode,
-                                  indexCount,
+                                  GLsizei(level.indexCount),
                                   GL_UNSIGNED_INT,
-                                  nullptr));
+                                  (void*)(std::size_t(level.indexOffset) * sizeof(std::uint32_t))));
   }
 }
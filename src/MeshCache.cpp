@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "MeshCache.hpp"
+
+#include "BakeCache.hpp"
+#include "CacheFile.hpp"
+
+namespace
+{
+  // Bump whenever ObjLoader, the mesh builders or the processing applied before a mesh is
+  // stored change what a source turns into.
+  constexpr std::uint32_t kBuildVersion = 4;
+}
+
+namespace Akoylasar
+{
+  MeshCache::MeshCache(const std::filesystem::path& directory)
+  : mDirectory(directory)
+  {}
+
+  std::uint64_t MeshCache::getKey(const void* source, std::size_t sourceSize, const void* parameters, std::size_t parametersSize)
+  {
+    const std::uint64_t seed = BakeCache::hash(&kBuildVersion, sizeof(kBuildVersion));
+    return BakeCache::hash(parameters, parametersSize, BakeCache::hash(source, sourceSize, seed));
+  }
+
+  std::filesystem::path MeshCache::getEntryPath(std::uint64_t key) const
+  {
+    return CacheFile::getEntryPath(mDirectory, key, ".pbrmesh");
+  }
+
+  bool MeshCache::load(std::uint64_t key, MappedFile& file, MeshView& mesh, PackedVertices& packed) const
+  {
+    return CacheFile::load(getEntryPath(key), key, "Mesh cache", file, [&mesh, &packed](const MappedFile& mapped, std::uint64_t& storedKey)
+    {
+      return MeshContainer::read(mapped, storedKey, mesh, packed);
+    });
+  }
+
+  bool MeshCache::store(std::uint64_t key, const MeshView& mesh, const PackedVertices& packed) const
+  {
+    return CacheFile::store(getEntryPath(key), "Mesh cache", [key, &mesh, &packed](const std::filesystem::path& path)
+    {
+      return MeshContainer::write(path, key, mesh, packed);
+    });
+  }
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "MeshContainer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include "CacheFile.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  constexpr char kMagic[4] = {'P', 'M', 'S', 'H'};
+  constexpr std::uint32_t kVersion = 2;
+
+  enum Section
+  {
+    kVertices,
+    kIndices,
+    kPackedVertices,
+    kLods,
+    kSectionCount
+  };
+
+  // Written as is, so containers are only portable between machines of the same endianness.
+  struct Header
+  {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t key;
+    std::uint64_t vertexCount;
+    std::uint64_t indexCount;
+    std::uint64_t lodCount;
+    // The Vertex layout of the writer, checked rather than trusted.
+    std::uint32_t vertexStride;
+    std::uint32_t normalOffset;
+    std::uint32_t uvOffset;
+    std::uint32_t packedFormat;
+    std::uint32_t packedStride;
+    float packedBoundsMin[3];
+    float packedBoundsMax[3];
+    CacheFile::Section sections[kSectionCount];
+  };
+
+  // Checked on all cores, the index section of a large scan is tens of MB.
+  bool areIndicesInRange(const std::uint32_t* indices, std::size_t count, std::size_t vertexCount)
+  {
+    std::atomic<bool> inRange {true};
+    Parallel::forRange(count, 1 << 16, [&](std::size_t begin, std::size_t end)
+    {
+      std::uint32_t largest = 0;
+      for (std::size_t i = begin; i < end; ++i)
+        largest = std::max(largest, indices[i]);
+      if (largest >= vertexCount)
+        inRange = false;
+    });
+    return inRange;
+  }
+
+  // Whole triangles within the index section, finest first.
+  bool areLodsValid(const MeshLod* lods, std::size_t count, std::size_t indexCount)
+  {
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const MeshLod& lod = lods[i];
+      if (!lod.indexCount || lod.indexOffset % 3 || lod.indexCount % 3 || lod.indexOffset > indexCount ||
+          lod.indexCount > indexCount - lod.indexOffset || !(lod.error >= 0.0f) || (i && lod.error < lods[i - 1].error))
+        return false;
+    }
+    return true;
+  }
+}
+
+namespace Akoylasar
+{
+  bool MeshContainer::write(const std::filesystem::path& path, std::uint64_t key, const MeshView& mesh, const PackedVertices& packed)
+  {
+    Header header {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.key = key;
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indexCount;
+    header.lodCount = mesh.lodCount;
+    header.vertexStride = sizeof(Vertex);
+    header.normalOffset = offsetof(Vertex, normal);
+    header.uvOffset = offsetof(Vertex, uv);
+    header.packedFormat = packed.data ? packed.format : 0;
+    header.packedStride = packed.data ? packed.stride : 0;
+    std::memcpy(header.packedBoundsMin, packed.boundsMin, sizeof(header.packedBoundsMin));
+    std::memcpy(header.packedBoundsMax, packed.boundsMax, sizeof(header.packedBoundsMax));
+
+    const void* data[kSectionCount] = {mesh.vertices, mesh.indices, packed.data, mesh.lods};
+    const std::uint64_t sizes[kSectionCount] = {mesh.vertexCount * sizeof(Vertex), mesh.indexCount * sizeof(std::uint32_t),
+                                                mesh.vertexCount * header.packedStride, mesh.lodCount * sizeof(MeshLod)};
+    return CacheFile::writeSections(path, "mesh container", &header, sizeof(header), header.sections, data, sizes, kSectionCount);
+  }
+
+  bool MeshContainer::read(const MappedFile& file, std::uint64_t& key, MeshView& mesh, PackedVertices& packed)
+  {
+    auto reject = [](const char* reason)
+    {
+      std::cerr << "Invalid mesh container: " << reason << std::endl;
+      return false;
+    };
+
+    if (file.getSize() < sizeof(Header))
+      return reject("truncated");
+    Header header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) || header.version != kVersion)
+      return reject("unknown version");
+    if (header.vertexStride != sizeof(Vertex) || header.normalOffset != offsetof(Vertex, normal) || header.uvOffset != offsetof(Vertex, uv))
+      return reject("different vertex layout");
+    if (!header.vertexCount || header.vertexCount > 0xffffffffull || !header.indexCount || header.indexCount % 3)
+      return reject("bad counts");
+
+    if (header.lodCount > 0xffff)
+      return reject("bad counts");
+
+    const std::uint64_t sizes[kSectionCount] = {header.vertexCount * sizeof(Vertex), header.indexCount * sizeof(std::uint32_t),
+                                                header.vertexCount * header.packedStride, header.lodCount * sizeof(MeshLod)};
+    const std::uint8_t* data[kSectionCount];
+    for (int i = 0; i < kSectionCount; ++i)
+    {
+      const CacheFile::Section& section = header.sections[i];
+      if (section.size != sizes[i])
+        return reject("truncated");
+      if (const char* reason = CacheFile::readSection(file, section, data[i]))
+        return reject(reason);
+    }
+    const auto* indices = reinterpret_cast<const std::uint32_t*>(data[kIndices]);
+    if (!areIndicesInRange(indices, header.indexCount, header.vertexCount))
+      return reject("index out of range");
+    const auto* lods = reinterpret_cast<const MeshLod*>(data[kLods]);
+    if (!areLodsValid(lods, header.lodCount, header.indexCount))
+      return reject("bad levels of detail");
+
+    mesh.vertices = reinterpret_cast<const Vertex*>(data[kVertices]);
+    mesh.vertexCount = header.vertexCount;
+    mesh.indices = indices;
+    mesh.indexCount = header.indexCount;
+    mesh.lods = lods;
+    mesh.lodCount = header.lodCount;
+    packed = PackedVertices();
+    if (data[kPackedVertices])
+    {
+      packed.format = header.packedFormat;
+      packed.stride = header.packedStride;
+      std::memcpy(packed.boundsMin, header.packedBoundsMin, sizeof(packed.boundsMin));
+      std::memcpy(packed.boundsMax, header.packedBoundsMax, sizeof(packed.boundsMax));
+      packed.data = data[kPackedVertices];
+    }
+    key = header.key;
+    return true;
+  }
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Debug.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  constexpr std::uint32_t kUnused = ~0u;
+  constexpr std::size_t kFetchLineSize = 64;
+  constexpr std::uint32_t kFetchCacheLines = 128;
+
+  // A FIFO of cacheSize entries as time stamps: an entry is still in the cache while fewer
+  // than cacheSize others have been inserted after it.
+  class FifoCache
+  {
+  public:
+    FifoCache(std::size_t entryCount, std::uint32_t cacheSize)
+    : mStamps(entryCount, 0),
+      mCacheSize(cacheSize),
+      mTime(cacheSize + 1)
+    {}
+
+    // True on a miss, which inserts entry.
+    bool access(std::uint32_t entry)
+    {
+      if (mTime - mStamps[entry] <= mCacheSize)
+        return false;
+      mStamps[entry] = mTime++;
+      return true;
+    }
+
+    bool contains(std::uint32_t entry) const { return mTime - mStamps[entry] <= mCacheSize; }
+    // Time since entry was inserted, in insertions.
+    std::uint32_t getAge(std::uint32_t entry) const { return mTime - mStamps[entry]; }
+
+    void clear()
+    {
+      // Moving time past every stamp empties the cache without touching them.
+      mTime += mCacheSize + 1;
+    }
+
+  private:
+    std::vector<std::uint32_t> mStamps;
+    std::uint32_t mCacheSize;
+    std::uint32_t mTime;
+  };
+
+  // Triangles around each vertex as ranges of one flat list, plus how many of them are left
+  // to emit.
+  struct Adjacency
+  {
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> triangles;
+    std::vector<std::uint32_t> live;
+  };
+
+  void buildAdjacency(const std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount, Adjacency& adjacency)
+  {
+    adjacency.live.assign(vertexCount, 0);
+    for (std::size_t i = 0; i < indexCount; ++i)
+      ++adjacency.live[indices[i]];
+    adjacency.offsets.resize(vertexCount + 1);
+    adjacency.offsets[0] = 0;
+    for (std::size_t v = 0; v < vertexCount; ++v)
+      adjacency.offsets[v + 1] = adjacency.offsets[v] + adjacency.live[v];
+    adjacency.triangles.resize(indexCount);
+    std::vector<std::uint32_t> cursors(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    for (std::size_t i = 0; i < indexCount; ++i)
+      adjacency.triangles[cursors[indices[i]]++] = std::uint32_t(i / 3);
+  }
+
+  // Most recently emitted vertex that still has triangles left, or failing that the next one
+  // in index order. kUnused once every triangle is out.
+  std::uint32_t skipDeadEnd(std::vector<std::uint32_t>& deadEnd, const std::vector<std::uint32_t>& live, std::size_t& cursor, bool& fromCursor)
+  {
+    fromCursor = false;
+    while (!deadEnd.empty())
+    {
+      const std::uint32_t vertex = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[vertex] > 0)
+        return vertex;
+    }
+    fromCursor = true;
+    for (; cursor < live.size(); ++cursor)
+      if (live[cursor] > 0)
+        return std::uint32_t(cursor);
+    return kUnused;
+  }
+
+  std::size_t countTransformed(const std::uint32_t* triangles, std::size_t triangleCount, FifoCache& cache)
+  {
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < triangleCount * 3; ++i)
+      misses += cache.access(triangles[i]);
+    return misses;
+  }
+}
+
+namespace Akoylasar
+{
+  VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::uint32_t* indices, std::size_t indexCount, std::size_t vertexCount, int cacheSize)
+  {
+    VertexCacheStats stats;
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<char> referenced(vertexCount, 0);
+    std::size_t referencedCount = 0;
+    for (std::size_t i = 0; i < indexCount; ++i)
+    {
+      stats.transformedVertices += cache.access(indices[i]);
+      referencedCount += !referenced[indices[i]];
+      referenced[indices[i]] = 1;
+    }
+    stats.acmr = indexCount ? float(stats.transformedVertices) / (indexCount / 3) : 0.0f;
+    stats.atvr = referencedCount ? float(stats.transformedVertices) / referencedCount : 0.0f;
+    return stats;
+  }
+
+  float MeshOptimizer::analyzeVertexFetch(const std::uint32_t* indices,
+                                          std::size_t indexCount,
+                                          std::size_t vertexCount,
+                                          std::size_t vertexSize,
+                                          int cacheSize)
+  {
+    FifoCache transformCache(vertexCount, cacheSize);
+    FifoCache lineCache((vertexCount * vertexSize + kFetchLineSize - 1) / kFetchLineSize, kFetchCacheLines);
+    std::vector<char> referenced(vertexCount, 0);
+    std::size_t referencedBytes = 0;
+    std::size_t fetchedBytes = 0;
+    for (std::size_t i = 0; i < indexCount; ++i)
+    {
+      const std::uint32_t vertex = indices[i];
+      referencedBytes += referenced[vertex] ? 0 : vertexSize;
+      referenced[vertex] = 1;
+      if (!transformCache.access(vertex))
+        continue;
+      const std::size_t firstLine = vertex * vertexSize / kFetchLineSize;
+      const std::size_t lastLine = ((vertex + 1) * vertexSize - 1) / kFetchLineSize;
+      for (std::size_t line = firstLine; line <= lastLine; ++line)
+        fetchedBytes += lineCache.access(std::uint32_t(line)) ? kFetchLineSize : 0;
+    }
+    return referencedBytes ? float(fetchedBytes) / referencedBytes : 0.0f;
+  }
+
+  void MeshOptimizer::optimizeVertexCache(std::uint32_t* indices,
+                                          std::size_t indexCount,
+                                          std::size_t vertexCount,
+                                          int cacheSize,
+                                          std::vector<std::uint32_t>* clusters)
+  {
+    DEBUG_ASSERT(indexCount % 3 == 0);
+    Adjacency adjacency;
+    buildAdjacency(indices, indexCount, vertexCount, adjacency);
+    std::vector<std::uint32_t>& live = adjacency.live;
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<char> emitted(indexCount / 3, 0);
+    std::vector<std::uint32_t> deadEnd;
+    std::vector<std::uint32_t> candidates;
+    std::vector<std::uint32_t> output;
+    output.reserve(indexCount);
+    if (clusters)
+      clusters->clear();
+
+    // Emit every remaining triangle around the fanning vertex, then move on to the candidate
+    // that is still in the cache, and would stay there while its own triangles go out, that
+    // entered it earliest.
+    std::size_t cursor = 0;
+    bool fromCursor = false;
+    std::uint32_t fanning = skipDeadEnd(deadEnd, live, cursor, fromCursor);
+    while (fanning != kUnused)
+    {
+      if (clusters && fromCursor)
+        clusters->push_back(std::uint32_t(output.size() / 3));
+      candidates.clear();
+      for (std::uint32_t i = adjacency.offsets[fanning]; i < adjacency.offsets[fanning + 1]; ++i)
+      {
+        const std::uint32_t triangle = adjacency.triangles[i];
+        if (emitted[triangle])
+          continue;
+        emitted[triangle] = 1;
+        for (int j = 0; j < 3; ++j)
+        {
+          const std::uint32_t vertex = indices[triangle * 3 + j];
+          output.push_back(vertex);
+          deadEnd.push_back(vertex);
+          candidates.push_back(vertex);
+          --live[vertex];
+          cache.access(vertex);
+        }
+      }
+
+      fanning = kUnused;
+      int bestPriority = -1;
+      for (const std::uint32_t vertex : candidates)
+      {
+        if (!live[vertex])
+          continue;
+        const int age = int(cache.getAge(vertex));
+        const int priority = age + 2 * int(live[vertex]) <= cacheSize ? age : 0;
+        if (priority > bestPriority)
+        {
+          bestPriority = priority;
+          fanning = vertex;
+        }
+      }
+      if (fanning == kUnused)
+        fanning = skipDeadEnd(deadEnd, live, cursor, fromCursor);
+      else
+        fromCursor = false;
+    }
+    DEBUG_ASSERT(output.size() == indexCount);
+    std::copy(output.begin(), output.end(), indices);
+  }
+
+  void MeshOptimizer::optimizeOverdraw(std::uint32_t* indices,
+                                       std::size_t indexCount,
+                                       const Vertex* vertices,
+                                       std::vector<std::uint32_t>& clusters,
+                                       float threshold,
+                                       int cacheSize)
+  {
+    const std::size_t triangleCount = indexCount / 3;
+    if (clusters.empty() || clusters[0] != 0)
+      clusters.insert(clusters.begin(), 0);
+    std::uint32_t vertexCount = 0;
+    for (std::size_t i = 0; i < indexCount; ++i)
+      vertexCount = std::max(vertexCount, indices[i] + 1);
+
+    // Soft boundaries: restart a cluster as soon as its running ACMR has come down to within
+    // threshold of what the whole cluster gets, so that the split costs next to nothing.
+    std::vector<std::uint32_t> split;
+    FifoCache cache(vertexCount, cacheSize);
+    for (std::size_t c = 0; c < clusters.size(); ++c)
+    {
+      const std::size_t begin = clusters[c];
+      const std::size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+      cache.clear();
+      const float clusterAcmr = float(countTransformed(indices + begin * 3, end - begin, cache)) / (end - begin);
+      cache.clear();
+      split.push_back(std::uint32_t(begin));
+      std::size_t misses = 0;
+      std::size_t start = begin;
+      for (std::size_t t = begin; t < end; ++t)
+      {
+        misses += countTransformed(indices + t * 3, 1, cache);
+        if (t + 1 < end && float(misses) / (t + 1 - start) <= clusterAcmr * threshold)
+        {
+          split.push_back(std::uint32_t(t + 1));
+          start = t + 1;
+          misses = 0;
+          cache.clear();
+        }
+      }
+    }
+    clusters.swap(split);
+
+    // Area weighted centroid and normal of every cluster and of the mesh.
+    struct ClusterOrder
+    {
+      std::uint32_t cluster;
+      float key;
+    };
+    std::vector<Neon::Vec3f> centroids(clusters.size(), Neon::Vec3f(0.0f));
+    std::vector<Neon::Vec3f> normals(clusters.size(), Neon::Vec3f(0.0f));
+    Neon::Vec3f meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (std::size_t c = 0; c < clusters.size(); ++c)
+    {
+      const std::size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+      float area = 0.0f;
+      for (std::size_t t = clusters[c]; t < end; ++t)
+      {
+        const Neon::Vec3f& a = vertices[indices[t * 3]].position;
+        const Neon::Vec3f& b = vertices[indices[t * 3 + 1]].position;
+        const Neon::Vec3f& d = vertices[indices[t * 3 + 2]].position;
+        const Neon::Vec3f normal = Neon::cross(b - a, d - a);
+        const float triangleArea = Neon::mag(normal);
+        centroids[c] += (a + b + d) * (triangleArea / 3.0f);
+        normals[c] += normal;
+        area += triangleArea;
+      }
+      meshCentroid += centroids[c];
+      meshArea += area;
+      centroids[c] = area > 0.0f ? centroids[c] * (1.0f / area) : vertices[indices[clusters[c] * 3]].position;
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid * (1.0f / meshArea) : Neon::Vec3f(0.0f);
+    std::vector<ClusterOrder> order(clusters.size());
+    for (std::size_t c = 0; c < clusters.size(); ++c)
+    {
+      const float length = Neon::mag(normals[c]);
+      order[c] = {std::uint32_t(c), length > 0.0f ? Neon::dot(centroids[c] - meshCentroid, normals[c]) / length : 0.0f};
+    }
+    std::stable_sort(order.begin(), order.end(), [](const ClusterOrder& a, const ClusterOrder& b) { return a.key > b.key; });
+
+    std::vector<std::uint32_t> output;
+    output.reserve(indexCount);
+    std::vector<std::uint32_t> reordered;
+    reordered.reserve(clusters.size());
+    for (const ClusterOrder& entry : order)
+    {
+      const std::size_t begin = clusters[entry.cluster];
+      const std::size_t end = entry.cluster + 1 < clusters.size() ? clusters[entry.cluster + 1] : triangleCount;
+      reordered.push_back(std::uint32_t(output.size() / 3));
+      output.insert(output.end(), indices + begin * 3, indices + end * 3);
+    }
+    std::copy(output.begin(), output.end(), indices);
+    clusters.swap(reordered);
+  }
+
+  void MeshOptimizer::optimizeVertexFetch(Mesh& mesh)
+  {
+    std::vector<std::uint32_t> remap(mesh.vertices.size(), kUnused);
+    std::vector<Vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (std::uint32_t& index : mesh.indices)
+    {
+      if (remap[index] == kUnused)
+      {
+        remap[index] = std::uint32_t(vertices.size());
+        vertices.push_back(mesh.vertices[index]);
+      }
+      index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+  }
+
+  void MeshOptimizer::optimize(Mesh& mesh, MeshOptimizationStats* stats)
+  {
+    if (mesh.indices.empty())
+      return;
+    if (stats)
+    {
+      stats->cacheBefore = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+      stats->overfetchBefore = analyzeVertexFetch(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), sizeof(Vertex));
+    }
+
+    auto start = Clock::now();
+    std::vector<std::uint32_t> clusters;
+    optimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), kDefaultCacheSize, &clusters);
+    const double vertexCacheMs = getElapsedMs(start);
+    start = Clock::now();
+    optimizeOverdraw(mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), clusters);
+    const double overdrawMs = getElapsedMs(start);
+    start = Clock::now();
+    optimizeVertexFetch(mesh);
+    const double vertexFetchMs = getElapsedMs(start);
+
+    if (stats)
+    {
+      stats->cacheAfter = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+      stats->overfetchAfter = analyzeVertexFetch(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), sizeof(Vertex));
+      stats->clusters = clusters.size();
+      stats->vertexCacheMs = vertexCacheMs;
+      stats->overdrawMs = overdrawMs;
+      stats->vertexFetchMs = vertexFetchMs;
+    }
+  }
+}
@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "Debug.hpp"
+#include "MeshOptimizer.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  constexpr std::uint32_t kNone = ~0u;
+  constexpr std::uint32_t kMany = ~0u - 1;
+  // Planes through borders and seams, perpendicular to the triangles along them, count for more
+  // than the triangles' own so that outlines and seams keep their shape.
+  constexpr float kEdgeWeight = 10.0f;
+  // No collapse may turn a triangle by more than about 75 degrees.
+  constexpr float kMinNormalCos = 0.25f;
+
+  enum class VertexKind : std::uint8_t
+  {
+    Manifold, // Interior vertex with one set of attributes.
+    Border, // On exactly one open edge chain.
+    Seam, // Two sets of attributes meeting along one seam.
+    Locked
+  };
+
+  // Sum of squared distances to weighted planes, as the symmetric matrix A, the vector b and the
+  // constant c of p'Ap + 2b'p + c.
+  struct Quadric
+  {
+    float a00 = 0.0f, a11 = 0.0f, a22 = 0.0f, a01 = 0.0f, a02 = 0.0f, a12 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+    float c = 0.0f;
+    float weight = 0.0f;
+
+    // normal is unit length, the plane being dot(normal, p) + d = 0.
+    void addPlane(const Neon::Vec3f& normal, float d, float planeWeight)
+    {
+      a00 += planeWeight * normal.x * normal.x;
+      a11 += planeWeight * normal.y * normal.y;
+      a22 += planeWeight * normal.z * normal.z;
+      a01 += planeWeight * normal.x * normal.y;
+      a02 += planeWeight * normal.x * normal.z;
+      a12 += planeWeight * normal.y * normal.z;
+      b0 += planeWeight * normal.x * d;
+      b1 += planeWeight * normal.y * d;
+      b2 += planeWeight * normal.z * d;
+      c += planeWeight * d * d;
+      weight += planeWeight;
+    }
+
+    void add(const Quadric& other)
+    {
+      a00 += other.a00;
+      a11 += other.a11;
+      a22 += other.a22;
+      a01 += other.a01;
+      a02 += other.a02;
+      a12 += other.a12;
+      b0 += other.b0;
+      b1 += other.b1;
+      b2 += other.b2;
+      c += other.c;
+      weight += other.weight;
+    }
+
+    // Weighted mean squared distance of p to the planes.
+    float getError(const Neon::Vec3f& p) const
+    {
+      const float x = a00 * p.x + a01 * p.y + a02 * p.z + 2.0f * b0;
+      const float y = a01 * p.x + a11 * p.y + a12 * p.z + 2.0f * b1;
+      const float z = a02 * p.x + a12 * p.y + a22 * p.z + 2.0f * b2;
+      const float error = p.x * x + p.y * y + p.z * z + c;
+      return weight > 0.0f ? std::abs(error) / weight : 0.0f;
+    }
+  };
+
+  struct Collapse
+  {
+    std::uint32_t source;
+    std::uint32_t target;
+    float cost;
+  };
+
+  // Triangles around each vertex as ranges of one flat list.
+  struct Adjacency
+  {
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> triangles;
+  };
+
+  void buildAdjacency(const std::vector<std::uint32_t>& indices, std::size_t vertexCount, Adjacency& adjacency)
+  {
+    adjacency.offsets.assign(vertexCount + 1, 0);
+    for (const std::uint32_t index : indices)
+      ++adjacency.offsets[index + 1];
+    for (std::size_t v = 0; v < vertexCount; ++v)
+      adjacency.offsets[v + 1] += adjacency.offsets[v];
+    adjacency.triangles.resize(indices.size());
+    std::vector<std::uint32_t> cursors(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    for (std::size_t i = 0; i < indices.size(); ++i)
+      adjacency.triangles[cursors[indices[i]]++] = std::uint32_t(i / 3);
+  }
+
+  std::uint32_t hashPosition(const Neon::Vec3f& position)
+  {
+    // Adding zero turns -0 into 0, which compare equal; closed seams often meet at both.
+    const float components[3] = {position.x + 0.0f, position.y + 0.0f, position.z + 0.0f};
+    std::uint32_t bits[3];
+    std::memcpy(bits, components, sizeof(bits));
+    std::uint32_t h = bits[0] * 0x9e3779b1u ^ bits[1] * 0x85ebca77u ^ bits[2] * 0xc2b2ae3du;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+  }
+
+  // remap takes every referenced vertex to the first one with the same position, wedge links
+  // all of those in a ring.
+  void buildPositionRemap(const Vertex* vertices,
+                          std::size_t vertexCount,
+                          const std::vector<char>& referenced,
+                          std::vector<std::uint32_t>& remap,
+                          std::vector<std::uint32_t>& wedge)
+  {
+    std::size_t capacity = 16;
+    while (capacity < vertexCount * 2)
+      capacity *= 2;
+    std::vector<std::uint32_t> slots(capacity, kNone);
+    remap.assign(vertexCount, kNone);
+    wedge.assign(vertexCount, kNone);
+    for (std::uint32_t v = 0; v < vertexCount; ++v)
+    {
+      if (!referenced[v])
+        continue;
+      const Neon::Vec3f& position = vertices[v].position;
+      for (std::size_t slot = hashPosition(position) & (capacity - 1);; slot = (slot + 1) & (capacity - 1))
+      {
+        const std::uint32_t first = slots[slot];
+        if (first == kNone)
+        {
+          slots[slot] = v;
+          remap[v] = v;
+          wedge[v] = v;
+          break;
+        }
+        const Neon::Vec3f& other = vertices[first].position;
+        if (other.x == position.x && other.y == position.y && other.z == position.z)
+        {
+          remap[v] = first;
+          wedge[v] = wedge[first];
+          wedge[first] = v;
+          break;
+        }
+      }
+    }
+  }
+
+  bool hasEdge(const Adjacency& adjacency, const std::vector<std::uint32_t>& indices, std::uint32_t from, std::uint32_t to)
+  {
+    for (std::uint32_t i = adjacency.offsets[from]; i < adjacency.offsets[from + 1]; ++i)
+    {
+      const std::uint32_t* triangle = &indices[adjacency.triangles[i] * 3];
+      for (int k = 0; k < 3; ++k)
+      {
+        if (triangle[k] == from && triangle[(k + 1) % 3] == to)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  void recordOpenEdge(std::uint32_t& slot, std::uint32_t vertex)
+  {
+    slot = slot == kNone ? vertex : kMany;
+  }
+
+  bool isSingle(std::uint32_t slot)
+  {
+    return slot != kNone && slot != kMany;
+  }
+
+  Neon::Vec3f getNormal(const Neon::Vec3f& a, const Neon::Vec3f& b, const Neon::Vec3f& c)
+  {
+    return Neon::cross(b - a, c - a);
+  }
+
+  // Link condition in position space: the only vertices next to both ends of the edge may be
+  // the third corners of its own triangles. Otherwise the collapse pinches the surface, which is
+  // how fans around a locked vertex fold into pairs of back to back triangles.
+  bool isLinkValid(const Adjacency& adjacency,
+                   const std::vector<std::uint32_t>& indices,
+                   const std::vector<std::uint32_t>& remap,
+                   const std::vector<std::uint32_t>& wedge,
+                   std::uint32_t source,
+                   std::uint32_t targetPosition,
+                   std::vector<std::uint32_t>& neighbours,
+                   std::vector<std::uint32_t>& opposite)
+  {
+    const std::uint32_t sourcePosition = remap[source];
+    neighbours.clear();
+    opposite.clear();
+    for (std::uint32_t vertex = sourcePosition;;)
+    {
+      for (std::uint32_t i = adjacency.offsets[vertex]; i < adjacency.offsets[vertex + 1]; ++i)
+      {
+        const std::uint32_t* triangle = &indices[adjacency.triangles[i] * 3];
+        const bool onEdge = remap[triangle[0]] == targetPosition || remap[triangle[1]] == targetPosition ||
+                            remap[triangle[2]] == targetPosition;
+        for (int k = 0; k < 3; ++k)
+        {
+          const std::uint32_t corner = remap[triangle[k]];
+          if (corner != sourcePosition && corner != targetPosition)
+            (onEdge ? opposite : neighbours).push_back(corner);
+        }
+      }
+      vertex = wedge[vertex];
+      if (vertex == sourcePosition)
+        break;
+    }
+    for (std::uint32_t vertex = targetPosition;;)
+    {
+      for (std::uint32_t i = adjacency.offsets[vertex]; i < adjacency.offsets[vertex + 1]; ++i)
+      {
+        const std::uint32_t* triangle = &indices[adjacency.triangles[i] * 3];
+        for (int k = 0; k < 3; ++k)
+        {
+          const std::uint32_t corner = remap[triangle[k]];
+          if (std::find(neighbours.begin(), neighbours.end(), corner) != neighbours.end() &&
+              std::find(opposite.begin(), opposite.end(), corner) == opposite.end())
+            return false;
+        }
+      }
+      vertex = wedge[vertex];
+      if (vertex == targetPosition)
+        break;
+    }
+    return true;
+  }
+
+  // Whether moving vertex onto position turns any of its triangles, other than those that
+  // collapse with the edge, too far.
+  bool hasFlips(const Adjacency& adjacency,
+                const std::vector<std::uint32_t>& indices,
+                const std::vector<Neon::Vec3f>& positions,
+                const std::vector<std::uint32_t>& remap,
+                std::uint32_t vertex,
+                std::uint32_t targetPosition)
+  {
+    for (std::uint32_t i = adjacency.offsets[vertex]; i < adjacency.offsets[vertex + 1]; ++i)
+    {
+      const std::uint32_t* triangle = &indices[adjacency.triangles[i] * 3];
+      if (remap[triangle[0]] == targetPosition || remap[triangle[1]] == targetPosition || remap[triangle[2]] == targetPosition)
+        continue;
+      Neon::Vec3f corners[3];
+      for (int k = 0; k < 3; ++k)
+        corners[k] = positions[triangle[k] == vertex ? targetPosition : triangle[k]];
+      const Neon::Vec3f before = getNormal(positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]);
+      const Neon::Vec3f after = getNormal(corners[0], corners[1], corners[2]);
+      const float lengths = Neon::mag(before) * Neon::mag(after);
+      if (lengths <= 0.0f || Neon::dot(before, after) < kMinNormalCos * lengths)
+        return true;
+    }
+    return false;
+  }
+}
+
+namespace Akoylasar
+{
+  std::vector<std::uint32_t> MeshSimplifier::simplify(const Vertex* vertices,
+                                                      std::size_t vertexCount,
+                                                      const std::uint32_t* indices,
+                                                      std::size_t indexCount,
+                                                      std::size_t targetIndexCount,
+                                                      float maxError,
+                                                      float* error,
+                                                      int* passes)
+  {
+    std::vector<char> referenced(vertexCount, 0);
+    for (std::size_t i = 0; i < indexCount; ++i)
+      referenced[indices[i]] = 1;
+    std::vector<std::uint32_t> remap;
+    std::vector<std::uint32_t> wedge;
+    buildPositionRemap(vertices, vertexCount, referenced, remap, wedge);
+
+    // Errors are measured in a unit cube around the mesh, where float quadrics keep enough
+    // precision.
+    Neon::Vec3f lower(std::numeric_limits<float>::max());
+    Neon::Vec3f upper(-std::numeric_limits<float>::max());
+    for (std::size_t v = 0; v < vertexCount; ++v)
+    {
+      if (!referenced[v])
+        continue;
+      const Neon::Vec3f& p = vertices[v].position;
+      lower = Neon::Vec3f(std::min(lower.x, p.x), std::min(lower.y, p.y), std::min(lower.z, p.z));
+      upper = Neon::Vec3f(std::max(upper.x, p.x), std::max(upper.y, p.y), std::max(upper.z, p.z));
+    }
+    const Neon::Vec3f extent = upper - lower;
+    const float scale = std::max({extent.x, extent.y, extent.z, std::numeric_limits<float>::min()});
+    std::vector<Neon::Vec3f> positions(vertexCount, Neon::Vec3f(0.0f));
+    for (std::size_t v = 0; v < vertexCount; ++v)
+    {
+      if (referenced[v])
+        positions[v] = (vertices[v].position - lower) * (1.0f / scale);
+    }
+
+    // Triangles with two corners in the same place cover nothing.
+    std::vector<std::uint32_t> result;
+    result.reserve(indexCount);
+    for (std::size_t i = 0; i < indexCount; i += 3)
+    {
+      const std::uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+      if (a != b && b != c && a != c)
+        result.insert(result.end(), indices + i, indices + i + 3);
+    }
+
+    // Open edges in index space, at most one of them leaving and one arriving at every vertex
+    // of a border or seam.
+    Adjacency adjacency;
+    buildAdjacency(result, vertexCount, adjacency);
+    std::vector<std::uint32_t> openOut(vertexCount, kNone);
+    std::vector<std::uint32_t> openIn(vertexCount, kNone);
+    std::vector<Quadric> quadrics(vertexCount);
+    for (std::size_t i = 0; i < result.size(); i += 3)
+    {
+      const std::uint32_t* triangle = &result[i];
+      const Neon::Vec3f normal = getNormal(positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]);
+      const float doubleArea = Neon::mag(normal);
+      const Neon::Vec3f unitNormal = doubleArea > 0.0f ? normal * (1.0f / doubleArea) : Neon::Vec3f(0.0f);
+      for (int k = 0; k < 3; ++k)
+      {
+        const std::uint32_t from = triangle[k];
+        const std::uint32_t to = triangle[(k + 1) % 3];
+        if (doubleArea > 0.0f)
+          quadrics[remap[from]].addPlane(unitNormal, -Neon::dot(unitNormal, positions[from]), doubleArea * 0.5f);
+        if (hasEdge(adjacency, result, to, from))
+          continue;
+        recordOpenEdge(openOut[from], to);
+        recordOpenEdge(openIn[to], from);
+        const Neon::Vec3f edge = positions[to] - positions[from];
+        const Neon::Vec3f edgeNormal = Neon::cross(edge, unitNormal);
+        const float edgeNormalLength = Neon::mag(edgeNormal);
+        if (edgeNormalLength <= 0.0f)
+          continue;
+        const Neon::Vec3f planeNormal = edgeNormal * (1.0f / edgeNormalLength);
+        const float d = -Neon::dot(planeNormal, positions[from]);
+        const float weight = Neon::dot(edge, edge) * kEdgeWeight;
+        quadrics[remap[from]].addPlane(planeNormal, d, weight);
+        quadrics[remap[to]].addPlane(planeNormal, d, weight);
+      }
+    }
+
+    std::vector<VertexKind> kinds(vertexCount, VertexKind::Locked);
+    for (std::uint32_t v = 0; v < vertexCount; ++v)
+    {
+      if (!referenced[v])
+        continue;
+      const std::uint32_t twin = wedge[v];
+      if (twin == v)
+      {
+        if (openOut[v] == kNone && openIn[v] == kNone)
+          kinds[v] = VertexKind::Manifold;
+        else if (isSingle(openOut[v]) && isSingle(openIn[v]))
+          kinds[v] = VertexKind::Border;
+      }
+      else if (wedge[twin] == v && isSingle(openOut[v]) && isSingle(openIn[v]) && isSingle(openOut[twin]) &&
+               isSingle(openIn[twin]) && remap[openOut[v]] == remap[openIn[twin]] && remap[openIn[v]] == remap[openOut[twin]])
+        kinds[v] = VertexKind::Seam;
+    }
+
+    const auto canCollapse = [&](std::uint32_t source, std::uint32_t target)
+    {
+      switch (kinds[source])
+      {
+        case VertexKind::Manifold:
+          return true;
+        case VertexKind::Border:
+        case VertexKind::Seam:
+          return (kinds[target] == kinds[source] || kinds[target] == VertexKind::Locked) &&
+                 (openOut[source] == target || openIn[source] == target);
+        default:
+          return false;
+      }
+    };
+
+    const float scaledMaxError = maxError / scale;
+    const float maxCost = scaledMaxError * scaledMaxError;
+    float largestCost = 0.0f;
+    int passCount = 0;
+    std::vector<Collapse> candidates;
+    std::vector<Collapse> sorted;
+    std::vector<std::uint32_t> bucketOffsets;
+    std::vector<std::uint32_t> collapseTarget(vertexCount, kNone);
+    std::vector<char> locked(vertexCount, 0);
+    std::vector<std::uint32_t> collapsed;
+    std::vector<std::uint32_t> neighbours;
+    std::vector<std::uint32_t> opposite;
+    while (result.size() > targetIndexCount)
+    {
+      if (passCount)
+        buildAdjacency(result, vertexCount, adjacency);
+      ++passCount;
+
+      // The cheaper allowed direction of every edge. Interior edges are seen from both of their
+      // triangles and only taken once.
+      candidates.clear();
+      for (std::size_t i = 0; i < result.size(); ++i)
+      {
+        const std::uint32_t a = result[i];
+        const std::uint32_t b = result[i - i % 3 + (i + 1) % 3];
+        if (remap[a] > remap[b] && kinds[a] == VertexKind::Manifold && kinds[b] == VertexKind::Manifold)
+          continue;
+        const bool forward = canCollapse(a, b);
+        const bool backward = canCollapse(b, a);
+        if (!forward && !backward)
+          continue;
+        const float forwardCost = forward ? quadrics[remap[a]].getError(positions[b]) : std::numeric_limits<float>::max();
+        const float backwardCost = backward ? quadrics[remap[b]].getError(positions[a]) : std::numeric_limits<float>::max();
+        if (forwardCost <= backwardCost)
+          candidates.push_back({a, b, forwardCost});
+        else
+          candidates.push_back({b, a, backwardCost});
+      }
+
+      // Counting sort on the upper half of the costs' bits, which orders positive floats closely
+      // enough.
+      bucketOffsets.assign((1 << 16) + 1, 0);
+      const auto getBucket = [](float cost)
+      {
+        std::uint32_t bits;
+        std::memcpy(&bits, &cost, sizeof(bits));
+        return bits >> 16;
+      };
+      for (const Collapse& candidate : candidates)
+        ++bucketOffsets[getBucket(candidate.cost) + 1];
+      for (std::size_t i = 1; i < bucketOffsets.size(); ++i)
+        bucketOffsets[i] += bucketOffsets[i - 1];
+      sorted.resize(candidates.size());
+      for (const Collapse& candidate : candidates)
+        sorted[bucketOffsets[getBucket(candidate.cost)]++] = candidate;
+
+      // Cheapest first, at most one collapse among the triangles around any vertex, so that the
+      // flip checks see the positions the triangles end up with.
+      const std::size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+      std::size_t removed = 0;
+      collapsed.clear();
+      for (const Collapse& candidate : sorted)
+      {
+        if (candidate.cost > maxCost || removed >= trianglesToRemove)
+          break;
+        const std::uint32_t sourcePosition = remap[candidate.source];
+        const std::uint32_t targetPosition = remap[candidate.target];
+        if (locked[sourcePosition] || locked[targetPosition])
+          continue;
+        // The other side of a seam moves onto the target's wedge on its side.
+        std::uint32_t twin = kNone;
+        std::uint32_t twinTarget = kNone;
+        if (kinds[candidate.source] == VertexKind::Seam)
+        {
+          twin = wedge[candidate.source];
+          if (remap[openOut[twin]] == targetPosition)
+            twinTarget = openOut[twin];
+          else if (remap[openIn[twin]] == targetPosition)
+            twinTarget = openIn[twin];
+          else
+            continue;
+        }
+        if (!isLinkValid(adjacency, result, remap, wedge, candidate.source, targetPosition, neighbours, opposite) ||
+            hasFlips(adjacency, result, positions, remap, candidate.source, targetPosition) ||
+            (twin != kNone && hasFlips(adjacency, result, positions, remap, twin, targetPosition)))
+          continue;
+
+        collapseTarget[candidate.source] = candidate.target;
+        collapsed.push_back(candidate.source);
+        if (twin != kNone)
+        {
+          collapseTarget[twin] = twinTarget;
+          collapsed.push_back(twin);
+        }
+        quadrics[targetPosition].add(quadrics[sourcePosition]);
+        largestCost = std::max(largestCost, candidate.cost);
+        removed += kinds[candidate.source] == VertexKind::Border ? 1 : 2;
+        for (const std::uint32_t moved : {candidate.source, twin})
+        {
+          if (moved == kNone)
+            continue;
+          for (std::uint32_t i = adjacency.offsets[moved]; i < adjacency.offsets[moved + 1]; ++i)
+          {
+            const std::uint32_t* triangle = &result[adjacency.triangles[i] * 3];
+            for (int k = 0; k < 3; ++k)
+              locked[remap[triangle[k]]] = 1;
+          }
+        }
+        locked[targetPosition] = 1;
+      }
+      if (collapsed.empty())
+        break;
+
+      std::size_t output = 0;
+      for (std::size_t i = 0; i < result.size(); i += 3)
+      {
+        std::uint32_t triangle[3];
+        for (int k = 0; k < 3; ++k)
+          triangle[k] = collapseTarget[result[i + k]] != kNone ? collapseTarget[result[i + k]] : result[i + k];
+        if (remap[triangle[0]] == remap[triangle[1]] || remap[triangle[1]] == remap[triangle[2]] || remap[triangle[0]] == remap[triangle[2]])
+          continue;
+        std::copy(triangle, triangle + 3, &result[output]);
+        output += 3;
+      }
+      result.resize(output);
+      for (const std::uint32_t vertex : collapsed)
+        collapseTarget[vertex] = kNone;
+      std::fill(locked.begin(), locked.end(), 0);
+    }
+
+    if (error)
+      *error = std::sqrt(largestCost) * scale;
+    if (passes)
+      *passes = passCount;
+    return result;
+  }
+
+  void MeshSimplifier::buildLods(Mesh& mesh, const LodSettings& settings, std::vector<LodLevelStats>* stats)
+  {
+    DEBUG_ASSERT(mesh.lods.empty());
+    if (stats)
+      stats->clear();
+    if (mesh.indices.empty())
+      return;
+    Neon::Vec3f lower = mesh.vertices[0].position;
+    Neon::Vec3f upper = lower;
+    for (const Vertex& vertex : mesh.vertices)
+    {
+      lower = Neon::Vec3f(std::min(lower.x, vertex.position.x), std::min(lower.y, vertex.position.y), std::min(lower.z, vertex.position.z));
+      upper = Neon::Vec3f(std::max(upper.x, vertex.position.x), std::max(upper.y, vertex.position.y), std::max(upper.z, vertex.position.z));
+    }
+    const Neon::Vec3f extent = upper - lower;
+    const float errorBudget = settings.maxError * std::max({extent.x, extent.y, extent.z});
+
+    mesh.lods.push_back({0, std::uint32_t(mesh.indices.size()), 0.0f});
+    if (stats)
+      stats->push_back({mesh.indices.size() / 3, 0.0f, 0, 0.0});
+    std::vector<std::uint32_t> level = mesh.indices;
+    float error = 0.0f;
+    while (int(mesh.lods.size()) < settings.maxLevels)
+    {
+      const std::size_t targetTriangles = std::size_t(level.size() / 3 * settings.levelRatio);
+      if (targetTriangles < settings.minTriangles)
+        break;
+      const auto start = Clock::now();
+      float levelError = 0.0f;
+      int passes = 0;
+      std::vector<std::uint32_t> next = simplify(mesh.vertices.data(), mesh.vertices.size(), level.data(), level.size(),
+                                                 targetTriangles * 3, errorBudget - error, &levelError, &passes);
+      // Not worth a level of its own when the error budget or locked vertices stopped it short.
+      if (next.size() > level.size() - (level.size() - targetTriangles * 3) / 2)
+        break;
+      MeshOptimizer::optimizeVertexCache(next.data(), next.size(), mesh.vertices.size());
+      error += levelError;
+      mesh.lods.push_back({std::uint32_t(mesh.indices.size()), std::uint32_t(next.size()), error});
+      mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+      if (stats)
+        stats->push_back({next.size() / 3, error, passes, getElapsedMs(start)});
+      level.swap(next);
+    }
+  }
+
+  int MeshSimplifier::selectLod(const MeshLod* lods,
+                                std::size_t lodCount,
+                                const Neon::Vec3f& boundsCenter,
+                                float boundsRadius,
+                                const float* model,
+                                const Neon::Vec3f& cameraOrigin,
+                                float projectionScale,
+                                float viewportHeight,
+                                float maxPixelError)
+  {
+    const Neon::Vec3f center(model[0] * boundsCenter.x + model[4] * boundsCenter.y + model[8] * boundsCenter.z + model[12],
+                             model[1] * boundsCenter.x + model[5] * boundsCenter.y + model[9] * boundsCenter.z + model[13],
+                             model[2] * boundsCenter.x + model[6] * boundsCenter.y + model[10] * boundsCenter.z + model[14]);
+    float scaleSquared = 0.0f;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      const float* column = model + axis * 4;
+      scaleSquared = std::max(scaleSquared, column[0] * column[0] + column[1] * column[1] + column[2] * column[2]);
+    }
+    const float scale = std::sqrt(scaleSquared);
+    const float distance = Neon::mag(center - cameraOrigin);
+    if (lodCount < 2 || distance <= boundsRadius * scale)
+      return 0;
+    // At distance 1 half the viewport spans 1 / projectionScale units, so a unit covers
+    // projectionScale times half its height in pixels, shrinking with distance.
+    const float pixelsPerUnit = 0.5f * viewportHeight * projectionScale * scale / distance;
+    int lod = 0;
+    while (lod + 1 < int(lodCount) && lods[lod + 1].error * pixelsPerUnit <= maxPixelError)
+      ++lod;
+    return lod;
+  }
+}
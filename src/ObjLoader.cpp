@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "ObjLoader.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// The experimental parser splits the file into one chunk per thread and parses them in
+// parallel, where the main tinyobj::ObjReader reads line by line on the calling thread.
+#define TINYOBJ_LOADER_OPT_IMPLEMENTATION
+#include <tinyobj_loader_opt.h>
+
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  // Attribute indices of one face corner, -1 when absent.
+  struct Corner
+  {
+    int position;
+    int texcoord;
+    int normal;
+
+    bool operator==(const Corner& other) const
+    {
+      return position == other.position && texcoord == other.texcoord && normal == other.normal;
+    }
+  };
+
+  std::uint32_t hashCorner(const Corner& corner)
+  {
+    // Murmur3's finaliser over a multiplicative mix of the three indices.
+    std::uint32_t h = std::uint32_t(corner.position) * 0x9e3779b1u ^ std::uint32_t(corner.texcoord) * 0x85ebca77u ^
+                      std::uint32_t(corner.normal) * 0xc2b2ae3du;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  // Open addressing with linear probing. Slots only hold an index into the unique corners, 4
+  // bytes each, so that the table stays small enough to be mostly cached at half load.
+  class CornerMap
+  {
+  public:
+    explicit CornerMap(std::size_t expectedCount)
+    {
+      std::size_t capacity = 16;
+      while (capacity < expectedCount * 2)
+        capacity *= 2;
+      mSlots.assign(capacity, kEmpty);
+      mCorners.reserve(expectedCount);
+    }
+
+    // Index of the vertex for corner, added if it is new.
+    std::uint32_t insert(const Corner& corner)
+    {
+      if ((mCorners.size() + 1) * 2 > mSlots.size())
+        grow();
+      const std::size_t mask = mSlots.size() - 1;
+      for (std::size_t slot = hashCorner(corner) & mask;; slot = (slot + 1) & mask)
+      {
+        const std::uint32_t index = mSlots[slot];
+        if (index == kEmpty)
+        {
+          mSlots[slot] = std::uint32_t(mCorners.size());
+          mCorners.push_back(corner);
+          return mSlots[slot];
+        }
+        if (mCorners[index] == corner)
+          return index;
+      }
+    }
+
+    const std::vector<Corner>& getCorners() const { return mCorners; }
+    std::size_t getCapacity() const { return mSlots.size(); }
+
+  private:
+    void grow()
+    {
+      mSlots.assign(mSlots.size() * 2, kEmpty);
+      const std::size_t mask = mSlots.size() - 1;
+      for (std::uint32_t i = 0; i < mCorners.size(); ++i)
+      {
+        std::size_t slot = hashCorner(mCorners[i]) & mask;
+        while (mSlots[slot] != kEmpty)
+          slot = (slot + 1) & mask;
+        mSlots[slot] = i;
+      }
+    }
+
+  private:
+    static constexpr std::uint32_t kEmpty = ~0u;
+    std::vector<std::uint32_t> mSlots;
+    std::vector<Corner> mCorners;
+  };
+
+  // tinyobj_opt leaves absent indices negative; anything out of range is treated the same.
+  int getAttributeIndex(int index, std::size_t count)
+  {
+    return index >= 0 && std::size_t(index) < count ? index : -1;
+  }
+}
+
+namespace Akoylasar
+{
+  std::unique_ptr<Mesh> ObjLoader::load(const std::filesystem::path& path, int threads, ObjLoadStats* stats)
+  {
+    ObjLoadStats localStats;
+    stats = stats ? stats : &localStats;
+    *stats = ObjLoadStats();
+
+    MappedFile file;
+    if (!file.open(path))
+    {
+      std::cerr << "Failed to open model with path " << path << std::endl;
+      return nullptr;
+    }
+    stats->fileBytes = file.getSize();
+    stats->threads = threads > 0 ? threads : int(Parallel::getThreadCount());
+
+    auto start = Clock::now();
+    tinyobj_opt::attrib_t attrib;
+    std::vector<tinyobj_opt::shape_t> shapes;
+    std::vector<tinyobj_opt::material_t> materials;
+    tinyobj_opt::LoadOption option;
+    option.req_num_threads = stats->threads;
+    option.triangulate = true;
+    if (!tinyobj_opt::parseObj(&attrib, &shapes, &materials, reinterpret_cast<const char*>(file.getData()), file.getSize(), option))
+    {
+      std::cerr << "Failed to parse model with path " << path << std::endl;
+      return nullptr;
+    }
+    file.close();
+    stats->parseMs = getElapsedMs(start);
+
+    start = Clock::now();
+    const std::size_t positionCount = attrib.vertices.size() / 3;
+    const std::size_t texcoordCount = attrib.texcoords.size() / 2;
+    const std::size_t normalCount = attrib.normals.size() / 3;
+    auto mesh = std::make_unique<Mesh>();
+    // Each position of a closed mesh is shared by about six triangles, usually with one normal
+    // and texcoord, so the table starts out sized for as many vertices as positions and only
+    // grows for seams.
+    CornerMap map(positionCount);
+    mesh->indices.reserve(attrib.indices.size());
+    std::size_t cornerOffset = 0;
+    for (const int faceCorners : attrib.face_num_verts)
+    {
+      std::uint32_t fan[2] = {0, 0};
+      for (int i = 0; i < faceCorners; ++i)
+      {
+        const tinyobj_opt::index_t& index = attrib.indices[cornerOffset + i];
+        const Corner corner {getAttributeIndex(index.vertex_index, positionCount),
+                             getAttributeIndex(index.texcoord_index, texcoordCount),
+                             getAttributeIndex(index.normal_index, normalCount)};
+        if (corner.position < 0)
+        {
+          std::cerr << "Face with a missing position in model " << path << std::endl;
+          return nullptr;
+        }
+        const std::uint32_t vertex = map.insert(corner);
+        if (i >= 2)
+        {
+          mesh->indices.push_back(fan[0]);
+          mesh->indices.push_back(fan[1]);
+          mesh->indices.push_back(vertex);
+        }
+        fan[i == 0 ? 0 : 1] = vertex;
+      }
+      cornerOffset += faceCorners;
+    }
+
+    const std::vector<Corner>& corners = map.getCorners();
+    mesh->vertices.resize(corners.size());
+    bool missingNormals = false;
+    for (std::size_t i = 0; i < corners.size(); ++i)
+    {
+      const Corner& corner = corners[i];
+      Vertex& vertex = mesh->vertices[i];
+      const float* position = &attrib.vertices[std::size_t(corner.position) * 3];
+      vertex.position = Neon::Vec3f(position[0], position[1], position[2]);
+      if (corner.normal >= 0)
+      {
+        const float* normal = &attrib.normals[std::size_t(corner.normal) * 3];
+        vertex.normal = Neon::Vec3f(normal[0], normal[1], normal[2]);
+      }
+      else
+      {
+        vertex.normal = Neon::Vec3f(0.0f);
+        missingNormals = true;
+      }
+      if (corner.texcoord >= 0)
+      {
+        const float* texcoord = &attrib.texcoords[std::size_t(corner.texcoord) * 2];
+        vertex.uv = Neon::Vec2f(texcoord[0], 1.0f - texcoord[1]);
+      }
+      else
+        vertex.uv = Neon::Vec2f(0.0f, 0.0f);
+    }
+    stats->dedupMs = getElapsedMs(start);
+    stats->corners = mesh->indices.size();
+    stats->vertices = mesh->vertices.size();
+    stats->hashCapacity = map.getCapacity();
+
+    if (missingNormals)
+    {
+      // Summed per position rather than per vertex, so that texcoord seams stay smooth. The
+      // cross product's length is twice the triangle's area, which does the weighting.
+      start = Clock::now();
+      std::vector<Neon::Vec3f> positionNormals(positionCount, Neon::Vec3f(0.0f));
+      for (std::size_t i = 0; i < mesh->indices.size(); i += 3)
+      {
+        const Vertex* triangle[3] = {&mesh->vertices[mesh->indices[i]], &mesh->vertices[mesh->indices[i + 1]],
+                                     &mesh->vertices[mesh->indices[i + 2]]};
+        const Neon::Vec3f normal = Neon::cross(triangle[1]->position - triangle[0]->position,
+                                               triangle[2]->position - triangle[0]->position);
+        for (std::size_t j = 0; j < 3; ++j)
+          positionNormals[corners[mesh->indices[i + j]].position] += normal;
+      }
+      for (std::size_t i = 0; i < corners.size(); ++i)
+      {
+        if (corners[i].normal >= 0)
+          continue;
+        const Neon::Vec3f& normal = positionNormals[corners[i].position];
+        mesh->vertices[i].normal = Neon::mag(normal) > 0.0f ? Neon::normalize(normal) : Neon::Vec3f(0.0f, 1.0f, 0.0f);
+      }
+      stats->normalsMs = getElapsedMs(start);
+    }
+
+    std::cout << "Loaded " << path << ": " << stats->corners / 3 << " triangles, " << stats->vertices << " vertices, parsed in "
+              << stats->parseMs << "ms on " << stats->threads << " threads, merged in " << stats->dedupMs << "ms" << std::endl;
+    return mesh;
+  }
+}
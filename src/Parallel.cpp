@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "Parallel.hpp"
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace
+{
+  std::atomic<Akoylasar::JobSystem*> gJobSystem {nullptr};
+
+  // Shared with the helper jobs, which may only get to run after forRange has returned.
+  struct RangeState
+  {
+    const std::function<void(std::size_t, std::size_t)>* body = nullptr;
+    std::size_t count = 0;
+    std::size_t chunkSize = 0;
+    std::size_t chunkCount = 0;
+    std::atomic<std::size_t> nextChunk {0};
+    std::atomic<std::size_t> remainingChunks {0};
+  };
+
+  void runChunks(RangeState& state)
+  {
+    // Once every chunk has been claimed the body is never touched again, so a helper that
+    // starts late just returns.
+    for (std::size_t chunk = state.nextChunk++; chunk < state.chunkCount; chunk = state.nextChunk++)
+    {
+      const std::size_t begin = chunk * state.chunkSize;
+      (*state.body)(begin, std::min(begin + state.chunkSize, state.count));
+      --state.remainingChunks;
+    }
+  }
+}
+
+namespace Akoylasar
+{
+  unsigned int Parallel::getThreadCount()
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  void Parallel::setJobSystem(JobSystem* jobs)
+  {
+    gJobSystem = jobs;
+  }
+
+  void Parallel::forRange(std::size_t count,
+                          std::size_t grainSize,
+                          const std::function<void(std::size_t, std::size_t)>& body)
+  {
+    if (count == 0)
+      return;
+
+    JobSystem* jobs = gJobSystem;
+    const std::size_t workerCount = jobs ? jobs->getWorkerCount() : 0;
+    // Over-split a little so that uneven chunks still balance across the threads.
+    const std::size_t threadCount = workerCount + 1;
+    const std::size_t chunkSize = std::max<std::size_t>(std::max<std::size_t>(grainSize, 1), count / (threadCount * 4));
+    const std::size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    if (chunkCount == 1 || workerCount == 0 || jobs->isCancelled())
+    {
+      body(0, count);
+      return;
+    }
+
+    auto state = std::make_shared<RangeState>();
+    state->body = &body;
+    state->count = count;
+    state->chunkSize = chunkSize;
+    state->chunkCount = chunkCount;
+    state->remainingChunks = chunkCount;
+
+    // Helpers pick up chunks as workers come free, the calling thread works through the rest
+    // itself, so nested calls from inside a busy job never wait on a queue.
+    const std::size_t helperCount = std::min(workerCount, chunkCount - 1);
+    for (std::size_t i = 0; i < helperCount; ++i)
+      jobs->submit([state]() { runChunks(*state); });
+    runChunks(*state);
+
+    // Only chunks already running on other threads are left.
+    while (state->remainingChunks > 0)
+      std::this_thread::yield();
+  }
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "ProcessStats.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace Akoylasar
+{
+  std::size_t ProcessStats::getPeakResidentBytes()
+  {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+      return 0;
+    return std::size_t(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+      return 0;
+#ifdef __APPLE__
+    return std::size_t(usage.ru_maxrss); // Bytes on macOS.
+#else
+    return std::size_t(usage.ru_maxrss) * 1024; // Kilobytes on Linux.
+#endif
+#endif
+  }
+}
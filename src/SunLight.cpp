@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "SunLight.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <unordered_set>
+#include <vector>
+
+#include "Debug.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  constexpr double kPi = 3.14159265358979323846;
+
+  float getLuminance(const float* rgb)
+  {
+    const float luminance = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+    // Also drops NaNs.
+    return luminance > 0.0f ? luminance : 0.0f;
+  }
+
+  // Exact solid angle of a texel in row of a width x height panorama.
+  double getRowSolidAngle(int row, int width, int height)
+  {
+    const double lat0 = (double(row) / height - 0.5) * kPi;
+    const double lat1 = (double(row + 1) / height - 0.5) * kPi;
+    return 2.0 * kPi / width * (std::sin(lat1) - std::sin(lat0));
+  }
+
+  Neon::Vec3f getTexelDirection(int column, int row, int width, int height)
+  {
+    const double phi = ((column + 0.5) / width - 0.5) * 2.0 * kPi;
+    const double latitude = ((row + 0.5) / height - 0.5) * kPi;
+    return Neon::Vec3f(float(std::cos(latitude) * std::cos(phi)), float(std::sin(latitude)), float(std::cos(latitude) * std::sin(phi)));
+  }
+}
+
+namespace Akoylasar
+{
+  float SunLight::getCosRadius() const
+  {
+    // A cap of solid angle w has 1 - cos(radius) = w / 2 pi.
+    return 1.0f - solidAngle / float(2.0 * kPi);
+  }
+
+  Neon::Vec3f SunLight::getRadiance() const
+  {
+    return isEmpty() ? Neon::Vec3f(0.0f) : irradiance * (1.0f / solidAngle);
+  }
+
+  bool SunExtractor::extract(float* texels, int width, int height, const SunExtractionSettings& settings, SunLight& sun)
+  {
+    DEBUG_ASSERT(texels && width > 0 && height > 0);
+    sun = SunLight();
+
+    // Brightest texel and the solid angle weighted luminance of each row.
+    std::vector<std::size_t> rowPeaks(height);
+    std::vector<double> rowSums(height);
+    Parallel::forRange(height, 16, [&](std::size_t begin, std::size_t end)
+    {
+      for (std::size_t row = begin; row < end; ++row)
+      {
+        const float* texel = texels + row * width * 3;
+        std::size_t peak = 0;
+        float peakLuminance = -1.0f;
+        double sum = 0.0;
+        for (int x = 0; x < width; ++x, texel += 3)
+        {
+          const float luminance = getLuminance(texel);
+          sum += luminance;
+          if (luminance > peakLuminance)
+          {
+            peakLuminance = luminance;
+            peak = x;
+          }
+        }
+        rowPeaks[row] = row * width + peak;
+        rowSums[row] = sum * getRowSolidAngle(int(row), width, height);
+      }
+    });
+    std::size_t peak = rowPeaks[0];
+    double total = 0.0;
+    for (int row = 0; row < height; ++row)
+    {
+      if (getLuminance(texels + rowPeaks[row] * 3) > getLuminance(texels + peak * 3))
+        peak = rowPeaks[row];
+      total += rowSums[row];
+    }
+    const float peakLuminance = getLuminance(texels + peak * 3);
+    const double mean = total / (4.0 * kPi);
+    if (peakLuminance <= 0.0f || peakLuminance < settings.minPeakRatio * mean)
+      return false;
+
+    // Flood fill from the peak, wrapping around in azimuth. Texels that fail the threshold
+    // next to the region make up its border.
+    const float threshold = settings.threshold * peakLuminance;
+    std::vector<std::size_t> region {peak};
+    std::vector<std::size_t> border;
+    std::unordered_set<std::size_t> visited {peak};
+    double regionSolidAngle = 0.0;
+    for (std::size_t i = 0; i < region.size(); ++i)
+    {
+      const int x = int(region[i] % width);
+      const int y = int(region[i] / width);
+      regionSolidAngle += getRowSolidAngle(y, width, height);
+      if (regionSolidAngle > settings.maxSolidAngle)
+        return false;
+      const int neighbours[4][2] = {{(x + 1) % width, y}, {(x + width - 1) % width, y}, {x, y + 1}, {x, y - 1}};
+      for (const auto& neighbour : neighbours)
+      {
+        if (neighbour[1] < 0 || neighbour[1] >= height)
+          continue;
+        const std::size_t index = std::size_t(neighbour[1]) * width + neighbour[0];
+        if (!visited.insert(index).second)
+          continue;
+        (getLuminance(texels + index * 3) >= threshold ? region : border).push_back(index);
+      }
+    }
+
+    Neon::Vec3f fill(0.0f);
+    double borderSolidAngle = 0.0;
+    for (const std::size_t index : border)
+    {
+      const float solidAngle = float(getRowSolidAngle(int(index / width), width, height));
+      const float* texel = texels + index * 3;
+      fill += Neon::Vec3f(texel[0], texel[1], texel[2]) * solidAngle;
+      borderSolidAngle += solidAngle;
+    }
+    if (borderSolidAngle > 0.0)
+      fill = fill * float(1.0 / borderSolidAngle);
+
+    Neon::Vec3f irradiance(0.0f);
+    Neon::Vec3f direction(0.0f);
+    for (const std::size_t index : region)
+    {
+      const int x = int(index % width);
+      const int y = int(index / width);
+      const float solidAngle = float(getRowSolidAngle(y, width, height));
+      float* texel = texels + index * 3;
+      const float kept[3] = {std::min(texel[0], fill.x), std::min(texel[1], fill.y), std::min(texel[2], fill.z)};
+      const float removed[3] = {texel[0] - kept[0], texel[1] - kept[1], texel[2] - kept[2]};
+      std::copy(kept, kept + 3, texel);
+      irradiance += Neon::Vec3f(removed[0], removed[1], removed[2]) * solidAngle;
+      direction += getTexelDirection(x, y, width, height) * (getLuminance(removed) * solidAngle);
+    }
+    sun.direction = Neon::normalize(direction);
+    sun.irradiance = irradiance;
+    sun.solidAngle = float(regionSolidAngle);
+    return true;
+  }
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "TextureUploader.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Debug.hpp"
+
+namespace
+{
+  constexpr int kBlockSize = 4;
+
+  std::size_t getComponentCount(GLenum format)
+  {
+    return format == GL_RED ? 1 : format == GL_RG ? 2 : format == GL_RGBA ? 4 : 3;
+  }
+}
+
+namespace Akoylasar
+{
+  TextureUploader::TextureUploader(std::size_t stagingBufferSize, int stagingBufferCount)
+  : mStagingBuffers(stagingBufferCount)
+  {
+    for (auto& staging : mStagingBuffers)
+    {
+      staging.size = stagingBufferSize;
+      CHECK_GL_ERROR(glGenBuffers(1, &staging.buffer));
+      CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer));
+      CHECK_GL_ERROR(glBufferData(GL_PIXEL_UNPACK_BUFFER, staging.size, nullptr, GL_STREAM_DRAW));
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+  }
+
+  TextureUploader::~TextureUploader()
+  {
+    for (auto& staging : mStagingBuffers)
+    {
+      if (staging.fence)
+        glDeleteSync(staging.fence);
+      CHECK_GL_ERROR(glDeleteBuffers(1, &staging.buffer));
+    }
+  }
+
+  void TextureUploader::enqueue(GLuint texture,
+                                GLenum bindTarget,
+                                GLenum imageTarget,
+                                GLint level,
+                                int width,
+                                int height,
+                                GLenum format,
+                                const std::uint16_t* texels)
+  {
+    const std::size_t rowSize = std::size_t(width) * getComponentCount(format) * sizeof(std::uint16_t);
+    mRequests.push_back({texture, bindTarget, imageTarget, level, width, height, format, false,
+                         reinterpret_cast<const std::uint8_t*>(texels), rowSize, height, 0});
+  }
+
+  void TextureUploader::enqueueCompressed(GLuint texture,
+                                          GLenum bindTarget,
+                                          GLenum imageTarget,
+                                          GLint level,
+                                          int width,
+                                          int height,
+                                          GLenum internalFormat,
+                                          std::size_t blockBytes,
+                                          const std::uint8_t* blocks)
+  {
+    const std::size_t rowSize = std::size_t((width + kBlockSize - 1) / kBlockSize) * blockBytes;
+    mRequests.push_back({texture, bindTarget, imageTarget, level, width, height, internalFormat, true,
+                         blocks, rowSize, (height + kBlockSize - 1) / kBlockSize, 0});
+  }
+
+  std::size_t TextureUploader::update(std::size_t byteBudget)
+  {
+    std::size_t copied = 0;
+    bool boundBuffer = false;
+    while (!mRequests.empty() && (copied < byteBudget || copied == 0))
+    {
+      StagingBuffer& staging = mStagingBuffers[mNextStagingBuffer];
+      if (!isAvailable(staging))
+      {
+        ++mStats.stalls;
+        break;
+      }
+
+      Request& request = mRequests.front();
+      const std::size_t rowSize = request.rowSize;
+      const std::size_t available = std::min(staging.size, std::max(byteBudget - copied, rowSize));
+      const int rows = std::min(request.rowCount - request.nextRow, std::max(int(available / rowSize), 1));
+      const std::size_t chunkSize = rowSize * rows;
+
+      if (!boundBuffer)
+      {
+        CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        boundBuffer = true;
+      }
+      CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer));
+      if (chunkSize > staging.size)
+      {
+        // A single row does not fit, grow this buffer for good.
+        staging.size = chunkSize;
+        CHECK_GL_ERROR(glBufferData(GL_PIXEL_UNPACK_BUFFER, staging.size, nullptr, GL_STREAM_DRAW));
+      }
+
+      // The fence has signalled, so nothing needs to be synchronised with the GPU; invalidating
+      // lets the driver hand out fresh memory instead of waiting on the old contents.
+      void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, chunkSize,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+      if (!mapped)
+      {
+        std::cerr << "TextureUploader: failed to map a staging buffer" << std::endl;
+        break;
+      }
+      std::memcpy(mapped, request.data + rowSize * request.nextRow, chunkSize);
+      CHECK_GL_ERROR(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+
+      CHECK_GL_ERROR(glBindTexture(request.bindTarget, request.texture));
+      // Offset 0 into the bound buffer.
+      if (request.compressed)
+      {
+        // Compressed updates have to cover whole blocks, except where they reach the edge.
+        const int y = request.nextRow * kBlockSize;
+        const int height = std::min(rows * kBlockSize, request.height - y);
+        CHECK_GL_ERROR(glCompressedTexSubImage2D(request.imageTarget, request.level, 0, y, request.width, height,
+                                                 request.format, GLsizei(chunkSize), nullptr));
+      }
+      else
+        CHECK_GL_ERROR(glTexSubImage2D(request.imageTarget, request.level, 0, request.nextRow, request.width, rows,
+                                       request.format, GL_HALF_FLOAT, nullptr));
+      staging.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      mNextStagingBuffer = (mNextStagingBuffer + 1) % mStagingBuffers.size();
+
+      copied += chunkSize;
+      ++mStats.chunks;
+      request.nextRow += rows;
+      if (request.nextRow == request.rowCount)
+        mRequests.pop_front();
+    }
+
+    if (boundBuffer)
+    {
+      CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+      CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+      // Make sure the copies start now rather than whenever the driver next flushes.
+      CHECK_GL_ERROR(glFlush());
+    }
+    if (copied)
+    {
+      mStats.bytes += copied;
+      ++mStats.frames;
+    }
+    return copied;
+  }
+
+  bool TextureUploader::isIdle()
+  {
+    if (!mRequests.empty())
+      return false;
+    for (auto& staging : mStagingBuffers)
+      if (!isAvailable(staging))
+        return false;
+    return true;
+  }
+
+  bool TextureUploader::isAvailable(StagingBuffer& staging)
+  {
+    if (!staging.fence)
+      return true;
+    const GLenum status = glClientWaitSync(staging.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+      return false;
+    if (status == GL_WAIT_FAILED)
+      std::cerr << "TextureUploader: waiting on a staging buffer fence failed" << std::endl;
+    glDeleteSync(staging.fence);
+    staging.fence = nullptr;
+    return true;
+  }
+}
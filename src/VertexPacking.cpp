@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include "VertexPacking.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Half.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+  using namespace Akoylasar;
+
+  std::uint16_t quantizeUnorm16(float value, float lower, float extent)
+  {
+    const float normalized = extent > 0.0f ? (value - lower) / extent : 0.0f;
+    return std::uint16_t(std::lround(std::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+  }
+
+  // GL's normalized short conversion since 4.2: c / 32767, clamped at -1.
+  float toSnorm16(std::int16_t value)
+  {
+    return std::max(float(value) / 32767.0f, -1.0f);
+  }
+
+  float getSign(float value)
+  {
+    return value >= 0.0f ? 1.0f : -1.0f;
+  }
+}
+
+namespace Akoylasar
+{
+  void VertexPacking::getBounds(const Vertex* vertices, std::size_t count, Neon::Vec3f& boundsMin, Neon::Vec3f& boundsMax)
+  {
+    boundsMin = count ? vertices[0].position : Neon::Vec3f(0.0f);
+    boundsMax = boundsMin;
+    for (std::size_t i = 1; i < count; ++i)
+    {
+      const Neon::Vec3f& position = vertices[i].position;
+      boundsMin = Neon::Vec3f(std::min(boundsMin.x, position.x), std::min(boundsMin.y, position.y), std::min(boundsMin.z, position.z));
+      boundsMax = Neon::Vec3f(std::max(boundsMax.x, position.x), std::max(boundsMax.y, position.y), std::max(boundsMax.z, position.z));
+    }
+  }
+
+  void VertexPacking::pack(const Vertex* input,
+                           std::size_t count,
+                           const Neon::Vec3f& boundsMin,
+                           const Neon::Vec3f& boundsMax,
+                           PackedVertex* output)
+  {
+    const Neon::Vec3f extent = boundsMax - boundsMin;
+    Parallel::forRange(count, 1 << 14, [&](std::size_t begin, std::size_t end)
+    {
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        const Vertex& vertex = input[i];
+        PackedVertex& packed = output[i];
+        packed.position[0] = quantizeUnorm16(vertex.position.x, boundsMin.x, extent.x);
+        packed.position[1] = quantizeUnorm16(vertex.position.y, boundsMin.y, extent.y);
+        packed.position[2] = quantizeUnorm16(vertex.position.z, boundsMin.z, extent.z);
+        packed.position[3] = 0;
+        encodeOctahedral(vertex.normal, packed.normal);
+        packed.uv[0] = Half::fromFloat(vertex.uv.x);
+        packed.uv[1] = Half::fromFloat(vertex.uv.y);
+      }
+    });
+  }
+
+  Vertex VertexPacking::unpack(const PackedVertex& packed, const Neon::Vec3f& boundsMin, const Neon::Vec3f& boundsMax)
+  {
+    const Neon::Vec3f extent = boundsMax - boundsMin;
+    Vertex vertex;
+    vertex.position = Neon::Vec3f(boundsMin.x + packed.position[0] / 65535.0f * extent.x,
+                                  boundsMin.y + packed.position[1] / 65535.0f * extent.y,
+                                  boundsMin.z + packed.position[2] / 65535.0f * extent.z);
+    vertex.normal = decodeOctahedral(packed.normal);
+    vertex.uv = Neon::Vec2f(Half::toFloat(packed.uv[0]), Half::toFloat(packed.uv[1]));
+    return vertex;
+  }
+
+  void VertexPacking::encodeOctahedral(const Neon::Vec3f& normal, std::int16_t* encoded)
+  {
+    const float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length <= 0.0f)
+    {
+      encoded[0] = encoded[1] = 0;
+      return;
+    }
+    float u = normal.x / length;
+    float v = normal.y / length;
+    if (normal.z < 0.0f)
+    {
+      const float foldedU = (1.0f - std::abs(v)) * getSign(u);
+      v = (1.0f - std::abs(u)) * getSign(v);
+      u = foldedU;
+    }
+
+    // Plain rounding is off by up to twice the best of the four candidates around the point.
+    const Neon::Vec3f unit = normal * (1.0f / Neon::mag(normal));
+    const float scaledU = std::clamp(u, -1.0f, 1.0f) * 32767.0f;
+    const float scaledV = std::clamp(v, -1.0f, 1.0f) * 32767.0f;
+    float bestDot = -2.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+      const std::int16_t candidate[2] = {std::int16_t((i & 1) ? std::ceil(scaledU) : std::floor(scaledU)),
+                                         std::int16_t((i & 2) ? std::ceil(scaledV) : std::floor(scaledV))};
+      const float dot = Neon::dot(decodeOctahedral(candidate), unit);
+      if (dot > bestDot)
+      {
+        bestDot = dot;
+        encoded[0] = candidate[0];
+        encoded[1] = candidate[1];
+      }
+    }
+  }
+
+  Neon::Vec3f VertexPacking::decodeOctahedral(const std::int16_t* encoded)
+  {
+    // Same as decodeOctahedralNormal in ibl.vs.
+    Neon::Vec3f normal(toSnorm16(encoded[0]), toSnorm16(encoded[1]), 0.0f);
+    normal.z = 1.0f - std::abs(normal.x) - std::abs(normal.y);
+    const float fold = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return Neon::normalize(normal);
+  }
+}
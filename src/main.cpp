@@ -1,7 +1,11 @@
 /*
  * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
@@ -20,6 +24,8 @@
 #include "Ubo.hpp"
 
 #include "IBL.hpp"
+#include "JobSystem.hpp"
+#include "Parallel.hpp"
 
 using namespace Akoylasar;
 
@@ -37,6 +43,14 @@ namespace
   constexpr float kNear = 0.3f;
   constexpr float kFar = 1000.0f;
   
+  // Zoom sweep: kSweepSteps distances from the look at point, spaced geometrically, each drawn
+  // for kSweepWarmupFrames and then timed over kSweepFrames, with levels of detail and without.
+  constexpr int kSweepSteps = 10;
+  constexpr float kSweepNearest = 2.5f;
+  constexpr float kSweepFarthest = 80.0f;
+  constexpr int kSweepWarmupFrames = 30;
+  constexpr int kSweepFrames = 60;
+
   const GLuint kMatricesUniformBlockBinding = 0;
   const char* const kMatricesUbName = "ubMatrices";
 }
@@ -56,6 +70,7 @@ public:
                                      kNear,
                                      kFar)),
   	mMatricesUbo(nullptr),
+  	mJobSystem(nullptr),
   	mIBLScene(std::make_unique<IBLScene>())
   {}
   ~MainApp() override = default;
@@ -80,7 +95,10 @@ protected:
     const auto matricesBlockSize = 2 * sizeof(Neon::Mat4f);
     mMatricesUbo = Ubo::createUbo(matricesBlockSize, kMatricesUniformBlockBinding);
 
-    mIBLScene->initialise();
+    // Leave a core to the main thread.
+    mJobSystem = std::make_unique<JobSystem>(std::max(1u, Parallel::getThreadCount() - 1));
+    Parallel::setJobSystem(mJobSystem.get());
+    mIBLScene->initialise(*mJobSystem);
     
     clearGLErrors();
   }
@@ -105,11 +123,19 @@ protected:
 
   void draw(double deltaTime) override
   {
+    mJobSystem->runMainThreadJobs();
+    updateSweep(deltaTime);
+
     CHECK_GL_ERROR(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
     
     Ubo::updateUbo(*mMatricesUbo, 0, sizeof(Neon::Mat4f), mCamera->getProjection().data());
     Ubo::updateUbo(*mMatricesUbo, sizeof(Neon::Mat4f), sizeof(Neon::Mat4f), mCamera->getView().data());
 
+    // deltaTime is the length of the previous frame.
+    if (mEnvironmentLoading)
+      mWorstLoadFrameMs = std::max(mWorstLoadFrameMs, deltaTime * 1000.0);
+    mEnvironmentLoading = mIBLScene->isLoading();
+
     if (mSceneIndex == 0)
       mIBLScene->render(deltaTime, *mCamera);
 
@@ -122,7 +148,12 @@ protected:
   
   void shutDown() override
   {
+    // Nothing may still run against the scene once it is gone.
+    mJobSystem->cancel();
+    mJobSystem->drain();
     mIBLScene.reset();
+    Parallel::setJobSystem(nullptr);
+    mJobSystem.reset();
     
     Ubo::releaseUbo(*mMatricesUbo);
     mMatricesUbo.reset();
@@ -134,6 +165,15 @@ protected:
   }
     
 private:
+  struct SweepSample
+  {
+    float distance = 0.0f;
+    bool lod = false;
+    double frameMs = 0.0;
+    double shadingGpuMs = 0.0;
+    std::size_t triangles = 0;
+  };
+
   void drawUI(double deltaTime)
   {
     mUiTs->begin();
@@ -158,6 +198,8 @@ private:
       ImGui::Text("UI (GPU): %.2f(ms)", uiMs);
       ImGui::Separator();
       ImGui::Text("Frame time: %.2f(ms)", deltaTime * 1000.0);
+      ImGui::Text("Worst frame while loading the environment: %.2f(ms)", mWorstLoadFrameMs);
+      drawSweepUI();
     }
     ImGui::End();
     
@@ -170,13 +212,112 @@ private:
     
     mUiTs->end();
   }
+
+  void startSweep()
+  {
+    mSweepSamples.clear();
+    mSweepOrigin = mCamera->getOrigin();
+    mSweepLodEnabled = mIBLScene->isLodEnabled();
+    mSweepStep = 0;
+    mSweepFrame = 0;
+    mSweepFrameMs = 0.0;
+    // Frame times are meaningless at the refresh rate.
+    setSwapInterval(0);
+  }
+
+  // Called before each frame is drawn, with deltaTime the length of the one before it.
+  void updateSweep(double deltaTime)
+  {
+    if (mSweepStep < 0)
+      return;
+    if (mSweepFrame > kSweepWarmupFrames)
+      mSweepFrameMs += deltaTime * 1000.0;
+    if (mSweepFrame == kSweepWarmupFrames + kSweepFrames)
+    {
+      SweepSample& sample = mSweepSamples.back();
+      sample.frameMs = mSweepFrameMs / kSweepFrames;
+      sample.shadingGpuMs = mIBLScene->getShadingGpuMs();
+      sample.triangles = mIBLScene->getDrawnTriangles();
+      ++mSweepStep;
+      mSweepFrame = 0;
+      mSweepFrameMs = 0.0;
+    }
+    if (mSweepStep == 2 * kSweepSteps)
+    {
+      finishSweep();
+      return;
+    }
+    if (mSweepFrame == 0)
+    {
+      const int step = mSweepStep % kSweepSteps;
+      SweepSample sample;
+      sample.lod = mSweepStep < kSweepSteps;
+      sample.distance = kSweepNearest * std::pow(kSweepFarthest / kSweepNearest, float(step) / (kSweepSteps - 1));
+      const Neon::Vec3f& lookAt = mCamera->getLookAt();
+      mCamera->setOrigin(lookAt + mCamera->getDirection() * sample.distance);
+      mIBLScene->setLodEnabled(sample.lod);
+      mSweepSamples.push_back(sample);
+    }
+    ++mSweepFrame;
+  }
+
+  void finishSweep()
+  {
+    mSweepStep = -1;
+    mCamera->setOrigin(mSweepOrigin);
+    mIBLScene->setLodEnabled(mSweepLodEnabled);
+    setSwapInterval(1);
+    std::cout << "Zoom sweep, averaged over " << kSweepFrames << " frames per distance:" << std::endl;
+    std::cout << "  distance  triangles (LOD / full)  frame ms (LOD / full)  shading GPU ms (LOD / full)" << std::endl;
+    for (int i = 0; i < kSweepSteps; ++i)
+    {
+      const SweepSample& lod = mSweepSamples[i];
+      const SweepSample& full = mSweepSamples[i + kSweepSteps];
+      char line[160];
+      std::snprintf(line, sizeof(line), "  %8.2f  %9zu / %-9zu  %8.3f / %-8.3f  %8.3f / %-8.3f", lod.distance, lod.triangles,
+                    full.triangles, lod.frameMs, full.frameMs, lod.shadingGpuMs, full.shadingGpuMs);
+      std::cout << line << std::endl;
+    }
+  }
+
+  void drawSweepUI()
+  {
+    ImGui::Separator();
+    if (mSweepStep >= 0)
+    {
+      ImGui::Text("Zoom sweep: step %d of %d...", mSweepStep + 1, 2 * kSweepSteps);
+      return;
+    }
+    if (!mIBLScene->isLoading() && ImGui::Button("Zoom sweep"))
+      startSweep();
+    if (mSweepSamples.size() != 2 * kSweepSteps)
+      return;
+    ImGui::Text("Distance, triangles, frame and shading GPU (ms), LOD / full:");
+    for (int i = 0; i < kSweepSteps; ++i)
+    {
+      const SweepSample& lod = mSweepSamples[i];
+      const SweepSample& full = mSweepSamples[i + kSweepSteps];
+      ImGui::Text("%6.2f  %zu / %zu  %.3f / %.3f  %.3f / %.3f", lod.distance, lod.triangles, full.triangles, lod.frameMs,
+                  full.frameMs, lod.shadingGpuMs, full.shadingGpuMs);
+    }
+  }
 private:
   std::unique_ptr<Profiler> mProfiler;
   TimeStamp* mUiTs;
   std::unique_ptr<Camera> mCamera;
   std::unique_ptr<Ubo> mMatricesUbo;
+  std::unique_ptr<JobSystem> mJobSystem;
   std::unique_ptr<IBLScene> mIBLScene;
   int mSceneIndex = 0;
+  bool mEnvironmentLoading = false;
+  double mWorstLoadFrameMs = 0.0;
+  // The first kSweepSteps samples are with levels of detail, the rest without.
+  std::vector<SweepSample> mSweepSamples;
+  int mSweepStep = -1; // -1 when no sweep is running.
+  int mSweepFrame = 0;
+  double mSweepFrameMs = 0.0;
+  Neon::Vec3f mSweepOrigin;
+  bool mSweepLodEnabled = true;
 };
 
 int main()
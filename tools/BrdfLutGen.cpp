@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+// Build step: integrates the split sum BRDF LUT and writes it out as a C++ source file that
+// defines BrdfLut::getEmbeddedSize and BrdfLut::getEmbeddedTexels.
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "BrdfLut.hpp"
+#include "Half.hpp"
+#include "JobSystem.hpp"
+#include "Parallel.hpp"
+
+using namespace Akoylasar;
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cout << "Usage: BrdfLutGen <size> <output.cpp> [samples]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const int size = std::atoi(argv[1]);
+  const int numSamples = argc > 3 ? std::atoi(argv[3]) : BrdfLut::kDefaultNumSamples;
+  if (size <= 0 || numSamples <= 0)
+  {
+    std::cerr << "Invalid BRDF LUT size or sample count" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // generate spreads its rows over the job system.
+  JobSystem jobs(std::max(1u, Parallel::getThreadCount() - 1));
+  Parallel::setJobSystem(&jobs);
+  std::vector<float> texels;
+  BrdfLut::generate(size, numSamples, texels);
+  std::vector<std::uint16_t> halves(texels.size());
+  Half::fromFloats(texels.data(), halves.data(), texels.size());
+
+  std::ofstream file {argv[2]};
+  if (!file.is_open())
+  {
+    std::cerr << "Failed to open " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+  }
+  file << "// Generated by BrdfLutGen (" << size << "x" << size << ", " << numSamples << " samples). Do not edit.\n"
+       << "#include \"BrdfLut.hpp\"\n\n"
+       << "namespace\n{\n"
+       << "  const std::uint16_t kTexels[] =\n  {";
+  file << std::hex << std::setfill('0');
+  for (std::size_t i = 0; i < halves.size(); ++i)
+  {
+    if (i % 16 == 0)
+      file << "\n    ";
+    file << "0x" << std::setw(4) << halves[i] << ",";
+  }
+  file << std::dec << "\n  };\n}\n\n"
+       << "namespace Akoylasar\n{\n"
+       << "  int BrdfLut::getEmbeddedSize()\n  {\n    return " << size << ";\n  }\n\n"
+       << "  const std::uint16_t* BrdfLut::getEmbeddedTexels()\n  {\n    return kTexels;\n  }\n}\n";
+  if (!file)
+  {
+    std::cerr << "Failed to write " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
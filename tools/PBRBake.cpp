@@ -0,0 +1,1764 @@
+/*
+ * Copyright (c) Fouad Valadbeigi (akoylasar@gmail.com) */
+// Headless CPU bake of the IBL maps, for machines without a GPU.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "IBLBaker.hpp"
+#include "BakeCache.hpp"
+#include "BrdfLut.hpp"
+#include "Bc6hEncoder.hpp"
+#include "EnvironmentContainer.hpp"
+#include "EnvironmentPipeline.hpp"
+#include "EnvironmentSampler.hpp"
+#include "Half.hpp"
+#include "HdrPacking.hpp"
+#include "HdrReader.hpp"
+#include "JobSystem.hpp"
+#include "MappedFile.hpp"
+#include "MeshContainer.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "VertexPacking.hpp"
+#include "ObjLoader.hpp"
+#include "Parallel.hpp"
+#include "ProcessStats.hpp"
+#include "SunLight.hpp"
+
+using namespace Akoylasar;
+
+namespace
+{
+  // Same parameters as IBLScene.
+  constexpr int kIrradianceMapSize = 32;
+  constexpr std::size_t kDefaultDecodeBudget = std::size_t(256) << 20;
+
+  using Clock = std::chrono::steady_clock;
+  double getElapsedMs(const Clock::time_point& start)
+  {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  }
+
+  void printUsage()
+  {
+    const PrefilterSettings defaults;
+    std::cout << "Usage: PBRBake <panorama.hdr> [options]\n"
+              << "       PBRBake --check     Run the self checks, failing if any of them does\n"
+              << "  --size <n>          Prefilter map face size (default " << defaults.size << ")\n"
+              << "  --samples <n>       GGX samples per texel (default " << defaults.numSamples << ")\n"
+              << "  --fis               Use filtered importance sampling for the prefilter map\n"
+              << "  --target-error <e>  Relative error the filtered sample counts aim for (default " << defaults.targetError << ")\n"
+              << "  --compare           Also bake the brute force reference and report error and speedup\n"
+              << "  --bench-decode      Compare HdrReader with stb_image on 3k, 8k and 16k versions of the panorama\n"
+              << "  --bench-half        Time the scalar and SIMD float/half conversions on the panorama's texels\n"
+              << "  --bench-jobs        Stress test the job system and time a sampling workload on 1 to N workers\n"
+              << "  --bench-pipeline    Treat the input as a directory of .hdr files and compare the staged loader\n"
+              << "                      with running its stages back to back\n"
+              << "  --bench-bc6h        Compress the panorama and the baked maps with every BC6H preset and report\n"
+              << "                      blocks/s, size saved and PSNR\n"
+              << "  --bench-packing     Compare RGB16F, BC6H, RGB9E5 and RGBM storage of the baked maps: bytes, PSNR\n"
+              << "                      and scalar against SIMD packer throughput\n"
+              << "  --bench-cubemap     Time the equirect to cubemap conversion and compare equirect with cube lookups\n"
+              << "                      and prefilter bakes\n"
+              << "  --bench-octahedral  Compare octahedral maps with cubemaps of the same texel density: memory, bake\n"
+              << "                      times, lookup rate and PSNR between the layouts\n"
+              << "  --bench-sampling    Build the environment importance sampling tables at 3k, 8k and 16k, time CDF\n"
+              << "                      against alias draws and compare irradiance noise with cosine weighted sampling\n"
+              << "  --bench-sun         Take the sun out of the panorama, bake the rest at half the resolution and an eighth\n"
+              << "                      of the samples, and compare the shading with the full bake\n"
+              << "  --extract-sun       Take the sun out of the panorama before baking and store it with --output\n"
+              << "  --bench-obj         Treat the input as a Wavefront .obj and time parsing on every core and on one,\n"
+              << "                      vertex merging and normal generation, report peak RSS against the file size,\n"
+              << "                      ACMR, ATVR and overfetch before and after optimising the mesh, the levels of\n"
+              << "                      detail simplified from it, packed vertex size, speed and error, and compare\n"
+              << "                      with mapping the same mesh from a mesh cache container\n"
+              << "  --bench-stream      Decode the panorama within the decode budget and report peak RSS against its size\n"
+              << "  --decode-budget <m> Megabytes the streaming decoder may use (default " << (kDefaultDecodeBudget >> 20) << " for --bench-stream,\n"
+              << "                      otherwise panoramas are decoded whole)\n"
+              << "  --output <file>     Write the bakes as a .pbrenv environment container\n";
+  }
+
+  void encodeRgbe(const float* rgb, std::uint8_t* rgbe)
+  {
+    const float maxComponent = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+    if (maxComponent < 1e-32f)
+    {
+      rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+      return;
+    }
+    int exponent;
+    const float scale = std::frexp(maxComponent, &exponent) * 256.0f / maxComponent;
+    rgbe[0] = std::uint8_t(std::max(rgb[0], 0.0f) * scale);
+    rgbe[1] = std::uint8_t(std::max(rgb[1], 0.0f) * scale);
+    rgbe[2] = std::uint8_t(std::max(rgb[2], 0.0f) * scale);
+    rgbe[3] = std::uint8_t(exponent + 128);
+  }
+
+  // Standard run length encoding of one channel: runs of 4 or more equal bytes, literals otherwise.
+  void encodeRleChannel(const std::uint8_t* data, int width, std::vector<char>& output)
+  {
+    int x = 0;
+    while (x < width)
+    {
+      int run = 1;
+      while (x + run < width && run < 127 && data[x + run] == data[x])
+        ++run;
+      if (run >= 4)
+      {
+        output.push_back(char(128 + run));
+        output.push_back(char(data[x]));
+        x += run;
+        continue;
+      }
+      int literal = 0;
+      while (x + literal < width && literal < 128)
+      {
+        int next = 1;
+        while (x + literal + next < width && next < 4 && data[x + literal + next] == data[x + literal])
+          ++next;
+        if (next >= 4)
+          break;
+        ++literal;
+      }
+      output.push_back(char(literal));
+      output.insert(output.end(), data + x, data + x + literal);
+      x += literal;
+    }
+  }
+
+  // Writes a nearest neighbour resample of the panorama as an RLE .hdr file in memory.
+  void encodeHdr(const EquirectImage& source, int width, int height, std::vector<char>& output)
+  {
+    const std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(height) + " +X " + std::to_string(width) + "\n";
+    output.assign(header.begin(), header.end());
+    std::vector<std::uint8_t> rgbe(std::size_t(width) * 4), channel(width);
+    for (int y = 0; y < height; ++y)
+    {
+      // Files store the top row first, EquirectImage the bottom row.
+      const int sourceY = source.height - 1 - int(std::int64_t(y) * source.height / height);
+      const float* row = source.texels + std::size_t(sourceY) * source.width * 3;
+      for (int x = 0; x < width; ++x)
+        encodeRgbe(row + std::size_t(std::int64_t(x) * source.width / width) * 3, rgbe.data() + x * 4);
+      const char lineHeader[4] = {2, 2, char(width >> 8), char(width & 0xff)};
+      output.insert(output.end(), lineHeader, lineHeader + 4);
+      for (int c = 0; c < 4; ++c)
+      {
+        for (int x = 0; x < width; ++x)
+          channel[x] = rgbe[x * 4 + c];
+        encodeRleChannel(channel.data(), width, output);
+      }
+    }
+  }
+
+  void benchDecode(const EquirectImage& source)
+  {
+    constexpr int kRuns = 3;
+    for (const int width : {3072, 8192, 16384})
+    {
+      const int height = width / 2;
+      std::vector<char> file;
+      encodeHdr(source, width, height, file);
+      const double megapixels = double(width) * height * 1e-6;
+      std::cout << width << "x" << height << " (" << file.size() / (1024.0 * 1024.0) << "MB encoded)" << std::endl;
+
+      // Best of kRuns for each decoder.
+      double stbMs = 1e30, floatMs = 1e30, halfMs = 1e30;
+      float* reference = nullptr;
+      std::unique_ptr<float[]> floats;
+      std::unique_ptr<std::uint16_t[]> halves;
+      for (int run = 0; run < kRuns; ++run)
+      {
+        stbi_image_free(reference);
+        floats.reset();
+        auto start = Clock::now();
+        int w, h, numComps;
+        stbi_set_flip_vertically_on_load(true);
+        reference = stbi_loadf_from_memory(reinterpret_cast<const stbi_uc*>(file.data()), int(file.size()), &w, &h, &numComps, 3);
+        stbMs = std::min(stbMs, getElapsedMs(start));
+
+        start = Clock::now();
+        HdrReader::decode(file.data(), file.size(), w, h, floats);
+        floatMs = std::min(floatMs, getElapsedMs(start));
+
+        halves.reset();
+        start = Clock::now();
+        HdrReader::decode(file.data(), file.size(), w, h, halves);
+        halfMs = std::min(halfMs, getElapsedMs(start));
+      }
+
+      std::size_t mismatches = 0;
+      const std::size_t count = std::size_t(width) * height * 3;
+      for (std::size_t i = 0; i < count; ++i)
+        mismatches += std::memcmp(&reference[i], &floats[i], sizeof(float)) != 0;
+      stbi_image_free(reference);
+
+      std::cout << "  stb_image:         " << stbMs << "ms (" << megapixels * 1000.0 / stbMs << " Mpixels/s)\n"
+                << "  HdrReader (float): " << floatMs << "ms (" << megapixels * 1000.0 / floatMs << " Mpixels/s), "
+                << stbMs / floatMs << "x, " << mismatches << " texels differ from stb\n"
+                << "  HdrReader (half):  " << halfMs << "ms (" << megapixels * 1000.0 / halfMs << " Mpixels/s), "
+                << stbMs / halfMs << "x" << std::endl;
+    }
+  }
+
+  void benchHalf(const EquirectImage& source)
+  {
+    constexpr int kRuns = 5;
+    const std::size_t count = std::size_t(source.width) * source.height * 3;
+    std::vector<std::uint16_t> scalar(count), simd(count);
+    std::vector<float> floats(count);
+
+    // Best of kRuns for each conversion.
+    double scalarMs = 1e30, fromFloatsMs = 1e30, toFloatMs = 1e30, toFloatsMs = 1e30;
+    for (int run = 0; run < kRuns; ++run)
+    {
+      auto start = Clock::now();
+      for (std::size_t i = 0; i < count; ++i)
+        scalar[i] = Half::fromFloat(source.texels[i]);
+      scalarMs = std::min(scalarMs, getElapsedMs(start));
+
+      start = Clock::now();
+      Half::fromFloats(source.texels, simd.data(), count);
+      fromFloatsMs = std::min(fromFloatsMs, getElapsedMs(start));
+
+      start = Clock::now();
+      for (std::size_t i = 0; i < count; ++i)
+        floats[i] = Half::toFloat(simd[i]);
+      toFloatMs = std::min(toFloatMs, getElapsedMs(start));
+
+      start = Clock::now();
+      Half::toFloats(simd.data(), floats.data(), count);
+      toFloatsMs = std::min(toFloatsMs, getElapsedMs(start));
+    }
+
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < count; ++i)
+      mismatches += scalar[i] != simd[i];
+
+    const double floatBytes = double(count) * sizeof(float);
+    const auto throughput = [floatBytes](double ms) { return floatBytes / (ms * 1e6); };
+    std::cout << source.width << "x" << source.height << " RGB, " << floatBytes / (1024.0 * 1024.0) << "MB as float, "
+              << floatBytes / (2.0 * 1024.0 * 1024.0) << "MB as half\n"
+              << "  Half::fromFloat loop: " << scalarMs << "ms (" << throughput(scalarMs) << "GB/s of floats)\n"
+              << "  Half::fromFloats:     " << fromFloatsMs << "ms (" << throughput(fromFloatsMs) << "GB/s of floats), "
+              << scalarMs / fromFloatsMs << "x, " << mismatches << " halves differ\n"
+              << "  Half::toFloat loop:   " << toFloatMs << "ms (" << throughput(toFloatMs) << "GB/s of floats)\n"
+              << "  Half::toFloats:       " << toFloatsMs << "ms (" << throughput(toFloatsMs) << "GB/s of floats), "
+              << toFloatMs / toFloatsMs << "x" << std::endl;
+  }
+
+  bool stressJobs(unsigned int workerCount)
+  {
+    // Random DAG where every job checks that its dependencies ran before it. Some jobs submit
+    // children from inside a worker and some continue on the main thread.
+    constexpr int kJobCount = 200000;
+    JobSystem jobs(workerCount);
+    std::vector<int> order(kJobCount, -1);
+    std::vector<JobSystem::JobHandle> handles(kJobCount);
+    std::atomic<int> nextOrder {0};
+    std::atomic<int> violations {0};
+    std::atomic<int> children {0};
+    std::atomic<int> mainThreadRuns {0};
+    std::uint32_t random = 0x9e3779b9u;
+    const auto nextRandom = [&random]() { random ^= random << 13; random ^= random >> 17; random ^= random << 5; return random; };
+
+    const auto start = Clock::now();
+    for (int i = 0; i < kJobCount; ++i)
+    {
+      std::vector<int> dependencies;
+      for (int d = 0; d < 3 && i > 0; ++d)
+        if (nextRandom() % 2)
+          dependencies.push_back(int(nextRandom() % i));
+      std::vector<JobSystem::JobHandle> dependencyHandles;
+      for (const int d : dependencies)
+        dependencyHandles.push_back(handles[d]);
+
+      const auto task = [&, i, dependencies]()
+      {
+        for (const int d : dependencies)
+          violations += order[d] < 0;
+        order[i] = nextOrder++;
+        if (i % 97 == 0)
+          jobs.submit([&children]() { ++children; });
+      };
+      if (i % 1009 == 0)
+        handles[i] = jobs.submitMainThread([&, task]() { task(); ++mainThreadRuns; }, dependencyHandles);
+      else
+        handles[i] = jobs.submit(task, dependencyHandles);
+    }
+    jobs.drain();
+    const double dagMs = getElapsedMs(start);
+
+    const int expectedChildren = (kJobCount + 96) / 97;
+    const int expectedMainThread = (kJobCount + 1008) / 1009;
+    bool ok = violations == 0 && nextOrder == kJobCount && children == expectedChildren && mainThreadRuns == expectedMainThread;
+    const JobSystem::Stats stats = jobs.getStats();
+    std::cout << "  " << workerCount << " workers: " << kJobCount << " jobs in " << dagMs << "ms ("
+              << stats.executed / (dagMs * 1e-3) * 1e-6 << " Mjobs/s), " << stats.stolen << " stolen, "
+              << violations << " ordering violations" << std::endl;
+
+    // Cancel half way through a long backlog; every job must still be accounted for.
+    JobSystem cancelled(workerCount);
+    std::atomic<int> ran {0};
+    JobSystem::JobHandle previous;
+    for (int i = 0; i < kJobCount / 4; ++i)
+    {
+      auto task = [&ran]() { volatile int spin = 0; for (int k = 0; k < 20000; ++k) spin = spin + k; ++ran; };
+      previous = i % 4 == 0 ? cancelled.submit(task) : cancelled.submit(task, {previous});
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    cancelled.cancel();
+    cancelled.drain();
+    const JobSystem::Stats cancelStats = cancelled.getStats();
+    ok = ok && cancelStats.executed + cancelStats.skipped == std::size_t(kJobCount / 4) && std::size_t(ran) == cancelStats.executed;
+    std::cout << "  cancel: " << cancelStats.executed << " ran, " << cancelStats.skipped << " skipped" << std::endl;
+    return ok;
+  }
+
+  void benchJobs(const EquirectImage& source)
+  {
+    const unsigned int threadCount = Parallel::getThreadCount();
+    std::cout << "Stress test" << std::endl;
+    bool ok = true;
+    for (const unsigned int workerCount : {1u, 3u, std::max(8u, threadCount * 2)})
+      ok = stressJobs(workerCount) && ok;
+    std::cout << (ok ? "  passed" : "  FAILED") << std::endl;
+
+    // Many small sampling jobs, roughly the grain of a prefilter tile.
+    constexpr int kTileCount = 512;
+    constexpr int kSamplesPerTile = 16384;
+    std::cout << "Scaling (" << kTileCount << " jobs of " << kSamplesPerTile << " panorama lookups, "
+              << threadCount << " hardware threads)" << std::endl;
+    std::vector<unsigned int> workerCounts;
+    for (unsigned int workerCount = 1; workerCount < threadCount; workerCount *= 2)
+      workerCounts.push_back(workerCount);
+    workerCounts.push_back(threadCount);
+    double singleMs = 0.0;
+    for (const unsigned int workerCount : workerCounts)
+    {
+      JobSystem jobs(workerCount);
+      std::vector<float> sums(kTileCount);
+      const auto start = Clock::now();
+      for (int tile = 0; tile < kTileCount; ++tile)
+      {
+        jobs.submit([&source, &sums, tile]()
+        {
+          std::uint32_t random = 0x9e3779b9u * (tile + 1);
+          float sum = 0.0f;
+          for (int i = 0; i < kSamplesPerTile; ++i)
+          {
+            float direction[3];
+            for (auto& component : direction)
+            {
+              random ^= random << 13; random ^= random >> 17; random ^= random << 5;
+              component = random * (2.0f / 4294967296.0f) - 1.0f;
+            }
+            float rgb[3];
+            IBLBaker::sampleEquirect(source, direction[0], direction[1], direction[2], rgb);
+            sum += rgb[0] + rgb[1] + rgb[2];
+          }
+          sums[tile] = sum;
+        });
+      }
+      jobs.drain();
+      const double ms = getElapsedMs(start);
+      if (workerCount == 1)
+        singleMs = ms;
+      std::cout << "  " << workerCount << " workers: " << ms << "ms, " << singleMs / ms << "x, "
+                << 100.0 * singleMs / (ms * workerCount) << "% efficiency" << std::endl;
+    }
+  }
+
+  void benchStream(const char* path, std::size_t decodeBudget, bool compare)
+  {
+    MappedFile file;
+    StreamedHdr streamed;
+    const auto start = Clock::now();
+    if (!file.open(path) || !HdrReader::decodeStreaming(file, decodeBudget, streamed))
+    {
+      std::cerr << "Failed to load texture with path " << path << std::endl;
+      return;
+    }
+    const double ms = getElapsedMs(start);
+    // Read before anything else gets allocated.
+    const std::size_t peakResidentBytes = ProcessStats::getPeakResidentBytes();
+    const double megabyte = 1024.0 * 1024.0;
+    const std::size_t floatBytes = std::size_t(streamed.sourceWidth) * streamed.sourceHeight * 3 * sizeof(float);
+    std::cout << streamed.sourceWidth << "x" << streamed.sourceHeight << ": " << file.getSize() / megabyte << "MB encoded, "
+              << floatBytes / megabyte << "MB as floats" << std::endl;
+    std::cout << "  Kept at " << streamed.mips.widths[0] << "x" << streamed.mips.heights[0] << " (1/" << streamed.downsampleFactor
+              << ") with " << streamed.mips.getLevelCount() << " mips in " << ms << "ms" << std::endl;
+    std::cout << "  Decoder heap " << streamed.peakBytes / megabyte << "MB of a " << decodeBudget / megabyte << "MB budget, peak RSS "
+              << peakResidentBytes / megabyte << "MB (" << 100.0 * peakResidentBytes / floatBytes << "% of the float image)" << std::endl;
+    if (!compare)
+      return;
+
+    // Reference SH from a whole decode, which is what the budget is there to avoid.
+    int width, height;
+    std::unique_ptr<float[]> texels;
+    HdrReader::decode(file.getData(), file.getSize(), width, height, texels);
+    const ShCoefficients reference = IBLBaker::projectToSh({width, height, texels.get()});
+    const float* a = reinterpret_cast<const float*>(streamed.radianceSh.data());
+    const float* b = reinterpret_cast<const float*>(reference.data());
+    float maxError = 0.0f;
+    for (int i = 0; i < 27; ++i)
+      maxError = std::max(maxError, std::abs(a[i] - b[i]) / std::max(std::abs(b[i % 3]), 1e-6f));
+    std::cout << "  SH max error relative to the DC term: " << maxError << std::endl;
+  }
+
+  void benchPipeline(const std::filesystem::path& directory, const PrefilterSettings& prefilterSettings, std::size_t decodeBudget)
+  {
+    std::vector<std::filesystem::path> paths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+      if (entry.path().extension() == ".hdr")
+        paths.push_back(entry.path());
+    std::sort(paths.begin(), paths.end());
+    if (paths.empty())
+    {
+      std::cerr << "No .hdr files in " << directory << std::endl;
+      return;
+    }
+
+    EnvironmentPipelineSettings settings;
+    settings.prefilter = prefilterSettings;
+    settings.irradianceSize = kIrradianceMapSize;
+    settings.cpuPrefilter = true;
+    settings.decodeMemoryBudget = decodeBudget;
+    // Nothing is ever stored there, so every environment goes through every stage.
+    const BakeCache cache {std::filesystem::temp_directory_path() / "pbrbake-empty-cache"};
+
+    std::cout << "Serial (" << paths.size() << " environments)" << std::endl;
+    const auto serialStart = Clock::now();
+    for (const auto& path : paths)
+    {
+      EnvironmentData item;
+      item.path = path;
+      for (int stage = EnvironmentPipeline::kRead; stage < EnvironmentPipeline::kUpload; ++stage)
+        EnvironmentPipeline::runStage(EnvironmentPipeline::Stage(stage), item, cache, settings);
+    }
+    const double serialMs = getElapsedMs(serialStart);
+    std::cout << "  " << serialMs << "ms, " << paths.size() / (serialMs * 1e-3) << " environments/s" << std::endl;
+
+    std::cout << "Pipelined" << std::endl;
+    JobSystem jobs(Parallel::getThreadCount());
+    EnvironmentPipeline pipeline(jobs, cache, settings);
+    const auto pipelineStart = Clock::now();
+    for (const auto& path : paths)
+      pipeline.submit(path);
+    while (!pipeline.isIdle())
+    {
+      // Stands in for the GL thread, which would upload here.
+      if (pipeline.popReady())
+        pipeline.finishUpload(0.0);
+      else
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const double pipelineMs = getElapsedMs(pipelineStart);
+    for (const auto& stage : pipeline.getStats())
+      std::cout << "  " << stage.name << ": " << stage.processed << " done, peak queue " << stage.peakQueueDepth
+                << ", " << stage.busyMs << "ms busy, " << stage.itemsPerSecond << "/s" << std::endl;
+    std::cout << "  " << pipelineMs << "ms, " << pipeline.getEnvironmentsPerSecond() << " environments/s, "
+              << serialMs / pipelineMs << "x over serial" << std::endl;
+  }
+
+  void benchObj(const char* path)
+  {
+    // Every core first, so that peak RSS is that of a single load with the parallel parser.
+    ObjLoadStats stats;
+    auto start = Clock::now();
+    std::unique_ptr<Mesh> mesh = ObjLoader::load(path, 0, &stats);
+    if (!mesh)
+      return;
+    const double ms = getElapsedMs(start);
+    const std::size_t peakResidentBytes = ProcessStats::getPeakResidentBytes();
+    const double megabyte = 1024.0 * 1024.0;
+    const std::size_t meshBytes = mesh->vertices.size() * sizeof(Vertex) + mesh->indices.size() * sizeof(std::uint32_t);
+    std::cout << path << ": " << stats.fileBytes / megabyte << "MB, " << stats.corners / 3 << " triangles, " << stats.vertices
+              << " vertices (" << double(stats.corners) / stats.vertices << " indices per vertex), " << meshBytes / megabyte
+              << "MB as a Mesh" << std::endl;
+    const auto printStats = [&](const ObjLoadStats& run, double totalMs)
+    {
+      std::cout << "  " << run.threads << " threads: " << totalMs << "ms total, parse " << run.parseMs << "ms ("
+                << run.fileBytes / megabyte / (run.parseMs * 1e-3) << "MB/s), merge " << run.dedupMs << "ms ("
+                << run.corners / (run.dedupMs * 1e-3) * 1e-6 << "M corners/s, " << run.hashCapacity << " slots), normals "
+                << run.normalsMs << "ms" << std::endl;
+    };
+    printStats(stats, ms);
+    std::cout << "  Peak RSS " << peakResidentBytes / megabyte << "MB (" << double(peakResidentBytes) / stats.fileBytes
+              << "x the file)" << std::endl;
+
+    // What buildSceneMesh does to the mesh before it is cached.
+    MeshOptimizationStats optimization;
+    start = Clock::now();
+    MeshOptimizer::optimize(*mesh, &optimization);
+    const double optimizeMs = getElapsedMs(start);
+    std::cout << "  Optimised in " << optimizeMs << "ms (cache " << optimization.vertexCacheMs << "ms, overdraw "
+              << optimization.overdrawMs << "ms over " << optimization.clusters << " clusters, fetch " << optimization.vertexFetchMs
+              << "ms): ACMR " << optimization.cacheBefore.acmr << " -> " << optimization.cacheAfter.acmr << ", ATVR "
+              << optimization.cacheBefore.atvr << " -> " << optimization.cacheAfter.atvr << ", overfetch " << optimization.overfetchBefore
+              << " -> " << optimization.overfetchAfter << std::endl;
+
+    // Its levels of detail, errors relative to the largest extent as in LodSettings::maxError.
+    std::vector<LodLevelStats> lodStats;
+    start = Clock::now();
+    MeshSimplifier::buildLods(*mesh, {}, &lodStats);
+    const double lodMs = getElapsedMs(start);
+    Neon::Vec3f meshMin, meshMax;
+    VertexPacking::getBounds(mesh->vertices.data(), mesh->vertices.size(), meshMin, meshMax);
+    const Neon::Vec3f meshExtent = meshMax - meshMin;
+    const float largestExtent = std::max({meshExtent.x, meshExtent.y, meshExtent.z});
+    std::cout << "  " << lodStats.size() << " levels of detail in " << lodMs << "ms, "
+              << (mesh->indices.size() - lodStats.front().triangles * 3) * sizeof(std::uint32_t) / megabyte << "MB of extra indices"
+              << std::endl;
+    for (std::size_t i = 1; i < lodStats.size(); ++i)
+    {
+      const LodLevelStats& level = lodStats[i];
+      std::cout << "    Level " << i << ": " << level.triangles << " triangles (" << 100.0 * level.triangles / lodStats.front().triangles
+                << "%), error " << level.error / largestExtent << " of the extent, " << level.passes << " passes in " << level.ms
+                << "ms" << std::endl;
+    }
+
+    // The PackedVertex stream stored next to it, and how far what the vertex shader decodes is
+    // from the floats.
+    Neon::Vec3f boundsMin, boundsMax;
+    VertexPacking::getBounds(mesh->vertices.data(), mesh->vertices.size(), boundsMin, boundsMax);
+    std::vector<PackedVertex> packedVertices(mesh->vertices.size());
+    start = Clock::now();
+    VertexPacking::pack(mesh->vertices.data(), mesh->vertices.size(), boundsMin, boundsMax, packedVertices.data());
+    const double packMs = getElapsedMs(start);
+    float positionError = 0.0f;
+    float normalError = 0.0f;
+    float uvError = 0.0f;
+    for (std::size_t i = 0; i < packedVertices.size(); ++i)
+    {
+      const Vertex& vertex = mesh->vertices[i];
+      const Vertex decoded = VertexPacking::unpack(packedVertices[i], boundsMin, boundsMax);
+      positionError = std::max(positionError, Neon::mag(decoded.position - vertex.position));
+      // Near 1 the dot product's rounding alone is worth hundredths of a degree.
+      if (Neon::mag(vertex.normal) > 0.0f)
+      {
+        const Neon::Vec3f normal = Neon::normalize(vertex.normal);
+        normalError = std::max(normalError, std::atan2(Neon::mag(Neon::cross(decoded.normal, normal)), Neon::dot(decoded.normal, normal)));
+      }
+      uvError = std::max({uvError, std::abs(decoded.uv.x - vertex.uv.x), std::abs(decoded.uv.y - vertex.uv.y)});
+    }
+    const Neon::Vec3f extent = boundsMax - boundsMin;
+    std::cout << "  Packed " << mesh->vertices.size() * sizeof(Vertex) / megabyte << "MB of Vertex into "
+              << packedVertices.size() * sizeof(PackedVertex) / megabyte << "MB of PackedVertex in " << packMs << "ms ("
+              << mesh->vertices.size() / (packMs * 1e-3) * 1e-6 << "M vertices/s), largest errors: position "
+              << positionError / std::max({extent.x, extent.y, extent.z}) << " of the bounds, normal "
+              << normalError * 180.0 / Neon::kPi << " degrees, uv " << uvError << std::endl;
+    PackedVertices packed;
+    packed.format = VertexPacking::kFormat;
+    packed.stride = sizeof(PackedVertex);
+    const float bounds[6] = {boundsMin.x, boundsMin.y, boundsMin.z, boundsMax.x, boundsMax.y, boundsMax.z};
+    std::copy(bounds, bounds + 3, packed.boundsMin);
+    std::copy(bounds + 3, bounds + 6, packed.boundsMax);
+    packed.data = reinterpret_cast<const std::uint8_t*>(packedVertices.data());
+
+    // The same mesh through a container, mapped and checked the way a mesh cache hit is. The
+    // first pass may read from disk, the second finds the pages cached.
+    const std::filesystem::path containerPath = std::filesystem::temp_directory_path() / "PBRBake.pbrmesh";
+    if (MeshContainer::write(containerPath, 0, mesh->getView(), packed))
+    {
+      mesh.reset();
+      std::error_code error;
+      std::cout << "  Container " << std::filesystem::file_size(containerPath, error) / megabyte << "MB" << std::endl;
+      for (const char* pass : {"first", "second"})
+      {
+        start = Clock::now();
+        MappedFile container;
+        MeshView view;
+        PackedVertices packed;
+        std::uint64_t key;
+        if (!container.open(containerPath) || !MeshContainer::read(container, key, view, packed))
+          break;
+        const double containerMs = getElapsedMs(start);
+        std::cout << "  Container " << pass << " map and check: " << containerMs << "ms, " << ms / containerMs
+                  << "x faster than loading the OBJ" << std::endl;
+      }
+      std::filesystem::remove(containerPath, error);
+    }
+    mesh.reset();
+
+    if (stats.threads > 1)
+    {
+      start = Clock::now();
+      ObjLoader::load(path, 1, &stats);
+      printStats(stats, getElapsedMs(start));
+    }
+  }
+
+  void benchBc6h(const EquirectImage& source, const CubeMapData& irradiance, const CubeMapData& prefiltered)
+  {
+    struct Map
+    {
+      const char* name;
+      std::vector<std::uint16_t> texels;
+      int size; // Width of the panorama, face size of the cubemaps.
+      int height;
+      int mipLevels; // 0 for the panorama.
+    };
+    Map maps[] =
+    {
+      {"Panorama", std::vector<std::uint16_t>(std::size_t(source.width) * source.height * 3), source.width, source.height, 0},
+      {"Irradiance", std::vector<std::uint16_t>(irradiance.texels.size()), irradiance.size, irradiance.size, 1},
+      {"Prefilter", std::vector<std::uint16_t>(prefiltered.texels.size()), prefiltered.size, prefiltered.size, prefiltered.mipLevels}
+    };
+    Half::fromFloats(source.texels, maps[0].texels.data(), maps[0].texels.size());
+    Half::fromFloats(irradiance.texels.data(), maps[1].texels.data(), maps[1].texels.size());
+    Half::fromFloats(prefiltered.texels.data(), maps[2].texels.data(), maps[2].texels.size());
+
+    const std::pair<const char*, Bc6hQuality> presets[] = {{"fast", Bc6hQuality::Fast}, {"normal", Bc6hQuality::Normal}, {"high", Bc6hQuality::High}};
+    for (const auto& map : maps)
+    {
+      const std::size_t halfBytes = map.texels.size() * sizeof(std::uint16_t);
+      std::cout << map.name << " " << map.size << "x" << map.height << (map.mipLevels ? " cubemap" : "") << ", "
+                << halfBytes / (1024.0 * 1024.0) << "MB as RGB16F" << std::endl;
+      for (const auto& preset : presets)
+      {
+        std::vector<std::uint8_t> blocks;
+        const auto start = Clock::now();
+        double psnr;
+        if (map.mipLevels)
+        {
+          Bc6hEncoder::encodeCubeMap(map.texels.data(), map.size, map.mipLevels, preset.second, blocks);
+          const double ms = getElapsedMs(start);
+          psnr = Bc6hEncoder::computeCubeMapPsnr(map.texels.data(), blocks.data(), map.size, map.mipLevels);
+          std::cout << "  " << preset.first << ": " << ms << "ms, " << blocks.size() / Bc6hEncoder::kBlockBytes * 1000.0 / ms << " blocks/s";
+        }
+        else
+        {
+          blocks.resize(Bc6hEncoder::getCompressedSize(map.size, map.height));
+          Bc6hEncoder::encode(map.texels.data(), map.size, map.height, preset.second, blocks.data());
+          const double ms = getElapsedMs(start);
+          psnr = Bc6hEncoder::computePsnr(map.texels.data(), blocks.data(), map.size, map.height);
+          std::cout << "  " << preset.first << ": " << ms << "ms, " << blocks.size() / Bc6hEncoder::kBlockBytes * 1000.0 / ms << " blocks/s";
+        }
+        std::cout << ", " << blocks.size() / (1024.0 * 1024.0) << "MB (" << (halfBytes - blocks.size()) / (1024.0 * 1024.0)
+                  << "MB saved), PSNR " << psnr << "dB" << std::endl;
+      }
+    }
+  }
+
+  // Tonemapped like Bc6hEncoder::computePsnr so that the formats compare alike.
+  double getTonemappedPsnr(const float* reference, const float* decoded, std::size_t count)
+  {
+    double sumSquaredError = 0.0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const double a = std::max(double(reference[i]), 0.0);
+      const double b = std::max(double(decoded[i]), 0.0);
+      const double d = a / (1.0 + a) - b / (1.0 + b);
+      sumSquaredError += d * d;
+    }
+    return sumSquaredError > 0.0 ? 10.0 * std::log10(count / sumSquaredError) : INFINITY;
+  }
+
+  void benchPacking(const CubeMapData& irradiance, const CubeMapData& prefiltered)
+  {
+    constexpr int kRuns = 5;
+    const std::pair<const char*, const CubeMapData*> maps[] = {{"Irradiance", &irradiance}, {"Prefilter", &prefiltered}};
+    for (const auto& map : maps)
+    {
+      const CubeMapData& data = *map.second;
+      const std::size_t count = data.texels.size();
+      const std::size_t texelCount = count / 3;
+      std::vector<float> decoded(count);
+      std::cout << map.first << " " << data.size << "x" << data.size << ", " << data.mipLevels << " mips, " << texelCount << " texels" << std::endl;
+
+      std::vector<std::uint16_t> halves(count);
+      Half::fromFloats(data.texels.data(), halves.data(), count);
+      Half::toFloats(halves.data(), decoded.data(), count);
+      std::cout << "  RGB16F: " << count * sizeof(std::uint16_t) / 1024.0 << "KB, PSNR "
+                << getTonemappedPsnr(data.texels.data(), decoded.data(), count) << "dB" << std::endl;
+
+      std::vector<std::uint8_t> blocks;
+      Bc6hEncoder::encodeCubeMap(halves.data(), data.size, data.mipLevels, Bc6hQuality::Normal, blocks);
+      std::cout << "  BC6H:   " << blocks.size() / 1024.0 << "KB, PSNR "
+                << Bc6hEncoder::computeCubeMapPsnr(halves.data(), blocks.data(), data.size, data.mipLevels) << "dB" << std::endl;
+
+      std::vector<std::uint32_t> scalar(texelCount), packed(texelCount);
+      double scalarMs = 1e30, simdMs = 1e30;
+      for (int run = 0; run < kRuns; ++run)
+      {
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < texelCount; ++i)
+          scalar[i] = HdrPacking::packRgb9e5(data.texels.data() + i * 3);
+        scalarMs = std::min(scalarMs, getElapsedMs(start));
+        start = Clock::now();
+        HdrPacking::packRgb9e5(data.texels.data(), packed.data(), texelCount);
+        simdMs = std::min(simdMs, getElapsedMs(start));
+      }
+      std::size_t mismatches = 0;
+      for (std::size_t i = 0; i < texelCount; ++i)
+      {
+        mismatches += scalar[i] != packed[i];
+        HdrPacking::unpackRgb9e5(packed[i], decoded.data() + i * 3);
+      }
+      std::cout << "  RGB9E5: " << texelCount * 4 / 1024.0 << "KB, PSNR " << getTonemappedPsnr(data.texels.data(), decoded.data(), count)
+                << "dB, pack " << scalarMs << "ms scalar, " << simdMs << "ms bulk (" << scalarMs / simdMs << "x), "
+                << mismatches << " texels differ" << std::endl;
+
+      const float range = HdrPacking::getRgbmRange(data.texels.data(), texelCount);
+      std::vector<std::uint8_t> rgbm(texelCount * 4), reference(texelCount * 4);
+      scalarMs = 1e30;
+      simdMs = 1e30;
+      for (int run = 0; run < kRuns; ++run)
+      {
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < texelCount; ++i)
+          HdrPacking::packRgbm(data.texels.data() + i * 3, range, reference.data() + i * 4);
+        scalarMs = std::min(scalarMs, getElapsedMs(start));
+        start = Clock::now();
+        HdrPacking::packRgbm(data.texels.data(), rgbm.data(), texelCount, range);
+        simdMs = std::min(simdMs, getElapsedMs(start));
+      }
+      mismatches = 0;
+      for (std::size_t i = 0; i < texelCount; ++i)
+      {
+        mismatches += std::memcmp(&rgbm[i * 4], &reference[i * 4], 4) != 0;
+        HdrPacking::unpackRgbm(rgbm.data() + i * 4, range, decoded.data() + i * 3);
+      }
+      std::cout << "  RGBM:   " << texelCount * 4 / 1024.0 << "KB, range " << range << ", PSNR "
+                << getTonemappedPsnr(data.texels.data(), decoded.data(), count) << "dB, pack " << scalarMs << "ms scalar, "
+                << simdMs << "ms bulk (" << scalarMs / simdMs << "x), " << mismatches << " texels differ" << std::endl;
+    }
+  }
+
+  // count normalized directions, xyz one after another.
+  std::vector<float> getRandomDirections(int count)
+  {
+    std::vector<float> directions(std::size_t(count) * 3);
+    std::uint32_t seed = 1;
+    for (float& value : directions)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      value = float(seed >> 8) / float(1 << 24) * 2.0f - 1.0f;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      float* d = directions.data() + std::size_t(i) * 3;
+      const float invLength = 1.0f / std::sqrt(std::max(d[0] * d[0] + d[1] * d[1] + d[2] * d[2], 1e-12f));
+      d[0] *= invLength;
+      d[1] *= invLength;
+      d[2] *= invLength;
+    }
+    return directions;
+  }
+
+  // Looks map up in every direction at lod, returning the time it took.
+  double sampleMap(const CubeMapData& map, const std::vector<float>& directions, float lod, std::vector<float>& texels)
+  {
+    const std::size_t count = directions.size() / 3;
+    texels.resize(directions.size());
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const float* d = directions.data() + i * 3;
+      IBLBaker::sampleCubeMap(map, d[0], d[1], d[2], lod, texels.data() + i * 3);
+    }
+    return getElapsedMs(start);
+  }
+
+  // The layouts have no texels in common, so maps are compared through lookups in the same
+  // directions.
+  double getLookupPsnr(const CubeMapData& a, const CubeMapData& b, const std::vector<float>& directions, float lod)
+  {
+    std::vector<float> texelsA, texelsB;
+    sampleMap(a, directions, lod, texelsA);
+    sampleMap(b, directions, lod, texelsB);
+    return getTonemappedPsnr(texelsA.data(), texelsB.data(), texelsA.size());
+  }
+
+  void benchCubeMap(const EquirectImage& image, const PrefilterSettings& settings)
+  {
+    constexpr int kRuns = 3;
+    constexpr int kLookups = 1 << 22;
+    const int size = IBLBaker::getEquirectCubeMapSize(image.width);
+    CubeMapData cube;
+    double convertMs = 1e30;
+    for (int run = 0; run < kRuns; ++run)
+    {
+      const auto start = Clock::now();
+      IBLBaker::equirectToCubeMap(image, size, cube);
+      convertMs = std::min(convertMs, getElapsedMs(start));
+    }
+    const std::size_t equirectBytes = std::size_t(image.width) * image.height * 3 * sizeof(std::uint16_t);
+    std::cout << image.width << "x" << image.height << " to " << size << "x" << size << " cubemap, " << cube.mipLevels << " mips: "
+              << convertMs << "ms, " << cube.texels.size() / 3 / (convertMs * 1e3) << " Mtexels/s, "
+              << cube.texels.size() * sizeof(std::uint16_t) / (1024.0 * 1024.0) << "MB as RGB16F against "
+              << equirectBytes / (1024.0 * 1024.0) << "MB for the panorama" << std::endl;
+
+    // The per fetch cost the shaders no longer pay, on the CPU: atan and asin against a face
+    // selection, both followed by a bilinear lookup.
+    const std::vector<float> directions = getRandomDirections(kLookups);
+    std::vector<float> equirectTexels(std::size_t(kLookups) * 3), cubeTexels(std::size_t(kLookups) * 3);
+    auto start = Clock::now();
+    for (int i = 0; i < kLookups; ++i)
+    {
+      const float* d = directions.data() + std::size_t(i) * 3;
+      IBLBaker::sampleEquirect(image, d[0], d[1], d[2], equirectTexels.data() + std::size_t(i) * 3);
+    }
+    const double equirectMs = getElapsedMs(start);
+    start = Clock::now();
+    for (int i = 0; i < kLookups; ++i)
+    {
+      const float* d = directions.data() + std::size_t(i) * 3;
+      IBLBaker::sampleCubeMap(cube, d[0], d[1], d[2], 0.0f, cubeTexels.data() + std::size_t(i) * 3);
+    }
+    const double cubeMs = getElapsedMs(start);
+    std::cout << "Lookups (scalar, 1 thread): equirect " << kLookups / (equirectMs * 1e3) << "M/s, cube "
+              << kLookups / (cubeMs * 1e3) << "M/s, PSNR of cube against equirect "
+              << getTonemappedPsnr(equirectTexels.data(), cubeTexels.data(), cubeTexels.size()) << "dB" << std::endl;
+
+    CubeMapData fromEquirect, fromCube;
+    start = Clock::now();
+    IBLBaker::prefilterEnvMap(image, settings, fromEquirect);
+    const double equirectBakeMs = getElapsedMs(start);
+    start = Clock::now();
+    IBLBaker::prefilterEnvMap(cube, settings, fromCube);
+    const double cubeBakeMs = getElapsedMs(start);
+    std::cout << "Prefilter " << settings.size << "x" << settings.size << (settings.mode == PrefilterMode::BruteForce ? " brute force" : " filtered")
+              << ": " << equirectBakeMs << "ms from the panorama, " << cubeBakeMs << "ms from the cubemap, PSNR "
+              << getTonemappedPsnr(fromEquirect.texels.data(), fromCube.texels.data(), fromCube.texels.size()) << "dB" << std::endl;
+  }
+
+  void benchOctahedral(const EquirectImage& image, const PrefilterSettings& settings)
+  {
+    constexpr int kRuns = 3;
+    constexpr int kLookups = 1 << 22;
+    constexpr int kIrradianceRuns = 20;
+    const auto getMegabytes = [](const CubeMapData& map) { return map.texels.size() * sizeof(std::uint16_t) / (1024.0 * 1024.0); };
+    const auto time = [](int runs, const std::function<void()>& bake)
+    {
+      double bestMs = 1e30;
+      for (int run = 0; run < runs; ++run)
+      {
+        const auto start = Clock::now();
+        bake();
+        bestMs = std::min(bestMs, getElapsedMs(start));
+      }
+      return bestMs;
+    };
+
+    // Same texel density at the axes, where octahedral texels are the smallest and cube ones
+    // the largest.
+    const int cubeSize = IBLBaker::getEquirectCubeMapSize(image.width);
+    const int octahedralSize = IBLBaker::getOctahedralSize(cubeSize);
+    CubeMapData cube, octahedral;
+    const double cubeMs = time(kRuns, [&]() { IBLBaker::equirectToCubeMap(image, cubeSize, cube); });
+    const double octahedralMs = time(kRuns, [&]() { IBLBaker::equirectToCubeMap(image, octahedralSize, octahedral, MapLayout::Octahedral); });
+    std::cout << "Environment: cubemap " << cubeSize << "x" << cubeSize << " " << cubeMs << "ms, " << getMegabytes(cube)
+              << "MB; octahedral " << octahedralSize << "x" << octahedralSize << " " << octahedralMs << "ms, "
+              << getMegabytes(octahedral) << "MB as RGB16F" << std::endl;
+
+    // What a fetch costs besides the bilinear lookup: a face selection against the fold.
+    const std::vector<float> directions = getRandomDirections(kLookups);
+    std::vector<float> cubeTexels, octahedralTexels;
+    const double cubeLookupMs = sampleMap(cube, directions, 0.0f, cubeTexels);
+    const double octahedralLookupMs = sampleMap(octahedral, directions, 0.0f, octahedralTexels);
+    std::cout << "Lookups (scalar, 1 thread): cube " << kLookups / (cubeLookupMs * 1e3) << "M/s, octahedral "
+              << kLookups / (octahedralLookupMs * 1e3) << "M/s, PSNR "
+              << getTonemappedPsnr(cubeTexels.data(), octahedralTexels.data(), cubeTexels.size()) << "dB at lod 0, "
+              << getLookupPsnr(cube, octahedral, directions, 4.0f) << "dB at lod 4" << std::endl;
+
+    const ShCoefficients sh = IBLBaker::projectToSh(image);
+    CubeMapData cubeIrradiance, octahedralIrradiance;
+    const int octahedralIrradianceSize = IBLBaker::getOctahedralSize(kIrradianceMapSize);
+    const double cubeIrradianceMs = time(kIrradianceRuns, [&]() { IBLBaker::bakeIrradianceMap(sh, kIrradianceMapSize, cubeIrradiance); });
+    const double octahedralIrradianceMs = time(kIrradianceRuns, [&]()
+    {
+      IBLBaker::bakeIrradianceMap(sh, octahedralIrradianceSize, octahedralIrradiance, MapLayout::Octahedral);
+    });
+    std::cout << "Irradiance: cubemap " << kIrradianceMapSize << "x" << kIrradianceMapSize << " " << cubeIrradianceMs << "ms, "
+              << cubeIrradiance.texels.size() * sizeof(std::uint16_t) / 1024.0 << "KB; octahedral " << octahedralIrradianceSize << "x"
+              << octahedralIrradianceSize << " " << octahedralIrradianceMs << "ms, "
+              << octahedralIrradiance.texels.size() * sizeof(std::uint16_t) / 1024.0 << "KB, PSNR "
+              << getLookupPsnr(cubeIrradiance, octahedralIrradiance, directions, 0.0f) << "dB" << std::endl;
+
+    // Every combination of source and output layout, as the app can switch them independently.
+    PrefilterSettings octahedralSettings = settings;
+    octahedralSettings.layout = MapLayout::Octahedral;
+    octahedralSettings.size = IBLBaker::getOctahedralSize(settings.size);
+    CubeMapData cubeToCube, cubeToOctahedral, octahedralToOctahedral;
+    const double cubeToCubeMs = time(1, [&]() { IBLBaker::prefilterEnvMap(cube, settings, cubeToCube); });
+    const double cubeToOctahedralMs = time(1, [&]() { IBLBaker::prefilterEnvMap(cube, octahedralSettings, cubeToOctahedral); });
+    const double octahedralToOctahedralMs = time(1, [&]() { IBLBaker::prefilterEnvMap(octahedral, octahedralSettings, octahedralToOctahedral); });
+    std::cout << "Prefilter " << (settings.mode == PrefilterMode::BruteForce ? "brute force" : "filtered") << ": cubemap "
+              << settings.size << "x" << settings.size << " " << getMegabytes(cubeToCube) * 1024.0 << "KB, octahedral "
+              << octahedralSettings.size << "x" << octahedralSettings.size << " " << getMegabytes(cubeToOctahedral) * 1024.0 << "KB" << std::endl;
+    std::cout << "  cube to cube " << cubeToCubeMs << "ms, cube to octahedral " << cubeToOctahedralMs << "ms, octahedral to octahedral "
+              << octahedralToOctahedralMs << "ms" << std::endl;
+    for (int mip = 0; mip < settings.mipLevels; ++mip)
+      std::cout << "  mip " << mip << " PSNR against cube to cube: cube to octahedral "
+                << getLookupPsnr(cubeToCube, cubeToOctahedral, directions, float(mip)) << "dB, octahedral to octahedral "
+                << getLookupPsnr(cubeToCube, octahedralToOctahedral, directions, float(mip)) << "dB" << std::endl;
+  }
+
+  void benchSampling(const EquirectImage& source)
+  {
+    constexpr int kRuns = 3;
+    constexpr int kDraws = 1 << 22;
+    for (const int width : {3072, 8192, 16384})
+    {
+      // Nearest neighbour resample, like encodeHdr, so that a small sun stays as bright.
+      const int height = width / 2;
+      std::vector<float> texels(std::size_t(width) * height * 3);
+      Parallel::forRange(height, 16, [&](std::size_t begin, std::size_t end)
+      {
+        for (std::size_t y = begin; y < end; ++y)
+        {
+          const float* row = source.texels + std::size_t(std::int64_t(y) * source.height / height) * source.width * 3;
+          float* destination = texels.data() + y * width * 3;
+          for (int x = 0; x < width; ++x)
+            std::memcpy(destination + x * 3, row + std::size_t(std::int64_t(x) * source.width / width) * 3, 3 * sizeof(float));
+        }
+      });
+      const EquirectImage image {width, height, texels.data()};
+
+      EnvironmentSampler sampler;
+      double buildMs = 1e30;
+      for (int run = 0; run < kRuns; ++run)
+      {
+        const auto start = Clock::now();
+        sampler.build(image);
+        buildMs = std::min(buildMs, getElapsedMs(start));
+      }
+      std::cout << width << "x" << height << ": tables built in " << buildMs << "ms ("
+                << double(width) * height / (buildMs * 1e3) << " Mtexels/s), "
+                << sampler.getMemoryBytes() / (1024.0 * 1024.0) << "MB" << std::endl;
+
+      // Luminance / pdf is nearly constant within a texel, so both estimates of the integral
+      // should land on it with hardly any noise.
+      std::vector<float> randoms(std::size_t(kDraws) * 2);
+      std::uint32_t seed = 1;
+      for (float& value : randoms)
+      {
+        seed = seed * 1664525u + 1013904223u;
+        value = float(seed >> 8) / float(1 << 24);
+      }
+      std::vector<EnvironmentSampler::Sample> samples(kDraws);
+      for (const bool alias : {false, true})
+      {
+        const auto start = Clock::now();
+        for (int i = 0; i < kDraws; ++i)
+          samples[i] = alias ? sampler.sampleAlias(randoms[i * 2], randoms[i * 2 + 1]) : sampler.sampleCdf(randoms[i * 2], randoms[i * 2 + 1]);
+        const double ms = getElapsedMs(start);
+        double sum = 0.0;
+        for (const auto& sample : samples)
+        {
+          if (sample.pdf <= 0.0f)
+            continue;
+          float rgb[3];
+          IBLBaker::sampleEquirect(image, sample.direction.x, sample.direction.y, sample.direction.z, rgb);
+          sum += (0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2]) / sample.pdf;
+        }
+        std::cout << "  " << (alias ? "alias" : "CDF  ") << ": " << kDraws / (ms * 1e3) << "M draws/s, luminance integral "
+                  << sum / kDraws << " against " << sampler.getLuminanceIntegral() << std::endl;
+      }
+
+      if (width != source.width)
+        continue;
+      // Irradiance over a spread of normals against a converged reference, at the sample counts
+      // of an interactive reference renderer.
+      constexpr int kNormals = 64;
+      constexpr int kReferenceSamples = 1 << 16;
+      const ShCoefficients irradianceSh = IBLBaker::convolveIrradiance(IBLBaker::projectToSh(image));
+      std::vector<Neon::Vec3f> normals, references;
+      for (int i = 0; i < kNormals; ++i)
+      {
+        // Fibonacci sphere.
+        const float y = 1.0f - (i + 0.5f) * 2.0f / kNormals;
+        const float r = std::sqrt(1.0f - y * y), phi = 2.39996323f * i;
+        normals.emplace_back(r * std::cos(phi), y, r * std::sin(phi));
+        references.push_back(IBLBaker::estimateIrradiance(image, sampler, normals.back(), kReferenceSamples));
+      }
+      const auto getRelativeRms = [&](const std::function<Neon::Vec3f(const Neon::Vec3f&)>& estimate)
+      {
+        double sumSquared = 0.0, sumReference = 0.0;
+        for (int i = 0; i < kNormals; ++i)
+        {
+          const Neon::Vec3f e = estimate(normals[i]) - references[i];
+          sumSquared += e.x * e.x + e.y * e.y + e.z * e.z;
+          sumReference += references[i].x + references[i].y + references[i].z;
+        }
+        return std::sqrt(sumSquared / (3.0 * kNormals)) / (sumReference / (3.0 * kNormals));
+      };
+      std::cout << "  irradiance relative rms against " << kReferenceSamples << " samples: SH "
+                << getRelativeRms([&](const Neon::Vec3f& n) { return IBLBaker::evaluateSh(irradianceSh, n); }) << std::endl;
+      for (const int numSamples : {16, 64, 256})
+      {
+        // Cosine weighted with random numbers, so that the noise is not particular to one
+        // low discrepancy set.
+        std::uint32_t random = 1;
+        const auto cosine = [&](const Neon::Vec3f& n)
+        {
+          const Neon::Vec3f up = std::abs(n.y) < 0.999f ? Neon::Vec3f(0.0f, 1.0f, 0.0f) : Neon::Vec3f(1.0f, 0.0f, 0.0f);
+          const Neon::Vec3f tangent = Neon::normalize(Neon::cross(up, n));
+          const Neon::Vec3f bitangent = Neon::cross(n, tangent);
+          Neon::Vec3f sum(0.0f);
+          for (int i = 0; i < numSamples; ++i)
+          {
+            random = random * 1664525u + 1013904223u;
+            const float xi0 = float(random >> 8) / float(1 << 24);
+            random = random * 1664525u + 1013904223u;
+            const float phi = float(random >> 8) / float(1 << 24) * 6.28318531f;
+            const float r = std::sqrt(xi0);
+            const Neon::Vec3f d = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(1.0f - xi0);
+            float rgb[3];
+            IBLBaker::sampleEquirect(image, d.x, d.y, d.z, rgb);
+            // L cos / (cos / pi), divided by pi again for irradiance / pi.
+            sum += Neon::Vec3f(rgb[0], rgb[1], rgb[2]);
+          }
+          return sum * (1.0f / numSamples);
+        };
+        std::cout << "  " << numSamples << " samples: cosine weighted " << getRelativeRms(cosine) << ", environment + cosine (MIS) "
+                  << getRelativeRms([&](const Neon::Vec3f& n) { return IBLBaker::estimateIrradiance(image, sampler, n, numSamples); })
+                  << std::endl;
+      }
+    }
+  }
+
+  // CPU version of the shading in ibl.fs, for comparing bakes by what ends up on screen.
+  struct ShadingMaps
+  {
+    const ShCoefficients* irradianceSh;
+    const CubeMapData* prefilter;
+    const std::vector<float>* brdfLut; // RG, kBrdfLutSize x kBrdfLutSize.
+    SunLight sun;
+  };
+
+  constexpr int kBrdfLutSize = 64;
+
+  Neon::Vec3f fresnelSchlick(float cosTheta, const Neon::Vec3f& f0, float roughness)
+  {
+    const float f = std::pow(std::max(1.0f - cosTheta, 0.0f), 5.0f);
+    const float r = 1.0f - roughness;
+    return f0 + (Neon::Vec3f(std::max(r, f0.x), std::max(r, f0.y), std::max(r, f0.z)) - f0) * f;
+  }
+
+  Neon::Vec3f multiply(const Neon::Vec3f& a, const Neon::Vec3f& b)
+  {
+    return Neon::Vec3f(a.x * b.x, a.y * b.y, a.z * b.z);
+  }
+
+  // Bilinear, clamped to the texel centres like the GL sampler.
+  void sampleBrdfLut(const std::vector<float>& lut, float s, float t, float* rg)
+  {
+    const float x = std::min(std::max(s * kBrdfLutSize - 0.5f, 0.0f), kBrdfLutSize - 1.0f);
+    const float y = std::min(std::max(t * kBrdfLutSize - 0.5f, 0.0f), kBrdfLutSize - 1.0f);
+    const int x0 = std::min(int(x), kBrdfLutSize - 2), y0 = std::min(int(y), kBrdfLutSize - 2);
+    const float fx = x - x0, fy = y - y0;
+    for (int c = 0; c < 2; ++c)
+    {
+      const auto at = [&](int i, int j) { return lut[(std::size_t(j) * kBrdfLutSize + i) * 2 + c]; };
+      rg[c] = (at(x0, y0) * (1.0f - fx) + at(x0 + 1, y0) * fx) * (1.0f - fy) + (at(x0, y0 + 1) * (1.0f - fx) + at(x0 + 1, y0 + 1) * fx) * fy;
+    }
+  }
+
+  Neon::Vec3f shadeSun(const SunLight& sun, const Neon::Vec3f& n, const Neon::Vec3f& v, const Neon::Vec3f& f0,
+                       const Neon::Vec3f& albedo, float metallic, float roughness)
+  {
+    const float nDotL = Neon::dot(n, sun.direction);
+    if (sun.isEmpty() || nDotL <= 0.0f)
+      return Neon::Vec3f(0.0f);
+    const float nDotV = std::max(Neon::dot(n, v), 1e-4f);
+    const Neon::Vec3f h = Neon::normalize(v + sun.direction);
+    const float a = roughness * roughness;
+    const float cosRadius = sun.getCosRadius();
+    const float sunA = std::sqrt(a * a + 0.25f * (1.0f - cosRadius * cosRadius));
+    const float nDotH = std::max(Neon::dot(n, h), 0.0f);
+    const float a2 = sunA * sunA;
+    const float d = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+    const float distribution = a2 / (3.1415926535f * d * d);
+    const float k = (roughness + 1.0f) * (roughness + 1.0f) / 8.0f;
+    const float geometry = nDotV / (nDotV * (1.0f - k) + k) * nDotL / (nDotL * (1.0f - k) + k);
+    const Neon::Vec3f f = fresnelSchlick(std::max(Neon::dot(h, v), 0.0f), f0, 0.0f);
+    const Neon::Vec3f specular = f * (distribution * geometry / (4.0f * nDotV));
+    const Neon::Vec3f diffuse = multiply(Neon::Vec3f(1.0f) - f, albedo) * ((1.0f - metallic) / 3.1415926535f);
+    return multiply(diffuse * nDotL + specular, sun.irradiance);
+  }
+
+  // Before tone mapping.
+  Neon::Vec3f shade(const ShadingMaps& maps, const Neon::Vec3f& n, const Neon::Vec3f& v, float roughness)
+  {
+    // The app's default material.
+    const Neon::Vec3f albedo(0.98f, 0.96f, 0.99f);
+    const float metallic = 0.5f;
+    const Neon::Vec3f f0 = Neon::Vec3f(0.04f) + (albedo - Neon::Vec3f(0.04f)) * metallic;
+    const Neon::Vec3f r = n * (2.0f * Neon::dot(n, v)) - v;
+    const float nDotV = std::max(Neon::dot(n, v), 0.0f);
+    const Neon::Vec3f kS = fresnelSchlick(nDotV, f0, roughness);
+    const Neon::Vec3f kD = (Neon::Vec3f(1.0f) - kS) * (1.0f - metallic);
+    const Neon::Vec3f irradiance = IBLBaker::evaluateSh(*maps.irradianceSh, n);
+    const Neon::Vec3f diffuse = multiply(multiply(kD, albedo),
+                                         Neon::Vec3f(std::max(irradiance.x, 0.0f), std::max(irradiance.y, 0.0f), std::max(irradiance.z, 0.0f)));
+    float prefilter[3], brdf[2];
+    IBLBaker::sampleCubeMap(*maps.prefilter, r.x, r.y, r.z, roughness * (maps.prefilter->mipLevels - 1), prefilter);
+    sampleBrdfLut(*maps.brdfLut, nDotV, roughness, brdf);
+    const Neon::Vec3f specular = multiply(Neon::Vec3f(prefilter[0], prefilter[1], prefilter[2]), kS * brdf[0] + Neon::Vec3f(brdf[1]));
+    return diffuse + specular + shadeSun(maps.sun, n, v, f0, albedo, metallic, roughness);
+  }
+
+  // The sun's share of every texel of a prefilter map baked without it, integrated over its
+  // disc instead of left to the GGX samples: what the bake converges to. Each texel holds
+  // E[L N.L] / E[N.L] over l = reflect(-N, h), h drawn from D(h) (N.h), and that density is
+  // D(h) / 4 in l with V = N.
+  void addSunToPrefilter(const SunLight& sun, CubeMapData& prefilter)
+  {
+    constexpr int kDiscSamples = 256;
+    constexpr int kLobeSamples = 1 << 14;
+    const float cosRadius = sun.getCosRadius();
+    const Neon::Vec3f radiance = sun.getRadiance();
+    const Neon::Vec3f up = std::abs(sun.direction.y) < 0.999f ? Neon::Vec3f(0.0f, 1.0f, 0.0f) : Neon::Vec3f(1.0f, 0.0f, 0.0f);
+    const Neon::Vec3f tangent = Neon::normalize(Neon::cross(up, sun.direction));
+    const Neon::Vec3f bitangent = Neon::cross(sun.direction, tangent);
+    std::vector<Neon::Vec3f> disc;
+    for (int i = 0; i < kDiscSamples; ++i)
+    {
+      // Uniform over the cap, stratified in both dimensions.
+      const float cosTheta = 1.0f - (1.0f - cosRadius) * ((i / 16 + 0.5f) / 16.0f);
+      const float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+      const float phi = (i % 16 + 0.5f) / 16.0f * 6.28318531f;
+      disc.push_back(tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + sun.direction * cosTheta);
+    }
+    const float sampleSolidAngle = sun.solidAngle / kDiscSamples;
+
+    for (int mip = 0; mip < prefilter.mipLevels; ++mip)
+    {
+      const float roughness = float(mip) / std::max(prefilter.mipLevels - 1, 1);
+      const float a2 = roughness * roughness * roughness * roughness;
+      double meanNdotL = 0.0;
+      for (int i = 0; i < kLobeSamples; ++i)
+      {
+        const float xi = (i + 0.5f) / kLobeSamples;
+        const float cosThetaH2 = (1.0f - xi) / (1.0f + (a2 - 1.0f) * xi);
+        meanNdotL += std::max(2.0f * cosThetaH2 - 1.0f, 0.0f);
+      }
+      meanNdotL /= kLobeSamples;
+      const int size = prefilter.getMipSize(mip);
+      Parallel::forRange(std::size_t(prefilter.getFaceCount()) * size, 4, [&](std::size_t begin, std::size_t end)
+      {
+        for (std::size_t row = begin; row < end; ++row)
+        {
+          const int face = int(row / size);
+          const int t = int(row % size);
+          float* texel = prefilter.getFace(mip, face) + std::size_t(t) * size * 3;
+          for (int s = 0; s < size; ++s, texel += 3)
+          {
+            const Neon::Vec3f n = IBLBaker::getCubeMapDirection(face, (s + 0.5f) / size, (t + 0.5f) / size);
+            float weight = 0.0f;
+            if (mip == 0)
+              weight = Neon::dot(n, sun.direction) >= cosRadius ? 1.0f : 0.0f;
+            else
+            {
+              for (const Neon::Vec3f& l : disc)
+              {
+                const float nDotL = Neon::dot(n, l);
+                if (nDotL <= 0.0f)
+                  continue;
+                const float nDotH = Neon::dot(n, Neon::normalize(n + l));
+                const float d = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+                weight += nDotL * a2 / (3.1415926535f * d * d) * 0.25f * sampleSolidAngle;
+              }
+              weight = float(weight / meanNdotL);
+            }
+            texel[0] += radiance.x * weight;
+            texel[1] += radiance.y * weight;
+            texel[2] += radiance.z * weight;
+          }
+        }
+      });
+    }
+  }
+
+  void benchSun(const EquirectImage& image, const PrefilterSettings& settings)
+  {
+    SunLight sun;
+    std::vector<float> sunless(image.texels, image.texels + std::size_t(image.width) * image.height * 3);
+    const auto extractStart = Clock::now();
+    if (!SunExtractor::extract(sunless.data(), image.width, image.height, SunExtractionSettings(), sun))
+    {
+      std::cout << "No sun found in the panorama" << std::endl;
+      return;
+    }
+    const double extractMs = getElapsedMs(extractStart);
+    const float radiusDegrees = std::acos(sun.getCosRadius()) * 180.0f / 3.1415926535f;
+    std::cout << "Sun extracted in " << extractMs << "ms: direction (" << sun.direction.x << ", " << sun.direction.y << ", "
+              << sun.direction.z << "), irradiance (" << sun.irradiance.x << ", " << sun.irradiance.y << ", " << sun.irradiance.z
+              << "), " << sun.solidAngle << "sr (" << radiusDegrees << " degrees radius)" << std::endl;
+    const EquirectImage sunlessImage {image.width, image.height, sunless.data()};
+
+    // The full bake as the app does it, against half the resolution and an eighth of the
+    // samples, with the sun left in and taken out.
+    struct Bake
+    {
+      const char* name;
+      const EquirectImage* image;
+      int cubeSize;
+      PrefilterSettings settings;
+      ShCoefficients irradianceSh {};
+      CubeMapData prefilter {};
+      double ms = 0.0;
+    };
+    const int cubeSize = IBLBaker::getEquirectCubeMapSize(image.width);
+    PrefilterSettings reduced = settings;
+    reduced.size = std::max(settings.size / 2, 1 << (settings.mipLevels - 1));
+    reduced.numSamples = std::max(settings.numSamples / 8, 1);
+    Bake bakes[] =
+    {
+      {"full", &image, cubeSize, settings},
+      {"reduced, sun in the maps", &image, cubeSize / 2, reduced},
+      {"reduced, analytic sun", &sunlessImage, cubeSize / 2, reduced},
+      {"reference", &sunlessImage, cubeSize, settings}
+    };
+    for (Bake& bake : bakes)
+    {
+      if (&bake == &bakes[3])
+        continue;
+      const auto start = Clock::now();
+      CubeMapData cube;
+      IBLBaker::equirectToCubeMap(*bake.image, bake.cubeSize, cube);
+      bake.irradianceSh = IBLBaker::convolveIrradiance(IBLBaker::projectToSh(*bake.image));
+      IBLBaker::prefilterEnvMap(cube, bake.settings, bake.prefilter);
+      bake.ms = getElapsedMs(start);
+    }
+    bakes[2].ms += extractMs;
+    // The full bake of the sunless panorama plus the sun's converged share, as a reference
+    // that the full bake's own noise can be measured against.
+    {
+      CubeMapData cube;
+      IBLBaker::equirectToCubeMap(sunlessImage, cubeSize, cube);
+      IBLBaker::prefilterEnvMap(cube, settings, bakes[3].prefilter);
+      addSunToPrefilter(sun, bakes[3].prefilter);
+      bakes[3].irradianceSh = bakes[0].irradianceSh;
+    }
+    for (int b = 0; b < 3; ++b)
+      std::cout << bakes[b].name << ": cubemap " << bakes[b].cubeSize << "x" << bakes[b].cubeSize << ", prefilter " << bakes[b].settings.size
+                << "x" << bakes[b].settings.size << " at " << bakes[b].settings.numSamples << " samples, " << bakes[b].ms << "ms ("
+                << bakes[0].ms / bakes[b].ms << "x)" << std::endl;
+
+    // Shaded like ibl.fs for random normals and view directions in front of them, and compared
+    // tone mapped.
+    constexpr int kPoints = 1 << 16;
+    const std::vector<float> directions = getRandomDirections(kPoints * 2);
+    std::vector<float> lut;
+    BrdfLut::generate(kBrdfLutSize, 256, lut);
+    std::vector<float> shaded[4];
+    for (const float roughness : {0.0f, 0.25f, 0.5f, 0.75f, 1.0f})
+    {
+      for (int b = 0; b < 4; ++b)
+      {
+        const ShadingMaps maps {&bakes[b].irradianceSh, &bakes[b].prefilter, &lut, b == 2 ? sun : SunLight()};
+        shaded[b].resize(std::size_t(kPoints) * 3);
+        for (int i = 0; i < kPoints; ++i)
+        {
+          const float* n = directions.data() + std::size_t(i) * 3;
+          const float* v = directions.data() + std::size_t(kPoints + i) * 3;
+          const Neon::Vec3f normal(n[0], n[1], n[2]);
+          Neon::Vec3f view(v[0], v[1], v[2]);
+          if (Neon::dot(normal, view) < 0.0f)
+            view = view * -1.0f;
+          const Neon::Vec3f color = shade(maps, normal, view, roughness);
+          shaded[b][std::size_t(i) * 3] = color.x;
+          shaded[b][std::size_t(i) * 3 + 1] = color.y;
+          shaded[b][std::size_t(i) * 3 + 2] = color.z;
+        }
+      }
+      std::cout << "  roughness " << roughness << " PSNR against the full bake: sun in the maps "
+                << getTonemappedPsnr(shaded[0].data(), shaded[1].data(), shaded[0].size()) << "dB, analytic sun "
+                << getTonemappedPsnr(shaded[0].data(), shaded[2].data(), shaded[0].size()) << "dB; against the reference: full bake "
+                << getTonemappedPsnr(shaded[3].data(), shaded[0].data(), shaded[0].size()) << "dB, sun in the maps "
+                << getTonemappedPsnr(shaded[3].data(), shaded[1].data(), shaded[0].size()) << "dB, analytic sun "
+                << getTonemappedPsnr(shaded[3].data(), shaded[2].data(), shaded[0].size()) << "dB" << std::endl;
+    }
+
+    // SH rings around a sun; the analytic one does not. Against a converged estimate of the
+    // original panorama.
+    constexpr int kNormals = 256;
+    constexpr int kReferenceSamples = 1 << 14;
+    EnvironmentSampler sampler;
+    sampler.build(image);
+    double shError = 0.0, analyticError = 0.0, referenceSum = 0.0;
+    for (int i = 0; i < kNormals; ++i)
+    {
+      const float y = 1.0f - (i + 0.5f) * 2.0f / kNormals;
+      const float r = std::sqrt(1.0f - y * y), phi = 2.39996323f * i;
+      const Neon::Vec3f n(r * std::cos(phi), y, r * std::sin(phi));
+      const Neon::Vec3f reference = IBLBaker::estimateIrradiance(image, sampler, n, kReferenceSamples);
+      const Neon::Vec3f withSun = IBLBaker::evaluateSh(bakes[0].irradianceSh, n) - reference;
+      const Neon::Vec3f analytic = IBLBaker::evaluateSh(bakes[2].irradianceSh, n) +
+                                   sun.irradiance * (std::max(Neon::dot(n, sun.direction), 0.0f) / 3.1415926535f) - reference;
+      shError += Neon::dot(withSun, withSun);
+      analyticError += Neon::dot(analytic, analytic);
+      referenceSum += reference.x + reference.y + reference.z;
+    }
+    const double referenceMean = referenceSum / (3.0 * kNormals);
+    std::cout << "Irradiance relative rms against " << kReferenceSamples << " samples: SH with the sun "
+              << std::sqrt(shError / (3.0 * kNormals)) / referenceMean << ", SH without it plus the analytic sun "
+              << std::sqrt(analyticError / (3.0 * kNormals)) / referenceMean << std::endl;
+  }
+
+  void prefilter(const EquirectImage& image, const PrefilterSettings& settings, CubeMapData& output, double& totalMs)
+  {
+    std::vector<PrefilterMipStats> stats;
+    const auto start = Clock::now();
+    IBLBaker::prefilterEnvMap(image, settings, output, &stats);
+    totalMs = getElapsedMs(start);
+    for (const auto& mip : stats)
+      std::cout << "Prefilter mip " << mip.size << "x" << mip.size << " roughness " << mip.roughness << " (" << mip.numSamples << " samples): "
+                << mip.ms << "ms, " << mip.texelsPerSecond << " texels/s" << std::endl;
+    std::cout << "Prefilter total: " << totalMs << "ms" << std::endl;
+  }
+
+  // Every level of the chain filled with its own index, so that a trilinear lookup returns the
+  // lod it was made at.
+  void fillWithLevelIndices(EquirectMipChain& chain)
+  {
+    for (int level = 0; level < chain.getLevelCount(); ++level)
+    {
+      float* texels = chain.texels.data() + chain.offsets[level];
+      std::fill(texels, texels + std::size_t(chain.widths[level]) * chain.heights[level] * 3, float(level));
+    }
+  }
+
+  Neon::Vec3f getTexelCentreDirection(const CubeMapData& map, int face, int s, int t)
+  {
+    const float u = (s + 0.5f) / map.size;
+    const float v = (t + 0.5f) / map.size;
+    return map.layout == MapLayout::Octahedral ? IBLBaker::getOctahedralDirection(u, v) : IBLBaker::getCubeMapDirection(face, u, v);
+  }
+
+  // log2 of the solid angle of the texel in direction n, up to a constant per image: map texels
+  // cover |d|^-3 times the smallest ones, d being n scaled onto the cube or the octahedron, and
+  // panorama texels cos(latitude) times those on the equator.
+  double getLog2MapTexelSolidAngle(MapLayout layout, const Neon::Vec3f& n)
+  {
+    const double scale = layout == MapLayout::Octahedral ? std::abs(n.x) + std::abs(n.y) + std::abs(n.z)
+                                                         : std::max({std::abs(n.x), std::abs(n.y), std::abs(n.z)});
+    return 3.0 * std::log2(scale);
+  }
+
+  double getLog2EquirectTexelSolidAngle(const Neon::Vec3f& n)
+  {
+    return 0.5 * std::log2(std::max(1.0 - double(n.y) * n.y, 1e-4));
+  }
+
+  // Fills every mip of the map with its own index, like fillWithLevelIndices.
+  void fillWithMipIndices(CubeMapData& map)
+  {
+    for (int mip = 0; mip < map.mipLevels; ++mip)
+    {
+      const int size = map.getMipSize(mip);
+      float* texels = map.getFace(mip, 0);
+      std::fill(texels, texels + std::size_t(size) * size * 3 * map.getFaceCount(), float(mip));
+    }
+  }
+
+  // A resample's lookups are made at half the log2 of the output texel's solid angle over the
+  // source texel's, so with a source holding its level indices two output texels should differ
+  // by exactly that. Compares the corners of the +x face with its centre, or on an octahedral
+  // map the -x vertex and the middle of an edge with the +x vertex, all well away from the poles.
+  bool checkTexelLods(const CubeMapData& map,
+                      const char* name,
+                      int sourceLevels,
+                      const std::function<double(const Neon::Vec3f&)>& getLog2SourceTexelSolidAngle)
+  {
+    constexpr double kTolerance = 0.02; // Mips.
+    const int size = map.size;
+    const int half = size / 2;
+    const bool octahedral = map.layout == MapLayout::Octahedral;
+    const std::vector<std::array<int, 2>> texels = octahedral
+      ? std::vector<std::array<int, 2>> {{size - 1, half}, {0, half}, {size * 3 / 4, size * 3 / 4}}
+      : std::vector<std::array<int, 2>> {{half, half}, {0, 0}, {size - 1, size - 1}, {0, size - 1}};
+    const auto getLod = [&](const std::array<int, 2>& texel) -> double
+    {
+      return map.getFace(0, 0)[(std::size_t(texel[1]) * size + texel[0]) * 3];
+    };
+    const auto getExpectedLod = [&](const std::array<int, 2>& texel)
+    {
+      const Neon::Vec3f n = getTexelCentreDirection(map, 0, texel[0], texel[1]);
+      return 0.5 * (getLog2MapTexelSolidAngle(map.layout, n) - getLog2SourceTexelSolidAngle(n));
+    };
+    bool ok = true;
+    for (std::size_t i = 1; i < texels.size(); ++i)
+    {
+      const double offset = getLod(texels[i]) - getLod(texels[0]);
+      const double expected = getExpectedLod(texels[i]) - getExpectedLod(texels[0]);
+      const bool clamped = getLod(texels[i]) <= 0.0 || getLod(texels[i]) >= sourceLevels - 1;
+      const bool passed = !clamped && std::abs(offset - expected) <= kTolerance;
+      std::cout << "  " << name << " texel (" << texels[i][0] << ", " << texels[i][1] << ") lod " << offset << " from ("
+                << texels[0][0] << ", " << texels[0][1] << "), expected " << expected << (passed ? "" : " FAILED") << std::endl;
+      ok = ok && passed;
+    }
+    return ok;
+  }
+
+  // Sizes are odd so that texels at the ends of rows go through the scalar path and the others
+  // through the SIMD one.
+  bool checkTexelLod()
+  {
+    EquirectMipChain chain;
+    chain.allocate(1024, 512);
+    fillWithLevelIndices(chain);
+    bool ok = true;
+    for (const MapLayout layout : {MapLayout::CubeMap, MapLayout::Octahedral})
+    {
+      CubeMapData map;
+      IBLBaker::equirectToCubeMap(chain, layout == MapLayout::Octahedral ? 121 : 61, map, layout);
+      ok = checkTexelLods(map, layout == MapLayout::Octahedral ? "Panorama to octahedral" : "Panorama to cubemap",
+                          chain.getLevelCount(), getLog2EquirectTexelSolidAngle) && ok;
+    }
+    return ok;
+  }
+
+  bool checkLayoutTexelLod()
+  {
+    bool ok = true;
+    for (const MapLayout layout : {MapLayout::CubeMap, MapLayout::Octahedral})
+    {
+      const bool octahedral = layout == MapLayout::Octahedral;
+      CubeMapData source;
+      source.allocate(octahedral ? 128 : 64, octahedral ? 8 : 7, layout);
+      fillWithMipIndices(source);
+      CubeMapData map;
+      const MapLayout outputLayout = octahedral ? MapLayout::CubeMap : MapLayout::Octahedral;
+      IBLBaker::convertMapLayout(source, octahedral ? 15 : 61, outputLayout, map);
+      ok = checkTexelLods(map, octahedral ? "Octahedral to cubemap" : "Cubemap to octahedral", source.mipLevels,
+                          [layout](const Neon::Vec3f& n) { return getLog2MapTexelSolidAngle(layout, n); }) && ok;
+    }
+    return ok;
+  }
+
+  // Levels with errors of 0.01 and 0.04 about a unit sphere, seen through a projection scale of 1
+  // on 1000 lines, step to level 1 at a distance of 5 and to level 2 at 20 for the identity;
+  // every case moves those thresholds by what its model matrix does to the sphere.
+  bool checkLodSelection()
+  {
+    struct Case
+    {
+      const char* name;
+      float model[16];
+      Neon::Vec3f boundsCenter;
+      Neon::Vec3f cameraOrigin;
+      float maxPixelError;
+      int expected;
+    };
+    const MeshLod lods[3] = {{0, 300, 0.0f}, {300, 150, 0.01f}, {450, 75, 0.04f}};
+    const Case cases[] = {
+      {"identity, inside the sphere", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 0.5f}, 1.0f, 0},
+      {"identity, short of level 1", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 4.9f}, 1.0f, 0},
+      {"identity, past level 1", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 5.1f}, 1.0f, 1},
+      {"identity, short of level 2", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 19.9f}, 1.0f, 1},
+      {"identity, past level 2", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 20.1f}, 1.0f, 2},
+      {"identity, 2 pixels", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 2.6f}, 2.0f, 1},
+      {"translated, camera next to it", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 100, 0, 0, 1}, {0, 0, 0}, {105.1f, 0, 0}, 1.0f, 1},
+      {"translated, camera at the origin", {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 100, 0, 0, 1}, {0, 0, 0}, {4.9f, 0, 0}, 1.0f, 2},
+      {"scaled by 2, inside the sphere", {2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 1.5f}, 1.0f, 0},
+      {"scaled by 2, short of level 1", {2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 9.9f}, 1.0f, 0},
+      {"scaled by 2, past level 1", {2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 10.1f}, 1.0f, 1},
+      {"scaled by 3 along y, short of level 2", {1, 0, 0, 0, 0, 3, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 59.0f}, 1.0f, 1},
+      {"scaled by 3 along y, past level 2", {1, 0, 0, 0, 0, 3, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, {0, 0, 0}, {0, 0, 61.0f}, 1.0f, 2},
+      // The bounds centre (1, 0, 0) turned a quarter around z onto (0, 1, 0), then moved to (0, 11, 0).
+      {"rotated and translated", {0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1, 0, 0, 10, 0, 1}, {1, 0, 0}, {0, 16.1f, 0}, 1.0f, 1},
+      {"rotated and translated, short", {0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1, 0, 0, 10, 0, 1}, {1, 0, 0}, {0, 15.9f, 0}, 1.0f, 0},
+    };
+    bool ok = true;
+    for (const Case& check : cases)
+    {
+      const int lod = MeshSimplifier::selectLod(lods, 3, check.boundsCenter, 1.0f, check.model, check.cameraOrigin, 1.0f, 1000.0f,
+                                                check.maxPixelError);
+      std::cout << "  " << check.name << ": level " << lod << (lod == check.expected ? "" : " FAILED") << std::endl;
+      ok = ok && lod == check.expected;
+    }
+    return ok;
+  }
+
+  // The embedded table against one integrated now with the same settings, which catches a stale
+  // BrdfLutData.cpp and a generate() that drifted from what BrdfLutGen baked.
+  bool checkBrdfLut()
+  {
+    const int size = BrdfLut::getEmbeddedSize();
+    std::vector<float> reference;
+    BrdfLut::generate(size, BrdfLut::kDefaultNumSamples, reference);
+    const BrdfLut::Error error = BrdfLut::compare(BrdfLut::getEmbeddedTexels(), reference.data(), reference.size());
+    const bool passed = error.max <= BrdfLut::kValidationTolerance;
+    std::cout << "  " << size << "x" << size << ", " << BrdfLut::kDefaultNumSamples << " samples: max error " << error.max
+              << " rms " << error.rms << ", tolerance " << BrdfLut::kValidationTolerance << (passed ? "" : " FAILED") << std::endl;
+    return passed;
+  }
+
+  // Exits with a failure when any of them fails.
+  bool runChecks()
+  {
+    std::cout << "Output texel lod of equirectToCubeMap and convertMapLayout:" << std::endl;
+    const bool texelLod = checkTexelLod();
+    const bool layoutTexelLod = checkLayoutTexelLod();
+    std::cout << "Level of detail selection:" << std::endl;
+    const bool lodSelection = checkLodSelection();
+    std::cout << "Embedded BRDF LUT against BrdfLut::generate:" << std::endl;
+    const bool brdfLut = checkBrdfLut();
+    return texelLod && layoutTexelLod && lodSelection && brdfLut;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  // Leave a core to the calling thread, which works on its own forRange chunks.
+  JobSystem parallelJobs(std::max(1u, Parallel::getThreadCount() - 1));
+  Parallel::setJobSystem(&parallelJobs);
+  if (!std::strcmp(argv[1], "--check"))
+    return runChecks() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  const char* imagePath = argv[1];
+  PrefilterSettings settings;
+  bool compare = false;
+  bool benchmarkDecode = false;
+  bool benchmarkHalf = false;
+  bool benchmarkJobs = false;
+  bool benchmarkPipeline = false;
+  bool benchmarkStream = false;
+  bool benchmarkBc6h = false;
+  bool benchmarkPacking = false;
+  bool benchmarkCubeMap = false;
+  bool benchmarkOctahedral = false;
+  bool benchmarkSampling = false;
+  bool benchmarkSun = false;
+  bool benchmarkObj = false;
+  bool extractSun = false;
+  std::size_t decodeBudget = 0;
+  const char* outputPath = nullptr;
+  for (int i = 2; i < argc; ++i)
+  {
+    if (!std::strcmp(argv[i], "--size") && i + 1 < argc)
+      settings.size = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "--samples") && i + 1 < argc)
+      settings.numSamples = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "--fis"))
+      settings.mode = PrefilterMode::FilteredImportanceSampling;
+    else if (!std::strcmp(argv[i], "--target-error") && i + 1 < argc)
+      settings.targetError = float(std::atof(argv[++i]));
+    else if (!std::strcmp(argv[i], "--compare"))
+      compare = true;
+    else if (!std::strcmp(argv[i], "--bench-decode"))
+      benchmarkDecode = true;
+    else if (!std::strcmp(argv[i], "--bench-half"))
+      benchmarkHalf = true;
+    else if (!std::strcmp(argv[i], "--bench-jobs"))
+      benchmarkJobs = true;
+    else if (!std::strcmp(argv[i], "--bench-pipeline"))
+      benchmarkPipeline = true;
+    else if (!std::strcmp(argv[i], "--bench-bc6h"))
+      benchmarkBc6h = true;
+    else if (!std::strcmp(argv[i], "--bench-packing"))
+      benchmarkPacking = true;
+    else if (!std::strcmp(argv[i], "--bench-cubemap"))
+      benchmarkCubeMap = true;
+    else if (!std::strcmp(argv[i], "--bench-octahedral"))
+      benchmarkOctahedral = true;
+    else if (!std::strcmp(argv[i], "--bench-sampling"))
+      benchmarkSampling = true;
+    else if (!std::strcmp(argv[i], "--bench-sun"))
+      benchmarkSun = true;
+    else if (!std::strcmp(argv[i], "--bench-obj"))
+      benchmarkObj = true;
+    else if (!std::strcmp(argv[i], "--extract-sun"))
+      extractSun = true;
+    else if (!std::strcmp(argv[i], "--bench-stream"))
+      benchmarkStream = true;
+    else if (!std::strcmp(argv[i], "--decode-budget") && i + 1 < argc)
+      decodeBudget = std::size_t(std::atoi(argv[++i])) << 20;
+    else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+      outputPath = argv[++i];
+    else
+    {
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Threads: " << Parallel::getThreadCount() << std::endl;
+
+  if (benchmarkPipeline)
+  {
+    benchPipeline(imagePath, settings, decodeBudget);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkObj)
+  {
+    benchObj(imagePath);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkStream)
+  {
+    benchStream(imagePath, decodeBudget ? decodeBudget : kDefaultDecodeBudget, compare);
+    return EXIT_SUCCESS;
+  }
+
+  auto start = Clock::now();
+  int w, h;
+  MappedFile source;
+  std::unique_ptr<float[]> data;
+  if (!source.open(imagePath) || !HdrReader::decode(source.getData(), source.getSize(), w, h, data))
+  {
+    std::cerr << "Failed to load texture with path " << imagePath << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Loaded " << imagePath << " (" << w << "x" << h << ") in " << getElapsedMs(start) << "ms" << std::endl;
+  const EquirectImage image {w, h, data.get()};
+
+  if (benchmarkDecode)
+  {
+    benchDecode(image);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkHalf)
+  {
+    benchHalf(image);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkJobs)
+  {
+    benchJobs(image);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkCubeMap)
+  {
+    benchCubeMap(image, settings);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkOctahedral)
+  {
+    benchOctahedral(image, settings);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkSampling)
+  {
+    benchSampling(image);
+    return EXIT_SUCCESS;
+  }
+
+  if (benchmarkSun)
+  {
+    benchSun(image, settings);
+    return EXIT_SUCCESS;
+  }
+
+  SunLight sun;
+  if (extractSun)
+  {
+    start = Clock::now();
+    const bool found = SunExtractor::extract(data.get(), w, h, SunExtractionSettings(), sun);
+    std::cout << "Sun extraction: " << (found ? "found" : "none found") << " in " << getElapsedMs(start) << "ms" << std::endl;
+  }
+
+  start = Clock::now();
+  const ShCoefficients sh = IBLBaker::projectToSh(image);
+  std::cout << "SH projection: " << getElapsedMs(start) << "ms" << std::endl;
+
+  CubeMapData irradiance;
+  start = Clock::now();
+  IBLBaker::bakeIrradianceMap(sh, kIrradianceMapSize, irradiance);
+  std::cout << "Irradiance " << kIrradianceMapSize << "x" << kIrradianceMapSize << ": " << getElapsedMs(start) << "ms" << std::endl;
+
+  CubeMapData prefiltered;
+  double prefilterMs;
+  prefilter(image, settings, prefiltered, prefilterMs);
+
+  if (compare && settings.mode != PrefilterMode::BruteForce)
+  {
+    PrefilterSettings referenceSettings = settings;
+    referenceSettings.mode = PrefilterMode::BruteForce;
+    CubeMapData reference;
+    double referenceMs;
+    std::cout << "Brute force reference:" << std::endl;
+    prefilter(image, referenceSettings, reference, referenceMs);
+
+    // Relative to the mean reference radiance of each mip so dark and bright panoramas compare alike.
+    for (int mip = 0; mip < settings.mipLevels; ++mip)
+    {
+      const int size = reference.getMipSize(mip);
+      const std::size_t count = std::size_t(size) * size * 3 * 6;
+      const float* a = prefiltered.getFace(mip, 0);
+      const float* b = reference.getFace(mip, 0);
+      double mean = 0.0, sumSq = 0.0, maxError = 0.0;
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        const double diff = std::abs(double(a[i]) - double(b[i]));
+        mean += b[i];
+        sumSq += diff * diff;
+        maxError = std::max(maxError, diff);
+      }
+      mean = std::max(mean / count, 1e-12);
+      std::cout << "Mip " << size << "x" << size << " relative rms: " << std::sqrt(sumSq / count) / mean
+                << " relative max: " << maxError / mean << std::endl;
+    }
+    std::cout << "Speedup over brute force: " << referenceMs / prefilterMs << "x" << std::endl;
+  }
+
+  if (benchmarkBc6h)
+    benchBc6h(image, irradiance, prefiltered);
+
+  if (benchmarkPacking)
+    benchPacking(irradiance, prefiltered);
+
+  if (outputPath)
+  {
+    // Same layout the app's bake cache uses, with a key derived from the source alone since
+    // this file is addressed by name.
+    start = Clock::now();
+    CubeMapData sourceCube;
+    IBLBaker::equirectToCubeMap(image, IBLBaker::getEquirectCubeMapSize(w), sourceCube);
+    std::vector<std::uint16_t> sourceTexels(sourceCube.texels.size());
+    std::vector<std::uint16_t> irradianceTexels(irradiance.texels.size());
+    std::vector<std::uint16_t> prefilterTexels(prefiltered.texels.size());
+    Half::fromFloats(sourceCube.texels.data(), sourceTexels.data(), sourceTexels.size());
+    Half::fromFloats(irradiance.texels.data(), irradianceTexels.data(), irradianceTexels.size());
+    Half::fromFloats(prefiltered.texels.data(), prefilterTexels.data(), prefilterTexels.size());
+    EnvironmentView view;
+    view.radianceSh = sh;
+    view.sun = sun;
+    view.sourceSize = sourceCube.size;
+    view.sourceMipLevels = sourceCube.mipLevels;
+    view.source = sourceTexels.data();
+    view.irradianceSize = irradiance.size;
+    view.irradiance = irradianceTexels.data();
+    view.prefilterSize = prefiltered.size;
+    view.prefilterMipLevels = prefiltered.mipLevels;
+    view.prefilter = prefilterTexels.data();
+    if (!EnvironmentContainer::write(outputPath, BakeCache::hash(source.getData(), source.getSize()), view))
+      return EXIT_FAILURE;
+    std::cout << "Wrote " << outputPath << " in " << getElapsedMs(start) << "ms" << std::endl;
+  }
+
+  std::cout << "Peak RSS: " << ProcessStats::getPeakResidentBytes() / (1024.0 * 1024.0) << "MB" << std::endl;
+  return EXIT_SUCCESS;
+}